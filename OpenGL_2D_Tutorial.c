@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <GL/glut.h> // Including OpenGL GLUT library
+#include "common/app.h" // Command line options + headless (no window) benchmark mode
+#include "common/sprite_batch.h" // Many rectangles in one draw call
+#include "common/entity.h" // Many things moving at once (structure of arrays + SIMD)
 
 /*
 - ***** A Note on Transformations *****
@@ -47,12 +51,155 @@
 */
 
 float x_position = -10.0;
+float prev_x_position = -10.0; // x_position one update() ago (the game loop draws in between, see display())
 int state = 1; // When state is 1 we move right and if state is -1 we move left.
 float r = 0;
 float g = 0;
 float b = 0;
 int color_counter = 0;
 
+// The sprite field (--sprites N): N small rectangles bouncing left and right like ours, each one
+// with its own position, speed, direction and place in the color cycle. They live in an entity
+// store (common/entity.h): one array per field, updated 8 at a time without branches.
+// With --workers N the update runs on a pool of worker threads (common/jobs.h) at the same time as
+// display() draws: see update_sprites().
+// --sprite-mode batch (default) draws them all with ONE draw call (common/sprite_batch.h),
+// --sprite-mode immediate with a glBegin/glEnd per rectangle, the way ours is drawn.
+#define SPRITE_WIDTH 0.3f
+#define SPRITE_HEIGHT 0.4f
+enum { SPRITE_MODE_BATCH, SPRITE_MODE_IMMEDIATE };
+const char *sprite_mode_names[] = { "batch", "immediate" };
+
+int sprite_count = 0;
+int sprite_mode = SPRITE_MODE_BATCH;
+EntityStore sprites;
+SpriteBatch sprite_batch;
+long sprite_quads = 0;      // drawn since the last report
+long sprite_updates = 0;    // since the last report
+uint64_t sprite_update_ns = 0; // spent in update_sprites() (waiting for the workers included)
+JobBatch sprite_jobs;       // the update that is running on the workers
+uint64_t sprite_report_ns = 0;
+
+unsigned int sprite_random_state = 12345;
+float sprite_random(float low, float high)
+{
+    // Same tiny random number generator (xorshift) as the cube field: the same sprites every run.
+    sprite_random_state ^= sprite_random_state << 13;
+    sprite_random_state ^= sprite_random_state >> 17;
+    sprite_random_state ^= sprite_random_state << 5;
+    return low + (high - low) * (sprite_random_state / 4294967296.0f);
+}
+
+void init_sprites()
+{
+    int i;
+    // Bouncing between -10 and 10 - SPRITE_WIDTH the way ours does (stop, turn, go on).
+    entity_store_init(&sprites, sprite_count, ENTITY_BOUNCE_HOLD, -10, 10 - SPRITE_WIDTH, 0);
+    for (i = 0; i < sprite_count; i++)
+    {
+        float x = sprite_random(-10, 10 - SPRITE_WIDTH);
+        float y = sprite_random(-10, 10 - SPRITE_HEIGHT);
+        float speed = sprite_random(0.05f, 0.30f);
+        int right = sprite_random(0, 1) < 0.5f;
+        int color_counter = (int)sprite_random(0, 31);
+        entity_set(&sprites, i, x, y, speed, right, color_counter);
+    }
+    if (sprite_mode == SPRITE_MODE_BATCH && !sprite_batch_init(&sprite_batch, sprite_count, app.streaming))
+    {
+        fprintf(stderr, "batch mode needs OpenGL 1.5 buffers\n");
+        exit(1);
+    }
+    sprite_report_ns = clock_now_ns();
+}
+
+void update_sprite_chunk(void *store, int first, int last)
+{
+    // (one job: runs on a worker thread)
+    entity_update_range((EntityStore *)store, first, last);
+}
+
+void update_sprites()
+{
+    // The same steps as update() below, for every sprite (the old position is kept by the store,
+    // the color cycle moves on by itself).
+    // The next step is already computed ahead, into the store's third buffer:
+    //   tick N:  wait for step N (started at tick N - 1), swap so it's the current one, start N + 1
+    //   then display() draws step N (and N - 1 for the interpolation), while the workers write N + 1.
+    // Nothing the workers write is read by display() and the other way round, so the two never wait
+    // for each other within the frame, only here at the swap. Without --workers the step is simply
+    // computed right here, and it's the same sprites in the same places either way.
+    uint64_t start = clock_now_ns();
+    if (sprites.ticks == 0)
+        jobs_parallel_for(&app_jobs, &sprite_jobs, update_sprite_chunk, &sprites, sprites.capacity, ENTITY_CHUNK); // (the very first one)
+    jobs_wait(&app_jobs, &sprite_jobs);
+    entity_swap(&sprites);
+    jobs_parallel_for(&app_jobs, &sprite_jobs, update_sprite_chunk, &sprites, sprites.capacity, ENTITY_CHUNK);
+    sprite_update_ns += clock_now_ns() - start;
+    sprite_updates++;
+}
+
+void sprite_color(int i, GLubyte color[4])
+{
+    // Red, green, blue for 10 steps each (see update()).
+    int color_counter = entity_color_step(&sprites, i);
+    color[0] = color_counter < 10 ? 255 : 0;
+    color[1] = color_counter >= 10 && color_counter < 20 ? 255 : 0;
+    color[2] = color_counter >= 20 ? 255 : 0;
+    color[3] = 255;
+}
+
+void draw_sprites()
+{
+    int i;
+    GLubyte color[4];
+    if (sprite_mode == SPRITE_MODE_BATCH)
+    {
+        for (i = 0; i < sprite_count; i++)
+        {
+            sprite_color(i, color);
+            sprite_batch_add(&sprite_batch, loop_lerp(entity_prev_position(&sprites, i), entity_position(&sprites, i)), sprites.other[i], SPRITE_WIDTH, SPRITE_HEIGHT, color);
+        }
+        sprite_batch_flush(&sprite_batch); // All of them (that didn't fit yet) in one glDrawElements
+        sprite_batch_end_frame(&sprite_batch); // (a fence: the next frames write into the other regions meanwhile)
+        gl_state_invalidate(); // (drawing with a color array leaves the current color undefined, see common/gl_state.h)
+    }
+    else
+    {
+        for (i = 0; i < sprite_count; i++)
+        {
+            float x = loop_lerp(entity_prev_position(&sprites, i), entity_position(&sprites, i)), y = sprites.other[i];
+            sprite_color(i, color);
+            glColor3f(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f);
+            glBegin(GL_POLYGON);
+                glVertex2f(x, y + SPRITE_HEIGHT);
+                glVertex2f(x, y);
+                glVertex2f(x + SPRITE_WIDTH, y);
+                glVertex2f(x + SPRITE_WIDTH, y + SPRITE_HEIGHT);
+            glEnd();
+        }
+    }
+    sprite_quads += sprite_count;
+}
+
+void report(FILE *out)
+{
+    // Sprites per second since the last report (see AppCallbacks in common/app.h).
+    uint64_t now = clock_now_ns();
+    if (sprite_count == 0 || now == sprite_report_ns) return;
+    fprintf(out, "sprites (%s): %d per frame | %.2f M quads/s", sprite_mode_names[sprite_mode], sprite_count,
+            sprite_quads / ((now - sprite_report_ns) / 1e9) / 1e6);
+    if (sprite_mode == SPRITE_MODE_BATCH) fprintf(out, " | %.1f draw calls per frame", sprite_quads ? (double)sprite_batch.draw_calls * sprite_count / sprite_quads : 0.0);
+    if (sprite_updates) fprintf(out, " | update %.3f ms on the GLUT thread (%s)", sprite_update_ns / 1e6 / sprite_updates, ENTITY_SIMD_NAME);
+    fprintf(out, "\n");
+    stream_report(&sprite_batch.stream, out, "sprite stream");
+    sprite_quads = 0;
+    sprite_updates = 0;
+    sprite_update_ns = 0;
+    sprite_batch.draw_calls = 0;
+    sprite_batch.stream.frames = sprite_batch.stream.bytes = 0;
+    sprite_report_ns = now;
+}
+
 void display()
 {
     // This function is the display callback, called whenever the window needs to be redrawn.
@@ -139,15 +286,31 @@ void display()
     // subsequent drawing operations unless explicitly changed again. If no new color is set, 
     // shapes will be drawn using the last specified color or the default color.
 
+    // With the game loop (--loop) we draw between the last two update() steps, otherwise
+    // loop_alpha is 1 and this is simply x_position.
+    float x = loop_lerp(prev_x_position, x_position);
+
+    profile_gpu_begin("rectangle"); // (--profile: how long the GPU takes to draw it, see common/profile.h)
     glBegin(GL_POLYGON);
-        glVertex2f(x_position, 4.0);
-        glVertex2f(x_position, 0);
-        glVertex2f(x_position+3, 0);
-        glVertex2f(x_position+3, 4);
+        glVertex2f(x, 4.0);
+        glVertex2f(x, 0);
+        glVertex2f(x+3, 0);
+        glVertex2f(x+3, 4);
     glEnd();
+    profile_gpu_end();
     // Makes a 3-units wide and 4-units long rectangle.
 
-    glutSwapBuffers(); // Swaps the buffers, and automatically does the buffer flush.
+    if (sprite_count > 0)
+    {
+        profile_cpu_begin("sprites"); // (CPU: building + submitting them, GPU: drawing them)
+        profile_gpu_begin("sprites");
+        draw_sprites();
+        profile_gpu_end();
+        profile_cpu_end();
+    }
+
+    app_swap_buffers(); // Swaps the buffers, and automatically does the buffer flush.
+    // (In headless mode there are no buffers to swap, it waits for the frame to finish instead.)
 
 }
 
@@ -155,6 +318,7 @@ void reshape(int width, int height)
 {
     // This function is called when the window is resized.
     // It adjusts the viewport and projection matrix to match the new window size.
+    double aspect = (double)width / (height > 0 ? height : 1); // (the window's width/height)
 
     glViewport(0, 0, (GLsizei)width, (GLsizei)height); // Sets up the viewport
     // It takes 4 arguments: x and y coordinates (bottom-left corner) and width and height of the viewport.
@@ -169,7 +333,10 @@ void reshape(int width, int height)
 
     glMatrixMode(GL_PROJECTION); // Sets the current matrix mode to projection
     glLoadIdentity(); // Resets parameters of the projection matrix
-    gluOrtho2D(-10, 10, -10, 10); // Sets up an orthographic projection
+    if (aspect >= 1) gluOrtho2D(-10 * aspect, 10 * aspect, -10, 10); // Sets up an orthographic projection
+    else gluOrtho2D(-10, 10, -10 / aspect, 10 / aspect);
+    // (-10 to 10 along the shorter side of the window, more along the longer one, so a square
+    // stays square in a window that isn't.)
     // gluOrtho2D(left, right, bottom, top) defines a 2D orthographic projection matrix.
     // It maps a specified rectangle to the clipping volume, preserving the aspect ratio.
     // Note: An orthographic projection is typically what is used for 2D because it doesnt
@@ -187,18 +354,13 @@ void reshape(int width, int height)
     // not the camera's perspective.
 }
 
-void timer(int i)
+void update()
 {
-    // This is basically a loop function that is needed for the animation.
-    // It continuosly or periodically calls itself every 1/60th of a second
-    // ie 60 frames per seconds.
+    // One step of the animation, moves the rectangle left and right and cycles its color.
+    // Kept apart from timer() so the very same step can also be driven without GLUT's timer
+    // (ie by the headless benchmark in common/app.h).
 
-    glutPostRedisplay(); // Signals the window to be redrawn in the next frame. Along with glClear()
-    // they work hand in hand to clear the screen and prepare for rendering.
-
-    glutTimerFunc(1000/60, timer, 0); // Registers the timer again to call this function after
-    // approximately 1/60th of a second (assuming a 60 frames per second refresh rate).
-    // We wont be needing to use the 3rd paramater (explained in main).
+    prev_x_position = x_position; // Remembers where we were (for the interpolation in display())
 
     /* Stops at the end as our shape is 3 units wide and max x-coordinate is 10
     if (x_position < 7)
@@ -228,6 +390,8 @@ void timer(int i)
     color_counter++;
     if (color_counter > 30) color_counter = 0;
 
+    if (sprite_count > 0) update_sprites(); // (--sprites N)
+
     switch (state)
     {
         case 1:
@@ -270,6 +434,22 @@ void timer(int i)
     */
 }
 
+void timer(int i)
+{
+    // This is basically a loop function that is needed for the animation.
+    // It continuosly or periodically calls itself every 1/60th of a second
+    // ie 60 frames per seconds.
+
+    glutPostRedisplay(); // Signals the window to be redrawn in the next frame. Along with glClear()
+    // they work hand in hand to clear the screen and prepare for rendering.
+
+    glutTimerFunc(1000/60, timer, 0); // Registers the timer again to call this function after
+    // approximately 1/60th of a second (assuming a 60 frames per second refresh rate).
+    // We wont be needing to use the 3rd paramater (explained in main).
+
+    app_call("update", update); // Advances the animation by one step (timed with --profile, see common/app.h).
+}
+
 
 void init()
 {
@@ -278,32 +458,78 @@ void init()
 
     glClearColor(0.3, 0.3, 0.3, 0); // Sets the background color.
     // CHECK display function for details about colors in OpenGL.
+
+    if (sprite_count > 0) init_sprites(); // (--sprites N)
+}
+
+int parse_2d_args(int argc, char **argv, int i)
+{
+    // Our own command line options (see app_parse_args in common/app.h):
+    //   --sprites N               adds N bouncing rectangles
+    //   --sprite-mode batch|immediate
+    if (i + 1 >= argc) return 0;
+    if (strcmp(argv[i], "--sprites") == 0)
+    {
+        sprite_count = atoi(argv[i + 1]);
+        if (sprite_count < 0)
+        {
+            fprintf(stderr, "--sprites must be >= 0\n");
+            exit(1);
+        }
+        return 2;
+    }
+    if (strcmp(argv[i], "--sprite-mode") == 0)
+    {
+        if (strcmp(argv[i + 1], "batch") == 0) sprite_mode = SPRITE_MODE_BATCH;
+        else if (strcmp(argv[i + 1], "immediate") == 0) sprite_mode = SPRITE_MODE_IMMEDIATE;
+        else
+        {
+            fprintf(stderr, "unknown --sprite-mode '%s' (batch or immediate)\n", argv[i + 1]);
+            exit(1);
+        }
+        return 2;
+    }
+    return 0;
 }
 
 int main(int argc, char** argv)
 {
+    AppCallbacks callbacks = { "2D", init, reshape, update, display, report }; // The same callbacks GLUT gets below
+
+    if (!app_parse_args(&argc, argv, parse_2d_args)) return 1; // Reads our own options (--headless, --size, ...)
+    if (app_immediate_only() && sprite_count > 0 && sprite_mode == SPRITE_MODE_BATCH)
+    {
+        fprintf(stderr, "--backend sw and core (and --trace-record) only draw the sprites with --sprite-mode immediate\n");
+        return 1;
+    }
+    if (app.headless) return app_run_headless(&callbacks); // No window at all: benchmark N frames and exit
 
     glutInit(&argc, argv); // Initializes the GLUT library and processes any command line arguments.
+    app_init_context(); // (--backend core asks for a core profile context, see common/app.h)
 
     // To execute SINGLE BUFFER version of code (just drawing shapes) remove "GLUT_DOUBLE" below.
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE); // Sets the initial display mode to use RGB color model.
     // ALSO to Double Buffering mode (Explained in display function)
 
     glutInitWindowPosition(0, 0); // Sets the initial position of the window (in pixels).
-    glutInitWindowSize(500, 500); // Sets the initial size of the window (in pixels).
+    glutInitWindowSize(app.width, app.height); // Sets the initial size of the window (in pixels).
+    // (500x500 unless another size was given with --size WxH)
     // Note: this makes the window size to be 500 pixels wide and 500 pixels long, ie it will contain
     // 500*500 = 250,000 pixels in total (ie will cover 250,000 pixels of the screen).
     // If we draw a square that starts at let's say x = -10 to x = 0 and y = 0 to y = 4,
     // it will be 10 pixels wide and 4 pixels long ie will contain 10*4 = 40 pixels in total.
 
     glutCreateWindow("Daldezo's Square 1"); // Creates a window with the given title.
+    app_load_extensions(); // Loads the newer OpenGL functions (sprite batch, --backend core, ...) now that we have a context.
 
     // Callback functions are functions that are passed as arguments to other functions
     // Note: functions are reduced to pointers after being passed as arguments in some function.
 
     glutDisplayFunc(display); // Registers the display callback function.
     glutReshapeFunc(reshape); // Registers the reshape callback function.
-    glutTimerFunc(0, timer, 0); // Registers the timer callback function.
+    app_profile_callbacks(&callbacks); // --profile: times display/reshape (common/profile.h)
+    if (app.loop) app_start_loop(&callbacks); // --loop: a fixed-timestep game loop animates instead (common/loop.h)
+    else glutTimerFunc(0, timer, 0); // Registers the timer callback function.
     // Takes three arguments: 
     // 1. unsigned int millisec (time interval for callback function to be called, in milliseconds),
     // 2. pointer to the callback function,
@@ -312,7 +538,7 @@ int main(int argc, char** argv)
     // second you add 1 and print to the screen).
 
 
-    init(); // Calls the initialization function to set up OpenGL state.
+    app_call("init", init); // Calls the initialization function to set up OpenGL state.
 
     glutMainLoop(); // Enters the GLUT event processing loop.
     return 0;
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <GL/glut.h> // Including OpenGL GLUT library
+#include "common/app.h" // Command line options + headless (no window) benchmark mode
+#include "common/cull.h" // Frustum culling + bounding volume hierarchy
+#include "common/mesh_import.h" // OBJ and PLY models (--model)
+#include "common/mesh_lod.h" // Levels of detail (--lod)
+#include "common/render_queue.h" // Sorted draw commands (--render-queue)
 
 /*
 - ***** A Note on Transformations *****
@@ -80,11 +86,491 @@
 int state = 1;
 float x_position = 0;
 float z_position = -6;
+float prev_z_position = -6; // z_position one update() ago (the game loop draws in between, see display())
 float r = 0;
 float g = 0;
 float b = 0;
 int color_counter = 0;
 
+mat4 scene_projection; // The gluPerspective matrix of reshape(), kept on our side for the culling
+float scene_fovy = 60;  // gluPerspective's angle, and the viewport's height: how big things end up on screen
+int scene_height = 500; // (for picking levels of detail)
+
+// The object field (--objects N): N squares like ours scattered all around the camera, the whole
+// field slowly turning around the y-axis. Only the ones in the view frustum are drawn.
+int object_count = 0;
+int cull_log = 0;          // --cull-log: print the visible/culled counts of every frame
+float *object_positions;   // x, y, z of each square's center
+float *object_colors;      // r, g, b
+Aabb *object_boxes;        // bounding box of each square (they never move, the camera turns)
+Bvh object_bvh;
+int *visible_objects;      // filled by the culling every frame
+float field_angle = 0;
+float prev_field_angle = 0;
+CullStats cull_frame;      // this frame
+CullStats cull_total;      // summed over cull_frames frames (for the report)
+long cull_frames = 0;
+long cull_frames_drawn = 0;
+uint64_t cull_ns = 0;
+
+// A model instead of the squares (--model FILE, or --model ball), for every object, ours included.
+// With --lod each one is drawn with the simplest of the model's levels of detail that looks the
+// same at its distance (see common/mesh_lod.h): the far ones, a few pixels big, get a few triangles.
+const char *model_path = NULL;
+int model_lod = 0;                   // --lod
+float model_lod_pixels = 1;          // --lod-pixels P: how far (in pixels) a level may be off
+int model_level_count = 0;
+MeshLod model_levels[MESH_LOD_MAX];  // each level's triangles (where in its index buffer) and error
+GLuint model_vao[MESH_LOD_MAX];
+GLenum model_index_type[MESH_LOD_MAX];
+int model_index_size[MESH_LOD_MAX];
+float model_center[3] = { 0, 0, 0 };
+float model_scale = 1;               // makes its longest side 4, like our square
+int *object_levels;                  // the level of each visible object this frame
+long lod_objects[MESH_LOD_MAX];      // objects drawn with each level, and their triangles,
+uint64_t lod_triangles = 0;          // summed over lod_frames frames (for the report)
+long lod_frames = 0;
+
+// The field through a render queue (--render-queue state|depth, see common/render_queue.h): the
+// visible objects are recorded as commands (on the --workers threads, one queue per job), sorted
+// by their keys, and only then drawn. The field gets the depth test, so it looks the same in any
+// order: "state" draws it with as few mesh and color switches as possible, "depth" front to back.
+#define QUEUE_CHUNK 1024             // objects recorded per job
+int queue_order = -1;                // RENDER_ORDER_STATE or RENDER_ORDER_DEPTH, -1 = no queue
+RenderFrame object_queue;
+mat4 queue_view;                     // this frame's view (for the recording jobs)
+long queue_binds = 0, queue_colors = 0; // vertex array and color switches while drawing (for the report)
+
+unsigned int object_random_state = 12345;
+float object_random(float low, float high)
+{
+    // Same tiny random number generator (xorshift) as the cube field: the same field every run.
+    object_random_state ^= object_random_state << 13;
+    object_random_state ^= object_random_state >> 17;
+    object_random_state ^= object_random_state << 5;
+    return low + (high - low) * (object_random_state / 4294967296.0f);
+}
+
+void make_ball(MeshData *ball, int rings)
+{
+    // A ball as wide as our square (radius 2) out of rings x 2 * rings quads, with normals.
+    int segments = rings * 2, ring, segment;
+    uint32_t *index;
+    float *v;
+    memset(ball, 0, sizeof(*ball));
+    strcpy(ball->name, "ball");
+    ball->format = MESH_HAS_NORMAL;
+    ball->vertex_count = (uint32_t)(rings + 1) * (segments + 1);
+    ball->vertices = v = (float *)malloc(sizeof(float) * 6 * ball->vertex_count);
+    ball->indices = index = (uint32_t *)malloc(sizeof(uint32_t) * 6 * rings * segments);
+    for (ring = 0; ring <= rings; ring++)
+        for (segment = 0; segment <= segments; segment++, v += 6)
+        {
+            float theta = 3.14159265f * ring / rings, phi = 2 * 3.14159265f * segment / segments;
+            v[3] = sinf(theta) * cosf(phi);
+            v[4] = cosf(theta);
+            v[5] = -sinf(theta) * sinf(phi);
+            v[0] = 2 * v[3]; v[1] = 2 * v[4]; v[2] = 2 * v[5];
+        }
+    for (ring = 0; ring < rings; ring++)
+        for (segment = 0; segment < segments; segment++)
+        {
+            uint32_t a = ring * (segments + 1) + segment, b = a + segments + 1; // (b: the same one, a ring lower)
+            // (at the poles one of the two triangles would have no area)
+            if (ring > 0) { *index++ = a; *index++ = b + 1; *index++ = a + 1; }
+            if (ring < rings - 1) { *index++ = a; *index++ = b; *index++ = b + 1; }
+        }
+    ball->index_count = (uint32_t)(index - ball->indices);
+}
+
+GLuint make_buffer(GLenum target, size_t bytes, const void *data)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferData(target, bytes, data, GL_STATIC_DRAW);
+    return buffer;
+}
+
+GLuint make_model_vao(GLuint vbo, GLuint ibo, uint32_t format)
+{
+    // Where the positions (and normals, colors) are, recorded in a VAO like the cube's VBO mode.
+    GLsizei stride = mesh_vertex_stride(format);
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const void *)0);
+    if (format & MESH_HAS_NORMAL)
+    {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, stride, (const void *)(size_t)mesh_attrib_offset(format, MESH_HAS_NORMAL));
+    }
+    if (format & MESH_HAS_COLOR)
+    {
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(3, GL_FLOAT, stride, (const void *)(size_t)mesh_attrib_offset(format, MESH_HAS_COLOR));
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return vao;
+}
+
+void init_model()
+{
+    // Loads (or makes) the model, builds its levels of detail with --lod and uploads it all: one
+    // vertex buffer, and one index buffer with every level's triangles one after the other (the
+    // levels share the vertices). A mesh file that has its levels already (tools/mesh_convert.c
+    // --lod) gets the buffers of each of its meshes instead.
+    static const GLenum index_types[5] = { 0, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, 0, GL_UNSIGNED_INT };
+    size_t length = strlen(model_path);
+    uint64_t start = clock_now_ns(), loaded;
+    float low[3] = { 1e30f, 1e30f, 1e30f }, high[3] = { -1e30f, -1e30f, -1e30f }, size = 0;
+    uint32_t format, i;
+    MeshData model;
+    MeshFile file;
+    MeshImportStats import;
+    MeshLodChain chain;
+    int level, k, from_file = 0;
+
+    if (!GLEXT_HAVE(glGenBuffers) || !GLEXT_HAVE(glBufferData) || !GLEXT_HAVE(glGenVertexArrays) || !GLEXT_HAVE(glBindVertexArray))
+    {
+        fprintf(stderr, "--model needs OpenGL 3.0\n");
+        exit(1);
+    }
+    memset(&model, 0, sizeof(model));
+    memset(&chain, 0, sizeof(chain));
+    if (strcmp(model_path, "ball") == 0) make_ball(&model, 128);
+    else if (length > 5 && strcmp(model_path + length - 5, ".mesh") == 0)
+    {
+        // The file's first mesh, and with --lod the levels right after it (NAME.lod1, ...).
+        const MeshEntry *e;
+        const uint8_t *indices;
+        if (!mesh_file_open(&file, model_path)) exit(1);
+        if (file.header->mesh_count == 0)
+        {
+            fprintf(stderr, "%s has no meshes\n", model_path);
+            exit(1);
+        }
+        e = &file.meshes[0];
+        if (e->vertex_count == 0 || e->index_count == 0)
+        {
+            fprintf(stderr, "%s: the mesh '%.*s' is empty\n", model_path, MESH_NAME_SIZE, e->name);
+            exit(1);
+        }
+        for (level = 1; model_lod && level < (int)file.header->mesh_count && level < MESH_LOD_MAX; level++)
+        {
+            char name[MESH_NAME_SIZE + 8];
+            snprintf(name, sizeof(name), "%.*s.lod%d", MESH_NAME_SIZE - 6, e->name, level);
+            if (strcmp(file.meshes[level].name, name) != 0) break;
+        }
+        if (level > 1)
+        {
+            for (k = 0; k < 3; k++)
+            {
+                model_center[k] = (e->bounds_min[k] + e->bounds_max[k]) / 2;
+                if (e->bounds_max[k] - e->bounds_min[k] > size) size = e->bounds_max[k] - e->bounds_min[k];
+            }
+            model_level_count = level;
+            for (level = 0; level < model_level_count; level++)
+            {
+                const MeshEntry *m = &file.meshes[level];
+                GLuint vbo = make_buffer(GL_ARRAY_BUFFER, mesh_vertex_bytes(m), mesh_vertices(&file, m));
+                GLuint ibo = make_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh_index_bytes(m), mesh_indices(&file, m));
+                model_vao[level] = make_model_vao(vbo, ibo, m->format);
+                model_index_type[level] = index_types[m->index_size];
+                model_index_size[level] = (int)m->index_size;
+                model_levels[level].first = 0;
+                model_levels[level].count = m->index_count;
+                model_levels[level].error = m->lod_error;
+            }
+            format = e->format;
+            from_file = 1;
+        }
+        else
+        {
+            // No levels (or no --lod): copied out, the levels get built below.
+            indices = (const uint8_t *)mesh_indices(&file, e);
+            memcpy(model.name, e->name, MESH_NAME_SIZE);
+            model.format = e->format;
+            model.vertex_count = e->vertex_count;
+            model.index_count = e->index_count;
+            model.vertices = (float *)malloc(mesh_vertex_bytes(e));
+            model.indices = (uint32_t *)malloc(sizeof(uint32_t) * e->index_count);
+            memcpy(model.vertices, mesh_vertices(&file, e), mesh_vertex_bytes(e));
+            for (i = 0; i < e->index_count; i++)
+                model.indices[i] = e->index_size == 1 ? indices[i] : e->index_size == 2 ? ((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i];
+        }
+        mesh_file_close(&file);
+    }
+    else if (!mesh_import(model_path, &model, &app_jobs, &import)) exit(1);
+    loaded = clock_now_ns();
+
+    if (!from_file)
+    {
+        for (i = 0; i < model.vertex_count; i++)
+            for (k = 0; k < 3; k++)
+            {
+                float v = model.vertices[(size_t)i * (mesh_vertex_stride(model.format) / sizeof(float)) + k];
+                if (v < low[k]) low[k] = v;
+                if (v > high[k]) high[k] = v;
+            }
+        for (k = 0; k < 3; k++)
+        {
+            model_center[k] = model.vertex_count ? (low[k] + high[k]) / 2 : 0;
+            if (high[k] - low[k] > size) size = high[k] - low[k];
+        }
+        mesh_lod_build(&model, model_lod ? MESH_LOD_MAX : 1, MESH_LOD_RATIO, &chain);
+        model_level_count = chain.count;
+        model_vao[0] = make_model_vao(make_buffer(GL_ARRAY_BUFFER, (size_t)model.vertex_count * mesh_vertex_stride(model.format), model.vertices),
+                                      make_buffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * chain.index_count, chain.indices), model.format);
+        for (level = 0; level < chain.count; level++)
+        {
+            model_vao[level] = model_vao[0];
+            model_index_type[level] = GL_UNSIGNED_INT;
+            model_index_size[level] = 4;
+            model_levels[level] = chain.lods[level];
+        }
+        format = model.format;
+        mesh_lod_free(&chain);
+        free(model.vertices); // (the GPU has its own copy now)
+        free(model.indices);
+    }
+
+    model_scale = size > 0 ? 4 / size : 1;
+    printf("model: %s, %u triangles, loaded in %.1f ms", model_path, model_levels[0].count / 3, (loaded - start) / 1e6);
+    if (model_level_count > 1)
+    {
+        if (from_file) printf(", %d levels of detail from the file, triangles (error):", model_level_count);
+        else printf(", %d levels of detail built in %.1f ms, triangles (error):", model_level_count, (clock_now_ns() - loaded) / 1e6);
+        for (level = 1; level < model_level_count; level++) printf(" %u (%.3g)", model_levels[level].count / 3, model_levels[level].error);
+    }
+    printf("\n");
+
+    // Shading: without it a ball is a flat disc. OpenGL's light 0 shines from the camera by
+    // default, GL_COLOR_MATERIAL makes glColor3f the surface's color (like without lighting).
+    if (format & MESH_HAS_NORMAL)
+    {
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+        glEnable(GL_COLOR_MATERIAL);
+        glEnable(GL_NORMALIZE); // (the normals get scaled by model_scale too)
+    }
+    glEnable(GL_DEPTH_TEST); // (unlike a square, a model has parts in front of others)
+}
+
+int model_level(float depth)
+{
+    // The level for an object depth units in front of the camera (see common/mesh_lod.h).
+    // The errors are in the model's units, on screen they're model_scale times bigger.
+    if (!model_lod) return 0;
+    if (depth < 5) depth = 5; // (the near plane)
+    return mesh_lod_select(model_levels, model_level_count, depth, mesh_lod_pixels_per_unit(scene_fovy, scene_height) * model_scale,
+                           model_lod_pixels);
+}
+
+void draw_model(float x, float y, float z, int level)
+{
+    // The model at (x, y, z) with level's triangles (its VAO must be bound).
+    glPushMatrix();
+    glTranslatef(x - model_center[0] * model_scale, y - model_center[1] * model_scale, z - model_center[2] * model_scale);
+    glScalef(model_scale, model_scale, model_scale);
+    glDrawElements(GL_TRIANGLES, model_levels[level].count, model_index_type[level],
+                   (const void *)((size_t)model_levels[level].first * model_index_size[level]));
+    glPopMatrix();
+    lod_objects[level]++;
+    lod_triangles += model_levels[level].count / 3;
+}
+
+void init_object_field()
+{
+    // Squares in a 300 x 60 x 300 box around the camera. The frustum (60 degrees wide, 5 to 100
+    // deep) only ever sees a small slice of them.
+    int i;
+    object_positions = (float *)malloc(sizeof(float) * 3 * object_count);
+    object_colors = (float *)malloc(sizeof(float) * 3 * object_count);
+    object_boxes = (Aabb *)malloc(sizeof(Aabb) * object_count);
+    visible_objects = (int *)malloc(sizeof(int) * object_count);
+    object_levels = (int *)malloc(sizeof(int) * object_count);
+    for (i = 0; i < object_count; i++)
+    {
+        float *p = &object_positions[i * 3];
+        p[0] = object_random(-150, 150);
+        p[1] = object_random(-30, 30);
+        p[2] = object_random(-150, 150);
+        object_colors[i * 3 + 0] = object_random(0.2f, 1);
+        object_colors[i * 3 + 1] = object_random(0.2f, 1);
+        object_colors[i * 3 + 2] = object_random(0.2f, 1);
+        // The square is 4x4 and flat (glVertex3f(+-2, +-2, 0) in display()).
+        object_boxes[i].min[0] = p[0] - 2; object_boxes[i].max[0] = p[0] + 2;
+        object_boxes[i].min[1] = p[1] - 2; object_boxes[i].max[1] = p[1] + 2;
+        object_boxes[i].min[2] = p[2];     object_boxes[i].max[2] = p[2];
+        if (model_path) { object_boxes[i].min[2] -= 2; object_boxes[i].max[2] += 2; } // (a model is 4 deep too)
+    }
+    bvh_build(&object_bvh, object_boxes, object_count);
+}
+
+void record_objects(void *arg, int first, int last)
+{
+    // Job: a command for each of the visible objects first .. last - 1, into the job's own queue.
+    RenderQueue *queue = render_frame_queue(&object_queue, first / QUEUE_CHUNK);
+    const mat4 *view = &queue_view;
+    int i;
+    (void)arg;
+    for (i = first; i < last; i++)
+    {
+        int object = visible_objects[i];
+        const float *p = &object_positions[object * 3], *c = &object_colors[object * 3];
+        float depth = -(view->m[2] * p[0] + view->m[6] * p[1] + view->m[10] * p[2] + view->m[14]);
+        int level = model_path ? model_level(depth) : 0;
+        // Depth 5 (the near plane) .. 100 (the far plane) becomes 0 .. 1, the level is the "shader"
+        // (a switch of vertex array) and the color the material.
+        render_queue_push(queue, render_key(queue_order, 0, (depth - 5) / 95, level, render_material_rgb(c[0], c[1], c[2])),
+                          object, level);
+    }
+}
+
+void draw_queued_objects(int visible)
+{
+    // Records the visible objects, sorts them and draws them, switching the vertex array and the
+    // color only when the next one needs another.
+    JobBatch batch;
+    const RenderCommand *commands;
+    const float *color = NULL;
+    int count, bound = -1, i;
+    uint64_t start = clock_now_ns();
+
+    render_frame_begin(&object_queue, (visible + QUEUE_CHUNK - 1) / QUEUE_CHUNK);
+    jobs_parallel_for(&app_jobs, &batch, record_objects, NULL, visible, QUEUE_CHUNK);
+    jobs_wait(&app_jobs, &batch);
+    object_queue.record_ns += clock_now_ns() - start;
+    commands = render_frame_sort(&object_queue, &count);
+
+    if (!model_path)
+    {
+        glEnable(GL_DEPTH_TEST);
+        glBegin(GL_QUADS);
+    }
+    for (i = 0; i < count; i++)
+    {
+        const float *p = &object_positions[commands[i].item * 3], *c = &object_colors[commands[i].item * 3];
+        if (!color || c[0] != color[0] || c[1] != color[1] || c[2] != color[2])
+        {
+            glColor3f(c[0], c[1], c[2]);
+            color = c;
+            queue_colors++;
+        }
+        if (!model_path)
+        {
+            glVertex3f(p[0] - 2, p[1] + 2, p[2]);
+            glVertex3f(p[0] - 2, p[1] - 2, p[2]);
+            glVertex3f(p[0] + 2, p[1] - 2, p[2]);
+            glVertex3f(p[0] + 2, p[1] + 2, p[2]);
+            continue;
+        }
+        if ((int)commands[i].data != bound)
+        {
+            bound = (int)commands[i].data;
+            glBindVertexArray(model_vao[bound]);
+            queue_binds++;
+        }
+        draw_model(p[0], p[1], p[2], bound);
+    }
+    if (!model_path)
+    {
+        glEnd();
+        glDisable(GL_DEPTH_TEST);
+        return;
+    }
+    glBindVertexArray(0);
+    gl_state_invalidate(); // (a color array leaves the current color undefined, see common/gl_state.h)
+}
+
+void draw_object_field()
+{
+    // Culls the field against the frustum, then sends only the visible squares, all in one glBegin.
+    mat4 view = mat4_rotate(loop_lerp_degrees(prev_field_angle, field_angle), 0, 1, 0);
+    mat4 view_projection = mat4_mul(&scene_projection, &view);
+    Frustum frustum = frustum_from_matrix(&view_projection);
+    uint64_t start = clock_now_ns();
+    int visible = bvh_cull(&object_bvh, object_boxes, &frustum, visible_objects, &cull_frame), i;
+    cull_ns += clock_now_ns() - start;
+
+    glLoadMatrixf(view.m); // The field turns, our own square (drawn before) doesn't
+    profile_gpu_begin("objects");
+    if (queue_order >= 0)
+    {
+        queue_view = view;
+        draw_queued_objects(visible);
+        profile_gpu_end();
+        return;
+    }
+    if (model_path)
+    {
+        // Every object's level first (by its depth: the z of view * position), then the objects
+        // of one level all together.
+        int level;
+        for (i = 0; i < visible; i++)
+        {
+            const float *p = &object_positions[visible_objects[i] * 3];
+            object_levels[i] = model_level(-(view.m[2] * p[0] + view.m[6] * p[1] + view.m[10] * p[2] + view.m[14]));
+        }
+        for (level = 0; level < model_level_count; level++)
+        {
+            glBindVertexArray(model_vao[level]);
+            for (i = 0; i < visible; i++)
+                if (object_levels[i] == level)
+                {
+                    const float *p = &object_positions[visible_objects[i] * 3], *c = &object_colors[visible_objects[i] * 3];
+                    glColor3f(c[0], c[1], c[2]);
+                    draw_model(p[0], p[1], p[2], level);
+                }
+        }
+        glBindVertexArray(0);
+        gl_state_invalidate(); // (a color array leaves the current color undefined, see common/gl_state.h)
+        profile_gpu_end();
+        return;
+    }
+    glBegin(GL_QUADS);
+    for (i = 0; i < visible; i++)
+    {
+        const float *p = &object_positions[visible_objects[i] * 3], *c = &object_colors[visible_objects[i] * 3];
+        glColor3f(c[0], c[1], c[2]);
+        glVertex3f(p[0] - 2, p[1] + 2, p[2]);
+        glVertex3f(p[0] - 2, p[1] - 2, p[2]);
+        glVertex3f(p[0] + 2, p[1] - 2, p[2]);
+        glVertex3f(p[0] + 2, p[1] + 2, p[2]);
+    }
+    glEnd();
+    profile_gpu_end();
+}
+
+void report(FILE *out)
+{
+    // Average culling numbers per frame since the last report (see AppCallbacks in common/app.h).
+    if (cull_frames == 0) return;
+    fprintf(out, "culling: %.1f visible, %.1f culled per frame | %.1f boxes tested | %.3f ms\n",
+            (double)cull_total.visible / cull_frames, (double)cull_total.culled / cull_frames,
+            (double)cull_total.boxes_tested / cull_frames, cull_ns / 1e6 / cull_frames);
+    memset(&cull_total, 0, sizeof(cull_total));
+    cull_frames = 0;
+    cull_ns = 0;
+    if (lod_frames > 0)
+    {
+        int level;
+        fprintf(out, "lod: %.0f triangles per frame | objects per level:", (double)lod_triangles / lod_frames);
+        for (level = 0; level < model_level_count; level++) fprintf(out, " %.1f", (double)lod_objects[level] / lod_frames);
+        fprintf(out, "\n");
+        memset(lod_objects, 0, sizeof(lod_objects));
+        lod_triangles = 0;
+        lod_frames = 0;
+    }
+    render_frame_report(&object_queue, out, queue_binds, queue_colors);
+    queue_binds = queue_colors = 0;
+}
+
 void display()
 {
     // This function is the display callback, called whenever the window needs to be redrawn.
@@ -96,7 +582,8 @@ void display()
 
     // Clearing them before drawing again is crucial; otherwise, remnants of the previous frame linger.
 
-    glClear(GL_COLOR_BUFFER_BIT); // Clears the color buffer
+    glClear(model_path || queue_order >= 0 ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT); // Clears the color buffer
+    // (and the depth buffer, when there's a model or a render queue: see init_model() and draw_queued_objects())
     glLoadIdentity(); // Resets the coordinate system to its default (GL_MODELVIEW matrix is affected)
     // This also resets the coordinates for the shape being drawn, so each time it's called,
     // the shape is positioned back to its default. For example, if glTranslate changes the position,
@@ -171,22 +658,74 @@ void display()
     // subsequent drawing operations unless explicitly changed again. If no new color is set, 
     // shapes will be drawn using the last specified color or the default color.
 
-    glTranslatef(0,0,z_position); // Parameters: (x,y,z)
+    float z = loop_lerp(prev_z_position, z_position);
+    Aabb square_box = { { -2, -2, z }, { 2, 2, z } }; // (our square, see glBegin below)
+    Frustum frustum = frustum_from_matrix(&scene_projection); // (the ModelView is the identity here)
+    int plane_mask = 0x3f;
+
+    memset(&cull_frame, 0, sizeof(cull_frame));
+    if (model_path)
+    {
+        square_box.min[2] -= 2; // (a model is 4 deep too)
+        square_box.max[2] += 2;
+        lod_frames++;
+    }
+
+    glTranslatef(0,0,z); // Parameters: (x,y,z)
+    // (With the game loop (--loop) we draw between the last two update() steps, otherwise
+    // loop_alpha is 1 and this is simply z_position.)
 
     // - Not visible at z = 0 because thats behind the Near clipping plane as defined in glBegin()
     // - Note: We have set the zNear plane to 2 in the reshape callback function,
     //         ie the square will be closest to the screen at z = -5 or (0,0,-5).
     // - Remember: we move in the NEGATIVE z-axis so we just translate it.
 
-    glBegin(GL_POLYGON);
-        glVertex3f(-2, 2, 0);
-        glVertex3f(-2, -2, 0);
-        glVertex3f(2, -2, 0);
-        glVertex3f(2, 2, 0);
-    glEnd();
-    // Makes a 3-units wide and 4-units long rectangle.
+    // Culling: only send the square if its box is (at least partly) inside the view frustum.
+    // It never leaves it in this demo (-6 to -95, the frustum goes from -5 to -100), but the
+    // object field below does all the time.
+    cull_frame.boxes_tested++;
+    if (frustum_test_aabb(&frustum, &square_box, &plane_mask) != CULL_OUTSIDE)
+    {
+        profile_gpu_begin("square"); // (--profile: how long the GPU takes to draw it, see common/profile.h)
+        if (model_path)
+        {
+            // The model instead (--model), with the level of detail for how far away it is now.
+            int level = model_level(-z);
+            glBindVertexArray(model_vao[level]);
+            draw_model(0, 0, 0, level);
+            glBindVertexArray(0);
+            gl_state_invalidate();
+        }
+        else
+        {
+            glBegin(GL_POLYGON);
+                glVertex3f(-2, 2, 0);
+                glVertex3f(-2, -2, 0);
+                glVertex3f(2, -2, 0);
+                glVertex3f(2, 2, 0);
+            glEnd();
+        }
+        profile_gpu_end();
+        // Makes a 3-units wide and 4-units long rectangle.
+        cull_frame.visible++;
+    }
+    else cull_frame.culled++;
 
-    glutSwapBuffers(); // Swaps the buffers, and automatically does the buffer flush.
+    if (object_count > 0)
+    {
+        profile_cpu_begin("object field"); // (culling + sending the visible squares)
+        draw_object_field();
+        profile_cpu_end();
+    }
+    cull_total.visible += cull_frame.visible;
+    cull_total.culled += cull_frame.culled;
+    cull_total.boxes_tested += cull_frame.boxes_tested;
+    cull_frames++;
+    if (cull_log) printf("frame %ld: %ld visible, %ld culled\n", cull_frames_drawn, cull_frame.visible, cull_frame.culled);
+    cull_frames_drawn++;
+
+    app_swap_buffers(); // Swaps the buffers, and automatically does the buffer flush.
+    // (In headless mode there are no buffers to swap, it waits for the frame to finish instead.)
 
 }
 
@@ -194,6 +733,7 @@ void reshape(int width, int height)
 {
     // This function is called when the window is resized.
     // It adjusts the viewport and projection matrix to match the new window size.
+    double aspect = (double)width / (height > 0 ? height : 1); // (the window's width/height, see 2. below)
 
     glViewport(0, 0, (GLsizei)width, (GLsizei)height); // Sets up the viewport ie 
     // (where the rendered image is displayed).
@@ -210,7 +750,9 @@ void reshape(int width, int height)
     glMatrixMode(GL_PROJECTION); // Sets the current matrix mode to projection
     glLoadIdentity(); // Resets parameters of the projection matrix
 
-    gluPerspective(60.0, 1.0, 5.0, 100.0); // Sets up the perspective projection matrix which
+    scene_height = height; // (the levels of detail need to know how many pixels the view is tall)
+    scene_projection = mat4_perspective(scene_fovy, aspect, 5.0, 100.0); // (the same matrix, for the culling)
+    gluPerspective(scene_fovy, aspect, 5.0, 100.0); // Sets up the perspective projection matrix which
     // defines how 3D objects are projected onto a 2D screen.
     // Basically make the view frustum (explained in the top section under header files)
     // ie configures projection mode to perspective projection.
@@ -256,18 +798,17 @@ void reshape(int width, int height)
     // not the camera's perspective.
 }
 
-void timer(int i)
+void update()
 {
-    // This is basically a loop function that is needed for the animation.
-    // It continuosly or periodically calls itself every 1/60th of a second
-    // ie 60 frames per seconds.
+    // One step of the animation, moves the square back and forth along the z-axis and cycles its color.
+    // Kept apart from timer() so the very same step can also be driven without GLUT's timer
+    // (ie by the headless benchmark in common/app.h).
 
-    glutPostRedisplay(); // Signals the window to be redrawn in the next frame. Along with glClear()
-    // they work hand in hand to clear the screen and prepare for rendering.
+    prev_z_position = z_position; // Remembers where we were (for the interpolation in display())
+    prev_field_angle = field_angle;
 
-    glutTimerFunc(1000/60, timer, 0); // Registers the timer again to call this function after
-    // approximately 1/60th of a second (assuming a 60 frames per second refresh rate).
-    // We wont be needing to use the 3rd paramater (explained in main).
+    field_angle += 0.25; // The object field turns once every 24 seconds
+    if (field_angle >= 360) field_angle -= 360;
 
     if (color_counter < 10)
     {
@@ -309,8 +850,22 @@ void timer(int i)
         z_position += 0.75;
     }
     else z_position -= 0.75; 
+}
 
+void timer(int i)
+{
+    // This is basically a loop function that is needed for the animation.
+    // It continuosly or periodically calls itself every 1/60th of a second
+    // ie 60 frames per seconds.
+
+    glutPostRedisplay(); // Signals the window to be redrawn in the next frame. Along with glClear()
+    // they work hand in hand to clear the screen and prepare for rendering.
+
+    glutTimerFunc(1000/60, timer, 0); // Registers the timer again to call this function after
+    // approximately 1/60th of a second (assuming a 60 frames per second refresh rate).
+    // We wont be needing to use the 3rd paramater (explained in main).
 
+    app_call("update", update); // Advances the animation by one step (timed with --profile, see common/app.h).
 }
 
 
@@ -321,32 +876,114 @@ void init()
 
     glClearColor(0.3, 0.4, 0.4, 0); // Sets the background color.
     // CHECK display function for details about colors in OpenGL.
+
+    if (model_path) init_model(); // --model FILE
+    if (object_count > 0) init_object_field(); // --objects N
+}
+
+int parse_3d_args(int argc, char **argv, int i)
+{
+    // Our own command line options (see app_parse_args in common/app.h):
+    //   --objects N     adds a field of N squares around the camera (culled with a BVH)
+    //   --cull-log      prints how many objects were visible/culled every frame
+    //   --model FILE    draws FILE (.obj, .ply or .mesh) for every object instead of the squares,
+    //                   or "ball": a ball out of 65,000 triangles
+    //   --lod           ...with levels of detail, picked by how big the object is on screen
+    //   --lod-pixels P  how far (in pixels) a level may be off, default 1
+    //   --render-queue state|depth  records the field into a render queue, sorted for the fewest
+    //                   state changes or front to back (recorded on the --workers threads)
+    if (strcmp(argv[i], "--cull-log") == 0)
+    {
+        cull_log = 1;
+        return 1;
+    }
+    if (strcmp(argv[i], "--lod") == 0)
+    {
+        model_lod = 1;
+        return 1;
+    }
+    if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+    {
+        model_path = argv[i + 1];
+        return 2;
+    }
+    if (strcmp(argv[i], "--lod-pixels") == 0 && i + 1 < argc)
+    {
+        model_lod_pixels = (float)atof(argv[i + 1]);
+        if (model_lod_pixels <= 0)
+        {
+            fprintf(stderr, "--lod-pixels must be > 0\n");
+            exit(1);
+        }
+        return 2;
+    }
+    if (strcmp(argv[i], "--render-queue") == 0 && i + 1 < argc)
+    {
+        if (strcmp(argv[i + 1], "state") == 0) queue_order = RENDER_ORDER_STATE;
+        else if (strcmp(argv[i + 1], "depth") == 0) queue_order = RENDER_ORDER_DEPTH;
+        else
+        {
+            fprintf(stderr, "--render-queue must be state or depth\n");
+            exit(1);
+        }
+        return 2;
+    }
+    if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+    {
+        object_count = atoi(argv[i + 1]);
+        if (object_count < 0)
+        {
+            fprintf(stderr, "--objects must be >= 0\n");
+            exit(1);
+        }
+        return 2;
+    }
+    return 0;
 }
 
 int main(int argc, char** argv)
 {
+    AppCallbacks callbacks = { "3D", init, reshape, update, display, report }; // The same callbacks GLUT gets below
+
+    if (!app_parse_args(&argc, argv, parse_3d_args)) return 1; // Reads our own options (--headless, --size, ...)
+    if (model_lod && !model_path)
+    {
+        fprintf(stderr, "--lod needs a --model\n");
+        return 1;
+    }
+    if (model_path && app_immediate_only())
+    {
+        fprintf(stderr, "--model needs the gl backend (buffer objects) and can't be traced\n");
+        return 1;
+    }
+    if (app.headless) return app_run_headless(&callbacks); // No window at all: benchmark N frames and exit
 
     glutInit(&argc, argv); // Initializes the GLUT library and processes any command line arguments.
+    app_init_context(); // (--backend core asks for a core profile context, see common/app.h)
 
     // To execute SINGLE BUFFER version of code (just drawing shapes) remove "GLUT_DOUBLE" below.
-    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE); // Sets the initial display mode to use RGB color model.
-    // ALSO to Double Buffering mode (Explained in display function)
+    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH); // Sets the initial display mode to use RGB color model.
+    // ALSO to Double Buffering mode (Explained in display function), and a depth buffer (for --model)
 
     glutInitWindowPosition(500, 200); // Sets the initial position of the window (in pixels).
-    glutInitWindowSize(500, 500); // Sets the initial size of the window (in pixels).
+    glutInitWindowSize(app.width, app.height); // Sets the initial size of the window (in pixels).
+    // (500x500 unless another size was given with --size WxH)
     // Note: this makes the window size to be 500 pixels wide and 500 pixels long, ie it will contain
     // 500*500 = 250,000 pixels in total (ie will cover 250,000 pixels of the screen).
     // If we draw a square that starts at let's say x = -10 to x = 0 and y = 0 to y = 4,
     // it will be 10 pixels wide and 4 pixels long ie will contain 10*4 = 40 pixels in total.
 
     glutCreateWindow("Daldezo's Square 2"); // Creates a window with the given title.
+    app_load_extensions(); // Loads the newer OpenGL functions (models, --backend core, ...) now that we have a context.
 
     // Callback functions are functions that are passed as arguments to other functions
     // Note: functions are reduced to pointers after being passed as arguments in some function.
 
     glutDisplayFunc(display); // Registers the display callback function.
     glutReshapeFunc(reshape); // Registers the reshape callback function.
-    glutTimerFunc(0, timer, 0); // Registers the timer callback function.
+    app_profile_callbacks(&callbacks); // --profile: times display/reshape (common/profile.h)
+    if (app.loop) app_start_loop(&callbacks); // --loop: a fixed-timestep game loop animates instead (common/loop.h)
+    else glutTimerFunc(0, timer, 0); // Registers the timer callback function.
     // Takes three arguments: 
     // 1. unsigned int millisec (time interval for callback function to be called, in milliseconds),
     // 2. pointer to the callback function,
@@ -355,7 +992,7 @@ int main(int argc, char** argv)
     // second you add 1 and print to the screen).
 
 
-    init(); // Calls the initialization function to set up OpenGL state.
+    app_call("init", init); // Calls the initialization function to set up OpenGL state.
 
     glutMainLoop(); // Enters the GLUT event processing loop.
     return 0;
@@ -1,6 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h> // offsetof()
+#include <string.h>
+#include <math.h>
 #include <GL/glut.h> // Including OpenGL GLUT library
+#include "common/app.h" // Command line options + headless (no window) benchmark mode
+#include "common/shader.h" // GLSL shader compiling (instanced mode)
+#include "common/stream.h" // Persistently mapped buffers (the instanced mode's matrices go to OpenGL through one)
+#include "common/vmath.h" // Our own matrices/quaternions (SSE)
+#include "common/mesh.h" // Binary mesh files (--scene)
+#include "common/mesh_import.h" // OBJ and PLY models (--scene)
+#include "common/mesh_opt.h" // Reordering them for the GPU (--optimize)
 
 /*
 - ***** A Note on Transformations *****
@@ -78,6 +88,788 @@
 */
 
 float g_angle = 0;
+float prev_g_angle = 0; // g_angle one update() ago (the game loop draws in between, see display())
+mat4 cube_projection; // The gluPerspective matrix of reshape(), kept on our side for the shaders
+
+mat4 cube_model_view(float angle)
+{
+    // glTranslatef(0,0,-9) followed by the 7 glRotatef(angle, ...) of display(), in one matrix.
+    static const float axes[7][3] = { {0,1,1}, {1,1,0}, {0,1,0}, {1,0,1}, {1,1,1}, {1,0,0}, {0,0,1} };
+    quat spin = { 0, 0, 0, 1 };
+    mat4 model_view;
+    int i;
+    for (i = 0; i < 7; i++) spin = quat_mul(spin, quat_from_axis_angle(angle, axes[i][0], axes[i][1], axes[i][2]));
+    model_view = quat_to_mat4(spin);
+    model_view.m[12] = 0; // translate(0, 0, -9) * rotation = the rotation with -9 as z translation
+    model_view.m[13] = 0;
+    model_view.m[14] = -9;
+    return model_view;
+}
+
+// How the cube gets to the GPU (--mode immediate, vbo or instanced, 'm' toggles it while running):
+enum { CUBE_MODE_IMMEDIATE, CUBE_MODE_VBO, CUBE_MODE_INSTANCED };
+int cube_mode = CUBE_MODE_IMMEDIATE;
+const char *cube_mode_names[] = { "immediate", "vbo", "instanced" };
+
+/*
+- ***** A Note on Vertex Buffer Objects (VBOs) *****
+  With glBegin()/glEnd() (called "immediate mode") we send every single vertex and color to the
+  driver again on every frame: 24 glVertex3f + 6 glColor3f calls per frame for one cube, and
+  each call costs some CPU time in the driver. But the cube never changes! Only the matrix does.
+  So instead we can copy the cube ONCE (in init) into a buffer owned by OpenGL (a Vertex Buffer
+  Object) and every frame simply say "draw what's in that buffer" with a single call.
+  - The vertex buffer (GL_ARRAY_BUFFER) holds the vertices: position + color for each.
+  - The index buffer (GL_ELEMENT_ARRAY_BUFFER) says which vertices make up each triangle,
+    so we don't have to repeat a vertex that is used by two triangles.
+  - The Vertex Array Object (VAO) remembers how the buffers are laid out (where the positions
+    and colors are), so drawing is just: bind the VAO, call glDrawElements().
+  Note: GL_QUADS isn't a thing on modern GPUs (the driver splits every quad into 2 triangles
+        behind our back), so we store triangles right away.
+*/
+
+typedef struct CubeVertex
+{
+    GLfloat position[3];
+    GLfloat color[3];
+} CubeVertex;
+
+// Same cube as draw_cube_immediate(), just written down as data. Each face gets its own 4 vertices:
+// a corner is shared by 3 faces, but it has a different color on each face and a vertex can only
+// have one color.
+const CubeVertex cube_vertices[24] =
+{
+    // Front
+    {{-2, 2, 0}, {0.8, 0.2, 0.6}}, {{-2, -2, 0}, {0.8, 0.2, 0.6}}, {{2, -2, 0}, {0.8, 0.2, 0.6}}, {{2, 2, 0}, {0.8, 0.2, 0.6}},
+    // Back
+    {{-2, 2, -4}, {0.8, 0.7, 0.2}}, {{2, 2, -4}, {0.8, 0.7, 0.2}}, {{2, -2, -4}, {0.8, 0.7, 0.2}}, {{-2, -2, -4}, {0.8, 0.7, 0.2}},
+    // Top
+    {{-2, 2, -4}, {0.3, 0.8, 0.2}}, {{-2, 2, 0}, {0.3, 0.8, 0.2}}, {{2, 2, 0}, {0.3, 0.8, 0.2}}, {{2, 2, -4}, {0.3, 0.8, 0.2}},
+    // Bottom
+    {{-2, -2, -4}, {0.4, 0.8, 0.5}}, {{2, -2, -4}, {0.4, 0.8, 0.5}}, {{2, -2, 0}, {0.4, 0.8, 0.5}}, {{-2, -2, 0}, {0.4, 0.8, 0.5}},
+    // Right
+    {{2, 2, 0}, {0.4, 0.5, 0.8}}, {{2, -2, 0}, {0.4, 0.5, 0.8}}, {{2, -2, -4}, {0.4, 0.5, 0.8}}, {{2, 2, -4}, {0.4, 0.5, 0.8}},
+    // Left
+    {{-2, 2, 0}, {0.5, 0.3, 0.7}}, {{-2, 2, -4}, {0.5, 0.3, 0.7}}, {{-2, -2, -4}, {0.5, 0.3, 0.7}}, {{-2, -2, 0}, {0.5, 0.3, 0.7}},
+};
+
+// Every quad (a, b, c, d) becomes the triangles (a, b, c) and (a, c, d), which keeps the
+// counterclockwise/clockwise order of the quad.
+#define CUBE_QUAD(a) (a), (a) + 1, (a) + 2, (a), (a) + 2, (a) + 3
+const GLubyte cube_indices[36] =
+{
+    CUBE_QUAD(0), CUBE_QUAD(4), CUBE_QUAD(8), CUBE_QUAD(12), CUBE_QUAD(16), CUBE_QUAD(20)
+};
+
+GLuint cube_vao = 0;
+GLuint cube_vbo = 0;
+GLuint cube_ibo = 0;
+
+// The mesh in the buffers: our cube, or any mesh from a mesh file (--scene cube.mesh, made by
+// tools/mesh_convert.c from assets/cube.scene, see common/mesh.h). Its arrays are mapped straight
+// from the file into memory and handed to glBufferData as they are, without any parsing.
+// Or an OBJ or PLY model (--scene assets/cube.obj), read with common/mesh_import.h on the job pool
+// (and with --optimize put in a GPU-friendly order by common/mesh_opt.h before it's uploaded).
+const char *scene_path = NULL;          // --scene FILE
+const char *scene_mesh_name = "cube";   // --mesh NAME
+int scene_optimize = 0;                 // --optimize
+MeshFile scene;
+GLsizei cube_vertex_stride = sizeof(CubeVertex);
+GLsizei cube_index_count = 36;
+GLenum cube_index_type = GL_UNSIGNED_BYTE;
+size_t cube_color_offset = offsetof(CubeVertex, color); // (0 = no colors: drawn white)
+float cube_center[3] = { 0, 0, -2 };    // the middle of its bounding box (the cube goes from z = 0 to z = -4)
+float cube_size = 4;                    // and its longest side
+
+int scene_is_model()
+{
+    // An .obj or .ply file (anything else is a mesh file).
+    size_t length = scene_path ? strlen(scene_path) : 0;
+    const char *extension = length > 4 ? scene_path + length - 4 : "";
+    return strcmp(extension, ".obj") == 0 || strcmp(extension, ".ply") == 0 || strcmp(extension, ".OBJ") == 0 || strcmp(extension, ".PLY") == 0;
+}
+
+int have_cube_buffers()
+{
+    // Whether init_cube_buffers() can work: everything it calls beyond OpenGL 1.1 (buffers are
+    // OpenGL 1.5, vertex array objects 3.0).
+    return GLEXT_HAVE(glGenBuffers) && GLEXT_HAVE(glBindBuffer) && GLEXT_HAVE(glBufferData) &&
+           GLEXT_HAVE(glGenVertexArrays) && GLEXT_HAVE(glBindVertexArray);
+}
+
+void init_cube_buffers()
+{
+    // Uploads the cube into GPU buffers once. Called from init().
+    const void *vertices = cube_vertices, *indices = cube_indices;
+    size_t vertex_bytes = sizeof(cube_vertices), index_bytes = sizeof(cube_indices);
+    uint64_t start = clock_now_ns(), mapped = start;
+    MeshData model;
+    MeshImportStats import;
+
+    memset(&model, 0, sizeof(model));
+    if (scene_is_model())
+    {
+        // A model: parsed here (see common/mesh_import.h), which takes much longer than mapping a
+        // mesh file, so converting big ones once with tools/mesh_convert.c pays off.
+        uint32_t i;
+        int k;
+        if (!mesh_import(scene_path, &model, &app_jobs, &import)) exit(1);
+        if (scene_optimize)
+        {
+            MeshOptStats before = mesh_analyze(&model), after;
+            uint64_t optimize_start = clock_now_ns();
+            mesh_optimize(&model);
+            after = mesh_analyze(&model);
+            printf("scene: optimized in %.1f ms: ACMR %.3f -> %.3f, overdraw %.3f -> %.3f\n", (clock_now_ns() - optimize_start) / 1e6,
+                   before.acmr, after.acmr, before.overdraw, after.overdraw);
+        }
+        vertices = model.vertices;
+        indices = model.indices;
+        vertex_bytes = (size_t)model.vertex_count * mesh_vertex_stride(model.format);
+        index_bytes = (size_t)model.index_count * sizeof(uint32_t);
+        cube_vertex_stride = mesh_vertex_stride(model.format);
+        cube_index_count = model.index_count;
+        cube_index_type = GL_UNSIGNED_INT;
+        cube_color_offset = model.format & MESH_HAS_COLOR ? mesh_attrib_offset(model.format, MESH_HAS_COLOR) : 0;
+        cube_size = 0;
+        for (k = 0; k < 3; k++)
+        {
+            float low = 1e30f, high = -1e30f;
+            for (i = 0; i < model.vertex_count; i++)
+            {
+                float v = model.vertices[(size_t)i * (cube_vertex_stride / sizeof(float)) + k];
+                if (v < low) low = v;
+                if (v > high) high = v;
+            }
+            cube_center[k] = model.vertex_count ? (low + high) / 2 : 0;
+            if (high - low > cube_size) cube_size = high - low;
+        }
+        if (cube_size <= 0) cube_size = 1;
+        mapped = clock_now_ns();
+    }
+    else if (scene_path)
+    {
+        static const GLenum index_types[5] = { 0, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, 0, GL_UNSIGNED_INT };
+        const MeshEntry *mesh;
+        int k;
+        if (!mesh_file_open(&scene, scene_path)) exit(1);
+        mesh = mesh_file_find(&scene, scene_mesh_name);
+        if (!mesh)
+        {
+            fprintf(stderr, "%s has no mesh called '%s' (see tools/mesh_convert --info)\n", scene_path, scene_mesh_name);
+            exit(1);
+        }
+        vertices = mesh_vertices(&scene, mesh); // (pointers into the mapped file)
+        indices = mesh_indices(&scene, mesh);
+        vertex_bytes = mesh_vertex_bytes(mesh);
+        index_bytes = mesh_index_bytes(mesh);
+        cube_vertex_stride = mesh->vertex_stride;
+        cube_index_count = mesh->index_count;
+        cube_index_type = index_types[mesh->index_size];
+        cube_color_offset = mesh->format & MESH_HAS_COLOR ? mesh_attrib_offset(mesh->format, MESH_HAS_COLOR) : 0;
+        cube_size = 0;
+        for (k = 0; k < 3; k++)
+        {
+            cube_center[k] = (mesh->bounds_min[k] + mesh->bounds_max[k]) / 2;
+            if (mesh->bounds_max[k] - mesh->bounds_min[k] > cube_size) cube_size = mesh->bounds_max[k] - mesh->bounds_min[k];
+        }
+        if (cube_size <= 0) cube_size = 1;
+        mapped = clock_now_ns();
+    }
+
+    glGenVertexArrays(1, &cube_vao);
+    glBindVertexArray(cube_vao); // Everything below gets recorded into the VAO
+
+    glGenBuffers(1, &cube_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertices, GL_STATIC_DRAW);
+    // GL_STATIC_DRAW: "written once, drawn a lot", so the driver can keep it in the fastest memory.
+
+    glGenBuffers(1, &cube_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices, GL_STATIC_DRAW);
+
+    // Where to find the positions and colors inside the buffer. The last parameter is an
+    // offset into the bound buffer (not a real pointer) since a VBO is bound.
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, cube_vertex_stride, (const void *)0);
+    if (cube_color_offset)
+    {
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(3, GL_FLOAT, cube_vertex_stride, (const void *)cube_color_offset);
+    }
+
+    glBindVertexArray(0);
+
+    if (scene_path)
+    {
+        // Start-up cost of the mesh: mapping the file is next to free, so this is all upload (the
+        // file's pages are read from disk while glBufferData copies them, unless they're cached).
+        glFinish(); // (the upload has really happened by now)
+        if (model.vertices)
+            printf("scene: %s, %.1f MB imported in %.1f ms (%.0f MB/s, %d threads, %llu corners welded into %u vertices), ",
+                   scene_path, import.bytes / 1e6, import.seconds * 1e3, import.bytes / 1e6 / import.seconds, import.threads,
+                   (unsigned long long)import.corners, model.vertex_count);
+        else printf("scene: %s '%s', %.1f MB: mapped in %.3f ms, ", scene_path, scene_mesh_name, (vertex_bytes + index_bytes) / 1e6, (mapped - start) / 1e6);
+        printf("uploaded in %.1f ms (%.2f GB/s)\n", (clock_now_ns() - mapped) / 1e6, (vertex_bytes + index_bytes) / (double)(clock_now_ns() - mapped));
+    }
+    free(model.vertices); // (the GPU has its own copy now)
+    free(model.indices);
+}
+
+void draw_cube_vbo()
+{
+    // The whole cube in ONE call: 36 indices = 12 triangles = 6 faces.
+    glBindVertexArray(cube_vao);
+    if (!cube_color_offset) glColor3f(1, 1, 1);
+    glDrawElements(GL_TRIANGLES, cube_index_count, cube_index_type, (const void *)0);
+    glBindVertexArray(0);
+    gl_state_invalidate(); // (drawing with a color array leaves the current color undefined, see common/gl_state.h)
+}
+
+void draw_cube_immediate()
+{
+    // The cube sent vertex by vertex every frame (immediate mode).
+
+    glBegin(GL_QUADS); // To make a cube use GL_Quads
+    // Note: the front, right, and top faces must be defined in a counterclockwise order.
+    //       while the back, left, and bottom faces must be defined in a clockwise order.
+        // Front
+        glColor3f(0.8,0.2,0.6);
+        glVertex3f(-2, 2, 0);
+        glVertex3f(-2, -2, 0);
+        glVertex3f(2, -2, 0);
+        glVertex3f(2, 2, 0);
+
+        // Back
+        glColor3f(0.8,0.7,0.2);
+        glVertex3f(-2, 2, -4);
+        glVertex3f(2, 2, -4);
+        glVertex3f(2, -2, -4);
+        glVertex3f(-2, -2, -4);
+
+        // Top
+        glColor3f(0.3,0.8,0.2);
+        glVertex3f(-2, 2, -4);
+        glVertex3f(-2, 2, 0);
+        glVertex3f(2, 2, 0);
+        glVertex3f(2, 2, -4);
+
+        // Bottom
+        glColor3f(0.4,0.8,0.5);
+        glVertex3f(-2, -2, -4);
+        glVertex3f(2, -2, -4);
+        glVertex3f(2, -2, 0);
+        glVertex3f(-2, -2, 0);
+
+        // Right
+        glColor3f(0.4,0.5,0.8);
+        glVertex3f(2, 2, 0);
+        glVertex3f(2, -2, 0);
+        glVertex3f(2, -2, -4);
+        glVertex3f(2, 2, -4);
+
+        // Left
+        glColor3f(0.5,0.3,0.7);
+        glVertex3f(-2, 2, 0);
+        glVertex3f(-2, 2, -4);
+        glVertex3f(-2, -2, -4);
+        glVertex3f(-2, -2, 0);
+    glEnd();
+}
+
+/*
+- ***** A Note on Instancing *****
+  Drawing 100,000 cubes with 100,000 draw calls would spend all the time in the driver, not on
+  the GPU. With instancing we draw the SAME mesh (our cube in the VBO) many times with ONE call:
+  glDrawElementsInstanced(..., count). The vertex shader then runs for every vertex of every
+  copy ("instance") and gets gl_InstanceID plus any per-instance data we like.
+  The per-instance data (each cube's model matrix and color) lives in buffers just like the vertices.
+  glVertexAttribDivisor(attrib, 1) tells OpenGL "advance this attribute once per INSTANCE
+  instead of once per vertex".
+  Note: A mat4 attribute takes up 4 attribute slots in a row, one per column.
+*/
+
+// The spinning cubes of the field, one entry (or x,y,z triplet) per cube in each array.
+// The matrices are recomputed every frame from these.
+int instance_count = 10000;          // --instances N
+GLfloat *instance_positions = NULL;  // x,y,z
+GLfloat *instance_axes = NULL;       // x,y,z of the rotation axis (normalized)
+GLfloat *instance_speeds = NULL;     // how many times g_angle it spins, a whole number (negative = the other way around)
+GLfloat *instance_scales = NULL;
+GLfloat *instance_angles = NULL;     // speed * g_angle, filled every frame
+mat4 *instance_matrices = NULL;      // one model matrix per instance, rewritten every frame (--stream orphan)
+GLuint instance_program = 0;
+GLint instance_view_projection = -1; // location of the shader's view_projection uniform
+GLuint instance_vao = 0;
+GLuint instance_matrix_vbo = 0;      // (--stream orphan)
+StreamBuffer instance_matrix_stream; // the matrices are written straight into it (see common/stream.h)
+GLuint instance_color_vbo = 0;
+
+/*
+- ***** A Note on Hidden Cubes *****
+  The depth test throws away fragments behind what's ALREADY drawn. A cube that is drawn first
+  and covered by a nearer one later was shaded for nothing. With a dense field (--cube-scale 0.9:
+  every cube fills 90% of its cell) most of what we shade gets covered up again. Two ways out:
+  --prepass    Draws the field twice. First into the depth buffer only (glColorMask off), then
+               with colors and glDepthFunc(GL_LEQUAL). By then the depth buffer holds the nearest
+               surface of every pixel, so only that one passes and each pixel is shaded once.
+               The vertices are paid for twice.
+  --occlusion  Doesn't draw the hidden cubes at all. The field is cut into blocks of 4x4x4 cubes
+               ("groups", one draw each, front to back) and an occlusion query counts the samples
+               of a group that pass the depth test (0 = hidden). Waiting for that count would
+               stall the CPU like waiting for a timer query (see common/profile.h), so we go by
+               LAST frame's count: the groups that were visible are drawn right away and fill the
+               depth buffer. The others first draw their bounding box (no colors, no depth writes)
+               inside a query, then the group inside glBeginConditionalRender(that query): the GPU
+               skips the draw by itself if no part of the box passed. A count that isn't in yet
+               counts as visible.
+  Both can be used together (the pre-pass then only draws last frame's visible groups).
+  The report shows the fragments shaded per frame, counted by a GL_SAMPLES_PASSED query.
+*/
+
+int field_prepass = 0;          // --prepass
+int field_occlusion = 0;        // --occlusion
+float field_cube_scale = 0.3f;  // --cube-scale F: how much of its cell a cube fills
+
+#define FIELD_GROUP_SIDE 4      // a group is (up to) 4x4x4 cubes
+
+typedef struct FieldGroup
+{
+    int first, count;           // its instances (sorted so every group is one range)
+    float min[3], max[3];       // its bounding box, whichever way the cubes turn
+    GLuint draw_queries[2];     // samples of the group itself (this frame's and last frame's)
+    GLuint box_query;           // samples of the bounding box (for the conditional draw)
+    int queried[2];             // draw_queries[k] was issued
+    int visible;                // by last frame's count
+} FieldGroup;
+
+FieldGroup *field_groups = NULL;
+int field_group_count = 0;
+GLuint field_fragment_queries[2]; // the whole color pass (without --occlusion)
+int field_fragment_queried[2];
+unsigned int field_frame = 0;     // picks this frame's query of each pair
+uint64_t field_fragments = 0;     // summed over field_frames frames (for the report)
+uint64_t field_visible_groups = 0, field_box_tests = 0, field_late = 0;
+int field_frames = 0;
+int field_drawn_groups = 0, field_drawn_box_tests = 0; // last frame's, counted once its fragments are in
+
+const char *instance_vertex_shader =
+    "#version 330 compatibility\n"
+    "uniform mat4 view_projection;\n"
+    "in vec3 position;\n"
+    "in vec3 color;\n"
+    "in mat4 instance_model;\n"   // per instance (divisor 1)
+    "in vec3 instance_color;\n"   // per instance (divisor 1)
+    "out vec3 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = view_projection * instance_model * vec4(position, 1.0);\n"
+    "    v_color = color * instance_color;\n"
+    "}\n";
+
+const char *instance_fragment_shader =
+    "#version 330 compatibility\n"
+    "in vec3 v_color;\n"
+    "out vec4 frag_color;\n"
+    "void main()\n"
+    "{\n"
+    "    frag_color = vec4(v_color, 1.0);\n"
+    "}\n";
+
+enum { ATTRIB_POSITION = 0, ATTRIB_COLOR = 1, ATTRIB_INSTANCE_MODEL = 2 /* 2..5 */, ATTRIB_INSTANCE_COLOR = 6 };
+
+unsigned int field_random_state = 12345; // Fixed seed: every run (and every machine) gets the same field
+
+float field_random()
+{
+    // A tiny random number generator (xorshift) giving a float in [0, 1).
+    // rand() would do too, but it gives different numbers on different platforms.
+    field_random_state ^= field_random_state << 13;
+    field_random_state ^= field_random_state >> 17;
+    field_random_state ^= field_random_state << 5;
+    return (field_random_state >> 8) / 16777216.0f;
+}
+
+void permute(GLfloat *values, int per_instance, const int *order, GLfloat *scratch)
+{
+    // values[i] = values[order[i]], per_instance floats at a time.
+    int i;
+    memcpy(scratch, values, sizeof(GLfloat) * per_instance * instance_count);
+    for (i = 0; i < instance_count; i++)
+        memcpy(&values[i * per_instance], &scratch[order[i] * per_instance], sizeof(GLfloat) * per_instance);
+}
+
+void init_field_groups(int n, GLfloat *colors)
+{
+    // --occlusion: sorts the cubes block by block (nearest blocks first) so each group of
+    // 4x4x4 cubes is one range of instances, and gives every group its box and queries.
+    int blocks = (n + FIELD_GROUP_SIDE - 1) / FIELD_GROUP_SIDE, i, g, k;
+    int *order = (int *)malloc(sizeof(int) * instance_count);
+    int *starts = (int *)calloc(blocks * blocks * blocks + 1, sizeof(int));
+    GLfloat *scratch = (GLfloat *)malloc(sizeof(GLfloat) * 3 * instance_count);
+    float radius;
+
+    // A counting sort on the block (z slowest, so the front slab comes first).
+#define FIELD_BLOCK(i) ((((i) / (n * n) / FIELD_GROUP_SIDE) * blocks + (i) / n % n / FIELD_GROUP_SIDE) * blocks + (i) % n / FIELD_GROUP_SIDE)
+    for (i = 0; i < instance_count; i++) starts[FIELD_BLOCK(i) + 1]++;
+    for (g = 0; g < blocks * blocks * blocks; g++) starts[g + 1] += starts[g];
+    for (i = 0; i < instance_count; i++) order[starts[FIELD_BLOCK(i)]++] = i; // (moves every start to its end)
+#undef FIELD_BLOCK
+    permute(instance_positions, 3, order, scratch);
+    permute(instance_axes, 3, order, scratch);
+    permute(instance_speeds, 1, order, scratch);
+    permute(instance_scales, 1, order, scratch);
+    permute(colors, 3, order, scratch);
+
+    field_groups = (FieldGroup *)calloc(blocks * blocks * blocks, sizeof(FieldGroup));
+    field_group_count = 0;
+    for (g = 0; g < blocks * blocks * blocks; g++)
+    {
+        FieldGroup *group = &field_groups[field_group_count];
+        group->first = g == 0 ? 0 : starts[g - 1];
+        group->count = starts[g] - group->first;
+        if (group->count == 0) continue; // (the last blocks of a field that isn't a whole cube)
+        for (k = 0; k < 3; k++)
+        {
+            group->min[k] = instance_positions[group->first * 3 + k];
+            group->max[k] = group->min[k];
+        }
+        for (i = group->first; i < group->first + group->count; i++)
+        {
+            // A turning cube stays within half the diagonal of its bounding box from its center.
+            radius = instance_scales[i] * cube_size * 0.8661f;
+            for (k = 0; k < 3; k++)
+            {
+                if (instance_positions[i * 3 + k] - radius < group->min[k]) group->min[k] = instance_positions[i * 3 + k] - radius;
+                if (instance_positions[i * 3 + k] + radius > group->max[k]) group->max[k] = instance_positions[i * 3 + k] + radius;
+            }
+        }
+        glGenQueries(2, group->draw_queries);
+        glGenQueries(1, &group->box_query);
+        group->visible = 1;
+        field_group_count++;
+    }
+    free(order);
+    free(starts);
+    free(scratch);
+}
+
+void point_instance_matrices(GLintptr offset)
+{
+    // The 4 columns of the instance_model attribute: offset is where this frame's matrices start
+    // in their buffer (with the instanced VAO bound).
+    int i;
+    glBindBuffer(GL_ARRAY_BUFFER, instance_matrix_stream.memory ? instance_matrix_stream.buffer : instance_matrix_vbo);
+    for (i = 0; i < 4; i++)
+        glVertexAttribPointer(ATTRIB_INSTANCE_MODEL + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (const void *)(offset + sizeof(GLfloat) * 4 * i));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void init_cube_field()
+{
+    // Lays the cubes out on a n*n*n grid in front of the camera (between z = -10 and z = -40,
+    // inside the zNear = 2 / zFar = 50 of reshape()), each with a random axis, speed and color.
+    int n = 1, i;
+    GLfloat *colors;
+    ShaderAttrib attribs[] =
+    {
+        { ATTRIB_POSITION, "position" }, { ATTRIB_COLOR, "color" },
+        { ATTRIB_INSTANCE_MODEL, "instance_model" }, { ATTRIB_INSTANCE_COLOR, "instance_color" }
+    };
+
+    while (n * n * n < instance_count) n++;
+    instance_positions = (GLfloat *)malloc(sizeof(GLfloat) * 3 * instance_count);
+    instance_axes = (GLfloat *)malloc(sizeof(GLfloat) * 3 * instance_count);
+    instance_speeds = (GLfloat *)malloc(sizeof(GLfloat) * instance_count);
+    instance_scales = (GLfloat *)malloc(sizeof(GLfloat) * instance_count);
+    instance_angles = (GLfloat *)malloc(sizeof(GLfloat) * instance_count);
+    colors = (GLfloat *)malloc(sizeof(GLfloat) * 3 * instance_count);
+    for (i = 0; i < instance_count; i++)
+    {
+        GLfloat *position = &instance_positions[i * 3], *axis = &instance_axes[i * 3];
+        float cell_xy = 12.0f / n, cell_z = 30.0f / n, length;
+        position[0] = -6 + cell_xy * (i % n + 0.5f);
+        position[1] = -6 + cell_xy * (i / n % n + 0.5f);
+        position[2] = -10 - cell_z * (i / (n * n) + 0.5f);
+        axis[0] = field_random() - 0.5f;
+        axis[1] = field_random() - 0.5f;
+        axis[2] = field_random() - 0.5f + 0.01f;
+        length = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+        axis[0] /= length; axis[1] /= length; axis[2] /= length;
+        // Whole numbers only: g_angle jumps from 360 back to 0, and only a whole number of turns
+        // (speed * 360) jumps back to the same orientation.
+        instance_speeds[i] = (float)(1 + (int)(field_random() * 3)) * (field_random() < 0.5f ? -1 : 1);
+        instance_scales[i] = field_cube_scale * (cell_xy < cell_z ? cell_xy : cell_z) / cube_size; // (our cube is 4 units wide)
+        colors[i * 3 + 0] = 0.5f + field_random();
+        colors[i * 3 + 1] = 0.5f + field_random();
+        colors[i * 3 + 2] = 0.5f + field_random();
+    }
+    if (field_occlusion) init_field_groups(n, colors);
+    glGenQueries(2, field_fragment_queries);
+
+    instance_program = shader_program_create(instance_vertex_shader, instance_fragment_shader, attribs, 4);
+    if (!instance_program)
+    {
+        fprintf(stderr, "instanced mode is not available\n");
+        exit(1);
+    }
+    instance_view_projection = glGetUniformLocation(instance_program, "view_projection");
+
+    glGenVertexArrays(1, &instance_vao);
+    glBindVertexArray(instance_vao);
+
+    // Per vertex: the very same cube buffers as the VBO mode, just as shader inputs this time.
+    glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, cube_vertex_stride, (const void *)0);
+    if (cube_color_offset)
+    {
+        glEnableVertexAttribArray(ATTRIB_COLOR);
+        glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, cube_vertex_stride, (const void *)cube_color_offset);
+    }
+    else glVertexAttrib3f(ATTRIB_COLOR, 1, 1, 1); // (a mesh without colors: white, tinted per instance)
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube_ibo);
+
+    // Per instance: the model matrices (rewritten every frame -> a stream buffer, 3 frames of
+    // them, or GL_STREAM_DRAW with --stream orphan)...
+    if (!app.streaming || !stream_init(&instance_matrix_stream, GL_ARRAY_BUFFER, sizeof(mat4) * (instance_count + 1))) // (leaves it bound)
+    {
+        glGenBuffers(1, &instance_matrix_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_matrix_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * instance_count, NULL, GL_STREAM_DRAW);
+        instance_matrices = (mat4 *)malloc(sizeof(mat4) * instance_count);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        glEnableVertexAttribArray(ATTRIB_INSTANCE_MODEL + i);
+        glVertexAttribDivisor(ATTRIB_INSTANCE_MODEL + i, 1);
+    }
+    point_instance_matrices(0);
+
+    // ...and the colors (never change -> GL_STATIC_DRAW).
+    glGenBuffers(1, &instance_color_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_color_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * instance_count, colors, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_INSTANCE_COLOR);
+    glVertexAttribPointer(ATTRIB_INSTANCE_COLOR, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+    glVertexAttribDivisor(ATTRIB_INSTANCE_COLOR, 1);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(colors);
+}
+
+void update_instance_matrices(mat4 *matrices, float angle)
+{
+    // model = translate(position) * rotate(speed * angle, axis) * scale * translate(0, 0, 2)
+    // The last translate moves the cube's center (it goes from z = 0 to z = -4) onto the origin
+    // so every cube spins around its own center (a --scene mesh: the center of its bounding box).
+    // mat4_compose_batch() builds 4 of these at a time.
+    const float to_center[3] = { -cube_center[0], -cube_center[1], -cube_center[2] };
+    int i;
+    for (i = 0; i < instance_count; i++) instance_angles[i] = instance_speeds[i] * angle;
+    mat4_compose_batch(matrices, instance_positions, instance_axes, instance_angles,
+                       instance_scales, to_center, instance_count);
+}
+
+int field_query_result(GLuint query, GLint *samples)
+{
+    // Last frame's count, if it's in already (never waits for the GPU).
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        field_late++;
+        return 0;
+    }
+    glGetQueryObjectiv(query, GL_QUERY_RESULT, samples);
+    return 1;
+}
+
+void collect_field_fragments()
+{
+    GLint samples;
+    int last = (field_frame + 1) & 1;
+    if (!field_fragment_queried[last]) return;
+    field_fragment_queried[last] = 0;
+    if (!field_query_result(field_fragment_queries[last], &samples)) return;
+    field_fragments += samples;
+    field_frames++;
+}
+
+void draw_field_group(const FieldGroup *group)
+{
+    // (the per-instance attributes start at instance group->first)
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, cube_index_count, cube_index_type, (const void *)0,
+                                        group->count, group->first);
+}
+
+void draw_box(const float *min, const float *max)
+{
+    glBegin(GL_QUADS);
+        glVertex3f(min[0], min[1], max[2]); glVertex3f(max[0], min[1], max[2]); glVertex3f(max[0], max[1], max[2]); glVertex3f(min[0], max[1], max[2]); // Front
+        glVertex3f(min[0], min[1], min[2]); glVertex3f(min[0], max[1], min[2]); glVertex3f(max[0], max[1], min[2]); glVertex3f(max[0], min[1], min[2]); // Back
+        glVertex3f(min[0], max[1], min[2]); glVertex3f(min[0], max[1], max[2]); glVertex3f(max[0], max[1], max[2]); glVertex3f(max[0], max[1], min[2]); // Top
+        glVertex3f(min[0], min[1], min[2]); glVertex3f(max[0], min[1], min[2]); glVertex3f(max[0], min[1], max[2]); glVertex3f(min[0], min[1], max[2]); // Bottom
+        glVertex3f(max[0], min[1], min[2]); glVertex3f(max[0], max[1], min[2]); glVertex3f(max[0], max[1], max[2]); glVertex3f(max[0], min[1], max[2]); // Right
+        glVertex3f(min[0], min[1], min[2]); glVertex3f(min[0], min[1], max[2]); glVertex3f(min[0], max[1], max[2]); glVertex3f(min[0], max[1], min[2]); // Left
+    glEnd();
+}
+
+void draw_field_groups()
+{
+    // --occlusion (see the note on hidden cubes), with the instanced program and VAO bound.
+    int g, now = field_frame & 1, last = (field_frame + 1) & 1, counted = 1;
+    GLint samples;
+    uint64_t fragments = 0;
+
+    // 1. Last frame's counts: which groups were visible (and how many fragments they shaded).
+    for (g = 0; g < field_group_count; g++)
+    {
+        FieldGroup *group = &field_groups[g];
+        if (!group->queried[last]) continue;
+        group->queried[last] = 0;
+        if (field_query_result(group->draw_queries[last], &samples))
+        {
+            group->visible = samples > 0;
+            fragments += samples;
+        }
+        else
+        {
+            group->visible = 1;
+            counted = 0;
+        }
+    }
+    // Last frame goes into the report only as a whole: its fragments, groups and box tests together,
+    // and not at all if one of its results was late (then its fragments are only part of the picture).
+    if (field_frame > 0 && counted)
+    {
+        field_fragments += fragments;
+        field_visible_groups += field_drawn_groups;
+        field_box_tests += field_drawn_box_tests;
+        field_frames++;
+    }
+    field_drawn_groups = field_drawn_box_tests = 0;
+
+    // 2. (--prepass) The depth of the visible ones.
+    if (field_prepass)
+    {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (g = 0; g < field_group_count; g++)
+            if (field_groups[g].visible) draw_field_group(&field_groups[g]);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LEQUAL);
+    }
+
+    // 3. The visible ones, front to back, each counted for next frame.
+    for (g = 0; g < field_group_count; g++)
+    {
+        FieldGroup *group = &field_groups[g];
+        if (!group->visible) continue;
+        glBeginQuery(GL_SAMPLES_PASSED, group->draw_queries[now]);
+        draw_field_group(group);
+        glEndQuery(GL_SAMPLES_PASSED);
+        group->queried[now] = 1;
+        field_drawn_groups++;
+    }
+
+    // 4. The boxes of the hidden ones against all that (plain glBegin, so no program)...
+    glUseProgram(0);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    for (g = 0; g < field_group_count; g++)
+    {
+        FieldGroup *group = &field_groups[g];
+        if (group->visible) continue;
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, group->box_query);
+        draw_box(group->min, group->max);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        field_drawn_box_tests++;
+    }
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // 5. ...and the groups themselves, only if their box got through (decided on the GPU).
+    glUseProgram(instance_program);
+    for (g = 0; g < field_group_count; g++)
+    {
+        FieldGroup *group = &field_groups[g];
+        if (group->visible) continue;
+        glBeginConditionalRender(group->box_query, GL_QUERY_NO_WAIT);
+        glBeginQuery(GL_SAMPLES_PASSED, group->draw_queries[now]);
+        draw_field_group(group);
+        glEndQuery(GL_SAMPLES_PASSED);
+        glEndConditionalRender();
+        group->queried[now] = 1;
+    }
+    glDepthFunc(GL_LESS);
+}
+
+void draw_cube_field(float angle)
+{
+    GLintptr offset = 0;
+    if (instance_matrix_stream.memory)
+    {
+        // The new matrices go straight into this frame's region of the mapped buffer, the GPU
+        // reads them from there (it may still be drawing from the other two regions meanwhile).
+        update_instance_matrices((mat4 *)stream_alloc(&instance_matrix_stream, sizeof(mat4) * instance_count, sizeof(mat4), &offset), angle);
+    }
+    else
+    {
+        // Hands the new matrices to OpenGL. Giving glBufferData a NULL pointer first "orphans" the old
+        // storage: the GPU may still be drawing last frame from it, so instead of waiting we get fresh memory.
+        update_instance_matrices(instance_matrices, angle);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_matrix_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(mat4) * instance_count, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(mat4) * instance_count, instance_matrices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // All the cubes, one call (or one per group with --occlusion, see the note on hidden cubes).
+    glUseProgram(instance_program);
+    glUniformMatrix4fv(instance_view_projection, 1, GL_FALSE, cube_projection.m); // The camera, once per frame
+    glBindVertexArray(instance_vao);
+    if (instance_matrix_stream.memory) point_instance_matrices(offset);
+    if (field_occlusion) draw_field_groups();
+    else
+    {
+        GLuint query = field_fragment_queries[field_frame & 1];
+        collect_field_fragments();
+        if (field_prepass)
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDrawElementsInstanced(GL_TRIANGLES, cube_index_count, cube_index_type, (const void *)0, instance_count);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL); // (the very same depth again passes)
+        }
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+        glDrawElementsInstanced(GL_TRIANGLES, cube_index_count, cube_index_type, (const void *)0, instance_count);
+        glEndQuery(GL_SAMPLES_PASSED);
+        field_fragment_queried[field_frame & 1] = 1;
+        glDepthFunc(GL_LESS);
+    }
+    field_frame++;
+    glBindVertexArray(0);
+    glUseProgram(0);
+    stream_end_frame(&instance_matrix_stream); // (a fence behind this frame's draws)
+    gl_state_invalidate(); // (the vertex attributes may have changed the current color too)
+}
+
+void report(FILE *out)
+{
+    // Fragments shaded per frame since the last report (see AppCallbacks in common/app.h).
+    if (field_frames == 0) return;
+    fprintf(out, "fragments: %.0f shaded per frame (%.2f per pixel)%s", (double)field_fragments / field_frames,
+            (double)field_fragments / field_frames / ((double)app.width * app.height), field_prepass ? ", after a depth pre-pass" : "");
+    if (field_occlusion)
+        fprintf(out, " | groups: %.1f of %d visible, %.1f box tests per frame", (double)field_visible_groups / field_frames,
+                field_group_count, (double)field_box_tests / field_frames);
+    fprintf(out, " | %llu late results\n", (unsigned long long)field_late);
+    stream_report(&instance_matrix_stream, out, "matrix stream");
+    field_fragments = field_visible_groups = field_box_tests = field_late = 0;
+    field_frames = 0;
+    instance_matrix_stream.frames = instance_matrix_stream.bytes = 0;
+}
 
 void display()
 {
@@ -169,7 +961,22 @@ void display()
     // subsequent drawing operations unless explicitly changed again. If no new color is set, 
     // shapes will be drawn using the last specified color or the default color.
 
-    glTranslatef(0,0,-9); // Parameters: (x,y,z)
+    // With the game loop (--loop) we draw between the last two update() steps, otherwise
+    // loop_alpha is 1 and this is simply g_angle.
+    float angle = loop_lerp_degrees(prev_g_angle, g_angle);
+
+    if (cube_mode == CUBE_MODE_INSTANCED)
+    {
+        // A whole field of cubes, each one with its own matrix (see draw_cube_field()),
+        // so the single cube's glTranslatef/glRotatef below don't apply.
+        profile_gpu_begin("cube field"); // (--profile: how long the GPU takes to draw it, see common/profile.h)
+        draw_cube_field(angle);
+        profile_gpu_end();
+        app_swap_buffers();
+        return;
+    }
+
+    //glTranslatef(0,0,-9); // Parameters: (x,y,z) (now part of cube_model_view(), see below)
 
     // - Not visible at z = 0 because thats behind the Near clipping plane as defined in glBegin()
     // - Note: We have set the zNear plane to 2 in the reshape callback function,
@@ -194,6 +1001,7 @@ void display()
     // Therefore, glRotatef(45, 1, 0, 0) is equivalent to glRotatef(45, 2, 0, 0)
     // as both represent the x-axis direction.
 
+    /* The spin used to be 7 rotations in a row:
     glRotatef(g_angle, 0, 1, 1);
     glRotatef(g_angle, 1, 1, 0);
     glRotatef(g_angle, 0, 1, 0);
@@ -201,53 +1009,18 @@ void display()
     glRotatef(g_angle, 1, 1, 1);
     glRotatef(g_angle, 1, 0, 0);
     glRotatef(g_angle, 0, 0, 1);
+    */
+    // Every glRotatef is a full 4x4 matrix multiply inside the driver. The exact same rotations
+    // combined as quaternions on our side (common/vmath.h) are much cheaper, and the result
+    // (together with the glTranslatef above) goes to OpenGL with ONE glLoadMatrixf call.
+    glLoadMatrixf(cube_model_view(angle).m);
 
 
-    glBegin(GL_QUADS); // To make a cube use GL_Quads
-    // Note: the front, right, and top faces must be defined in a counterclockwise order.
-    //       while the back, left, and bottom faces must be defined in a clockwise order.
-        // Front
-        glColor3f(0.8,0.2,0.6);
-        glVertex3f(-2, 2, 0);
-        glVertex3f(-2, -2, 0);
-        glVertex3f(2, -2, 0);
-        glVertex3f(2, 2, 0);
-
-        // Back
-        glColor3f(0.8,0.7,0.2);
-        glVertex3f(-2, 2, -4);
-        glVertex3f(2, 2, -4);
-        glVertex3f(2, -2, -4);
-        glVertex3f(-2, -2, -4);
-
-        // Top
-        glColor3f(0.3,0.8,0.2);
-        glVertex3f(-2, 2, -4);
-        glVertex3f(-2, 2, 0);
-        glVertex3f(2, 2, 0);
-        glVertex3f(2, 2, -4);
-
-        // Bottom
-        glColor3f(0.4,0.8,0.5);
-        glVertex3f(-2, -2, -4);
-        glVertex3f(2, -2, -4);
-        glVertex3f(2, -2, 0);
-        glVertex3f(-2, -2, 0);
-
-        // Right
-        glColor3f(0.4,0.5,0.8);
-        glVertex3f(2, 2, 0);
-        glVertex3f(2, -2, 0);
-        glVertex3f(2, -2, -4);
-        glVertex3f(2, 2, -4);
-
-        // Left
-        glColor3f(0.5,0.3,0.7);
-        glVertex3f(-2, 2, 0);
-        glVertex3f(-2, 2, -4);
-        glVertex3f(-2, -2, -4);
-        glVertex3f(-2, -2, 0);
-    glEnd();
+    // Draws the cube (the same cube either way, see draw_cube_immediate() and draw_cube_vbo()).
+    profile_gpu_begin("cube");
+    if (cube_mode == CUBE_MODE_VBO) draw_cube_vbo();
+    else draw_cube_immediate();
+    profile_gpu_end();
 /*
     // Not my so not very good cube:
     glColor3f(1.0,0.0,0.0);
@@ -294,7 +1067,8 @@ void display()
     //       mode during initialization, clear the depth buffer to ensure proper rendering order,
     //       and include
 
-    glutSwapBuffers(); // Swaps the buffers, and automatically does the buffer flush.
+    app_swap_buffers(); // Swaps the buffers, and automatically does the buffer flush.
+    // (In headless mode there are no buffers to swap, it waits for the frame to finish instead.)
 
 }
 
@@ -302,6 +1076,7 @@ void reshape(int width, int height)
 {
     // This function is called when the window is resized.
     // It adjusts the viewport and projection matrix to match the new window size.
+    double aspect = (double)width / (height > 0 ? height : 1); // (the window's width/height, see 2. below)
 
     glViewport(0, 0, (GLsizei)width, (GLsizei)height); // Sets up the viewport ie 
     // (where the rendered image is displayed).
@@ -318,7 +1093,8 @@ void reshape(int width, int height)
     glMatrixMode(GL_PROJECTION); // Sets the current matrix mode to projection
     glLoadIdentity(); // Resets parameters of the projection matrix
 
-    gluPerspective(60.0, 1.0, 2.0, 50.0); // Sets up the perspective projection matrix which
+    gluPerspective(60.0, aspect, 2.0, 50.0); // Sets up the perspective projection matrix which
+    cube_projection = mat4_perspective(60.0, aspect, 2.0, 50.0); // (the very same matrix, for our shaders)
     // defines how 3D objects are projected onto a 2D screen.
     // Basically make the view frustum (explained in the top section under header files)
     // ie configures projection mode to perspective projection.
@@ -364,6 +1140,31 @@ void reshape(int width, int height)
     // not the camera's perspective.
 }
 
+void update()
+{
+    // One step of the animation, spins the cube a little further.
+    // Kept apart from timer() so the very same step can also be driven without GLUT's timer
+    // (ie by the headless benchmark in common/app.h).
+
+    prev_g_angle = g_angle; // Remembers where we were (for the interpolation in display())
+
+    if (g_angle > 360) g_angle = g_angle - 360;
+    g_angle += 0.8;
+}
+
+void keyboard(unsigned char key, int x, int y)
+{
+    // 'm' cycles through immediate mode, the VBO and the instanced field (to compare them while running).
+    // (The software rasterizer and --trace-record only know the immediate mode calls, so it stays there.)
+    if (key == 'm' && have_cube_buffers() && !app_immediate_only())
+    {
+        cube_mode = (cube_mode + 1) % (instance_program ? 3 : 2);
+        // (only our own cube has an immediate mode)
+        if (scene_path && cube_mode == CUBE_MODE_IMMEDIATE) cube_mode = CUBE_MODE_VBO;
+        printf("cube mode: %s\n", cube_mode_names[cube_mode]);
+    }
+}
+
 void timer(int i)
 {
     // This is basically a loop function that is needed for the animation.
@@ -377,10 +1178,7 @@ void timer(int i)
     // approximately 1/60th of a second (assuming a 60 frames per second refresh rate).
     // We wont be needing to use the 3rd paramater (explained in main).
 
-    if (g_angle > 360) g_angle = g_angle - 360;
-    g_angle += 0.8;
-
-
+    app_call("update", update); // Advances the animation by one step (timed with --profile, see common/app.h).
 }
 
 
@@ -397,12 +1195,123 @@ void init()
     // It determines which objects should be visible based on their distance from the viewer.
     // Note: For efficieny, objects that are behind other objects ie wont be seen or not fully
     //       are either not rendered or clipped.
+
+    if (have_cube_buffers() && app.backend == APP_BACKEND_GL) init_cube_buffers(); // Uploads the cube for the VBO mode
+    else if (scene_path)
+    {
+        fprintf(stderr, "--scene needs OpenGL 3.0\n");
+        exit(1);
+    }
+    else if (cube_mode != CUBE_MODE_IMMEDIATE)
+    {
+        printf("%s mode needs OpenGL 3.0, falling back to immediate mode\n", cube_mode_names[cube_mode]);
+        cube_mode = CUBE_MODE_IMMEDIATE;
+    }
+    if (cube_mode == CUBE_MODE_INSTANCED)
+    {
+        if (!GLEXT_HAVE(glDrawElementsInstanced) || !GLEXT_HAVE(glVertexAttribDivisor))
+        {
+            fprintf(stderr, "instanced mode needs OpenGL 3.3\n");
+            exit(1);
+        }
+        if (field_occlusion && (!GLEXT_HAVE(glDrawElementsInstancedBaseInstance) || !GLEXT_HAVE(glBeginConditionalRender)))
+        {
+            fprintf(stderr, "--occlusion needs OpenGL 4.2\n");
+            exit(1);
+        }
+        init_cube_field(); // Creates the cubes + the shader that draws them
+    }
 }
 
+int parse_cube_args(int argc, char **argv, int i)
+{
+    // Our own command line options (see app_parse_args in common/app.h):
+    //   --mode immediate|vbo|instanced
+    //   --instances N     how many cubes the instanced mode draws (default 10000)
+    //   --scene FILE      draws a mesh from a mesh file, or an .obj or .ply model, instead of our
+    //                     cube (vbo and instanced modes)
+    //   --mesh NAME       which mesh of a mesh file (default "cube")
+    //   --optimize        reorders an .obj or .ply model for the vertex cache and less overdraw
+    //   --cube-scale F    how much of its cell each cube of the field fills (default 0.3)
+    //   --prepass         draws the field into the depth buffer first (see the note on hidden cubes)
+    //   --occlusion       skips the hidden groups of cubes with occlusion queries
+    int mode;
+    if (strcmp(argv[i], "--optimize") == 0) { scene_optimize = 1; return 1; }
+    if (strcmp(argv[i], "--prepass") == 0) { field_prepass = 1; return 1; }
+    if (strcmp(argv[i], "--occlusion") == 0) { field_occlusion = 1; return 1; }
+    if (i + 1 >= argc) return 0;
+    if (strcmp(argv[i], "--mode") == 0)
+    {
+        for (mode = 0; mode < 3; mode++)
+            if (strcmp(argv[i + 1], cube_mode_names[mode]) == 0) break;
+        if (mode == 3)
+        {
+            fprintf(stderr, "unknown --mode '%s' (immediate, vbo or instanced)\n", argv[i + 1]);
+            exit(1);
+        }
+        cube_mode = mode;
+        return 2;
+    }
+    if (strcmp(argv[i], "--instances") == 0)
+    {
+        instance_count = atoi(argv[i + 1]);
+        if (instance_count <= 0)
+        {
+            fprintf(stderr, "--instances must be > 0\n");
+            exit(1);
+        }
+        return 2;
+    }
+    if (strcmp(argv[i], "--cube-scale") == 0)
+    {
+        field_cube_scale = (float)atof(argv[i + 1]);
+        if (field_cube_scale <= 0 || field_cube_scale > 1)
+        {
+            fprintf(stderr, "--cube-scale must be > 0 and at most 1\n");
+            exit(1);
+        }
+        return 2;
+    }
+    if (strcmp(argv[i], "--scene") == 0) { scene_path = argv[i + 1]; return 2; }
+    if (strcmp(argv[i], "--mesh") == 0) { scene_mesh_name = argv[i + 1]; return 2; }
+    return 0;
+}
+
+char cube_report_name[64];
+
 int main(int argc, char** argv)
 {
+    AppCallbacks callbacks = { "Cube", init, reshape, update, display, report }; // The same callbacks GLUT gets below
+
+    if (!app_parse_args(&argc, argv, parse_cube_args)) return 1; // Reads our own options (--headless, --size, ...)
+    if (app_immediate_only() && cube_mode != CUBE_MODE_IMMEDIATE)
+    {
+        fprintf(stderr, "--backend sw and core (and --trace-record) only draw the immediate mode cube\n");
+        return 1;
+    }
+    if (scene_path && cube_mode == CUBE_MODE_IMMEDIATE)
+    {
+        fprintf(stderr, "--scene draws from buffers: use it with --mode vbo or instanced\n");
+        return 1;
+    }
+    if (scene_optimize && !scene_is_model())
+    {
+        fprintf(stderr, "--optimize works on --scene model.obj/.ply (mesh files: tools/mesh_convert --optimize)\n");
+        return 1;
+    }
+    if ((field_prepass || field_occlusion || field_cube_scale != 0.3f) && cube_mode != CUBE_MODE_INSTANCED)
+    {
+        fprintf(stderr, "--prepass, --occlusion and --cube-scale are for the field: use them with --mode instanced\n");
+        return 1;
+    }
+    snprintf(cube_report_name, sizeof(cube_report_name), "Cube %s", cube_mode_names[cube_mode]); // (for the report)
+    if (cube_mode == CUBE_MODE_INSTANCED)
+        snprintf(cube_report_name, sizeof(cube_report_name), "Cube instanced x%d", instance_count);
+    callbacks.name = cube_report_name;
+    if (app.headless) return app_run_headless(&callbacks); // No window at all: benchmark N frames and exit
 
     glutInit(&argc, argv); // Initializes the GLUT library and processes any command line arguments.
+    app_init_context(); // (--backend core asks for a core profile context, see common/app.h)
 
     // To execute SINGLE BUFFER version of code (just drawing shapes) remove "GLUT_DOUBLE" below.
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
@@ -411,20 +1320,25 @@ int main(int argc, char** argv)
     // ALSO to Depth Buffering mode (for 3D shapes, needed for depth testing).
 
     glutInitWindowPosition(500, 200); // Sets the initial position of the window (in pixels).
-    glutInitWindowSize(500, 500); // Sets the initial size of the window (in pixels).
+    glutInitWindowSize(app.width, app.height); // Sets the initial size of the window (in pixels).
+    // (500x500 unless another size was given with --size WxH)
     // Note: this makes the window size to be 500 pixels wide and 500 pixels long, ie it will contain
     // 500*500 = 250,000 pixels in total (ie will cover 250,000 pixels of the screen).
     // If we draw a square that starts at let's say x = -10 to x = 0 and y = 0 to y = 4,
     // it will be 10 pixels wide and 4 pixels long ie will contain 10*4 = 40 pixels in total.
 
     glutCreateWindow("Daldezo's Cube"); // Creates a window with the given title.
+    app_load_extensions(); // Loads the newer OpenGL functions (VBOs) now that we have a context.
 
     // Callback functions are functions that are passed as arguments to other functions
     // Note: functions are reduced to pointers after being passed as arguments in some function.
 
     glutDisplayFunc(display); // Registers the display callback function.
     glutReshapeFunc(reshape); // Registers the reshape callback function.
-    glutTimerFunc(0, timer, 0); // Registers the timer callback function.
+    app_profile_callbacks(&callbacks); // --profile: times display/reshape (common/profile.h)
+    glutKeyboardFunc(keyboard); // Registers the keyboard callback function.
+    if (app.loop) app_start_loop(&callbacks); // --loop: a fixed-timestep game loop animates instead (common/loop.h)
+    else glutTimerFunc(0, timer, 0); // Registers the timer callback function.
     // Takes three arguments: 
     // 1. unsigned int millisec (time interval for callback function to be called, in milliseconds),
     // 2. pointer to the callback function,
@@ -433,7 +1347,7 @@ int main(int argc, char** argv)
     // second you add 1 and print to the screen).
 
 
-    init(); // Calls the initialization function to set up OpenGL state.
+    app_call("init", init); // Calls the initialization function to set up OpenGL state.
 
     glutMainLoop(); // Enters the GLUT event processing loop.
     return 0;
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GL/glut.h> // Including OpenGL GLUT library
+#include "common/app.h" // Command line options + headless (no window) benchmark mode
+#include "common/stream.h" // Persistently mapped buffers (the picture goes to OpenGL through one)
+#include "common/raycast.h" // The raycaster itself (grid, DDA, drawing the columns)
+
+/*
+- ***** A Note on Drawing Without Triangles *****
+  The other tutorials hand OpenGL shapes and let it work out the pixels. This one works out
+  every pixel itself, on the CPU, the way games did before there were 3D cards (see the notes in
+  common/raycast.h), and OpenGL only gets to SHOW the finished picture:
+  1. Every frame the picture is drawn into memory, column by column, on the worker threads
+     (--workers N, common/jobs.h: each one gets its own chunk of columns).
+  2. That memory becomes a texture (glTexSubImage2D).
+  3. ONE rectangle covering the whole window is drawn with that texture on it.
+  The picture is column-major (every column one after the other), which is what makes step 1
+  fast. A texture is row-major, so to OpenGL our picture looks like an image lying on its side:
+  height texels wide and width texels high. Instead of turning it around on the CPU (touching
+  every pixel once more) the rectangle's texture coordinates are simply swapped: the texture's
+  rows go along the screen's x, its columns along y, and the GPU does the turning while drawing.
+
+  The memory of step 1 is a persistently mapped pixel buffer (common/stream.h, with
+  GL_PIXEL_UNPACK_BUFFER): the threads draw right into memory the driver can copy the texture
+  from, no extra copy of our own. Without OpenGL 4.4 (or with --stream orphan) it's plain memory
+  and glTexSubImage2D copies it.
+
+  Keys (in the window): the arrow keys walk around (the camera flies by itself until then).
+  Options:
+    --map-scale N   a map N times as wide and tall (the same rooms again and again: longer rays)
+*/
+
+// The map: '.' is empty, a digit a wall and which texture it has (see raycast_make_textures()).
+// The first row is the top (north) of the map. The middle of the map is a hall with a pillar,
+// which the camera circles.
+const char *map_rows[] =
+{
+    "111111111111111111111111",
+    "1.....2.......3........1",
+    "1.....2.......3..3333..1",
+    "1..2222.......3..3..3..1",
+    "1.............3.....3..1",
+    "1......................1",
+    "1...4..............4...1",
+    "1......................1",
+    "1......................1",
+    "12222..............22221",
+    "1......................1",
+    "1..........44..........1",
+    "1..........44..........1",
+    "1......................1",
+    "13333..............33331",
+    "1......................1",
+    "1......................1",
+    "1...4..............4...1",
+    "1......................1",
+    "1..2.2.2..........1.1..1",
+    "1..........3...........1",
+    "1...22222..3..4444.....1",
+    "1..........3...........1",
+    "111111111111111111111111",
+};
+#define MAP_HEIGHT ((int)(sizeof(map_rows) / sizeof(map_rows[0])))
+#define CIRCLE_RADIUS 4.5f   // of the camera's path around the hall's pillar
+#define COLUMN_CHUNK 64      // columns per job (a multiple of 8, so the SIMD casting never splits)
+
+RaycastMap map;
+RaycastFrame frame;
+int map_scale = 1;
+
+// The camera: it flies around the hall (angle grows every update()) until an arrow key is pressed.
+int autopilot = 1;
+float angle = 0, prev_angle = 0;   // where it is on the circle (radians)
+float player_x, player_y, player_turn;             // (after an arrow key: where we are, where we look)
+float prev_player_x, prev_player_y, prev_player_turn;
+
+GLuint picture_texture = 0;
+StreamBuffer picture_stream;       // (region_size 0 = no persistent mapping, picture_memory is used)
+uint32_t *picture_memory = NULL;
+int picture_capacity = 0;          // pixels that fit in picture_memory / a stream region (width * stride)
+
+JobBatch picture_jobs;
+long frames_drawn = 0;             // since the last report
+long rays_cast = 0, cells_walked = 0;
+uint64_t cast_ns = 0, upload_ns = 0;
+
+void set_camera(RaycastCamera *camera)
+{
+    // Where the camera is for this frame (between the last two update() steps with --loop).
+    float plane = 0.5f * frame.width / (frame.height > 0 ? frame.height : 1);
+    float look;
+    if (autopilot)
+    {
+        float a = loop_lerp(prev_angle, angle);
+        float center = 12.0f * map_scale;
+        camera->x = center + CIRCLE_RADIUS * cosf(a);
+        camera->y = center + CIRCLE_RADIUS * sinf(a);
+        look = a + 1.5708f + 0.5f * sinf(a * 3); // along the circle, looking left and right a bit
+    }
+    else
+    {
+        camera->x = loop_lerp(prev_player_x, player_x);
+        camera->y = loop_lerp(prev_player_y, player_y);
+        look = loop_lerp(prev_player_turn, player_turn);
+    }
+    camera->dir_x = cosf(look);
+    camera->dir_y = sinf(look);
+    // A wall 1 unit tall at distance 1 is as tall as the window, so the window's height spans 1
+    // unit there (0.5 up, 0.5 down), and its width width/height units: that's the plane's length.
+    camera->plane_x = camera->dir_y * plane;
+    camera->plane_y = -camera->dir_x * plane;
+}
+
+void draw_columns(void *camera, int first, int last)
+{
+    // (one job: runs on a worker thread, or right here without --workers)
+    raycast_cast_simd(&frame, &map, (const RaycastCamera *)camera, first, last);
+    raycast_draw_columns(&frame, (const RaycastCamera *)camera, first, last);
+}
+
+uint32_t *picture_pixels(GLintptr *offset)
+{
+    // Where this frame's picture goes: the next piece of the stream buffer, or plain memory.
+    *offset = 0;
+    if (picture_stream.memory) return (uint32_t *)stream_alloc(&picture_stream, frame.width * frame.stride * 4, 64, offset);
+    return picture_memory;
+}
+
+void report(FILE *out)
+{
+    // How long the CPU took for the picture, and OpenGL to take it (see AppCallbacks in common/app.h).
+    if (frames_drawn == 0) return;
+    fprintf(out, "raycaster: %dx%d, %d workers (%s) | cast + draw %.3f ms | upload %.3f ms | %.1f cells per ray | %.2f G pixels/s\n",
+            frame.width, frame.height, app.workers, RAYCAST_SIMD_NAME, cast_ns / 1e6 / frames_drawn, upload_ns / 1e6 / frames_drawn,
+            (double)cells_walked / rays_cast, (double)frames_drawn * frame.width * frame.height / cast_ns);
+    stream_report(&picture_stream, out, "picture stream");
+    frames_drawn = 0;
+    rays_cast = cells_walked = 0;
+    cast_ns = upload_ns = 0;
+    picture_stream.frames = picture_stream.bytes = 0;
+}
+
+void display()
+{
+    // This function is the display callback, called whenever the window needs to be redrawn.
+    // No glClear(): the picture covers every pixel of the window anyway.
+    RaycastCamera camera;
+    GLintptr offset;
+    uint64_t start = clock_now_ns(), cast_done;
+    int c;
+
+    set_camera(&camera);
+    frame.pixels = picture_pixels(&offset);
+    raycast_setup_rays(&frame, &camera);
+    profile_cpu_begin("cast + draw"); // (--profile, see common/profile.h)
+    jobs_parallel_for(&app_jobs, &picture_jobs, draw_columns, &camera, frame.columns, COLUMN_CHUNK);
+    jobs_wait(&app_jobs, &picture_jobs);
+    profile_cpu_end();
+    cast_done = clock_now_ns();
+    for (c = 0; c < frame.width; c++) cells_walked += frame.steps[c];
+    rays_cast += frame.width;
+
+    // The picture into the texture. From the pixel buffer the "pointer" is an offset into it.
+    profile_gpu_begin("picture");
+    glBindTexture(GL_TEXTURE_2D, picture_texture);
+    if (picture_stream.memory) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, picture_stream.buffer);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, frame.stride); // (a column is stride pixels long, height of them are used)
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.height, frame.width, GL_RGBA, GL_UNSIGNED_BYTE,
+                    picture_stream.memory ? (const void *)offset : (const void *)frame.pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (picture_stream.memory) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // The rectangle: texture s runs along the screen's y, t along x (see the note at the top).
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_QUADS);
+        glTexCoord2f(0, 0); glVertex2f(0, 0);
+        glTexCoord2f(0, 1); glVertex2f(1, 0);
+        glTexCoord2f(1, 1); glVertex2f(1, 1);
+        glTexCoord2f(1, 0); glVertex2f(0, 1);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+    profile_gpu_end();
+    stream_end_frame(&picture_stream); // (a fence: the next frames draw into the other regions meanwhile)
+
+    cast_ns += cast_done - start;
+    upload_ns += clock_now_ns() - cast_done;
+    frames_drawn++;
+
+    app_swap_buffers(); // Swaps the buffers, and automatically does the buffer flush.
+}
+
+void reshape(int width, int height)
+{
+    // This function is called when the window is resized.
+    // The picture is drawn at the window's size, so everything sized by it is made anew.
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+    glViewport(0, 0, (GLsizei)width, (GLsizei)height); // Sets up the viewport
+
+    glMatrixMode(GL_PROJECTION); // Sets the current matrix mode to projection
+    glLoadIdentity();
+    gluOrtho2D(0, 1, 0, 1); // (0, 0) the bottom left corner of the window, (1, 1) the top right one
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    raycast_frame_resize(&frame, width, height);
+    if (width * frame.stride > picture_capacity)
+    {
+        // A bigger picture than ever before: a bigger buffer (3 regions of it, see common/stream.h).
+        picture_capacity = width * frame.stride;
+        stream_shutdown(&picture_stream);
+        if (!app.streaming || !stream_init(&picture_stream, GL_PIXEL_UNPACK_BUFFER, picture_capacity * 4 + 64))
+        {
+            free(picture_memory);
+            picture_memory = (uint32_t *)malloc(sizeof(uint32_t) * picture_capacity);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // The texture, lying on its side: height texels wide, width texels high.
+    glBindTexture(GL_TEXTURE_2D, picture_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, height, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+void move_player(float distance)
+{
+    // Walks along where we look, but not into a wall (each axis on its own: we slide along walls).
+    float x = player_x + cosf(player_turn) * distance, y = player_y + sinf(player_turn) * distance;
+    if (raycast_map_empty(&map, x, player_y)) player_x = x;
+    if (raycast_map_empty(&map, player_x, y)) player_y = y;
+}
+
+void special(int key, int x, int y)
+{
+    // The arrow keys: up/down walk, left/right turn. The first one takes over from the autopilot,
+    // starting where it was.
+    if (key != GLUT_KEY_UP && key != GLUT_KEY_DOWN && key != GLUT_KEY_LEFT && key != GLUT_KEY_RIGHT) return;
+    if (autopilot)
+    {
+        RaycastCamera camera;
+        set_camera(&camera);
+        player_x = prev_player_x = camera.x;
+        player_y = prev_player_y = camera.y;
+        player_turn = prev_player_turn = atan2f(camera.dir_y, camera.dir_x);
+        autopilot = 0;
+    }
+    if (key == GLUT_KEY_UP) move_player(0.15f);
+    if (key == GLUT_KEY_DOWN) move_player(-0.15f);
+    if (key == GLUT_KEY_LEFT) player_turn += 0.06f;
+    if (key == GLUT_KEY_RIGHT) player_turn -= 0.06f;
+}
+
+void update()
+{
+    // One step of the animation: the autopilot moves on along its circle.
+    // (The arrow keys move the player right when they're pressed, see special().)
+    prev_angle = angle;
+    prev_player_x = player_x;
+    prev_player_y = player_y;
+    prev_player_turn = player_turn;
+    if (autopilot) angle += 0.01f;
+}
+
+void timer(int i)
+{
+    // This is basically a loop function that is needed for the animation.
+    // It continuosly or periodically calls itself every 1/60th of a second
+    // ie 60 frames per seconds.
+
+    glutPostRedisplay(); // Signals the window to be redrawn in the next frame.
+    glutTimerFunc(1000/60, timer, 0); // Registers the timer again to call this function after
+    // approximately 1/60th of a second.
+
+    app_call("update", update); // Advances the animation by one step (timed with --profile, see common/app.h).
+}
+
+void init()
+{
+    // This function initializes OpenGL state: the texture the picture goes into.
+    glGenTextures(1, &picture_texture);
+    glBindTexture(GL_TEXTURE_2D, picture_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // (one texel per pixel, nothing
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); // to filter: unless --dynamic-res
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);       // shrinks the window's picture)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE); // (the texel as it is, no glColor)
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void init_map()
+{
+    // The map, map_scale times over in each direction. The copies' own border walls are left out
+    // (raycast_map_load() puts one around the whole map), so the rays see far into the others.
+    const char **rows = (const char **)malloc(sizeof(char *) * MAP_HEIGHT * map_scale);
+    int width = (int)strlen(map_rows[0]), x, y;
+    for (y = 0; y < MAP_HEIGHT * map_scale; y++)
+    {
+        char *row = (char *)malloc(width * map_scale + 1);
+        for (x = 0; x < width * map_scale; x++)
+        {
+            int in_x = x % width, in_y = y % MAP_HEIGHT;
+            int border = in_x == 0 || in_y == 0 || in_x == width - 1 || in_y == MAP_HEIGHT - 1;
+            row[x] = border && map_scale > 1 ? '.' : map_rows[in_y][in_x];
+        }
+        row[width * map_scale] = 0;
+        rows[y] = row;
+    }
+    raycast_map_load(&map, rows, MAP_HEIGHT * map_scale);
+    for (y = 0; y < MAP_HEIGHT * map_scale; y++) free((char *)rows[y]);
+    free(rows);
+
+    raycast_make_textures(&frame);
+    frame.ceiling = raycast_rgb(60, 60, 70);
+    frame.floor = raycast_rgb(100, 90, 80);
+}
+
+int parse_raycaster_args(int argc, char **argv, int i)
+{
+    // Our own command line options (see app_parse_args in common/app.h):
+    //   --map-scale N    (odd, so there's a middle copy of the map for the camera to circle in)
+    if (i + 1 >= argc) return 0;
+    if (strcmp(argv[i], "--map-scale") == 0)
+    {
+        map_scale = atoi(argv[i + 1]);
+        if (map_scale < 1 || map_scale % 2 == 0)
+        {
+            fprintf(stderr, "--map-scale must be odd and >= 1\n");
+            exit(1);
+        }
+        return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    AppCallbacks callbacks = { "Raycaster", init, reshape, update, display, report }; // The same callbacks GLUT gets below
+
+    if (!app_parse_args(&argc, argv, parse_raycaster_args)) return 1; // Reads our own options (--headless, --size, ...)
+    if (app_immediate_only())
+    {
+        // The picture goes to OpenGL as a texture, which the dispatch table doesn't have.
+        fprintf(stderr, "the raycaster needs --backend gl (its picture is a texture), and can't be traced\n");
+        return 1;
+    }
+    init_map();
+    if (app.headless) return app_run_headless(&callbacks); // No window at all: benchmark N frames and exit
+
+    glutInit(&argc, argv); // Initializes the GLUT library and processes any command line arguments.
+    app_init_context();
+    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE); // RGB colors, double buffering (see the 2D tutorial)
+    glutInitWindowPosition(0, 0);
+    glutInitWindowSize(app.width, app.height); // (500x500 unless another size was given with --size WxH)
+    glutCreateWindow("Daldezo's Raycaster");
+    app_load_extensions(); // Loads the newer OpenGL functions (the pixel buffer) now that we have a context.
+
+    glutDisplayFunc(display); // Registers the display callback function.
+    glutReshapeFunc(reshape); // Registers the reshape callback function.
+    glutSpecialFunc(special); // Registers the callback of the keys without a character (arrows, F1, ...).
+    app_profile_callbacks(&callbacks); // --profile: times display/reshape (common/profile.h)
+    if (app.loop) app_start_loop(&callbacks); // --loop: a fixed-timestep game loop animates instead (common/loop.h)
+    else glutTimerFunc(0, timer, 0); // Registers the timer callback function.
+
+    app_call("init", init); // Calls the initialization function to set up OpenGL state.
+
+    glutMainLoop(); // Enters the GLUT event processing loop.
+    return 0;
+}
@@ -0,0 +1,642 @@
+#ifndef COMMON_APP_H
+#define COMMON_APP_H
+
+/*
+- ***** A Note on the App Layer *****
+  Every tutorial is built the same way: an init() that sets up OpenGL, a reshape() for the
+  window size, a timer() that moves things around and a display() that draws them.
+  GLUT calls these for us while the window is open.
+
+  This file lets the very same callbacks run in a second way: "headless", with no window,
+  as fast as possible for a fixed number of frames while timing every single frame.
+  That is how we benchmark the demos on machines with no display.
+  It can also replace the timer with a fixed-timestep game loop (see common/loop.h), and
+  send the drawing calls to our own software rasterizer instead of OpenGL (see common/swr.h)
+  or to our own shaders in a core profile context (see common/glcore.h),
+  and record every frame to disk without slowing the demo down (see common/capture.h).
+  With --profile every callback is timed, and the demos time their drawing on the GPU (common/profile.h).
+  The state calls (glColor3f, glMatrixMode, ...) that wouldn't change anything are dropped on the
+  way (common/gl_state.h). With --workers the demos move their things on a pool of worker threads
+  (common/jobs.h) while the GLUT thread draws. With --dynamic-res the scene is drawn at a lower
+  resolution whenever the GPU can't keep up, and stretched to the window (common/dynres.h).
+  With --trace-record every drawing call goes into a file that tools/trace_replay.c plays back
+  the same way on any machine (common/trace.h). --golden and --baseline compare the frames and
+  the frame time with stored ones, and fail the run when they changed (common/golden.h).
+
+  Command line options understood by every demo:
+    --headless         render offscreen instead of opening a window, print frame times and exit
+    --frames N         number of measured frames in headless mode (default 600)
+    --warmup N         frames rendered before measuring starts (default 30)
+    --size WxH         window/framebuffer size in pixels (default 500x500)
+    --loop             animate with the fixed-timestep loop instead of glutTimerFunc
+    --present P        loop present policy: vsync (default), uncapped or cap (implies --loop)
+    --fps-cap N        frame rate for --present cap (default 60, implies --present cap)
+    --tick-hz N        simulation steps per second of the loop (default 60)
+    --backend B        gl (default), sw: draw with the software rasterizer (common/swr.h)
+                       or core: draw with shaders in a core profile context (common/glcore.h)
+    --shader-cache F   where --backend core keeps its compiled program (default shader_cache.bin, off = none)
+    --stream S         how data that changes every frame is uploaded (--backend core's vertices, the
+                       sprite batch, the instanced cubes' matrices): persistent (default, mapped
+                       buffers, see common/stream.h) or orphan (glBufferData(NULL) + glBufferSubData)
+                       (the raycaster's picture: a mapped pixel buffer, or plain memory with orphan)
+    --threads N        threads of the software rasterizer (default: one per CPU core)
+    --capture PATH     record the frames: out.y4m, out.raw or a PNG pattern like frames/shot_%05d.png
+    --capture-ring N   frames in flight between drawing and writing to disk (default 4, max 16)
+    --profile PATH     time the callbacks (CPU) and draw sections (GPU), write histograms to PATH (.json or .csv)
+    --state-cache S    on (default) or off: drop redundant state changes (common/gl_state.h)
+    --workers N        worker threads for the demos' updates (common/jobs.h), 0 (default) = none
+    --dynamic-res MS   draw the scene at the resolution that keeps the frame time near MS
+    --min-scale F      lowest resolution scale --dynamic-res may pick (default 0.5)
+    --res-log          print the scale and time of every frame with --dynamic-res
+    --trace-record F   write every drawing call of every frame into the trace F
+    --golden DIR       compare a few frames with the golden images in DIR (headless, exit code 1 if not the same)
+    --golden-update    write the golden images into DIR instead
+    --golden-tolerance T  how far a channel may be off before the pixel differs (default 8)
+    --golden-pixels P  percent of the pixels that may differ (default 0.1)
+    --baseline FILE    fail if the median frame time is slower than the one in FILE (headless)
+    --baseline-update  write the median frame time into FILE instead
+    --max-regression P how much slower (percent) is still ok (default 25)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glut.h>
+#include <GL/freeglut_ext.h> // glutGetProcAddress()
+#include "clock.h"
+#include "bench.h"
+#include "headless.h"
+#include "loop.h"
+#include "gl_dispatch.h"
+#include "swr.h"
+#include "glcore.h"
+#include "capture.h"
+#include "profile.h"
+#include "gl_state.h"
+#include "jobs.h"
+#include "dynres.h"
+#include "trace.h"
+#include "golden.h"
+
+enum { APP_BACKEND_GL, APP_BACKEND_SW, APP_BACKEND_CORE };
+
+typedef struct AppOptions
+{
+    int headless;
+    int frames;
+    int warmup;
+    int width;
+    int height;
+    int loop;       // fixed-timestep loop instead of the GLUT timer
+    int present;    // PRESENT_* (common/loop.h)
+    double fps_cap;
+    double tick_hz;
+    int backend;    // APP_BACKEND_*
+    int threads;    // software rasterizer threads, 0 = one per core
+    const char *capture_path; // NULL = no capture
+    int capture_ring;
+    const char *profile_path; // NULL = no profiling
+    int state_cache;          // redundant state changes are dropped
+    int workers;              // job pool threads, 0 = updates run on the GLUT thread
+    const char *shader_cache; // program binary of --backend core, NULL = no cache
+    int streaming;            // per-frame data is written into persistently mapped buffers
+    double dynamic_res_ms;    // frame time --dynamic-res aims at, 0 = off
+    float min_scale;
+    int res_log;
+    const char *trace_path;   // --trace-record, NULL = no trace
+} AppOptions;
+
+static AppOptions app = { 0, 600, 30, 500, 500, 0, PRESENT_VSYNC, 60, 60, APP_BACKEND_GL, 0, NULL, 4, NULL, 1, 0, "shader_cache.bin", 1, 0, 0.5f, 0, NULL };
+static JobPool app_jobs; // (started by app_parse_args() with --workers N)
+
+typedef struct AppCallbacks
+{
+    const char *name;           // printed in the benchmark report
+    void (*init)(void);
+    void (*reshape)(int width, int height);
+    void (*update)(void);       // one animation step (what timer() does besides rescheduling itself)
+    void (*display)(void);
+    void (*report)(FILE *out); // optional: the demo's own statistics, printed after the frame times
+} AppCallbacks;
+
+// A demo can understand extra options. The handler returns how many arguments it used
+// starting at argv[i] (0 means "not mine").
+typedef int (*AppArgHandler)(int argc, char **argv, int i);
+
+static inline void app_usage(const char *program)
+{
+    fprintf(stderr,
+        "usage: %s [--headless] [--frames N] [--warmup N] [--size WxH]\n"
+        "          [--loop] [--present vsync|uncapped|cap] [--fps-cap N] [--tick-hz N]\n"
+        "          [--backend gl|sw|core] [--threads N] [--capture PATH] [--capture-ring N]\n"
+        "          [--profile out.json|out.csv] [--state-cache on|off] [--workers N]\n"
+        "          [--shader-cache FILE|off] [--stream persistent|orphan]\n"
+        "          [--dynamic-res MS] [--min-scale F] [--res-log] [--trace-record FILE]\n"
+        "          [--golden DIR] [--golden-update] [--golden-tolerance T] [--golden-pixels P]\n"
+        "          [--baseline FILE] [--baseline-update] [--max-regression P]\n", program);
+}
+
+static inline void app_trace_close(void)
+{
+    // (atexit handler for the windowed demos)
+    trace_close(stdout);
+}
+
+static inline int app_parse_args(int *argc, char **argv, AppArgHandler extra)
+{
+    // Reads our options and removes them from argv, so glutInit() only sees the ones meant for GLUT.
+    // Returns 0 if an option was malformed.
+    int i, kept = 1, used;
+    for (i = 1; i < *argc; i += used)
+    {
+        used = 1;
+        if (strcmp(argv[i], "--headless") == 0) app.headless = 1;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < *argc) { app.frames = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < *argc) { app.warmup = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < *argc)
+        {
+            if (sscanf(argv[i + 1], "%dx%d", &app.width, &app.height) != 2 || app.width <= 0 || app.height <= 0)
+            {
+                fprintf(stderr, "bad --size '%s', expected WxH\n", argv[i + 1]);
+                return 0;
+            }
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--loop") == 0) app.loop = 1;
+        else if (strcmp(argv[i], "--present") == 0 && i + 1 < *argc)
+        {
+            if (strcmp(argv[i + 1], "vsync") == 0) app.present = PRESENT_VSYNC;
+            else if (strcmp(argv[i + 1], "uncapped") == 0) app.present = PRESENT_UNCAPPED;
+            else if (strcmp(argv[i + 1], "cap") == 0) app.present = PRESENT_CAP;
+            else
+            {
+                fprintf(stderr, "bad --present '%s', expected vsync, uncapped or cap\n", argv[i + 1]);
+                return 0;
+            }
+            app.loop = 1;
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--fps-cap") == 0 && i + 1 < *argc)
+        {
+            app.fps_cap = atof(argv[i + 1]);
+            app.present = PRESENT_CAP;
+            app.loop = 1;
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--tick-hz") == 0 && i + 1 < *argc) { app.tick_hz = atof(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < *argc)
+        {
+            if (strcmp(argv[i + 1], "gl") == 0) app.backend = APP_BACKEND_GL;
+            else if (strcmp(argv[i + 1], "sw") == 0) app.backend = APP_BACKEND_SW;
+            else if (strcmp(argv[i + 1], "core") == 0) app.backend = APP_BACKEND_CORE;
+            else
+            {
+                fprintf(stderr, "bad --backend '%s', expected gl, sw or core\n", argv[i + 1]);
+                return 0;
+            }
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < *argc) { app.threads = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < *argc) { app.capture_path = argv[i + 1]; used = 2; }
+        else if (strcmp(argv[i], "--capture-ring") == 0 && i + 1 < *argc) { app.capture_ring = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < *argc) { app.profile_path = argv[i + 1]; used = 2; }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < *argc) { app.workers = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < *argc)
+        {
+            app.shader_cache = strcmp(argv[i + 1], "off") == 0 ? NULL : argv[i + 1];
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < *argc)
+        {
+            if (strcmp(argv[i + 1], "persistent") == 0) app.streaming = 1;
+            else if (strcmp(argv[i + 1], "orphan") == 0) app.streaming = 0;
+            else
+            {
+                fprintf(stderr, "bad --stream '%s', expected persistent or orphan\n", argv[i + 1]);
+                return 0;
+            }
+            used = 2;
+        }
+        else if (strcmp(argv[i], "--dynamic-res") == 0 && i + 1 < *argc) { app.dynamic_res_ms = atof(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--min-scale") == 0 && i + 1 < *argc) { app.min_scale = (float)atof(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--res-log") == 0) app.res_log = 1;
+        else if (strcmp(argv[i], "--trace-record") == 0 && i + 1 < *argc) { app.trace_path = argv[i + 1]; used = 2; }
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < *argc) { golden.dir = argv[i + 1]; used = 2; }
+        else if (strcmp(argv[i], "--golden-update") == 0) golden.update = 1;
+        else if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < *argc) { golden.tolerance = atoi(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--golden-pixels") == 0 && i + 1 < *argc) { golden.max_pixels = atof(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < *argc) { golden.baseline = argv[i + 1]; used = 2; }
+        else if (strcmp(argv[i], "--baseline-update") == 0) golden.baseline_update = 1;
+        else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < *argc) { golden.max_regression = atof(argv[i + 1]); used = 2; }
+        else if (strcmp(argv[i], "--state-cache") == 0 && i + 1 < *argc)
+        {
+            if (strcmp(argv[i + 1], "on") == 0) app.state_cache = 1;
+            else if (strcmp(argv[i + 1], "off") == 0) app.state_cache = 0;
+            else
+            {
+                fprintf(stderr, "bad --state-cache '%s', expected on or off\n", argv[i + 1]);
+                return 0;
+            }
+            used = 2;
+        }
+        else if (extra && (used = extra(*argc, argv, i)) > 0) { }
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "unknown option '%s'\n", argv[i]);
+            app_usage(argv[0]);
+            return 0;
+        }
+        else { argv[kept++] = argv[i]; used = 1; } // not ours, leave it for glutInit()
+    }
+    if (app.frames <= 0 || app.warmup < 0)
+    {
+        fprintf(stderr, "--frames must be > 0 and --warmup >= 0\n");
+        return 0;
+    }
+    if (app.fps_cap <= 0 || app.tick_hz <= 0)
+    {
+        fprintf(stderr, "--fps-cap and --tick-hz must be > 0\n");
+        return 0;
+    }
+    if (app.threads < 0 || app.workers < 0)
+    {
+        fprintf(stderr, "--threads and --workers must be >= 0\n");
+        return 0;
+    }
+    if (app.dynamic_res_ms < 0 || app.min_scale <= 0 || app.min_scale > 1)
+    {
+        fprintf(stderr, "--dynamic-res must be >= 0 and --min-scale between 0 and 1\n");
+        return 0;
+    }
+    if (app.dynamic_res_ms > 0 && app.backend == APP_BACKEND_SW)
+    {
+        fprintf(stderr, "--dynamic-res needs --backend gl or core\n");
+        return 0;
+    }
+    if ((golden.dir || golden.baseline) && !app.headless)
+    {
+        fprintf(stderr, "--golden and --baseline need --headless (the same frames every run)\n");
+        return 0;
+    }
+    if ((golden.update && !golden.dir) || (golden.baseline_update && !golden.baseline))
+    {
+        fprintf(stderr, "--golden-update needs --golden DIR, --baseline-update needs --baseline FILE\n");
+        return 0;
+    }
+    if (golden.tolerance < 0 || golden.max_pixels < 0 || golden.max_regression < 0)
+    {
+        fprintf(stderr, "--golden-tolerance, --golden-pixels and --max-regression must be >= 0\n");
+        return 0;
+    }
+    if (app.dynamic_res_ms > 0 && app.trace_path)
+    {
+        fprintf(stderr, "--trace-record can't record --dynamic-res (its framebuffers aren't in the trace)\n");
+        return 0;
+    }
+    if (app.dynamic_res_ms > 0) dynres_setup(app.dynamic_res_ms, app.min_scale, app.res_log);
+    if (app.capture_path && !capture_open(app.capture_path, app.width, app.height, app.capture_ring,
+                                          app.loop && app.present == PRESENT_CAP ? app.fps_cap : 60))
+        return 0;
+    if (app.profile_path) profile_open(app.profile_path);
+    *argc = kept;
+    argv[kept] = NULL;
+    if (app.backend == APP_BACKEND_SW)
+    {
+        // From here on every glBegin/glVertex/... of the demo goes to the software rasterizer.
+        swr_init(app.threads);
+        gl_dispatch = &swr_dispatch;
+    }
+    else if (app.backend == APP_BACKEND_CORE)
+    {
+        // Every glBegin/glVertex/... goes to our shaders (they're created with the context).
+        glcore_reset();
+        gl_dispatch = &glcore_dispatch;
+    }
+    if (app.state_cache) gl_dispatch = gl_state_install(gl_dispatch); // (in front of either one)
+    if (app.trace_path)
+    {
+        // In front of everything: the trace gets the demo's calls just as it makes them.
+        if (!trace_open(app.trace_path, app.width, app.height)) return 0;
+        gl_dispatch = trace_install(gl_dispatch);
+        if (!app.headless) atexit(app_trace_close);
+    }
+    jobs_init(&app_jobs, app.workers);
+    return 1;
+}
+
+static inline int app_immediate_only(void)
+{
+    // Only the calls of the dispatch table get anywhere (no buffer objects): --backend sw and
+    // core draw nothing else, and --trace-record records nothing else.
+    return app.backend != APP_BACKEND_GL || app.trace_path != NULL;
+}
+
+static inline void *app_get_proc(const char *name)
+{
+    return (void *)glutGetProcAddress(name);
+}
+
+static inline void app_init_context(void)
+{
+    // --backend core: the window's context has to be a core profile one.
+    // Call it after glutInit(), before glutCreateWindow().
+    if (app.backend != APP_BACKEND_CORE) return;
+    glutInitContextVersion(3, 3);
+    glutInitContextProfile(GLUT_CORE_PROFILE);
+}
+
+static inline void app_load_extensions(void)
+{
+    // Loads the newer OpenGL functions (see common/gl_ext.h) for the window's context.
+    // Call it right after glutCreateWindow(), headless mode already does it by itself.
+    // With --backend core this also creates the shaders the tutorials' calls go to.
+    glext_load(app_get_proc);
+    if (app.backend == APP_BACKEND_CORE && !glcore_init(app.shader_cache, app.streaming)) exit(1);
+    if (dynres.enabled && !dynres_create(0)) exit(1);
+}
+
+static const AppCallbacks *app_callbacks; // the demo's callbacks, for the wrappers below
+
+static inline void app_call(const char *section, void (*callback)(void))
+{
+    // Calls callback, timed as section with --profile.
+    profile_cpu_begin(section);
+    callback();
+    profile_cpu_end();
+}
+
+static inline void app_update(void) { app_call("update", app_callbacks->update); }
+
+static inline void app_display(void)
+{
+    app_call("display", app_callbacks->display);
+    profile_frame_done();
+    gl_state_frame_done();
+}
+
+static inline void app_reshape(int width, int height)
+{
+    // With --dynamic-res the demo is told the size its scene is drawn at, not the window's.
+    if (dynres.enabled)
+    {
+        dynres_resize(width, height);
+        width = dynres.width;
+        height = dynres.height;
+    }
+    profile_cpu_begin("reshape");
+    app_callbacks->reshape(width, height);
+    profile_cpu_end();
+}
+
+static inline void app_profile_close(void)
+{
+    // (atexit handler for the windowed demos: the GPU results still in flight are lost)
+    profile_close(stdout, 0);
+}
+
+static inline void app_profile_callbacks(const AppCallbacks *cb)
+{
+    // --profile in a window: GLUT calls the timed wrappers instead of the demo's display/reshape.
+    // Call after glutDisplayFunc/glutReshapeFunc (the timer times its update() with app_call).
+    app_callbacks = cb;
+    if (dynres.enabled) glutReshapeFunc(app_reshape); // (the demo gets the scene's size, see above)
+    if (!profile.enabled) return;
+    profile_use_gpu(app.backend != APP_BACKEND_SW);
+    glutDisplayFunc(app_display);
+    glutReshapeFunc(app_reshape);
+    atexit(app_profile_close);
+}
+
+static inline void app_present_software_frame(void)
+{
+    // Copies the software rasterizer's picture into the window. The demo's calls never reached
+    // the real OpenGL, so its matrices are still the identity and (-1, -1) is the bottom left corner.
+    // (glViewport is the demo's, which goes to the rasterizer: we need the real one here.)
+    gl_dispatch_hw.Viewport(0, 0, swr.width, swr.height);
+    glRasterPos2f(-1, -1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, swr.stride);
+    glDrawPixels(swr.width, swr.height, GL_RGBA, GL_UNSIGNED_BYTE, swr.color);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+static inline void app_capture_close(void)
+{
+    // (atexit handler for the windowed demos, which leave through exit(): by then the window may
+    // be gone, so the last few frames still waiting in their PBOs are dropped.)
+    capture_close(stdout, 0);
+}
+
+static inline void app_capture_frame(void)
+{
+    // Hands the frame that was just drawn to common/capture.h. The first captured frame decides
+    // the size (the window's size at that point, resizing later doesn't change it).
+    if (!capture.active) return;
+    if (!capture.started)
+    {
+        if (app.backend == APP_BACKEND_SW) { capture.width = swr.width; capture.height = swr.height; }
+        else if (!app.headless) { capture.width = glutGet(GLUT_WINDOW_WIDTH); capture.height = glutGet(GLUT_WINDOW_HEIGHT); }
+        if (!app.headless) atexit(app_capture_close);
+    }
+    if (app.backend == APP_BACKEND_SW) capture_frame_memory(swr.color, swr.stride);
+    else capture_frame_gl();
+}
+
+static inline void app_golden_frame(void)
+{
+    // --golden: this frame against its golden image (reads it back, so only a few frames do this).
+    if (!golden_wanted()) return;
+    if (app.backend == APP_BACKEND_SW)
+    {
+        golden_check_frame(stdout, (const unsigned char *)swr.color, swr.width, swr.height, swr.stride);
+        return;
+    }
+    {
+        unsigned char *pixels = (unsigned char *)malloc((size_t)app.width * app.height * 4);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, app.width, app.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        golden_check_frame(stdout, pixels, app.width, app.height, app.width);
+        free(pixels);
+    }
+}
+
+static inline void app_swap_buffers(void)
+{
+    // With a window: show the finished back buffer (glutSwapBuffers also flushes).
+    // Headless: there is nothing to show, but we wait until the frame is really drawn
+    // (glFinish) so the measured time includes the actual rendering and not just queuing it up.
+    // The software rasterizer only draws its binned triangles here (swr_finish), on all threads.
+    // With --capture the finished frame is also queued for readback (that doesn't wait for anything).
+    // With --golden a few frames are compared with their golden images.
+    // With --dynamic-res the scene is first stretched to the window (and the next frame starts
+    // in the scene's framebuffer again, at the size the controller picked).
+    int rescaled = 0;
+    trace_frame_done(app_callbacks ? app_callbacks->name : NULL); // (--trace-record: the frame's calls are all in)
+    if (dynres.enabled) dynres_end_frame();
+    if (app.backend == APP_BACKEND_CORE) glcore_end_frame(); // (fences behind the frame's draws)
+    if (app.backend == APP_BACKEND_SW)
+    {
+        swr_finish();
+        if (app.headless) app_golden_frame();
+        app_capture_frame();
+        if (!app.headless)
+        {
+            app_present_software_frame();
+            glutSwapBuffers();
+        }
+    }
+    else if (app.headless)
+    {
+        glFinish();
+        app_golden_frame();
+        if (dynres.enabled) rescaled = dynres_frame_done();
+        app_capture_frame(); // (after glFinish, so the capture's cost doesn't include drawing the frame)
+    }
+    else
+    {
+        if (dynres.enabled) rescaled = dynres_frame_done();
+        app_capture_frame(); // (before the swap, which leaves the back buffer undefined)
+        glutSwapBuffers();
+    }
+    if (rescaled) app_reshape(dynres.window_width, dynres.window_height);
+    if (dynres.enabled) dynres_begin_frame();
+}
+
+static GameLoop app_loop;
+static uint64_t app_loop_report_ns;
+
+static inline void app_set_swap_interval(int interval)
+{
+    // 1 = swap waits for the monitor refresh (vsync), 0 = swap right away.
+    // Every platform names this function differently, so we just try them all.
+    typedef int (APIENTRY *SwapIntervalProc)(int);
+    const char *names[] = { "wglSwapIntervalEXT", "glXSwapIntervalMESA", "glXSwapIntervalSGI" };
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        SwapIntervalProc swap_interval = (SwapIntervalProc)app_get_proc(names[i]);
+        if (swap_interval)
+        {
+            swap_interval(interval);
+            return;
+        }
+    }
+    fprintf(stderr, "can't change the swap interval on this system\n");
+}
+
+static inline void app_loop_idle(void)
+{
+    // GLUT calls this whenever it has nothing else to do, ie all the time: one loop iteration per call.
+    const AppCallbacks *cb = app_callbacks;
+    uint64_t now;
+    loop_pace(&app_loop);                   // --present cap: wait for the frame slot
+    loop_advance(&app_loop, app_update);    // the fixed update() steps that are due + loop_alpha
+    app_display();                          // draws (in between the last two steps) and swaps
+    loop_frame_done(&app_loop);
+
+    now = clock_now_ns();
+    if (now - app_loop_report_ns >= 2000000000ull) // a line of stats every 2 seconds
+    {
+        loop_report(&app_loop, stdout, cb->name, (now - app_loop_report_ns) / 1e9);
+        if (cb->report) cb->report(stdout);
+        gl_state_report(stdout);
+        glcore_report(stdout);
+        dynres_report(stdout);
+        jobs_report(&app_jobs, stdout);
+        capture_report(stdout);
+        app_loop_report_ns = now;
+    }
+}
+
+static inline void app_start_loop(const AppCallbacks *cb)
+{
+    // Drives cb->update/cb->display from the fixed-timestep loop instead of glutTimerFunc.
+    // Call instead of glutTimerFunc(0, timer, 0), after glutCreateWindow().
+    app_callbacks = cb;
+    app_set_swap_interval(app.present == PRESENT_VSYNC ? 1 : 0);
+    loop_init(&app_loop, app.tick_hz, app.present, app.fps_cap);
+    app_loop_report_ns = clock_now_ns();
+    glutIdleFunc(app_loop_idle);
+}
+
+static inline int app_run_headless(const AppCallbacks *cb)
+{
+    // Drives the demo's own callbacks exactly like GLUT would (init, reshape, then update + display
+    // every frame), just without waiting 1/60th of a second in between. Returns the exit code.
+    FrameStats stats;
+    FrameSummary summary;
+    GameLoop loop;
+    uint64_t measure_start;
+    int frame;
+
+    app_callbacks = cb;
+    if (app.backend == APP_BACKEND_SW)
+    {
+        // No OpenGL at all: the rasterizer has its own framebuffer.
+        printf("%s: headless %dx%d on the software rasterizer (%d threads, %s, %dx%d tiles)\n", cb->name,
+               app.width, app.height, swr.thread_count, SWR_SIMD_NAME, SWR_TILE_SIZE, SWR_TILE_SIZE);
+    }
+    else
+    {
+        if (!headless_create(app.width, app.height, app.backend == APP_BACKEND_CORE)) return 1;
+        printf("%s: headless %dx%d on %s (%s)\n", cb->name, app.width, app.height,
+               (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+        if (app.backend == APP_BACKEND_CORE && !glcore_init(app.shader_cache, app.streaming)) return 1;
+        if (dynres.enabled && !dynres_create(headless_fbo)) return 1;
+    }
+    profile_use_gpu(app.backend != APP_BACKEND_SW);
+
+    app_call("init", cb->init);
+    app_reshape(app.width, app.height);
+
+    // Warm-up frames aren't measured: the first frames pay for shader compiles, memory allocation,
+    // caches being cold, etc. which isn't what we want to know.
+    for (frame = 0; frame < app.warmup; frame++)
+    {
+        app_update();
+        app_display();
+    }
+
+    // With --loop the animation follows the real clock (fixed ticks + interpolation) and the
+    // frames are paced by the present policy. There is no monitor here, so vsync = uncapped.
+    if (app.loop && app.present == PRESENT_VSYNC) printf("(no vsync without a window, running uncapped)\n");
+    loop_init(&loop, app.tick_hz, app.present, app.fps_cap);
+
+    frame_stats_init(&stats, app.frames);
+    measure_start = clock_now_ns();
+    for (frame = 0; frame < app.frames; frame++)
+    {
+        uint64_t start;
+        if (app.loop) loop_pace(&loop); // (waiting for the frame slot isn't part of the frame's cost)
+        start = clock_now_ns();
+        if (app.loop) loop_advance(&loop, app_update);
+        else app_update();
+        app_display(); // ends with app_swap_buffers() -> glFinish() / swr_finish()
+        frame_stats_add(&stats, clock_ns_to_ms(clock_now_ns() - start));
+        if (app.loop) loop_frame_done(&loop);
+    }
+
+    summary = frame_stats_summarize(&stats);
+    frame_summary_print(stdout, cb->name, &summary);
+    golden_check_time(stdout, summary.median_ms);
+    if (app.loop) loop_report(&loop, stdout, "loop", (clock_now_ns() - measure_start) / 1e9);
+    if (cb->report) cb->report(stdout);
+    gl_state_report(stdout);
+    glcore_report(stdout);
+    dynres_report(stdout);
+    jobs_report(&app_jobs, stdout);
+    trace_close(stdout);
+    capture_close(stdout, 1); // (writes out the frames still in flight, needs the OpenGL context)
+    profile_close(stdout, 1);
+    frame_stats_free(&stats);
+    loop_free(&loop);
+    if (app.backend == APP_BACKEND_SW) swr_shutdown();
+    else
+    {
+        dynres_destroy();
+        glcore_shutdown();
+        headless_destroy();
+    }
+    return golden.failures > 0 ? 1 : 0; // (--golden, --baseline: something changed)
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef COMMON_BENCH_H
+#define COMMON_BENCH_H
+
+/*
+- ***** A Note on Frame Time Statistics *****
+  "Frames per second" alone hides a lot. 1000 frames in one second could be 1000 frames
+  of 1 ms each (smooth), or 999 tiny frames and one frame of 500 ms (a very visible hitch).
+  So we record the time of EVERY frame and then look at:
+    - min:    the best case, what the code can do when nothing gets in the way.
+    - median: the typical frame (half the frames were faster, half were slower).
+    - p99:    the 99th percentile, only 1 frame in 100 was slower than this. This is where
+              stutters show up.
+  All times are in milliseconds. FPS = 1000 / frame time in ms.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+typedef struct FrameStats
+{
+    double *samples_ms; // one entry per recorded frame
+    int count;
+    int capacity;
+    double total_ms;    // sum of all samples (for the overall fps)
+} FrameStats;
+
+typedef struct FrameSummary
+{
+    int frames;
+    double min_ms;
+    double median_ms;
+    double p99_ms;
+    double max_ms;
+    double mean_ms;
+    double stddev_ms;   // how much the samples vary around the mean
+    double fps;         // frames / total time
+} FrameSummary;
+
+static inline void frame_stats_init(FrameStats *stats, int capacity)
+{
+    stats->samples_ms = (double *)malloc(sizeof(double) * (capacity > 0 ? capacity : 1));
+    stats->count = 0;
+    stats->capacity = capacity > 0 ? capacity : 1;
+    stats->total_ms = 0;
+}
+
+static inline void frame_stats_free(FrameStats *stats)
+{
+    free(stats->samples_ms);
+    memset(stats, 0, sizeof(*stats));
+}
+
+static inline void frame_stats_add(FrameStats *stats, double ms)
+{
+    if (stats->count == stats->capacity)
+    {
+        stats->capacity *= 2;
+        stats->samples_ms = (double *)realloc(stats->samples_ms, sizeof(double) * stats->capacity);
+    }
+    stats->samples_ms[stats->count++] = ms;
+    stats->total_ms += ms;
+}
+
+static inline int frame_stats_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline double frame_stats_percentile(const double *sorted, int count, double p)
+{
+    // Nearest-rank percentile: the smallest sample that p percent of the samples are <= to.
+    int rank;
+    if (count == 0) return 0;
+    rank = (int)(p / 100.0 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+static inline FrameSummary frame_stats_summarize(const FrameStats *stats)
+{
+    FrameSummary s;
+    double *sorted;
+    int i;
+    memset(&s, 0, sizeof(s));
+    s.frames = stats->count;
+    if (stats->count == 0) return s;
+
+    // Sort a copy so the samples stay in frame order (handy when dumping them).
+    sorted = (double *)malloc(sizeof(double) * stats->count);
+    memcpy(sorted, stats->samples_ms, sizeof(double) * stats->count);
+    qsort(sorted, stats->count, sizeof(double), frame_stats_compare);
+
+    s.min_ms = sorted[0];
+    s.max_ms = sorted[stats->count - 1];
+    s.median_ms = frame_stats_percentile(sorted, stats->count, 50);
+    s.p99_ms = frame_stats_percentile(sorted, stats->count, 99);
+    s.mean_ms = stats->total_ms / stats->count;
+    for (i = 0; i < stats->count; i++)
+        s.stddev_ms += (stats->samples_ms[i] - s.mean_ms) * (stats->samples_ms[i] - s.mean_ms);
+    s.stddev_ms = sqrt(s.stddev_ms / stats->count);
+    s.fps = stats->total_ms > 0 ? 1000.0 * stats->count / stats->total_ms : 0;
+    free(sorted);
+    return s;
+}
+
+static inline void frame_summary_print(FILE *out, const char *label, const FrameSummary *s)
+{
+    fprintf(out, "%s: %d frames | min %.3f ms | median %.3f ms | p99 %.3f ms | max %.3f ms | %.1f fps\n",
+            label, s->frames, s->min_ms, s->median_ms, s->p99_ms, s->max_ms, s->fps);
+}
+
+#endif
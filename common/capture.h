@@ -0,0 +1,528 @@
+#ifndef COMMON_CAPTURE_H
+#define COMMON_CAPTURE_H
+
+/*
+- ***** A Note on Capturing Frames *****
+  The obvious way to record the demo is glReadPixels() right after drawing each frame. But
+  glReadPixels() has to hand us the pixels when it returns, so the CPU waits until the GPU
+  has finished EVERYTHING queued so far, and then waits again while the pixels are copied.
+  The CPU and the GPU stop working side by side, every single frame.
+
+  Pixel Buffer Objects (PBOs) fix that. With a PBO bound to GL_PIXEL_PACK_BUFFER, glReadPixels
+  only QUEUES the copy (into the PBO, on the GPU side) and returns right away. We keep a ring
+  of a few PBOs and only look at a frame's PBO a few frames later, when the copy is long done:
+    frame N:   draw, glReadPixels into PBO[N % ring], glFenceSync (a marker we can ask about)
+    frame N+1: draw, glReadPixels into PBO[(N+1) % ring], ... PBO[N]'s fence done? -> map it
+  Mapping (glMapBufferRange) gives us a pointer straight into the PBO. That pointer goes to an
+  encoder thread which turns the pixels into a PNG / Y4M / raw frame and writes it, while the
+  main thread goes on drawing. When the encoder is done the PBO is unmapped and reused.
+  So the render thread never waits for the GPU or the disk, it only queues work.
+
+  Formats (picked by --capture PATH):
+    frames/shot_%05d.png   one PNG per frame (uncompressed deflate: fast to write, big files)
+    out.y4m                YUV4MPEG2 video, 4:2:0 (ffmpeg/ffplay/vlc/mpv play it directly)
+    out.raw                raw RGBA frames, top to bottom (ffplay -f rawvideo -pixel_format rgba -video_size WxH)
+
+  Note: With --backend sw there is no GPU: the frame is copied out of the rasterizer's memory
+        and handed to the encoder the same way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "gl_ext.h"
+#include "clock.h"
+#include "bench.h"
+
+#define CAPTURE_MAX_RING 16
+
+enum { CAPTURE_PNG, CAPTURE_Y4M, CAPTURE_RAW };
+enum { CAPTURE_SLOT_FREE, CAPTURE_SLOT_READING, CAPTURE_SLOT_ENCODING, CAPTURE_SLOT_DONE };
+
+typedef struct CaptureSlot
+{
+    int state;                    // CAPTURE_SLOT_*
+    long frame;
+    GLuint pbo;
+    GLsync fence;                 // signaled when the readback into pbo is done
+    const unsigned char *pixels;  // RGBA, bottom row first (the mapped PBO, or copy)
+    int stride;                   // pixels per row in "pixels"
+    unsigned char *copy;          // (software rasterizer) our own copy of the frame
+} CaptureSlot;
+
+typedef struct Capture
+{
+    int active;
+    int started;
+    int format;                   // CAPTURE_*
+    int use_pbo;                  // 0: the frames come from memory (capture_frame_memory)
+    int width, height, ring_size;
+    double fps;                   // (written into the Y4M header)
+    char path[1024];
+    FILE *file;                   // Y4M and raw: everything goes into one file
+    CaptureSlot slots[CAPTURE_MAX_RING];
+    long frames_issued;           // frames given to capture_frame*()
+    long next_delivery;           // the next frame the encoder gets (they go in order)
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int queue[CAPTURE_MAX_RING];  // slots waiting for the encoder
+    int queue_head, queue_count;
+    int quit;
+    unsigned char *scratch;       // encoder's buffer (PNG rows / YUV planes)
+
+    FrameStats cost;              // ms the render thread spent in capture_frame*() per frame
+    long fence_waits;             // times a readback wasn't done when its PBO was needed
+    long encoder_waits;           // times the encoder was behind and we had to wait for it
+    long frames_written;
+    double encode_ms;             // encoder thread CPU time
+    double bytes_written;
+} Capture;
+
+static Capture capture;
+
+/* ***** Encoder (runs on its own thread) ***** */
+
+static uint32_t capture_crc_table[256];
+
+static inline uint32_t capture_crc(uint32_t crc, const unsigned char *data, size_t length)
+{
+    // CRC-32 as PNG wants it (pass 0 to start).
+    size_t i;
+    crc = ~crc;
+    for (i = 0; i < length; i++) crc = capture_crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline void capture_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16); p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+}
+
+static inline size_t capture_write_png(FILE *f, const CaptureSlot *slot, int width, int height, unsigned char *raw)
+{
+    // An RGB PNG whose pixel data is "stored" (deflate without compression): no zlib needed,
+    // and as fast as writing the pixels out. Returns the bytes written.
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char header[25], small[8];
+    size_t row_bytes = 1 + (size_t)width * 3, raw_length = row_bytes * height, offset, idat_length;
+    uint32_t crc, adler_a = 1, adler_b = 0;
+    size_t blocks = (raw_length + 65534) / 65535, i;
+    int x, y;
+
+    // the rows, top one first, each starting with filter type 0 ("none"), alpha dropped
+    for (y = 0; y < height; y++)
+    {
+        const unsigned char *src = slot->pixels + (size_t)(height - 1 - y) * slot->stride * 4;
+        unsigned char *dst = raw + y * row_bytes;
+        *dst++ = 0;
+        for (x = 0; x < width; x++, src += 4, dst += 3) { dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; }
+    }
+    for (i = 0; i < raw_length; )
+    {
+        // (zlib's checksum of the uncompressed data, the "% 65521" only every 5552 bytes like zlib does)
+        size_t end = raw_length - i < 5552 ? raw_length : i + 5552;
+        for (; i < end; i++) { adler_a += raw[i]; adler_b += adler_a; }
+        adler_a %= 65521;
+        adler_b %= 65521;
+    }
+
+    fwrite(signature, 1, 8, f);
+    capture_put32(header, 13);
+    memcpy(header + 4, "IHDR", 4);
+    capture_put32(header + 8, (uint32_t)width);
+    capture_put32(header + 12, (uint32_t)height);
+    header[16] = 8; header[17] = 2; header[18] = 0; header[19] = 0; header[20] = 0; // 8 bit RGB
+    capture_put32(header + 21, capture_crc(0, header + 4, 17));
+    fwrite(header, 1, 25, f);
+
+    idat_length = 2 + blocks * 5 + raw_length + 4;
+    capture_put32(small, (uint32_t)idat_length);
+    memcpy(small + 4, "IDAT", 4);
+    fwrite(small, 1, 8, f);
+    crc = capture_crc(0, small + 4, 4);
+    small[0] = 0x78; small[1] = 0x01; // zlib header
+    fwrite(small, 1, 2, f);
+    crc = capture_crc(crc, small, 2);
+    for (offset = 0; offset < raw_length; offset += 65535)
+    {
+        size_t length = raw_length - offset < 65535 ? raw_length - offset : 65535;
+        small[0] = offset + length == raw_length ? 1 : 0; // last block?
+        small[1] = (unsigned char)length; small[2] = (unsigned char)(length >> 8);
+        small[3] = (unsigned char)~length; small[4] = (unsigned char)(~length >> 8);
+        fwrite(small, 1, 5, f);
+        crc = capture_crc(crc, small, 5);
+        fwrite(raw + offset, 1, length, f);
+        crc = capture_crc(crc, raw + offset, length);
+    }
+    capture_put32(small, (adler_b << 16) | adler_a);
+    fwrite(small, 1, 4, f);
+    crc = capture_crc(crc, small, 4);
+    capture_put32(small, crc);
+    fwrite(small, 1, 4, f);
+    capture_put32(small, 0);
+    memcpy(small + 4, "IEND", 4);
+    fwrite(small, 1, 8, f);
+    capture_put32(small, capture_crc(0, (const unsigned char *)"IEND", 4));
+    fwrite(small, 1, 4, f);
+    return 8 + 25 + 12 + idat_length + 12;
+}
+
+static inline size_t capture_write_y4m(FILE *f, const CaptureSlot *slot, int width, int height, unsigned char *yuv)
+{
+    // RGB -> YUV (BT.601, the usual video range 16..235), U and V once per 2x2 pixels: two rows at
+    // a time, so every pixel is read once. (An odd last row/column is paired with itself.)
+    int chroma_w = (width + 1) / 2, chroma_h = (height + 1) / 2, x, y;
+    unsigned char *plane_y = yuv, *plane_u = yuv + (size_t)width * height, *plane_v = plane_u + (size_t)chroma_w * chroma_h;
+    size_t size = (size_t)width * height + 2 * (size_t)chroma_w * chroma_h;
+    for (y = 0; y < height; y += 2)
+    {
+        int y2 = y + 1 < height ? y + 1 : y;
+        const unsigned char *row[2];
+        unsigned char *out_y[2], *out_u = plane_u + (size_t)(y / 2) * chroma_w, *out_v = plane_v + (size_t)(y / 2) * chroma_w;
+        row[0] = slot->pixels + (size_t)(height - 1 - y) * slot->stride * 4;
+        row[1] = slot->pixels + (size_t)(height - 1 - y2) * slot->stride * 4;
+        out_y[0] = plane_y + (size_t)y * width;
+        out_y[1] = plane_y + (size_t)y2 * width;
+        for (x = 0; x < width; x += 2)
+        {
+            int x2 = x + 1 < width ? x + 1 : x, r = 0, g = 0, b = 0, k;
+            for (k = 0; k < 2; k++)
+            {
+                const unsigned char *p0 = row[k] + x * 4, *p1 = row[k] + x2 * 4;
+                out_y[k][x] = (unsigned char)(16 + ((66 * p0[0] + 129 * p0[1] + 25 * p0[2] + 128) >> 8));
+                out_y[k][x2] = (unsigned char)(16 + ((66 * p1[0] + 129 * p1[1] + 25 * p1[2] + 128) >> 8));
+                r += p0[0] + p1[0]; g += p0[1] + p1[1]; b += p0[2] + p1[2];
+            }
+            r = (r + 2) >> 2; g = (g + 2) >> 2; b = (b + 2) >> 2;
+            out_u[x / 2] = (unsigned char)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+            out_v[x / 2] = (unsigned char)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+        }
+    }
+    fputs("FRAME\n", f);
+    fwrite(yuv, 1, size, f);
+    return 6 + size;
+}
+
+static inline size_t capture_write_raw(FILE *f, const CaptureSlot *slot, int width, int height)
+{
+    int y;
+    for (y = height - 1; y >= 0; y--) fwrite(slot->pixels + (size_t)y * slot->stride * 4, 4, width, f);
+    return (size_t)width * height * 4;
+}
+
+static inline void capture_encode(CaptureSlot *slot)
+{
+    size_t bytes = 0;
+    if (capture.format == CAPTURE_PNG)
+    {
+        char name[1100];
+        FILE *f;
+        snprintf(name, sizeof(name), capture.path, (int)slot->frame);
+        f = fopen(name, "wb");
+        if (!f)
+        {
+            fprintf(stderr, "capture: can't write %s\n", name);
+            return;
+        }
+        bytes = capture_write_png(f, slot, capture.width, capture.height, capture.scratch);
+        fclose(f);
+    }
+    else if (capture.format == CAPTURE_Y4M) bytes = capture_write_y4m(capture.file, slot, capture.width, capture.height, capture.scratch);
+    else bytes = capture_write_raw(capture.file, slot, capture.width, capture.height);
+    capture.bytes_written += bytes;
+}
+
+static inline void *capture_encoder(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&capture.lock);
+    for (;;)
+    {
+        CaptureSlot *slot;
+        uint64_t start;
+        while (capture.queue_count == 0 && !capture.quit) pthread_cond_wait(&capture.wake, &capture.lock);
+        if (capture.queue_count == 0) break; // (quit, and nothing left to write)
+        slot = &capture.slots[capture.queue[capture.queue_head]];
+        capture.queue_head = (capture.queue_head + 1) % CAPTURE_MAX_RING;
+        capture.queue_count--;
+        pthread_mutex_unlock(&capture.lock);
+
+        start = clock_thread_cpu_ns(); // (CPU time: the encoder shares the CPU with the demo)
+        capture_encode(slot);
+
+        pthread_mutex_lock(&capture.lock);
+        capture.encode_ms += clock_ns_to_ms(clock_thread_cpu_ns() - start);
+        capture.frames_written++;
+        slot->state = CAPTURE_SLOT_DONE;
+        pthread_cond_signal(&capture.done);
+    }
+    pthread_mutex_unlock(&capture.lock);
+    return NULL;
+}
+
+/* ***** Render thread side ***** */
+
+static inline int capture_png_pattern(const char *path)
+{
+    // The path becomes snprintf's format string, so it may hold exactly one conversion and it has
+    // to be the frame number: %d or %0Nd (%% is a plain '%' and fine too).
+    int numbers = 0;
+    for (; *path; path++)
+    {
+        if (*path != '%') continue;
+        if (path[1] == '%')
+        {
+            path++;
+            continue;
+        }
+        path++;
+        if (*path == '0')
+        {
+            path++;
+            while (*path >= '0' && *path <= '9') path++; // (the width)
+        }
+        if (*path != 'd') return 0;
+        numbers++;
+    }
+    return numbers == 1;
+}
+
+static inline int capture_open(const char *path, int width, int height, int ring_size, double fps)
+{
+    // Only remembers the settings: the PBOs need the OpenGL context, so everything else is set up
+    // on the first captured frame. Returns 0 if the path isn't usable.
+    size_t length = strlen(path);
+    memset(&capture, 0, sizeof(capture));
+    if (length >= sizeof(capture.path)) return 0;
+    strcpy(capture.path, path);
+    if (length > 4 && strcmp(path + length - 4, ".y4m") == 0) capture.format = CAPTURE_Y4M;
+    else if (length > 4 && strcmp(path + length - 4, ".raw") == 0) capture.format = CAPTURE_RAW;
+    else if (length > 4 && strcmp(path + length - 4, ".png") == 0 && capture_png_pattern(path)) capture.format = CAPTURE_PNG;
+    else
+    {
+        fprintf(stderr, "--capture: expected a .y4m or .raw file, or a .png pattern with one %%d or %%0Nd for the frame number, like frames/shot_%%05d.png\n");
+        return 0;
+    }
+    capture.width = width;
+    capture.height = height;
+    capture.ring_size = ring_size < 2 ? 2 : ring_size > CAPTURE_MAX_RING ? CAPTURE_MAX_RING : ring_size;
+    capture.fps = fps;
+    capture.active = 1;
+    return 1;
+}
+
+static inline int capture_start(int use_pbo)
+{
+    int i, chroma_w = (capture.width + 1) / 2, chroma_h = (capture.height + 1) / 2;
+    size_t frame_bytes = (size_t)capture.width * capture.height * 4;
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t c = (uint32_t)i;
+        int k;
+        for (k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        capture_crc_table[i] = c;
+    }
+    if (use_pbo && (!GLEXT_HAVE(glMapBufferRange) || !GLEXT_HAVE(glFenceSync)))
+    {
+        fprintf(stderr, "capture: PBO readback needs OpenGL 3.2\n");
+        return 0;
+    }
+    if (capture.format != CAPTURE_PNG)
+    {
+        capture.file = fopen(capture.path, "wb");
+        if (!capture.file)
+        {
+            fprintf(stderr, "capture: can't write %s\n", capture.path);
+            return 0;
+        }
+        if (capture.format == CAPTURE_Y4M)
+            fprintf(capture.file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n", capture.width, capture.height, (int)(capture.fps * 1000 + 0.5));
+    }
+    capture.use_pbo = use_pbo;
+    for (i = 0; i < capture.ring_size; i++)
+    {
+        CaptureSlot *slot = &capture.slots[i];
+        if (use_pbo)
+        {
+            // GL_STREAM_READ: written by the GPU once, read by us once
+            glGenBuffers(1, &slot->pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, frame_bytes, NULL, GL_STREAM_READ);
+        }
+        else slot->copy = (unsigned char *)malloc(frame_bytes);
+    }
+    if (use_pbo) glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.scratch = (unsigned char *)malloc((1 + (size_t)capture.width * 3) * capture.height
+                                              + (size_t)capture.width * capture.height + 2 * (size_t)chroma_w * chroma_h);
+    frame_stats_init(&capture.cost, 1024);
+    pthread_mutex_init(&capture.lock, NULL);
+    pthread_cond_init(&capture.wake, NULL);
+    pthread_cond_init(&capture.done, NULL);
+    pthread_create(&capture.thread, NULL, capture_encoder, NULL);
+    capture.started = 1;
+    return 1;
+}
+
+static inline void capture_hand_to_encoder(CaptureSlot *slot)
+{
+    pthread_mutex_lock(&capture.lock);
+    slot->state = CAPTURE_SLOT_ENCODING;
+    capture.queue[(capture.queue_head + capture.queue_count) % CAPTURE_MAX_RING] = (int)(slot - capture.slots);
+    capture.queue_count++;
+    pthread_cond_signal(&capture.wake);
+    pthread_mutex_unlock(&capture.lock);
+    capture.next_delivery++;
+}
+
+static inline void capture_deliver(long up_to_frame, int wait)
+{
+    // Maps the finished readbacks (oldest first) and hands them to the encoder. Stops at the first
+    // one that isn't done yet, unless wait is set: then frames up to up_to_frame are waited for.
+    while (capture.next_delivery < capture.frames_issued)
+    {
+        CaptureSlot *slot = &capture.slots[capture.next_delivery % capture.ring_size];
+        GLenum status;
+        if (slot->state != CAPTURE_SLOT_READING) break;
+        status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            if (!wait || slot->frame > up_to_frame) break;
+            capture.fence_waits++;
+            glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        }
+        glDeleteSync(slot->fence);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+        slot->pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                               (GLsizeiptr)capture.width * capture.height * 4, GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot->stride = capture.width;
+        capture_hand_to_encoder(slot);
+    }
+}
+
+static inline void capture_reclaim(CaptureSlot *slot)
+{
+    // Makes slot free again: its frame must have been delivered, encoded and (PBO) unmapped.
+    if (slot->state == CAPTURE_SLOT_READING) capture_deliver(slot->frame, 1);
+    if (slot->state == CAPTURE_SLOT_ENCODING)
+    {
+        pthread_mutex_lock(&capture.lock);
+        if (slot->state != CAPTURE_SLOT_DONE) capture.encoder_waits++;
+        while (slot->state != CAPTURE_SLOT_DONE) pthread_cond_wait(&capture.done, &capture.lock);
+        pthread_mutex_unlock(&capture.lock);
+    }
+    if (slot->state == CAPTURE_SLOT_DONE && capture.use_pbo)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    slot->state = CAPTURE_SLOT_FREE;
+}
+
+static inline CaptureSlot *capture_next_slot(void)
+{
+    CaptureSlot *slot = &capture.slots[capture.frames_issued % capture.ring_size];
+    int state;
+    pthread_mutex_lock(&capture.lock);
+    state = slot->state;
+    pthread_mutex_unlock(&capture.lock);
+    if (state != CAPTURE_SLOT_FREE) capture_reclaim(slot);
+    slot->frame = capture.frames_issued++;
+    return slot;
+}
+
+static inline void capture_frame_gl(void)
+{
+    // Call after the frame is drawn, before swapping: queues the readback of the current
+    // (back/FBO) buffer into the next PBO. Never waits unless the whole ring is still busy.
+    uint64_t start = clock_now_ns();
+    CaptureSlot *slot;
+    if (!capture.started && !capture_start(1))
+    {
+        capture.active = 0;
+        return;
+    }
+    capture_deliver(0, 0);
+    slot = capture_next_slot();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, capture.width, capture.height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // 0 = offset into the PBO
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->state = CAPTURE_SLOT_READING;
+    frame_stats_add(&capture.cost, clock_ns_to_ms(clock_now_ns() - start));
+}
+
+static inline void capture_frame_memory(const uint32_t *pixels, int stride)
+{
+    // The same for a frame that is already in memory (bottom row first, stride pixels per row).
+    uint64_t start = clock_now_ns();
+    CaptureSlot *slot;
+    int y;
+    if (!capture.started && !capture_start(0))
+    {
+        capture.active = 0;
+        return;
+    }
+    slot = capture_next_slot();
+    for (y = 0; y < capture.height; y++)
+        memcpy(slot->copy + (size_t)y * capture.width * 4, pixels + (size_t)y * stride, (size_t)capture.width * 4);
+    slot->pixels = slot->copy;
+    slot->stride = capture.width;
+    capture_hand_to_encoder(slot);
+    frame_stats_add(&capture.cost, clock_ns_to_ms(clock_now_ns() - start));
+}
+
+static inline void capture_report(FILE *out)
+{
+    FrameSummary s;
+    if (!capture.started) return;
+    s = frame_stats_summarize(&capture.cost);
+    fprintf(out, "capture: %ld frames to %s (%.1f MB) | render thread median %.3f ms p99 %.3f ms per frame"
+                 " | encoder %.3f ms CPU per frame | waits: %ld readback, %ld encoder\n",
+            capture.frames_written, capture.path, capture.bytes_written / 1e6, s.median_ms, s.p99_ms,
+            capture.frames_written ? capture.encode_ms / capture.frames_written : 0, capture.fence_waits, capture.encoder_waits);
+}
+
+static inline void capture_close(FILE *out, int have_context)
+{
+    // Writes out the frames still in flight (only possible while the OpenGL context is alive,
+    // have_context = 0 drops the ones still in PBOs), stops the encoder, closes the file and
+    // prints the final report to out.
+    int i;
+    if (!capture.started) return;
+    if (have_context && capture.use_pbo) capture_deliver(capture.frames_issued, 1);
+    pthread_mutex_lock(&capture.lock);
+    capture.quit = 1;
+    pthread_cond_signal(&capture.wake);
+    pthread_mutex_unlock(&capture.lock);
+    pthread_join(capture.thread, NULL);
+    for (i = 0; i < capture.ring_size; i++)
+    {
+        CaptureSlot *slot = &capture.slots[i];
+        if (have_context && capture.use_pbo)
+        {
+            if (slot->state == CAPTURE_SLOT_DONE)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &slot->pbo);
+        }
+        free(slot->copy);
+    }
+    if (capture.file) fclose(capture.file);
+    capture_report(out);
+    free(capture.scratch);
+    frame_stats_free(&capture.cost);
+    capture.started = 0;
+    capture.active = 0;
+}
+
+#endif
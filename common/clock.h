@@ -0,0 +1,62 @@
+#ifndef COMMON_CLOCK_H
+#define COMMON_CLOCK_H
+
+/*
+- ***** A Note on Measuring Time *****
+  To measure how long a frame takes we need a clock that:
+  1. Only ever moves forward (a "monotonic" clock). The normal wall clock can jump
+     backwards or forwards when the system time is corrected, which would give us
+     negative or huge frame times.
+  2. Has a fine resolution. A frame of our demos can take way less than a millisecond,
+     so we want (at least) microseconds, ideally nanoseconds.
+  On Windows that clock is QueryPerformanceCounter(), everywhere else it is
+  clock_gettime(CLOCK_MONOTONIC).
+*/
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static inline uint64_t clock_now_ns(void)
+{
+    // Returns the current time of the monotonic clock in nanoseconds.
+    // The number itself means nothing, only the difference between two calls does.
+#ifdef _WIN32
+    static LARGE_INTEGER frequency; // ticks per second, never changes while the program runs
+    LARGE_INTEGER now;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t clock_thread_cpu_ns(void)
+{
+    // CPU time the calling thread has used so far, in nanoseconds. Unlike clock_now_ns() this
+    // doesn't move while the thread waits or while other threads have the CPU.
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user; // (100 ns units)
+    GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+    return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+            + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline double clock_ns_to_ms(uint64_t ns)
+{
+    return (double)ns / 1e6;
+}
+
+#endif
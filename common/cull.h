@@ -0,0 +1,243 @@
+#ifndef COMMON_CULL_H
+#define COMMON_CULL_H
+
+/*
+- ***** A Note on Frustum Culling *****
+  OpenGL clips away whatever is outside the view frustum, but only AFTER we sent it: every
+  glVertex of an object behind the camera still costs us the call, the transform and the
+  clipping. Culling is doing that test ourselves, once per OBJECT instead of once per vertex,
+  and not sending what can't be seen.
+  - The 6 planes of the frustum can be read straight out of Projection * ModelView (the
+    "Gribb-Hartmann" trick): a point is inside when its clip space x, y, z are between -w and w,
+    and each of those 6 comparisons is a plane equation a*x + b*y + c*z + d >= 0.
+  - Each object gets an axis aligned bounding box (AABB), the smallest box around it whose sides
+    are parallel to the axes. Box vs plane is cheap: the box's center distance to the plane
+    against its "radius" in the plane's direction. Fully behind any one plane = invisible.
+
+- ***** A Note on the BVH *****
+  Testing 100000 boxes one by one is still 100000 tests. A Bounding Volume Hierarchy groups
+  nearby objects: the root box holds everything, it is split in two halves (along its longest
+  side, half of the objects each), each half in two again, and so on down to a few objects.
+  Culling starts at the root: a box fully outside throws away its whole subtree in one test,
+  and a box fully INSIDE the frustum takes its whole subtree without testing anything below.
+  Only boxes cut by a plane need their children looked at, which is a thin layer along the
+  frustum's sides. The objects of a subtree are next to each other in bvh.items, so "take the
+  whole subtree" is a single copy.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "vmath.h"
+
+#define BVH_LEAF_SIZE 4
+
+typedef struct Plane { float a, b, c, d; } Plane; // a*x + b*y + c*z + d >= 0 on the inside
+typedef struct Frustum { Plane planes[6]; } Frustum; // left, right, bottom, top, near, far
+typedef struct Aabb { float min[3], max[3]; } Aabb;
+
+enum { CULL_OUTSIDE, CULL_INTERSECTS, CULL_INSIDE };
+
+typedef struct BvhNode
+{
+    Aabb box;      // around every object below this node
+    int first;     // its objects are items[first .. first + count - 1]
+    int count;
+    int left;      // first child (the second is left + 1), -1 for a leaf
+} BvhNode;
+
+typedef struct Bvh
+{
+    BvhNode *nodes;
+    int node_count;
+    int *items;    // object indices, ordered so every node's objects are in one piece
+    int item_count;
+} Bvh;
+
+typedef struct CullStats
+{
+    long visible;       // objects sent to OpenGL
+    long culled;        // objects skipped
+    long boxes_tested;  // box vs frustum tests it took
+} CullStats;
+
+static inline Frustum frustum_from_matrix(const mat4 *m)
+{
+    // m = Projection * ModelView (column-major). Row i of m is (m[i], m[4+i], m[8+i], m[12+i]),
+    // and -w <= x <= w is "row 3 + row 0 >= 0" and "row 3 - row 0 >= 0", same for y and z.
+    Frustum f;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f, length;
+        Plane *p = &f.planes[i];
+        p->a = m->m[3] + sign * m->m[row];
+        p->b = m->m[7] + sign * m->m[4 + row];
+        p->c = m->m[11] + sign * m->m[8 + row];
+        p->d = m->m[15] + sign * m->m[12 + row];
+        // normalized, so a*x + b*y + c*z + d is the actual distance to the plane
+        length = sqrtf(p->a * p->a + p->b * p->b + p->c * p->c);
+        if (length > 0)
+        {
+            p->a /= length; p->b /= length; p->c /= length; p->d /= length;
+        }
+    }
+    return f;
+}
+
+static inline int frustum_test_aabb(const Frustum *f, const Aabb *box, int *plane_mask)
+{
+    // CULL_OUTSIDE, CULL_INSIDE or CULL_INTERSECTS. plane_mask has a bit for every plane the box
+    // still crosses: the children of a box are inside it, so they can skip the planes it was
+    // already fully inside of.
+    float cx = (box->min[0] + box->max[0]) * 0.5f, ex = (box->max[0] - box->min[0]) * 0.5f;
+    float cy = (box->min[1] + box->max[1]) * 0.5f, ey = (box->max[1] - box->min[1]) * 0.5f;
+    float cz = (box->min[2] + box->max[2]) * 0.5f, ez = (box->max[2] - box->min[2]) * 0.5f;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        const Plane *p = &f->planes[i];
+        float distance, radius;
+        if (!(*plane_mask & (1 << i))) continue;
+        distance = p->a * cx + p->b * cy + p->c * cz + p->d;
+        radius = fabsf(p->a) * ex + fabsf(p->b) * ey + fabsf(p->c) * ez;
+        if (distance < -radius) return CULL_OUTSIDE;
+        if (distance > radius) *plane_mask &= ~(1 << i);
+    }
+    return *plane_mask ? CULL_INTERSECTS : CULL_INSIDE;
+}
+
+static inline void aabb_merge(Aabb *into, const Aabb *box)
+{
+    int k;
+    for (k = 0; k < 3; k++)
+    {
+        if (box->min[k] < into->min[k]) into->min[k] = box->min[k];
+        if (box->max[k] > into->max[k]) into->max[k] = box->max[k];
+    }
+}
+
+static const Aabb *bvh_sort_boxes; // (qsort has no "user data" argument)
+static int bvh_sort_axis;
+
+static inline int bvh_compare_centers(const void *a, const void *b)
+{
+    const Aabb *box_a = &bvh_sort_boxes[*(const int *)a], *box_b = &bvh_sort_boxes[*(const int *)b];
+    float center_a = box_a->min[bvh_sort_axis] + box_a->max[bvh_sort_axis];
+    float center_b = box_b->min[bvh_sort_axis] + box_b->max[bvh_sort_axis];
+    return (center_a > center_b) - (center_a < center_b);
+}
+
+static inline void bvh_build_node(Bvh *bvh, const Aabb *boxes, int node_index)
+{
+    BvhNode *node = &bvh->nodes[node_index];
+    float center_min[3], center_max[3], widest = -1;
+    int i, k, first = node->first, count = node->count, half;
+
+    node->box = boxes[bvh->items[first]];
+    for (k = 0; k < 3; k++) center_min[k] = center_max[k] = boxes[bvh->items[first]].min[k] + boxes[bvh->items[first]].max[k];
+    for (i = first + 1; i < first + count; i++)
+    {
+        const Aabb *box = &boxes[bvh->items[i]];
+        aabb_merge(&node->box, box);
+        for (k = 0; k < 3; k++)
+        {
+            float center = box->min[k] + box->max[k];
+            if (center < center_min[k]) center_min[k] = center;
+            if (center > center_max[k]) center_max[k] = center;
+        }
+    }
+    node->left = -1;
+    if (count <= BVH_LEAF_SIZE) return;
+
+    // split along the axis the object centers spread the most, half of the objects each side
+    for (k = 0; k < 3; k++)
+        if (center_max[k] - center_min[k] > widest)
+        {
+            widest = center_max[k] - center_min[k];
+            bvh_sort_axis = k;
+        }
+    bvh_sort_boxes = boxes;
+    qsort(bvh->items + first, count, sizeof(int), bvh_compare_centers);
+
+    half = count / 2;
+    node->left = bvh->node_count;
+    bvh->node_count += 2;
+    bvh->nodes[node->left].first = first;
+    bvh->nodes[node->left].count = half;
+    bvh->nodes[node->left + 1].first = first + half;
+    bvh->nodes[node->left + 1].count = count - half;
+    bvh_build_node(bvh, boxes, node->left);
+    bvh_build_node(bvh, boxes, node->left + 1);
+}
+
+static inline void bvh_build(Bvh *bvh, const Aabb *boxes, int count)
+{
+    // Builds the hierarchy over boxes[0 .. count - 1] (for objects that don't move).
+    int i;
+    memset(bvh, 0, sizeof(*bvh));
+    if (count <= 0) return;
+    bvh->item_count = count;
+    bvh->items = (int *)malloc(sizeof(int) * count);
+    bvh->nodes = (BvhNode *)malloc(sizeof(BvhNode) * 2 * count); // a binary tree never has more than 2n - 1 nodes
+    for (i = 0; i < count; i++) bvh->items[i] = i;
+    bvh->node_count = 1;
+    bvh->nodes[0].first = 0;
+    bvh->nodes[0].count = count;
+    bvh_build_node(bvh, boxes, 0);
+}
+
+static inline int bvh_cull(const Bvh *bvh, const Aabb *boxes, const Frustum *f, int *visible, CullStats *stats)
+{
+    // Writes the indices of the objects in (or partly in) the frustum to visible[] and returns
+    // how many there are. visible needs room for all objects.
+    int stack[64], masks[64], depth = 0, count = 0;
+    if (bvh->node_count == 0) return 0;
+    stack[depth] = 0;
+    masks[depth++] = 0x3f;
+    while (depth > 0)
+    {
+        const BvhNode *node;
+        int mask, result, i;
+        depth--;
+        node = &bvh->nodes[stack[depth]];
+        mask = masks[depth];
+        stats->boxes_tested++;
+        result = frustum_test_aabb(f, &node->box, &mask);
+        if (result == CULL_OUTSIDE) continue;
+        if (result == CULL_INSIDE)
+        {
+            memcpy(visible + count, bvh->items + node->first, sizeof(int) * node->count);
+            count += node->count;
+        }
+        else if (node->left < 0)
+        {
+            // a leaf that crosses a plane: test its few objects one by one
+            for (i = node->first; i < node->first + node->count; i++)
+            {
+                int object_mask = mask;
+                stats->boxes_tested++;
+                if (frustum_test_aabb(f, &boxes[bvh->items[i]], &object_mask) != CULL_OUTSIDE) visible[count++] = bvh->items[i];
+            }
+        }
+        else
+        {
+            stack[depth] = node->left + 1; masks[depth++] = mask;
+            stack[depth] = node->left;     masks[depth++] = mask;
+        }
+    }
+    stats->visible += count;
+    stats->culled += bvh->item_count - count;
+    return count;
+}
+
+static inline void bvh_free(Bvh *bvh)
+{
+    free(bvh->nodes);
+    free(bvh->items);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+#endif
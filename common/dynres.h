@@ -0,0 +1,320 @@
+#ifndef COMMON_DYNRES_H
+#define COMMON_DYNRES_H
+
+/*
+- ***** A Note on Dynamic Resolution *****
+  Most of what a frame costs on the GPU is per pixel, so the same scene at 3840x2160 costs about
+  33 times what it costs at 500x500. Rather than letting the frame rate drop when the window
+  gets big, we can draw fewer pixels and stretch the picture to the window:
+  1. The scene is drawn into an offscreen framebuffer (FBO), into its bottom left
+     scale * width x scale * height pixels. The demo's reshape() is told that smaller size, so
+     its viewport and projection match. The aspect ratio stays the window's, the scale is the
+     same in x and y. A scissor rectangle keeps glClear to those pixels too. The FBO itself is
+     as big as the window, so a new scale is only a new rectangle, nothing is allocated. At
+     scale 1 the scene goes straight to the window as usual, there is nothing to stretch.
+  2. At the end of the frame glBlitFramebuffer stretches those pixels over the whole window
+     (GL_LINEAR: each window pixel mixes the 4 nearest scene pixels).
+  3. Two timestamp queries (glQueryCounter) around the frame tell how long the GPU took. The
+     result arrives a few frames later, so we keep a small ring of them and never wait.
+     The frame's time is the longer of that and the CPU's time from the start of the frame to
+     the end (not counting the wait for vsync). A GPU works next to the CPU, so whichever is
+     slower sets the frame rate. Mesa's llvmpipe does part of the "GPU" work on the calling
+     thread while drawing, so there the timestamps alone see only part of the frame.
+  4. A controller picks the next scale, in steps of 0.05. It remembers what a frame cost at every
+     scale it has been at (the average of its last frames there), and:
+     - goes back up to a higher scale that was no slower than this one. Drawing fewer pixels
+       isn't free (the stretch in 2. costs too), and if it doesn't pay off the full picture is
+       the better deal.
+     - goes down when the frames take longer than the target. Pixels go with scale^2, so the
+       scale that would hit the target is about scale * sqrt(target / time): it moves halfway
+       there. Unless a lower scale was already measured less than 10% faster than this one: then
+       the ones in between won't pay off either.
+     - goes up when the frames take less than 80% of the target, but not to a scale that was
+       measured over the target.
+     In between it stays put, and the first few frames at a new scale aren't measured (they pay
+     for the change), so it settles instead of bouncing between two scales.
+
+  Note: A smaller scale only helps when the pixels are what costs. If the frame is slow for any
+        other reason (lots of draw calls, a slow update()), the scale goes down until it sees
+        that didn't help, and comes back up.
+
+  --dynamic-res MS turns it on with a target time per frame, --min-scale F (default 0.5)
+  says how far down it may go, --res-log prints the scale and time of every measured frame.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "gl_ext.h"
+#include "gl_dispatch.h"
+#include "clock.h"
+
+#define DYNRES_QUERIES 4     // frames whose timestamps can be in flight
+#define DYNRES_STEP 0.05f    // the scale moves in steps of this
+#define DYNRES_LEVELS 21     // scales 0, 0.05, .. 1
+#define DYNRES_SETTLE 2      // frames at a new scale that aren't measured
+#define DYNRES_SAMPLES 4     // frames measured at a scale before the controller moves on
+#define DYNRES_HEADROOM 0.8  // up only when the frames take less than this much of the target
+#define DYNRES_GAIN 0.9      // down only to scales measured faster than this much of the frame
+
+typedef struct DynRes
+{
+    int enabled;
+    double target_ms;
+    float min_scale;
+    int log;                 // print every measured frame
+
+    float scale;             // of the window's width and height
+    int window_width, window_height;
+    int width, height;       // what the scene is drawn at
+    GLuint fbo, color_rb, depth_rb;
+    int fbo_width, fbo_height;
+    GLuint present_fbo;      // where the stretched picture goes (0 = the window)
+
+    GLuint queries[DYNRES_QUERIES][2]; // timestamps at the start and the end of a frame
+    float query_scale[DYNRES_QUERIES]; // the scale that frame was drawn at
+    double query_cpu_ms[DYNRES_QUERIES]; // and how long it took the CPU
+    int query_head, query_count;
+    int query_open;          // the start of this frame was timed
+    int query_pending;       // the end too, waiting for dynres_frame_done()
+    int scaled;              // this frame is drawn into the FBO
+    uint64_t cpu_start;
+    float cost_ms[DYNRES_LEVELS]; // a frame's time at each scale (index: scale / DYNRES_STEP), 0 = not measured
+    int measured;            // frames at this scale since the last change
+
+    long frames;             // measured
+    long over;               // of those, over the target
+    long changes;
+    double ms_sum, scale_sum;
+    float lowest, highest;
+} DynRes;
+
+static DynRes dynres;
+
+static inline void dynres_setup(double target_ms, float min_scale, int log)
+{
+    // (from the command line, before there is a context)
+    memset(&dynres, 0, sizeof(dynres));
+    dynres.enabled = 1;
+    dynres.target_ms = target_ms;
+    dynres.min_scale = min_scale;
+    dynres.log = log;
+    dynres.scale = dynres.lowest = dynres.highest = 1;
+}
+
+static inline int dynres_create(GLuint present_fbo)
+{
+    // Needs the context and the functions of common/gl_ext.h. Returns 0 if they're not there.
+    if (!GLEXT_HAVE(glGenFramebuffers) || !GLEXT_HAVE(glBlitFramebuffer) || !GLEXT_HAVE(glQueryCounter))
+    {
+        fprintf(stderr, "--dynamic-res needs OpenGL 3.3\n");
+        return 0;
+    }
+    dynres.present_fbo = present_fbo;
+    glGenFramebuffers(1, &dynres.fbo);
+    glGenQueries(DYNRES_QUERIES * 2, &dynres.queries[0][0]);
+    return 1;
+}
+
+static inline void dynres_update_size(void)
+{
+    dynres.width = (int)(dynres.window_width * dynres.scale + 0.5f);
+    dynres.height = (int)(dynres.window_height * dynres.scale + 0.5f);
+    if (dynres.width < 1) dynres.width = 1;
+    if (dynres.height < 1) dynres.height = 1;
+}
+
+static inline void dynres_resize(int width, int height)
+{
+    // The window is now width x height: the FBO is made as big (the scene never needs more).
+    dynres.window_width = width > 0 ? width : 1;
+    dynres.window_height = height > 0 ? height : 1;
+    dynres_update_size();
+    if (dynres.scaled) glScissor(0, 0, dynres.width, dynres.height); // (in the middle of a frame)
+    if (dynres.fbo_width == dynres.window_width && dynres.fbo_height == dynres.window_height) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, dynres.fbo);
+    glDeleteRenderbuffers(1, &dynres.color_rb);
+    glDeleteRenderbuffers(1, &dynres.depth_rb);
+    glGenRenderbuffers(1, &dynres.color_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, dynres.color_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, dynres.window_width, dynres.window_height);
+    glGenRenderbuffers(1, &dynres.depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, dynres.depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, dynres.window_width, dynres.window_height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, dynres.color_rb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dynres.depth_rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "dynamic resolution: the framebuffer is incomplete\n");
+    dynres.fbo_width = dynres.window_width;
+    dynres.fbo_height = dynres.window_height;
+
+    // One clear and one stretch right away: the driver may only really allocate the memory (and
+    // set up the blit) the first time they're used, and that shouldn't land on the first scaled frame.
+    // (The window's picture is overwritten, but the frame hasn't been drawn yet.)
+    gl_dispatch_hw.Disable(GL_SCISSOR_TEST);
+    gl_dispatch_hw.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dynres.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dynres.present_fbo);
+    glBlitFramebuffer(0, 0, dynres.fbo_width / 2, dynres.fbo_height / 2, 0, 0, dynres.fbo_width, dynres.fbo_height,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    if (dynres.scaled) gl_dispatch_hw.Enable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, dynres.scaled ? dynres.fbo : dynres.present_fbo);
+}
+
+static inline void dynres_begin_frame(void)
+{
+    // Before the frame's first draw: into the FBO (if it's scaled down), start timing (unless all
+    // queries are busy).
+    dynres.scaled = dynres.scale < 1;
+    if (dynres.scaled)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, dynres.fbo);
+        glScissor(0, 0, dynres.width, dynres.height);
+        gl_dispatch_hw.Enable(GL_SCISSOR_TEST); // (the real one: glEnable is the demo's, see common/gl_dispatch.h)
+    }
+    dynres.cpu_start = clock_now_ns();
+    dynres.query_open = dynres.query_count < DYNRES_QUERIES;
+    if (!dynres.query_open) return;
+    glQueryCounter(dynres.queries[(dynres.query_head + dynres.query_count) % DYNRES_QUERIES][0], GL_TIMESTAMP);
+}
+
+static inline float *dynres_cost(float scale)
+{
+    return &dynres.cost_ms[(int)(scale / DYNRES_STEP + 0.5f)];
+}
+
+static inline float dynres_round(float scale)
+{
+    // To a whole step, between --min-scale and 1.
+    scale = floorf(scale / DYNRES_STEP + 0.5f) * DYNRES_STEP;
+    if (scale < dynres.min_scale) scale = dynres.min_scale;
+    if (scale > 1) scale = 1;
+    return scale;
+}
+
+static inline int dynres_control(double ms, float scale)
+{
+    // One more measured frame (drawn at scale). Returns 1 if the scale changed.
+    float *cost, wanted, higher;
+    dynres.frames++;
+    dynres.ms_sum += ms;
+    dynres.scale_sum += scale;
+    if (ms > dynres.target_ms) dynres.over++;
+    if (dynres.log) printf("dynamic resolution: scale %.2f (%dx%d), %.3f ms\n", scale,
+                           (int)(dynres.window_width * scale + 0.5f), (int)(dynres.window_height * scale + 0.5f), ms);
+    if (scale != dynres.scale) return 0; // (drawn before the last change, says nothing about the new scale)
+    if (++dynres.measured <= DYNRES_SETTLE) return 0;
+    cost = dynres_cost(scale);
+    if (*cost > 0 && ms > *cost * 2) ms = *cost * 2; // (one hiccup moves the average a little, not a lot)
+    *cost = *cost > 0 ? *cost * 0.75f + (float)ms * 0.25f : (float)ms;
+    if (dynres.measured < DYNRES_SETTLE + DYNRES_SAMPLES) return 0;
+
+    // Back up to the highest scale that was no slower...
+    wanted = scale;
+    for (higher = 1; higher > scale + DYNRES_STEP / 2; higher -= DYNRES_STEP)
+    {
+        if (*dynres_cost(higher) > 0 && *dynres_cost(higher) <= *cost)
+        {
+            wanted = dynres_round(higher);
+            break;
+        }
+    }
+    // ...or down, over the target...
+    if (wanted == scale && *cost > dynres.target_ms)
+    {
+        float lower;
+        wanted = dynres_round(scale + (scale * (float)sqrt(dynres.target_ms / *cost) - scale) * 0.5f);
+        for (lower = scale - DYNRES_STEP; lower > DYNRES_STEP / 2; lower -= DYNRES_STEP)
+            if (*dynres_cost(lower) > 0 && *dynres_cost(lower) >= *cost * DYNRES_GAIN) wanted = scale; // (a lower one didn't pay off)
+    }
+    // ...or up, well under it.
+    else if (wanted == scale && *cost < dynres.target_ms * DYNRES_HEADROOM)
+    {
+        wanted = dynres_round(scale + (scale * (float)sqrt(dynres.target_ms / *cost) - scale) * 0.5f);
+        while (wanted > scale + DYNRES_STEP / 2 && *dynres_cost(wanted) > dynres.target_ms)
+            wanted = dynres_round(wanted - DYNRES_STEP);
+    }
+    if (fabsf(wanted - scale) < DYNRES_STEP / 2) return 0;
+
+    dynres.scale = wanted;
+    *dynres_cost(wanted) = 0; // (measured anew, the scene may have changed since)
+    dynres.measured = 0;
+    dynres.changes++;
+    if (wanted < dynres.lowest) dynres.lowest = wanted;
+    if (wanted > dynres.highest) dynres.highest = wanted;
+    dynres_update_size();
+    return 1;
+}
+
+static inline void dynres_end_frame(void)
+{
+    // After the frame's last draw: stretches it over present_fbo (and leaves that bound).
+    if (dynres.scaled)
+    {
+        gl_dispatch_hw.Disable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, dynres.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dynres.present_fbo);
+        glBlitFramebuffer(0, 0, dynres.width, dynres.height, 0, 0, dynres.window_width, dynres.window_height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, dynres.present_fbo);
+    }
+    if (!dynres.query_open) return;
+    glQueryCounter(dynres.queries[(dynres.query_head + dynres.query_count) % DYNRES_QUERIES][1], GL_TIMESTAMP);
+    dynres.query_open = 0;
+    dynres.query_pending = 1;
+}
+
+static inline int dynres_frame_done(void)
+{
+    // When the CPU is done with the frame (before the swap, which may wait for vsync, or after
+    // glFinish headless). Feeds the frame times that came in meanwhile to the controller.
+    // Returns 1 if the scale changed: the demo's reshape() has to hear about the new size
+    // before the next frame.
+    int changed = 0;
+    if (dynres.query_pending)
+    {
+        int slot = (dynres.query_head + dynres.query_count) % DYNRES_QUERIES;
+        dynres.query_scale[slot] = dynres.scale;
+        dynres.query_cpu_ms[slot] = clock_ns_to_ms(clock_now_ns() - dynres.cpu_start);
+        dynres.query_count++;
+        dynres.query_pending = 0;
+    }
+    while (dynres.query_count > 0)
+    {
+        GLuint *pair = dynres.queries[dynres.query_head];
+        GLint available = 0;
+        GLuint64 start, end;
+        double ms;
+        glGetQueryObjectiv(pair[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        glGetQueryObjectui64v(pair[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(pair[1], GL_QUERY_RESULT, &end);
+        ms = clock_ns_to_ms(end - start);
+        if (dynres.query_cpu_ms[dynres.query_head] > ms) ms = dynres.query_cpu_ms[dynres.query_head];
+        changed |= dynres_control(ms, dynres.query_scale[dynres.query_head]);
+        dynres.query_head = (dynres.query_head + 1) % DYNRES_QUERIES;
+        dynres.query_count--;
+    }
+    return changed;
+}
+
+static inline void dynres_report(FILE *out)
+{
+    if (!dynres.enabled || dynres.frames == 0) return;
+    fprintf(out, "dynamic resolution: target %.2f ms | %.3f ms per frame, %.0f%% over target | scale %.2f on average (%.2f .. %.2f), %ld changes\n",
+            dynres.target_ms, dynres.ms_sum / dynres.frames, 100.0 * dynres.over / dynres.frames,
+            dynres.scale_sum / dynres.frames, dynres.lowest, dynres.highest, dynres.changes);
+}
+
+static inline void dynres_destroy(void)
+{
+    if (!dynres.fbo) return;
+    glDeleteFramebuffers(1, &dynres.fbo);
+    glDeleteRenderbuffers(1, &dynres.color_rb);
+    glDeleteRenderbuffers(1, &dynres.depth_rb);
+    glDeleteQueries(DYNRES_QUERIES * 2, &dynres.queries[0][0]);
+    dynres.fbo = dynres.color_rb = dynres.depth_rb = 0;
+}
+
+#endif
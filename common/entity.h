@@ -0,0 +1,337 @@
+#ifndef COMMON_ENTITY_H
+#define COMMON_ENTITY_H
+
+/*
+- ***** A Note on Structure of Arrays *****
+  The natural way to keep many moving things is an array of structs ("AoS"):
+    struct { float x, prev_x, y, speed; int state, color_counter; } sprites[N];
+  But the update only needs x, speed and state. With AoS the CPU still loads whole structs
+  (the memory moves in 64 byte cache lines), so most of every line is fields we don't touch,
+  and SIMD can't load "the x of 8 sprites" in one go because they are 24 bytes apart.
+  A structure of arrays ("SoA") keeps every field in its own array:
+    float x[N]; float speed[N]; ...
+  Now the update streams through exactly the bytes it needs, and x[i .. i+7] is one AVX load.
+
+  The fields here:
+  - position:    the coordinate that bounces (x in 2D, z in 3D). There are 3 copies ("buffers")
+                 used in turn: the update reads the current one and writes the next one, then
+                 entity_swap() makes that the current one. So the one before stays around for the
+                 interpolation (no prev_x copy), and display() can draw from the current and
+                 previous ones while other threads already write the next update into the
+                 third (see update_sprites() in OpenGL_2D_Tutorial.c).
+  - other:       the coordinate that doesn't move (y).
+  - speed:       how far it moves per update (always > 0, the direction says which way).
+  - direction:   1 bit per entity ("direction flags"), 1 = towards high. 8 entities per byte.
+  - color_phase: where in the 31-step red/green/blue cycle of the tutorials it started. The cycle
+                 moves one step per update for everybody, so the color is (color_phase + ticks) % 31
+                 and nothing has to be written for it.
+  - angle:       (optional) 3 buffers like position, turning by spin degrees per update.
+
+- ***** A Note on Branch-Free Updates *****
+  The tutorials bounce with if/else: "if (x < 7) x += 0.30; else state = -1;". With millions of
+  entities at random places that branch is unpredictable, and SIMD can't branch per lane anyway.
+  So both sides are computed for 8 entities at once and the right one is picked with a mask
+  (a compare gives all-1 bits where it is true):
+    can_move = moving_right ? (x < high) : (x > low)
+    x        = x + (can_move AND velocity)           (adds 0 where it can't move)
+    moving_right = moving_right XOR (NOT can_move)   (turns around where it couldn't)
+  The two bounce styles of the tutorials:
+  - ENTITY_BOUNCE_HOLD (2D demo): move while inside the limits, at a limit turn around without
+    moving for that step.
+  - ENTITY_BOUNCE_TURN (3D demo): first turn around if past a limit, then always move.
+  AVX2 does 8 entities per instruction (compile with -mavx2 or -march=native), SSE2 4, and a
+  plain C loop is used without either. They all give exactly the same numbers.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#define ENTITY_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define ENTITY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(ENTITY_AVX2)
+#define ENTITY_SIMD_NAME "AVX2"
+#elif defined(ENTITY_SSE2)
+#define ENTITY_SIMD_NAME "SSE2"
+#else
+#define ENTITY_SIMD_NAME "scalar"
+#endif
+
+#define ENTITY_GROUP 8        // entities per direction byte; the arrays are padded to a multiple of it
+#define ENTITY_COLOR_STEPS 31 // color_counter 0..30 in the tutorials
+#define ENTITY_BUFFERS 3      // previous, current, next
+#define ENTITY_CHUNK 16384    // entities per job when the update is spread over threads (common/jobs.h)
+
+enum { ENTITY_BOUNCE_HOLD, ENTITY_BOUNCE_TURN };
+
+typedef struct EntityStore
+{
+    int count;             // entities
+    int capacity;          // count rounded up to ENTITY_GROUP (the padding entities never move)
+    int bounce;            // ENTITY_BOUNCE_*
+    float low, high;       // the limits position bounces between
+    float *position[ENTITY_BUFFERS]; // position[current] = now, the one before = one update ago
+    int current;
+    float *other;
+    float *speed;
+    uint8_t *direction;    // bit i % 8 of direction[i / 8]
+    uint8_t *color_phase;
+    float *angle[ENTITY_BUFFERS];    // (NULL without spin)
+    float *spin;
+    long ticks;            // updates so far
+} EntityStore;
+
+static inline void *entity_alloc(size_t bytes)
+{
+    // 64 byte aligned (a cache line, and what AVX loads like best), zeroed.
+    void *p = NULL;
+#ifdef _WIN32
+    p = _aligned_malloc(bytes, 64);
+#else
+    if (posix_memalign(&p, 64, bytes) != 0) p = NULL;
+#endif
+    if (p) memset(p, 0, bytes);
+    return p;
+}
+
+static inline void entity_free_block(void *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static inline void entity_store_init(EntityStore *store, int count, int bounce, float low, float high, int with_spin)
+{
+    // Room for count entities, all at low, not moving (speed 0), until they are set up.
+    int capacity = (count + ENTITY_GROUP - 1) / ENTITY_GROUP * ENTITY_GROUP, b;
+    memset(store, 0, sizeof(*store));
+    store->count = count;
+    store->capacity = capacity;
+    store->bounce = bounce;
+    store->low = low;
+    store->high = high;
+    for (b = 0; b < ENTITY_BUFFERS; b++) store->position[b] = (float *)entity_alloc(sizeof(float) * capacity);
+    store->other = (float *)entity_alloc(sizeof(float) * capacity);
+    store->speed = (float *)entity_alloc(sizeof(float) * capacity);
+    store->direction = (uint8_t *)entity_alloc(capacity / ENTITY_GROUP);
+    store->color_phase = (uint8_t *)entity_alloc(capacity);
+    if (with_spin)
+    {
+        for (b = 0; b < ENTITY_BUFFERS; b++) store->angle[b] = (float *)entity_alloc(sizeof(float) * capacity);
+        store->spin = (float *)entity_alloc(sizeof(float) * capacity);
+    }
+}
+
+static inline void entity_store_free(EntityStore *store)
+{
+    int b;
+    for (b = 0; b < ENTITY_BUFFERS; b++)
+    {
+        entity_free_block(store->position[b]);
+        entity_free_block(store->angle[b]);
+    }
+    entity_free_block(store->other);
+    entity_free_block(store->speed);
+    entity_free_block(store->direction);
+    entity_free_block(store->color_phase);
+    entity_free_block(store->spin);
+    memset(store, 0, sizeof(*store));
+}
+
+static inline void entity_set(EntityStore *store, int i, float position, float other, float speed, int towards_high, int color_phase)
+{
+    // Sets up entity i (in every buffer, so it doesn't jump in the first interpolation).
+    int b;
+    for (b = 0; b < ENTITY_BUFFERS; b++) store->position[b][i] = position;
+    store->other[i] = other;
+    store->speed[i] = speed;
+    if (towards_high) store->direction[i / ENTITY_GROUP] |= (uint8_t)(1 << (i % ENTITY_GROUP));
+    else store->direction[i / ENTITY_GROUP] &= (uint8_t)~(1 << (i % ENTITY_GROUP));
+    store->color_phase[i] = (uint8_t)(color_phase % ENTITY_COLOR_STEPS);
+}
+
+// current is switched by entity_swap() on one thread and read by the update jobs on others: its
+// RELEASE store and the ACQUIRE load here pair up, so whoever sees the new buffer index also sees
+// the positions that were written into that buffer.
+static inline int entity_current(const EntityStore *store) { return __atomic_load_n(&store->current, __ATOMIC_ACQUIRE); }
+static inline int entity_next(const EntityStore *store) { return (entity_current(store) + 1) % ENTITY_BUFFERS; }
+static inline int entity_prev(const EntityStore *store) { return (entity_current(store) + ENTITY_BUFFERS - 1) % ENTITY_BUFFERS; }
+static inline float entity_position(const EntityStore *store, int i) { return store->position[entity_current(store)][i]; }
+static inline float entity_prev_position(const EntityStore *store, int i) { return store->position[entity_prev(store)][i]; }
+static inline int entity_towards_high(const EntityStore *store, int i) { return (store->direction[i / ENTITY_GROUP] >> (i % ENTITY_GROUP)) & 1; }
+
+static inline int entity_color_step(const EntityStore *store, int i)
+{
+    // 0..30, what color_counter would be for this entity (0-9 red, 10-19 green, 20-30 blue).
+    return (int)((store->color_phase[i] + store->ticks) % ENTITY_COLOR_STEPS);
+}
+
+/* ***** The update kernels ***** */
+
+static inline void entity_update_scalar(EntityStore *store, int first, int last)
+{
+    // The plain C version, one entity at a time (still without branches on the data).
+    const float *in = store->position[entity_current(store)];
+    float *out = store->position[entity_next(store)];
+    float low = store->low, high = store->high;
+    int i;
+    for (i = first; i < last; i++)
+    {
+        uint8_t *flags = &store->direction[i / ENTITY_GROUP];
+        int bit = 1 << (i % ENTITY_GROUP);
+        int right = (*flags & bit) != 0;
+        float x = in[i];
+        if (store->bounce == ENTITY_BOUNCE_HOLD)
+        {
+            int can_move = right ? x < high : x > low;
+            out[i] = x + (can_move ? (right ? store->speed[i] : -store->speed[i]) : 0.0f);
+            right ^= !can_move;
+        }
+        else
+        {
+            right = (x < low) | (right & !(x > high));
+            out[i] = x + (right ? store->speed[i] : -store->speed[i]);
+        }
+        *flags = (uint8_t)(right ? (*flags | bit) : (*flags & ~bit));
+    }
+    if (store->spin)
+    {
+        const float *angle_in = store->angle[entity_current(store)];
+        float *angle_out = store->angle[entity_next(store)];
+        for (i = first; i < last; i++) angle_out[i] = angle_in[i] - (angle_in[i] > 360 ? 360.0f : 0.0f) + store->spin[i];
+    }
+}
+
+#if defined(ENTITY_AVX2)
+static inline void entity_update_simd(EntityStore *store, int first, int last)
+{
+    // 8 entities per step: one direction byte <-> an 8 lane mask.
+    const float *in = store->position[entity_current(store)];
+    float *out = store->position[entity_next(store)];
+    const __m256 low = _mm256_set1_ps(store->low), high = _mm256_set1_ps(store->high);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 full = _mm256_set1_ps(360);
+    const float *angle_in = store->angle[entity_current(store)];
+    float *angle_out = store->angle[entity_next(store)];
+    int i;
+    for (i = first; i < last; i += 8)
+    {
+        __m256 x = _mm256_load_ps(in + i), speed = _mm256_load_ps(store->speed + i);
+        __m256i bits = _mm256_set1_epi32(store->direction[i / 8]);
+        __m256 right = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, lane_bits), lane_bits));
+        __m256 velocity;
+        if (store->bounce == ENTITY_BOUNCE_HOLD)
+        {
+            __m256 can_move = _mm256_blendv_ps(_mm256_cmp_ps(x, low, _CMP_GT_OQ), _mm256_cmp_ps(x, high, _CMP_LT_OQ), right);
+            velocity = _mm256_xor_ps(speed, _mm256_andnot_ps(right, sign)); // -speed where moving left
+            x = _mm256_add_ps(x, _mm256_and_ps(can_move, velocity));
+            right = _mm256_xor_ps(right, _mm256_andnot_ps(can_move, _mm256_castsi256_ps(_mm256_set1_epi32(-1))));
+        }
+        else
+        {
+            right = _mm256_or_ps(_mm256_cmp_ps(x, low, _CMP_LT_OQ), _mm256_andnot_ps(_mm256_cmp_ps(x, high, _CMP_GT_OQ), right));
+            velocity = _mm256_xor_ps(speed, _mm256_andnot_ps(right, sign));
+            x = _mm256_add_ps(x, velocity);
+        }
+        _mm256_store_ps(out + i, x);
+        store->direction[i / 8] = (uint8_t)_mm256_movemask_ps(right);
+        if (store->spin)
+        {
+            // (in the same loop: one pass over memory instead of two)
+            __m256 a = _mm256_load_ps(angle_in + i);
+            a = _mm256_sub_ps(a, _mm256_and_ps(_mm256_cmp_ps(a, full, _CMP_GT_OQ), full));
+            _mm256_store_ps(angle_out + i, _mm256_add_ps(a, _mm256_load_ps(store->spin + i)));
+        }
+    }
+}
+#elif defined(ENTITY_SSE2)
+static inline __m128 entity_blend_ps(__m128 a, __m128 b, __m128 mask)
+{
+    // b where mask, a elsewhere (SSE2 has no blendv)
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+static inline void entity_update_simd(EntityStore *store, int first, int last)
+{
+    // 4 entities per step, so every direction byte is two halves.
+    const float *in = store->position[entity_current(store)];
+    float *out = store->position[entity_next(store)];
+    const __m128 low = _mm_set1_ps(store->low), high = _mm_set1_ps(store->high);
+    const __m128 sign = _mm_set1_ps(-0.0f), all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    const __m128i lane_bits[2] = { _mm_setr_epi32(1, 2, 4, 8), _mm_setr_epi32(16, 32, 64, 128) };
+    const __m128 full = _mm_set1_ps(360);
+    const float *angle_in = store->angle[entity_current(store)];
+    float *angle_out = store->angle[entity_next(store)];
+    int i, half;
+    for (i = first; i < last; i += 8)
+    {
+        __m128i bits = _mm_set1_epi32(store->direction[i / 8]);
+        int flags = 0;
+        for (half = 0; half < 2; half++)
+        {
+            int j = i + half * 4;
+            __m128 x = _mm_load_ps(in + j), speed = _mm_load_ps(store->speed + j), velocity;
+            __m128 right = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, lane_bits[half]), lane_bits[half]));
+            if (store->bounce == ENTITY_BOUNCE_HOLD)
+            {
+                __m128 can_move = entity_blend_ps(_mm_cmpgt_ps(x, low), _mm_cmplt_ps(x, high), right);
+                velocity = _mm_xor_ps(speed, _mm_andnot_ps(right, sign));
+                x = _mm_add_ps(x, _mm_and_ps(can_move, velocity));
+                right = _mm_xor_ps(right, _mm_andnot_ps(can_move, all));
+            }
+            else
+            {
+                right = _mm_or_ps(_mm_cmplt_ps(x, low), _mm_andnot_ps(_mm_cmpgt_ps(x, high), right));
+                velocity = _mm_xor_ps(speed, _mm_andnot_ps(right, sign));
+                x = _mm_add_ps(x, velocity);
+            }
+            _mm_store_ps(out + j, x);
+            flags |= _mm_movemask_ps(right) << (half * 4);
+            if (store->spin)
+            {
+                // (in the same loop: one pass over memory instead of two)
+                __m128 a = _mm_load_ps(angle_in + j);
+                a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpgt_ps(a, full), full));
+                _mm_store_ps(angle_out + j, _mm_add_ps(a, _mm_load_ps(store->spin + j)));
+            }
+        }
+        store->direction[i / 8] = (uint8_t)flags;
+    }
+}
+#else
+#define entity_update_simd entity_update_scalar
+#endif
+
+static inline void entity_update_range(EntityStore *store, int first, int last)
+{
+    // Computes the next step of entities first .. last - 1 into the next buffer (first and last
+    // multiples of ENTITY_GROUP, or last = capacity). Doesn't swap: see entity_swap().
+    // Different ranges can run at the same time on different threads.
+    entity_update_simd(store, first, last);
+}
+
+static inline void entity_swap(EntityStore *store)
+{
+    // Makes the buffer the update just wrote the current one.
+    __atomic_store_n(&store->current, entity_next(store), __ATOMIC_RELEASE);
+    store->ticks++;
+}
+
+static inline void entity_update(EntityStore *store)
+{
+    // One step for every entity.
+    entity_update_range(store, 0, store->capacity);
+    entity_swap(store);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef COMMON_GL_DISPATCH_H
+#define COMMON_GL_DISPATCH_H
+
+/*
+- ***** A Note on the Dispatch Table *****
+  The tutorials talk to OpenGL through plain calls like glColor3f() or glVertex3f(). To be able to
+  send those same calls somewhere else (our own software rasterizer in common/swr.h for example),
+  every OpenGL function the tutorials use goes through a table of function pointers:
+    glColor3f(r, g, b)  ->  gl_dispatch->Color3f(r, g, b)
+  The #defines at the bottom of this file do that rewrite, so the tutorial code doesn't change at
+  all. By default the table points at the real OpenGL functions (gl_dispatch_hw), switching
+  gl_dispatch to another table switches every call at once.
+  This is the same trick real OpenGL drivers use internally (Mesa calls it "glapi").
+
+  Note: Only the fixed-function calls the tutorials use are in the table. Buffers, shaders, etc.
+        (common/gl_ext.h) always go straight to OpenGL. A fixed-function call that isn't in the
+        table would get past every layer behind it (the state cache wouldn't know the matrix
+        changed, a trace wouldn't have it), so a tutorial that needs a new one adds it here.
+*/
+
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+typedef struct GLDispatch
+{
+    void (APIENTRY *Clear)(GLbitfield mask);
+    void (APIENTRY *ClearColor)(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
+    void (APIENTRY *Enable)(GLenum cap);
+    void (APIENTRY *Disable)(GLenum cap);
+    void (APIENTRY *Viewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+    void (APIENTRY *MatrixMode)(GLenum mode);
+    void (APIENTRY *LoadIdentity)(void);
+    void (APIENTRY *LoadMatrixf)(const GLfloat *m);
+    void (APIENTRY *Translatef)(GLfloat x, GLfloat y, GLfloat z);
+    void (APIENTRY *Rotatef)(GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
+    void (APIENTRY *Scalef)(GLfloat x, GLfloat y, GLfloat z);
+    void (APIENTRY *PushMatrix)(void);
+    void (APIENTRY *PopMatrix)(void);
+    void (APIENTRY *Begin)(GLenum mode);
+    void (APIENTRY *End)(void);
+    void (APIENTRY *Vertex2f)(GLfloat x, GLfloat y);
+    void (APIENTRY *Vertex3f)(GLfloat x, GLfloat y, GLfloat z);
+    void (APIENTRY *Color3f)(GLfloat red, GLfloat green, GLfloat blue);
+    void (APIENTRY *Perspective)(GLdouble fovy, GLdouble aspect, GLdouble z_near, GLdouble z_far); // gluPerspective
+    void (APIENTRY *Ortho2D)(GLdouble left, GLdouble right, GLdouble bottom, GLdouble top);       // gluOrtho2D
+} GLDispatch;
+
+// The real OpenGL (+ GLU) functions.
+static const GLDispatch gl_dispatch_hw =
+{
+    glClear, glClearColor, glEnable, glDisable, glViewport, glMatrixMode, glLoadIdentity, glLoadMatrixf,
+    glTranslatef, glRotatef, glScalef, glPushMatrix, glPopMatrix, glBegin, glEnd, glVertex2f, glVertex3f, glColor3f,
+    gluPerspective, gluOrtho2D
+};
+
+// Where the calls below currently go.
+static const GLDispatch *gl_dispatch = &gl_dispatch_hw;
+
+#define glClear gl_dispatch->Clear
+#define glClearColor gl_dispatch->ClearColor
+#define glEnable gl_dispatch->Enable
+#define glDisable gl_dispatch->Disable
+#define glViewport gl_dispatch->Viewport
+#define glMatrixMode gl_dispatch->MatrixMode
+#define glLoadIdentity gl_dispatch->LoadIdentity
+#define glLoadMatrixf gl_dispatch->LoadMatrixf
+#define glTranslatef gl_dispatch->Translatef
+#define glRotatef gl_dispatch->Rotatef
+#define glScalef gl_dispatch->Scalef
+#define glPushMatrix gl_dispatch->PushMatrix
+#define glPopMatrix gl_dispatch->PopMatrix
+#define glBegin gl_dispatch->Begin
+#define glEnd gl_dispatch->End
+#define glVertex2f gl_dispatch->Vertex2f
+#define glVertex3f gl_dispatch->Vertex3f
+#define glColor3f gl_dispatch->Color3f
+#define gluPerspective gl_dispatch->Perspective
+#define gluOrtho2D gl_dispatch->Ortho2D
+
+#endif
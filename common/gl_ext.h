@@ -0,0 +1,217 @@
+#ifndef COMMON_GL_EXT_H
+#define COMMON_GL_EXT_H
+
+/*
+- ***** A Note on OpenGL Extensions *****
+  The header <GL/gl.h> (and the opengl32 library on Windows) only gives us the really old
+  OpenGL 1.1 functions like glBegin(), glVertex3f() and glColor3f(). Everything newer
+  (framebuffers, buffer objects, shaders, ...) has to be asked for at runtime: we ask the
+  driver "where does glGenFramebuffers live?" and it hands us back a function pointer.
+  This is what libraries like GLEW or glad do for you, here we do it by hand since we only
+  need a handful of functions.
+
+  Every function we need is listed ONCE in GL_EXT_FUNCTIONS below. The X-macro trick then
+  uses that list to declare a pointer for each function, to load each pointer and to
+  #define the normal GL name to the pointer, so the rest of the code just calls
+  glGenFramebuffers(...) like it would with any other GL function.
+
+  Getting a pointer back doesn't mean the function works, though: with Mesa, glutGetProcAddress
+  (glXGetProcAddress underneath) and eglGetProcAddress hand out a stub for ANY name that starts
+  with "gl", whatever the context supports. So next to each function the list says which OpenGL version made it core, and which
+  extension (if any, under the very same name) brings it to older versions. glext_load() reads
+  the context's GL_VERSION and extensions and drops the pointers the context doesn't really
+  have, and GLEXT_HAVE() can be trusted again.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+// X(type, name, version (major * 10 + minor) it's core in, extension that has it too or NULL)
+#define GL_EXT_FUNCTIONS(X) \
+    X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLFRAMEBUFFERRENDERBUFFERPROC, glFramebufferRenderbuffer, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLBLITFRAMEBUFFERPROC, glBlitFramebuffer, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLBINDRENDERBUFFERPROC, glBindRenderbuffer, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLRENDERBUFFERSTORAGEPROC, glRenderbufferStorage, 30, "GL_ARB_framebuffer_object") \
+    X(PFNGLGENBUFFERSPROC, glGenBuffers, 15, NULL) \
+    X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers, 15, NULL) \
+    X(PFNGLBINDBUFFERPROC, glBindBuffer, 15, NULL) \
+    X(PFNGLBUFFERDATAPROC, glBufferData, 15, NULL) \
+    X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays, 30, "GL_ARB_vertex_array_object") \
+    X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays, 30, "GL_ARB_vertex_array_object") \
+    X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray, 30, "GL_ARB_vertex_array_object") \
+    X(PFNGLBUFFERSUBDATAPROC, glBufferSubData, 15, NULL) \
+    X(PFNGLBUFFERSTORAGEPROC, glBufferStorage, 44, "GL_ARB_buffer_storage") \
+    X(PFNGLCREATESHADERPROC, glCreateShader, 20, NULL) \
+    X(PFNGLDELETESHADERPROC, glDeleteShader, 20, NULL) \
+    X(PFNGLSHADERSOURCEPROC, glShaderSource, 20, NULL) \
+    X(PFNGLCOMPILESHADERPROC, glCompileShader, 20, NULL) \
+    X(PFNGLGETSHADERIVPROC, glGetShaderiv, 20, NULL) \
+    X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog, 20, NULL) \
+    X(PFNGLCREATEPROGRAMPROC, glCreateProgram, 20, NULL) \
+    X(PFNGLDELETEPROGRAMPROC, glDeleteProgram, 20, NULL) \
+    X(PFNGLATTACHSHADERPROC, glAttachShader, 20, NULL) \
+    X(PFNGLBINDATTRIBLOCATIONPROC, glBindAttribLocation, 20, NULL) \
+    X(PFNGLLINKPROGRAMPROC, glLinkProgram, 20, NULL) \
+    X(PFNGLGETPROGRAMIVPROC, glGetProgramiv, 20, NULL) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog, 20, NULL) \
+    X(PFNGLUSEPROGRAMPROC, glUseProgram, 20, NULL) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation, 20, NULL) \
+    X(PFNGLUNIFORM1FPROC, glUniform1f, 20, NULL) \
+    X(PFNGLUNIFORMMATRIX4FVPROC, glUniformMatrix4fv, 20, NULL) \
+    X(PFNGLGETUNIFORMBLOCKINDEXPROC, glGetUniformBlockIndex, 31, "GL_ARB_uniform_buffer_object") \
+    X(PFNGLUNIFORMBLOCKBINDINGPROC, glUniformBlockBinding, 31, "GL_ARB_uniform_buffer_object") \
+    X(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange, 31, "GL_ARB_uniform_buffer_object") \
+    X(PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri, 41, "GL_ARB_get_program_binary") \
+    X(PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary, 41, "GL_ARB_get_program_binary") \
+    X(PFNGLPROGRAMBINARYPROC, glProgramBinary, 41, "GL_ARB_get_program_binary") \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer, 20, NULL) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray, 20, NULL) \
+    X(PFNGLDISABLEVERTEXATTRIBARRAYPROC, glDisableVertexAttribArray, 20, NULL) \
+    X(PFNGLVERTEXATTRIB3FPROC, glVertexAttrib3f, 20, NULL) \
+    X(PFNGLVERTEXATTRIBDIVISORPROC, glVertexAttribDivisor, 33, NULL) \
+    X(PFNGLDRAWELEMENTSINSTANCEDPROC, glDrawElementsInstanced, 31, NULL) \
+    X(PFNGLDRAWELEMENTSINSTANCEDBASEINSTANCEPROC, glDrawElementsInstancedBaseInstance, 42, "GL_ARB_base_instance") \
+    X(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange, 30, "GL_ARB_map_buffer_range") \
+    X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer, 15, NULL) \
+    X(PFNGLFENCESYNCPROC, glFenceSync, 32, "GL_ARB_sync") \
+    X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync, 32, "GL_ARB_sync") \
+    X(PFNGLDELETESYNCPROC, glDeleteSync, 32, "GL_ARB_sync") \
+    X(PFNGLGENQUERIESPROC, glGenQueries, 15, NULL) \
+    X(PFNGLDELETEQUERIESPROC, glDeleteQueries, 15, NULL) \
+    X(PFNGLBEGINQUERYPROC, glBeginQuery, 15, NULL) \
+    X(PFNGLENDQUERYPROC, glEndQuery, 15, NULL) \
+    X(PFNGLGETQUERYOBJECTIVPROC, glGetQueryObjectiv, 15, NULL) \
+    X(PFNGLGETQUERYOBJECTUI64VPROC, glGetQueryObjectui64v, 33, "GL_ARB_timer_query") \
+    X(PFNGLQUERYCOUNTERPROC, glQueryCounter, 33, "GL_ARB_timer_query") \
+    X(PFNGLBEGINCONDITIONALRENDERPROC, glBeginConditionalRender, 30, NULL) \
+    X(PFNGLENDCONDITIONALRENDERPROC, glEndConditionalRender, 30, NULL)
+
+// Declares one pointer per function, eg: static PFNGLGENFRAMEBUFFERSPROC glext_glGenFramebuffers;
+#define GL_EXT_DECLARE(type, name, version, extension) static type glext_##name;
+GL_EXT_FUNCTIONS(GL_EXT_DECLARE)
+#undef GL_EXT_DECLARE
+
+typedef void *(*GLExtGetProc)(const char *name);
+
+static int glext_version; // the context's OpenGL version, major * 10 + minor (eg 45), 0 before glext_load()
+
+static inline int glext_has_extension(GLExtGetProc get_proc, const char *extension)
+{
+    // Whether the current context lists extension. A core profile context has no GL_EXTENSIONS
+    // string any more, there they are asked for one by one with glGetStringi (OpenGL 3.0).
+    PFNGLGETSTRINGIPROC get_stringi = glext_version >= 30 ? (PFNGLGETSTRINGIPROC)get_proc("glGetStringi") : NULL;
+    size_t length = strlen(extension);
+    const char *list;
+    if (get_stringi)
+    {
+        GLint i, count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (i = 0; i < count; i++)
+        {
+            const char *name = (const char *)get_stringi(GL_EXTENSIONS, (GLuint)i);
+            if (name && strcmp(name, extension) == 0) return 1;
+        }
+        return 0;
+    }
+    // (the old way: one string, names separated by spaces, and one name can start another one)
+    for (list = (const char *)glGetString(GL_EXTENSIONS); list && (list = strstr(list, extension)); list += length)
+        if (list[length] == ' ' || list[length] == 0) return 1;
+    return 0;
+}
+
+static inline int glext_load(GLExtGetProc get_proc)
+{
+    // Looks up every function of the list with get_proc (glutGetProcAddress, eglGetProcAddress, ...)
+    // Must be called AFTER a context was made current. Returns how many functions are missing.
+    // A missing function is not an error by itself (an old driver simply doesn't have it), the code
+    // that needs one checks for it with GLEXT_HAVE() before using it.
+    int missing = 0, major = 0, minor = 0;
+    const char *version_string = (const char *)glGetString(GL_VERSION);
+    if (version_string && sscanf(version_string, "%d.%d", &major, &minor) == 2) glext_version = major * 10 + minor;
+    else glext_version = 0;
+#define GL_EXT_LOAD(type, name, version, extension) \
+    glext_##name = glext_version >= version || (extension && glext_has_extension(get_proc, extension)) \
+                   ? (type)get_proc(#name) : NULL; \
+    if (!glext_##name) missing++;
+    GL_EXT_FUNCTIONS(GL_EXT_LOAD)
+#undef GL_EXT_LOAD
+    return missing;
+}
+
+// eg: if (!GLEXT_HAVE(glGenBuffers)) { ...fall back to the old way... }
+#define GLEXT_HAVE(name) (glext_##name != NULL)
+
+// From here on glGenFramebuffers(...) really calls glext_glGenFramebuffers(...)
+#define glGenFramebuffers glext_glGenFramebuffers
+#define glDeleteFramebuffers glext_glDeleteFramebuffers
+#define glBindFramebuffer glext_glBindFramebuffer
+#define glFramebufferRenderbuffer glext_glFramebufferRenderbuffer
+#define glCheckFramebufferStatus glext_glCheckFramebufferStatus
+#define glBlitFramebuffer glext_glBlitFramebuffer
+#define glGenRenderbuffers glext_glGenRenderbuffers
+#define glDeleteRenderbuffers glext_glDeleteRenderbuffers
+#define glBindRenderbuffer glext_glBindRenderbuffer
+#define glRenderbufferStorage glext_glRenderbufferStorage
+#define glGenBuffers glext_glGenBuffers
+#define glDeleteBuffers glext_glDeleteBuffers
+#define glBindBuffer glext_glBindBuffer
+#define glBufferData glext_glBufferData
+#define glGenVertexArrays glext_glGenVertexArrays
+#define glDeleteVertexArrays glext_glDeleteVertexArrays
+#define glBindVertexArray glext_glBindVertexArray
+#define glBufferSubData glext_glBufferSubData
+#define glBufferStorage glext_glBufferStorage
+#define glCreateShader glext_glCreateShader
+#define glDeleteShader glext_glDeleteShader
+#define glShaderSource glext_glShaderSource
+#define glCompileShader glext_glCompileShader
+#define glGetShaderiv glext_glGetShaderiv
+#define glGetShaderInfoLog glext_glGetShaderInfoLog
+#define glCreateProgram glext_glCreateProgram
+#define glDeleteProgram glext_glDeleteProgram
+#define glAttachShader glext_glAttachShader
+#define glBindAttribLocation glext_glBindAttribLocation
+#define glLinkProgram glext_glLinkProgram
+#define glGetProgramiv glext_glGetProgramiv
+#define glGetProgramInfoLog glext_glGetProgramInfoLog
+#define glUseProgram glext_glUseProgram
+#define glGetUniformLocation glext_glGetUniformLocation
+#define glUniform1f glext_glUniform1f
+#define glUniformMatrix4fv glext_glUniformMatrix4fv
+#define glGetUniformBlockIndex glext_glGetUniformBlockIndex
+#define glUniformBlockBinding glext_glUniformBlockBinding
+#define glBindBufferRange glext_glBindBufferRange
+#define glProgramParameteri glext_glProgramParameteri
+#define glGetProgramBinary glext_glGetProgramBinary
+#define glProgramBinary glext_glProgramBinary
+#define glVertexAttribPointer glext_glVertexAttribPointer
+#define glEnableVertexAttribArray glext_glEnableVertexAttribArray
+#define glDisableVertexAttribArray glext_glDisableVertexAttribArray
+#define glVertexAttrib3f glext_glVertexAttrib3f
+#define glVertexAttribDivisor glext_glVertexAttribDivisor
+#define glDrawElementsInstanced glext_glDrawElementsInstanced
+#define glDrawElementsInstancedBaseInstance glext_glDrawElementsInstancedBaseInstance
+#define glMapBufferRange glext_glMapBufferRange
+#define glUnmapBuffer glext_glUnmapBuffer
+#define glFenceSync glext_glFenceSync
+#define glClientWaitSync glext_glClientWaitSync
+#define glDeleteSync glext_glDeleteSync
+#define glGenQueries glext_glGenQueries
+#define glDeleteQueries glext_glDeleteQueries
+#define glBeginQuery glext_glBeginQuery
+#define glEndQuery glext_glEndQuery
+#define glGetQueryObjectiv glext_glGetQueryObjectiv
+#define glGetQueryObjectui64v glext_glGetQueryObjectui64v
+#define glQueryCounter glext_glQueryCounter
+#define glBeginConditionalRender glext_glBeginConditionalRender
+#define glEndConditionalRender glext_glEndConditionalRender
+
+#endif
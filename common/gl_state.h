@@ -0,0 +1,297 @@
+#ifndef COMMON_GL_STATE_H
+#define COMMON_GL_STATE_H
+
+/*
+- ***** A Note on Redundant State Changes *****
+  OpenGL doesn't check whether a call changes anything: glColor3f(1, 0, 0) when the color is
+  already red still goes through the driver, and so does every glMatrixMode(GL_MODELVIEW) when
+  we are already in GL_MODELVIEW. The demos do that a lot (the 2D/3D square gets the same color
+  for 10 frames in a row, display() resets a matrix that is still the identity, ...), and in
+  bigger scenes these useless calls can cost more driver time than the drawing itself.
+
+  This layer sits in the dispatch table (common/gl_dispatch.h) in front of the real OpenGL (or
+  the software rasterizer). It remembers ("shadows") the state it has set and drops the calls
+  that wouldn't change it. Calls it doesn't understand, and the ones that draw (glBegin,
+  glVertex, ...), go straight through: their table entries point right at the next layer.
+  Every state call is counted as issued (passed on) or elided (dropped).
+
+  The shadow copy is only right as long as nobody changes the state behind its back. Code that
+  does (eg drawing with glColorPointer leaves the current color undefined) calls
+  gl_state_invalidate() afterwards, and the next call of each kind goes through again.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "gl_dispatch.h"
+
+enum
+{
+    GL_STATE_CLEAR_COLOR, GL_STATE_COLOR, GL_STATE_ENABLE, GL_STATE_VIEWPORT, GL_STATE_MATRIX_MODE,
+    GL_STATE_LOAD_IDENTITY, GL_STATE_LOAD_MATRIX, GL_STATE_CALLS
+};
+
+static const char *const gl_state_call_names[GL_STATE_CALLS] =
+{
+    "glClearColor", "glColor3f", "glEnable/Disable", "glViewport", "glMatrixMode", "glLoadIdentity", "glLoadMatrixf"
+};
+
+// The capabilities glEnable/glDisable are tracked for (any other one always goes through).
+static const GLenum gl_state_caps[] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_TEXTURE_2D, GL_LIGHTING, GL_SCISSOR_TEST };
+#define GL_STATE_CAP_COUNT ((int)(sizeof(gl_state_caps) / sizeof(gl_state_caps[0])))
+
+typedef struct GLStateMatrix
+{
+    int known;      // m is the matrix currently in OpenGL
+    GLfloat m[16];
+} GLStateMatrix;
+
+typedef struct GLStateCache
+{
+    const GLDispatch *next;  // where the calls that do change something go
+    int clear_color_known, color_known, viewport_known, matrix_mode_known;
+    GLfloat clear_color[4];
+    GLfloat color[3];
+    GLint viewport[4];
+    GLenum matrix_mode;
+    unsigned caps_known, caps_enabled; // one bit per gl_state_caps entry
+    GLStateMatrix matrices[2];         // GL_MODELVIEW, GL_PROJECTION
+    long issued[GL_STATE_CALLS];
+    long elided[GL_STATE_CALLS];
+    long frames;                       // (for the per frame numbers of the report)
+} GLStateCache;
+
+static GLStateCache gl_state;
+static GLDispatch gl_state_dispatch;
+
+static inline void gl_state_invalidate(void)
+{
+    // Forgets everything: the next call of every kind goes through.
+    gl_state.clear_color_known = gl_state.color_known = gl_state.viewport_known = gl_state.matrix_mode_known = 0;
+    gl_state.caps_known = 0;
+    gl_state.matrices[0].known = gl_state.matrices[1].known = 0;
+}
+
+static inline GLStateMatrix *gl_state_current_matrix(void)
+{
+    // The shadow of the matrix glMatrixMode selected, NULL when unknown (or a texture/color matrix).
+    if (!gl_state.matrix_mode_known) return NULL;
+    if (gl_state.matrix_mode == GL_MODELVIEW) return &gl_state.matrices[0];
+    if (gl_state.matrix_mode == GL_PROJECTION) return &gl_state.matrices[1];
+    return NULL;
+}
+
+static inline void gl_state_forget_matrix(void)
+{
+    // The current matrix was multiplied by something (glTranslatef, gluPerspective, ...), or
+    // glPopMatrix brought back one we don't know.
+    GLStateMatrix *matrix = gl_state_current_matrix();
+    if (matrix) matrix->known = 0;
+    else gl_state.matrices[0].known = gl_state.matrices[1].known = 0; // (don't know which one)
+}
+
+static void APIENTRY gl_state_ClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    if (gl_state.clear_color_known && gl_state.clear_color[0] == red && gl_state.clear_color[1] == green
+        && gl_state.clear_color[2] == blue && gl_state.clear_color[3] == alpha)
+    {
+        gl_state.elided[GL_STATE_CLEAR_COLOR]++;
+        return;
+    }
+    gl_state.clear_color[0] = red; gl_state.clear_color[1] = green; gl_state.clear_color[2] = blue; gl_state.clear_color[3] = alpha;
+    gl_state.clear_color_known = 1;
+    gl_state.issued[GL_STATE_CLEAR_COLOR]++;
+    gl_state.next->ClearColor(red, green, blue, alpha);
+}
+
+static void APIENTRY gl_state_Color3f(GLfloat red, GLfloat green, GLfloat blue)
+{
+    // (also fine between glBegin and glEnd: a vertex takes the current color, which is the same)
+    if (gl_state.color_known && gl_state.color[0] == red && gl_state.color[1] == green && gl_state.color[2] == blue)
+    {
+        gl_state.elided[GL_STATE_COLOR]++;
+        return;
+    }
+    gl_state.color[0] = red; gl_state.color[1] = green; gl_state.color[2] = blue;
+    gl_state.color_known = 1;
+    gl_state.issued[GL_STATE_COLOR]++;
+    gl_state.next->Color3f(red, green, blue);
+}
+
+static inline int gl_state_cap_bit(GLenum cap)
+{
+    int i;
+    for (i = 0; i < GL_STATE_CAP_COUNT; i++)
+        if (gl_state_caps[i] == cap) return 1 << i;
+    return 0;
+}
+
+static inline int gl_state_set_cap(GLenum cap, int enable)
+{
+    // Returns 0 if cap already is in that state.
+    unsigned bit = (unsigned)gl_state_cap_bit(cap);
+    if (bit && (gl_state.caps_known & bit) && !(gl_state.caps_enabled & bit) == !enable)
+    {
+        gl_state.elided[GL_STATE_ENABLE]++;
+        return 0;
+    }
+    gl_state.caps_known |= bit;
+    if (enable) gl_state.caps_enabled |= bit;
+    else gl_state.caps_enabled &= ~bit;
+    gl_state.issued[GL_STATE_ENABLE]++;
+    return 1;
+}
+
+static void APIENTRY gl_state_Enable(GLenum cap)
+{
+    if (gl_state_set_cap(cap, 1)) gl_state.next->Enable(cap);
+}
+
+static void APIENTRY gl_state_Disable(GLenum cap)
+{
+    if (gl_state_set_cap(cap, 0)) gl_state.next->Disable(cap);
+}
+
+static void APIENTRY gl_state_Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (gl_state.viewport_known && gl_state.viewport[0] == x && gl_state.viewport[1] == y
+        && gl_state.viewport[2] == width && gl_state.viewport[3] == height)
+    {
+        gl_state.elided[GL_STATE_VIEWPORT]++;
+        return;
+    }
+    gl_state.viewport[0] = x; gl_state.viewport[1] = y; gl_state.viewport[2] = width; gl_state.viewport[3] = height;
+    gl_state.viewport_known = 1;
+    gl_state.issued[GL_STATE_VIEWPORT]++;
+    gl_state.next->Viewport(x, y, width, height);
+}
+
+static void APIENTRY gl_state_MatrixMode(GLenum mode)
+{
+    if (gl_state.matrix_mode_known && gl_state.matrix_mode == mode)
+    {
+        gl_state.elided[GL_STATE_MATRIX_MODE]++;
+        return;
+    }
+    gl_state.matrix_mode = mode;
+    gl_state.matrix_mode_known = 1;
+    gl_state.issued[GL_STATE_MATRIX_MODE]++;
+    gl_state.next->MatrixMode(mode);
+}
+
+static inline int gl_state_load(const GLfloat *m, int call)
+{
+    // Remembers m as the current matrix. Returns 0 if it already is.
+    GLStateMatrix *matrix = gl_state_current_matrix();
+    if (matrix && matrix->known && memcmp(matrix->m, m, sizeof(matrix->m)) == 0)
+    {
+        gl_state.elided[call]++;
+        return 0;
+    }
+    if (matrix)
+    {
+        memcpy(matrix->m, m, sizeof(matrix->m));
+        matrix->known = 1;
+    }
+    gl_state.issued[call]++;
+    return 1;
+}
+
+static void APIENTRY gl_state_LoadIdentity(void)
+{
+    static const GLfloat identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    if (gl_state_load(identity, GL_STATE_LOAD_IDENTITY)) gl_state.next->LoadIdentity();
+}
+
+static void APIENTRY gl_state_LoadMatrixf(const GLfloat *m)
+{
+    if (gl_state_load(m, GL_STATE_LOAD_MATRIX)) gl_state.next->LoadMatrixf(m);
+}
+
+static void APIENTRY gl_state_Translatef(GLfloat x, GLfloat y, GLfloat z)
+{
+    gl_state_forget_matrix();
+    gl_state.next->Translatef(x, y, z);
+}
+
+static void APIENTRY gl_state_Rotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+    gl_state_forget_matrix();
+    gl_state.next->Rotatef(angle, x, y, z);
+}
+
+static void APIENTRY gl_state_Scalef(GLfloat x, GLfloat y, GLfloat z)
+{
+    gl_state_forget_matrix();
+    gl_state.next->Scalef(x, y, z);
+}
+
+static void APIENTRY gl_state_PopMatrix(void)
+{
+    gl_state_forget_matrix();
+    gl_state.next->PopMatrix();
+}
+
+static void APIENTRY gl_state_Perspective(GLdouble fovy, GLdouble aspect, GLdouble z_near, GLdouble z_far)
+{
+    gl_state_forget_matrix();
+    gl_state.next->Perspective(fovy, aspect, z_near, z_far);
+}
+
+static void APIENTRY gl_state_Ortho2D(GLdouble left, GLdouble right, GLdouble bottom, GLdouble top)
+{
+    gl_state_forget_matrix();
+    gl_state.next->Ortho2D(left, right, bottom, top);
+}
+
+static inline const GLDispatch *gl_state_install(const GLDispatch *next)
+{
+    // Returns the table to use instead of next: next's own functions for the calls that aren't
+    // state (no extra jump for every glVertex), the shadowing ones above for the rest.
+    memset(&gl_state, 0, sizeof(gl_state));
+    gl_state.next = next;
+    gl_state_dispatch = *next;
+    gl_state_dispatch.ClearColor = gl_state_ClearColor;
+    gl_state_dispatch.Color3f = gl_state_Color3f;
+    gl_state_dispatch.Enable = gl_state_Enable;
+    gl_state_dispatch.Disable = gl_state_Disable;
+    gl_state_dispatch.Viewport = gl_state_Viewport;
+    gl_state_dispatch.MatrixMode = gl_state_MatrixMode;
+    gl_state_dispatch.LoadIdentity = gl_state_LoadIdentity;
+    gl_state_dispatch.LoadMatrixf = gl_state_LoadMatrixf;
+    gl_state_dispatch.Translatef = gl_state_Translatef;
+    gl_state_dispatch.Rotatef = gl_state_Rotatef;
+    gl_state_dispatch.Scalef = gl_state_Scalef;
+    gl_state_dispatch.PopMatrix = gl_state_PopMatrix; // (glPushMatrix leaves the current matrix as it is)
+    gl_state_dispatch.Perspective = gl_state_Perspective;
+    gl_state_dispatch.Ortho2D = gl_state_Ortho2D;
+    return &gl_state_dispatch;
+}
+
+static inline void gl_state_frame_done(void)
+{
+    gl_state.frames++;
+}
+
+static inline void gl_state_report(FILE *out)
+{
+    // Issued vs elided calls since the last report, per frame.
+    long issued = 0, elided = 0, frames = gl_state.frames;
+    int i;
+    if (!gl_state.next || frames <= 0) return;
+    for (i = 0; i < GL_STATE_CALLS; i++)
+    {
+        issued += gl_state.issued[i];
+        elided += gl_state.elided[i];
+    }
+    fprintf(out, "state cache: %.1f issued, %.1f elided per frame (%.0f%% elided)", (double)issued / frames,
+            (double)elided / frames, issued + elided ? 100.0 * elided / (issued + elided) : 0.0);
+    for (i = 0; i < GL_STATE_CALLS; i++)
+        if (gl_state.issued[i] || gl_state.elided[i])
+            fprintf(out, " | %s %.1f/%.1f", gl_state_call_names[i], (double)gl_state.issued[i] / frames, (double)gl_state.elided[i] / frames);
+    fprintf(out, "\n");
+    memset(gl_state.issued, 0, sizeof(gl_state.issued));
+    memset(gl_state.elided, 0, sizeof(gl_state.elided));
+    gl_state.frames = 0;
+}
+
+#endif
@@ -0,0 +1,574 @@
+#ifndef COMMON_GLCORE_H
+#define COMMON_GLCORE_H
+
+/*
+- ***** A Note on the Core Profile *****
+  glColor3f, glMatrixMode, gluPerspective, glBegin, ... are the "fixed-function pipeline". Since
+  OpenGL 3.2 there are two kinds of context: the "compatibility profile" still has all of it, the
+  "core profile" doesn't. In core there is no current color, no matrix stack and no glBegin: the
+  vertices go in buffers, the matrices in uniforms and our own shaders do the rest. The driver
+  then has nothing of its own to emulate (Mesa for one builds a shader out of the fixed-function
+  state behind our back, and checks on every draw whether that state changed).
+
+  --backend core (see common/app.h) asks for a core profile context and sends the tutorials'
+  calls here instead of to OpenGL (the same dispatch table trick as the software rasterizer,
+  see common/gl_dispatch.h), so the tutorials don't change:
+  1. glColor3f, glMatrixMode, glTranslatef, glPushMatrix, ... only change OUR copy of the state.
+     The matrices are computed exactly the way Mesa computes them (down to the order of the
+     additions), and so are the vertex positions and the triangles (see 2.), so the picture
+     stays the same pixel for pixel (tools/regress.sh checks that with a tolerance of 0).
+  2. glBegin .. glEnd collects the vertices. glEnd cuts quads and polygons into triangles (the
+     core profile only has triangles), appends them to one big vertex buffer and draws them.
+     Which diagonal a quad is cut along, and in which order the corners go, decides how its
+     colors are interpolated: a face whose color sits right between two values (0.3 * 255 =
+     76.5) comes out 1 off in places if it's cut any other way than the driver cuts it.
+  3. The matrices reach the shader through uniform buffers (UBOs), blocks of memory the shader
+     reads like a struct. Block "Frame" holds what's the same for the whole frame (the
+     projection) and is uploaded when that changes, block "Object" what belongs to one object
+     (the modelview). Every object gets its own slice of one big buffer (glBindBufferRange), so
+     nothing is overwritten while the GPU may still be reading it.
+  4. The vertices and the Object blocks are written straight into persistently mapped buffers,
+     3 frames' worth each (common/stream.h). With --stream orphan (or without OpenGL 4.4) they
+     go through glBufferSubData into buffers that are orphaned when they are full instead.
+  5. The program is compiled once, then kept on disk as a binary (shader_program_cached() in
+     common/shader.h): --shader-cache FILE, default shader_cache.bin, "off" = always compile.
+
+  Note: Only the calls of the dispatch table go through here. The demos' buffer and shader paths
+        (the VBO and instanced cube, the sprite batch, the 3D models) need the gl backend.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gl_dispatch.h"
+#include "gl_ext.h"
+#include "shader.h"
+#include "stream.h"
+#include "vmath.h"
+#include "clock.h"
+
+#define GLCORE_VERTEX_BUFFER (4 * 1024 * 1024)   // bytes of vertices before the buffer starts over (per region when streaming)
+#define GLCORE_OBJECT_BUFFER (1024 * 1024)       // bytes of "Object" blocks before it starts over (per region when streaming)
+#define GLCORE_STACK_DEPTH 32                    // glPushMatrix levels per matrix (what Mesa allows)
+
+typedef struct GLCoreVertex
+{
+    float position[3];
+    float color[3];
+} GLCoreVertex;
+
+// The two uniform blocks, laid out the way "layout(std140)" lays them out in the shader.
+typedef struct GLCoreFrameBlock
+{
+    mat4 projection;
+} GLCoreFrameBlock;
+
+typedef struct GLCoreObjectBlock
+{
+    mat4 model_view;
+} GLCoreObjectBlock;
+
+typedef struct GLCore
+{
+    GLuint program;
+    GLuint vao;
+    GLuint vertex_buffer;
+    GLuint frame_buffer;    // (the uniform buffer of the Frame block, not a framebuffer)
+    GLuint object_buffer;
+    int vertex_offset;      // bytes used in vertex_buffer
+    int object_offset;      // bytes used in object_buffer
+    int object_stride;      // sizeof(GLCoreObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    StreamBuffer vertex_stream, object_stream; // (used instead of the two above if they could be created)
+
+    // The fixed-function state we keep on our side.
+    GLenum matrix_mode;
+    mat4 modelview, projection;
+    mat4 stacks[2][GLCORE_STACK_DEPTH]; // what glPushMatrix saved: [0] modelview, [1] projection
+    int stack_depth[2];
+    int frame_dirty, object_dirty; // changed since they were last uploaded
+    float color[3];
+    GLenum primitive;
+    GLCoreVertex *vertices; // since glBegin
+    int vertex_count, vertex_capacity;
+    GLCoreVertex *triangles; // what glEnd makes of them
+    int triangle_capacity;
+
+    double program_ms;       // how long creating the program took
+    int program_from_cache;
+} GLCore;
+
+static GLCore glcore;
+
+static const char *glcore_vertex_shader =
+    "#version 330 core\n"
+    "layout(std140) uniform Frame\n"
+    "{\n"
+    "    mat4 projection;\n"
+    "};\n"
+    "layout(std140) uniform Object\n"
+    "{\n"
+    "    mat4 model_view;\n"
+    "};\n"
+    "in vec3 position;\n"
+    "in vec3 color;\n"
+    "out vec3 v_color;\n"
+    "void main()\n"
+    "{\n"
+    "    mat4 m = projection * model_view;\n" // (in this order: it's what OpenGL does)
+    "    vec4 p = m[0] * position.x;\n"       // m * vec4(position, 1.0), one column at a time and in
+    "    p = m[1] * position.y + p;\n"        // the order Mesa's fixed-function shader adds them up
+    "    p = m[2] * position.z + p;\n"        // (the same sums in another order round a hair
+    "    gl_Position = m[3] + p;\n"           // differently, and that moves some pixels by 1)
+    "    v_color = clamp(color, 0.0, 1.0);\n" // (the fixed-function pipeline clamps vertex colors)
+    "}\n";
+
+static const char *glcore_fragment_shader =
+    "#version 330 core\n"
+    "in vec3 v_color;\n"
+    "out vec4 frag_color;\n"
+    "void main()\n"
+    "{\n"
+    "    frag_color = vec4(v_color, 1.0);\n"
+    "}\n";
+
+enum { GLCORE_ATTRIB_POSITION = 0, GLCORE_ATTRIB_COLOR = 1 };
+enum { GLCORE_FRAME_BINDING = 0, GLCORE_OBJECT_BINDING = 1 };
+
+/* ***** The matrices, like Mesa's src/mesa/math/m_matrix.c ***** */
+
+static inline mat4 glcore_multiply(const mat4 *a, const mat4 *b)
+{
+    // a * b, every entry summed in the order a row of a meets a column of b (k = 0, 1, 2, 3),
+    // like OpenGL's matmul4(). (vmath's mat4_mul adds in the same order, with SSE.)
+    return mat4_mul(a, b);
+}
+
+static inline mat4 glcore_rotation(float angle, float x, float y, float z)
+{
+    // What glRotatef multiplies with. Unlike mat4_rotate() it follows OpenGL to the letter:
+    // sin/cos in double, a shortcut for the x, y and z axes, and (1 - c) * (x * x) instead of
+    // (t * x) * x. Floats round after every operation, so the order decides the last bit.
+    mat4 r = mat4_identity();
+    float *m = r.m;
+    float s = (float)sin(angle * M_PI / 180.0), c = (float)cos(angle * M_PI / 180.0);
+    float mag, xx, yy, zz, xy, yz, zx, xs, ys, zs, one_c;
+#define GLCORE_M(row, col) m[(col) * 4 + (row)]
+    if (x == 0.0f && y == 0.0f && z != 0.0f)
+    {
+        GLCORE_M(0, 0) = c; GLCORE_M(1, 1) = c;
+        GLCORE_M(0, 1) = z < 0.0f ? s : -s;
+        GLCORE_M(1, 0) = z < 0.0f ? -s : s;
+    }
+    else if (x == 0.0f && z == 0.0f && y != 0.0f)
+    {
+        GLCORE_M(0, 0) = c; GLCORE_M(2, 2) = c;
+        GLCORE_M(0, 2) = y < 0.0f ? -s : s;
+        GLCORE_M(2, 0) = y < 0.0f ? s : -s;
+    }
+    else if (y == 0.0f && z == 0.0f && x != 0.0f)
+    {
+        GLCORE_M(1, 1) = c; GLCORE_M(2, 2) = c;
+        GLCORE_M(1, 2) = x < 0.0f ? s : -s;
+        GLCORE_M(2, 1) = x < 0.0f ? -s : s;
+    }
+    else
+    {
+        mag = sqrtf(x * x + y * y + z * z);
+        if (mag <= 1.0e-4f) return r; // (no axis: OpenGL leaves the matrix alone)
+        x /= mag; y /= mag; z /= mag;
+        xx = x * x; yy = y * y; zz = z * z;
+        xy = x * y; yz = y * z; zx = z * x;
+        xs = x * s; ys = y * s; zs = z * s;
+        one_c = 1.0f - c;
+        GLCORE_M(0, 0) = (one_c * xx) + c;  GLCORE_M(0, 1) = (one_c * xy) - zs; GLCORE_M(0, 2) = (one_c * zx) + ys;
+        GLCORE_M(1, 0) = (one_c * xy) + zs; GLCORE_M(1, 1) = (one_c * yy) + c;  GLCORE_M(1, 2) = (one_c * yz) - xs;
+        GLCORE_M(2, 0) = (one_c * zx) - ys; GLCORE_M(2, 1) = (one_c * yz) + xs; GLCORE_M(2, 2) = (one_c * zz) + c;
+    }
+#undef GLCORE_M
+    return r;
+}
+
+static inline mat4 glcore_perspective(double fovy, double aspect, double z_near, double z_far)
+{
+    // gluPerspective: computed in double by GLU, handed to OpenGL as floats.
+    double radians = fovy / 2 * M_PI / 180, delta_z = z_far - z_near, sine = sin(radians), cotangent;
+    mat4 r = mat4_identity();
+    if (delta_z == 0 || sine == 0 || aspect == 0) return r;
+    cotangent = cos(radians) / sine;
+    r.m[0] = (float)(cotangent / aspect);
+    r.m[5] = (float)cotangent;
+    r.m[10] = (float)(-(z_far + z_near) / delta_z);
+    r.m[11] = -1;
+    r.m[14] = (float)(-2 * z_near * z_far / delta_z);
+    r.m[15] = 0;
+    return r;
+}
+
+/* ***** Drawing ***** */
+
+static inline void *glcore_grow(void *array, int *capacity, int needed, size_t item_size)
+{
+    if (needed <= *capacity) return array;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 256;
+    return realloc(array, item_size * *capacity);
+}
+
+static inline int glcore_triangulate(void)
+{
+    // Cuts the vertices since glBegin into separate triangles (in glcore.triangles), the same
+    // way the driver does for the fixed-function pipeline. Returns the number of vertices.
+    const GLCoreVertex *v = glcore.vertices;
+    GLCoreVertex *out;
+    int n = glcore.vertex_count, count = 0, i;
+    static int warned;
+    glcore.triangles = (GLCoreVertex *)glcore_grow(glcore.triangles, &glcore.triangle_capacity, n * 3, sizeof(GLCoreVertex));
+    out = glcore.triangles;
+#define GLCORE_TRIANGLE(a, b, c) (out[count++] = v[a], out[count++] = v[b], out[count++] = v[c])
+    switch (glcore.primitive)
+    {
+        case GL_TRIANGLES:
+            for (i = 2; i < n; i += 3) GLCORE_TRIANGLE(i - 2, i - 1, i);
+            break;
+        case GL_TRIANGLE_STRIP:
+            for (i = 2; i < n; i++)
+            {
+                if (i % 2 == 0) GLCORE_TRIANGLE(i - 2, i - 1, i);
+                else GLCORE_TRIANGLE(i - 1, i - 2, i); // (every other one turned, so they all face the same way)
+            }
+            break;
+        case GL_TRIANGLE_FAN:
+        case GL_POLYGON:
+            for (i = 2; i < n; i++) GLCORE_TRIANGLE(0, i - 1, i);
+            break;
+        case GL_QUADS:
+            // Along the diagonal from the 2nd to the 4th corner, both triangles ending with the 4th
+            // corner: that's how Mesa cuts them (see the note at the top).
+            for (i = 3; i < n; i += 4)
+            {
+                GLCORE_TRIANGLE(i - 3, i - 2, i);
+                GLCORE_TRIANGLE(i - 2, i - 1, i);
+            }
+            break;
+        case GL_QUAD_STRIP:
+            for (i = 3; i < n; i += 2)
+            {
+                GLCORE_TRIANGLE(i - 3, i - 2, i);
+                GLCORE_TRIANGLE(i - 3, i, i - 1);
+            }
+            break;
+        default:
+            if (!warned) fprintf(stderr, "core profile: only triangles, quads and polygons are drawn\n");
+            warned = 1;
+            break;
+    }
+#undef GLCORE_TRIANGLE
+    return count;
+}
+
+static inline void glcore_upload_frame(void)
+{
+    GLCoreFrameBlock block;
+    block.projection = glcore.projection;
+    glBindBuffer(GL_UNIFORM_BUFFER, glcore.frame_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW); // (a fresh one: the old one may still be in use)
+    glcore.frame_dirty = 0;
+}
+
+static inline void glcore_upload_object(void)
+{
+    // The next slice of the object buffer. When it's full, glBufferData(NULL) gives us fresh
+    // memory ("orphaning") instead of waiting for the GPU to be done with the old one.
+    // Streaming, the block is written straight into the mapped buffer instead.
+    GLCoreObjectBlock block, *mapped;
+    GLintptr offset;
+    block.model_view = glcore.modelview;
+    if (glcore.object_stream.memory)
+    {
+        mapped = (GLCoreObjectBlock *)stream_alloc(&glcore.object_stream, sizeof(block), glcore.object_stride, &offset);
+        *mapped = block;
+        glBindBufferRange(GL_UNIFORM_BUFFER, GLCORE_OBJECT_BINDING, glcore.object_stream.buffer, offset, sizeof(block));
+        glcore.object_dirty = 0;
+        return;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, glcore.object_buffer);
+    if (glcore.object_offset + glcore.object_stride > GLCORE_OBJECT_BUFFER)
+    {
+        glBufferData(GL_UNIFORM_BUFFER, GLCORE_OBJECT_BUFFER, NULL, GL_STREAM_DRAW);
+        glcore.object_offset = 0;
+    }
+    glBufferSubData(GL_UNIFORM_BUFFER, glcore.object_offset, sizeof(block), &block);
+    glBindBufferRange(GL_UNIFORM_BUFFER, GLCORE_OBJECT_BINDING, glcore.object_buffer, glcore.object_offset, sizeof(block));
+    glcore.object_offset += glcore.object_stride;
+    glcore.object_dirty = 0;
+}
+
+static inline void glcore_draw(void)
+{
+    int count = glcore_triangulate(), bytes = count * (int)sizeof(GLCoreVertex), first;
+    void *mapped;
+    GLintptr offset;
+    if (count == 0) return;
+    if (bytes > GLCORE_VERTEX_BUFFER - (int)sizeof(GLCoreVertex)) // (what fits in a region after aligning)
+    {
+        fprintf(stderr, "core profile: %d vertices between glBegin and glEnd is too many\n", glcore.vertex_count);
+        return;
+    }
+    if (glcore.frame_dirty) glcore_upload_frame();
+    if (glcore.object_dirty) glcore_upload_object();
+
+    if (glcore.vertex_stream.memory)
+    {
+        mapped = stream_alloc(&glcore.vertex_stream, bytes, sizeof(GLCoreVertex), &offset);
+        memcpy(mapped, glcore.triangles, bytes);
+        first = (int)(offset / (GLintptr)sizeof(GLCoreVertex));
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, glcore.vertex_buffer);
+        if (glcore.vertex_offset + bytes > GLCORE_VERTEX_BUFFER)
+        {
+            glBufferData(GL_ARRAY_BUFFER, GLCORE_VERTEX_BUFFER, NULL, GL_STREAM_DRAW);
+            glcore.vertex_offset = 0;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, glcore.vertex_offset, bytes, glcore.triangles);
+        first = glcore.vertex_offset / (int)sizeof(GLCoreVertex);
+        glcore.vertex_offset += bytes;
+    }
+
+    glUseProgram(glcore.program);
+    glBindVertexArray(glcore.vao);
+    glDrawArrays(GL_TRIANGLES, first, count);
+    glBindVertexArray(0);
+}
+
+static inline void glcore_end_frame(void)
+{
+    // After the frame's last draw (app_swap_buffers() calls it): fences for the streams.
+    stream_end_frame(&glcore.vertex_stream);
+    stream_end_frame(&glcore.object_stream);
+}
+
+static inline void glcore_report(FILE *out)
+{
+    stream_report(&glcore.vertex_stream, out, "vertex stream");
+    stream_report(&glcore.object_stream, out, "object stream");
+}
+
+/* ***** The dispatch table ***** */
+
+static inline void glcore_multiply_current(const mat4 *m)
+{
+    if (glcore.matrix_mode == GL_PROJECTION)
+    {
+        glcore.projection = glcore_multiply(&glcore.projection, m);
+        glcore.frame_dirty = 1;
+    }
+    else
+    {
+        glcore.modelview = glcore_multiply(&glcore.modelview, m);
+        glcore.object_dirty = 1;
+    }
+}
+
+static void APIENTRY glcore_gl_MatrixMode(GLenum mode) { glcore.matrix_mode = mode; }
+
+static void APIENTRY glcore_gl_LoadMatrixf(const GLfloat *m)
+{
+    if (glcore.matrix_mode == GL_PROJECTION)
+    {
+        memcpy(glcore.projection.m, m, sizeof(float) * 16);
+        glcore.frame_dirty = 1;
+    }
+    else
+    {
+        memcpy(glcore.modelview.m, m, sizeof(float) * 16);
+        glcore.object_dirty = 1;
+    }
+}
+
+static void APIENTRY glcore_gl_LoadIdentity(void)
+{
+    mat4 identity = mat4_identity();
+    glcore_gl_LoadMatrixf(identity.m);
+}
+
+static void APIENTRY glcore_gl_Translatef(GLfloat x, GLfloat y, GLfloat z)
+{
+    mat4 m = mat4_translate(x, y, z);
+    glcore_multiply_current(&m);
+}
+
+static void APIENTRY glcore_gl_Rotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+    mat4 m;
+    if (angle == 0.0f) return; // (OpenGL skips those too)
+    m = glcore_rotation(angle, x, y, z);
+    glcore_multiply_current(&m);
+}
+
+static void APIENTRY glcore_gl_Scalef(GLfloat x, GLfloat y, GLfloat z)
+{
+    mat4 m = mat4_scale(x, y, z);
+    glcore_multiply_current(&m);
+}
+
+static void APIENTRY glcore_gl_PushMatrix(void)
+{
+    // (a full stack ignores the call, like OpenGL does with GL_STACK_OVERFLOW)
+    int which = glcore.matrix_mode == GL_PROJECTION;
+    if (glcore.stack_depth[which] < GLCORE_STACK_DEPTH)
+        glcore.stacks[which][glcore.stack_depth[which]++] = which ? glcore.projection : glcore.modelview;
+}
+
+static void APIENTRY glcore_gl_PopMatrix(void)
+{
+    int which = glcore.matrix_mode == GL_PROJECTION;
+    if (glcore.stack_depth[which] > 0) glcore_gl_LoadMatrixf(glcore.stacks[which][--glcore.stack_depth[which]].m);
+}
+
+static void APIENTRY glcore_glu_Perspective(GLdouble fovy, GLdouble aspect, GLdouble z_near, GLdouble z_far)
+{
+    mat4 m = glcore_perspective(fovy, aspect, z_near, z_far);
+    glcore_multiply_current(&m);
+}
+
+static void APIENTRY glcore_glu_Ortho2D(GLdouble left, GLdouble right, GLdouble bottom, GLdouble top)
+{
+    // gluOrtho2D is glOrtho(left, right, bottom, top, -1, 1), which OpenGL computes in float.
+    mat4 m = mat4_ortho2d((float)left, (float)right, (float)bottom, (float)top);
+    glcore_multiply_current(&m);
+}
+
+static void APIENTRY glcore_gl_Color3f(GLfloat red, GLfloat green, GLfloat blue)
+{
+    glcore.color[0] = red; glcore.color[1] = green; glcore.color[2] = blue;
+}
+
+static void APIENTRY glcore_gl_Begin(GLenum mode)
+{
+    glcore.primitive = mode;
+    glcore.vertex_count = 0;
+}
+
+static void APIENTRY glcore_gl_Vertex3f(GLfloat x, GLfloat y, GLfloat z)
+{
+    GLCoreVertex *v;
+    glcore.vertices = (GLCoreVertex *)glcore_grow(glcore.vertices, &glcore.vertex_capacity, glcore.vertex_count + 1, sizeof(GLCoreVertex));
+    v = &glcore.vertices[glcore.vertex_count++];
+    v->position[0] = x; v->position[1] = y; v->position[2] = z;
+    memcpy(v->color, glcore.color, sizeof(v->color));
+}
+
+static void APIENTRY glcore_gl_Vertex2f(GLfloat x, GLfloat y) { glcore_gl_Vertex3f(x, y, 0); }
+
+static void APIENTRY glcore_gl_End(void)
+{
+    glcore_draw();
+    glcore.vertex_count = 0;
+}
+
+// glClear, glEnable, glViewport, ... exist in the core profile too and go straight to OpenGL.
+static void APIENTRY glcore_gl_Clear(GLbitfield mask) { gl_dispatch_hw.Clear(mask); }
+static void APIENTRY glcore_gl_ClearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) { gl_dispatch_hw.ClearColor(r, g, b, a); }
+static void APIENTRY glcore_gl_Enable(GLenum cap) { gl_dispatch_hw.Enable(cap); }
+static void APIENTRY glcore_gl_Disable(GLenum cap) { gl_dispatch_hw.Disable(cap); }
+static void APIENTRY glcore_gl_Viewport(GLint x, GLint y, GLsizei width, GLsizei height) { gl_dispatch_hw.Viewport(x, y, width, height); }
+
+static const GLDispatch glcore_dispatch =
+{
+    glcore_gl_Clear, glcore_gl_ClearColor, glcore_gl_Enable, glcore_gl_Disable, glcore_gl_Viewport, glcore_gl_MatrixMode,
+    glcore_gl_LoadIdentity, glcore_gl_LoadMatrixf, glcore_gl_Translatef, glcore_gl_Rotatef, glcore_gl_Scalef,
+    glcore_gl_PushMatrix, glcore_gl_PopMatrix, glcore_gl_Begin, glcore_gl_End, glcore_gl_Vertex2f, glcore_gl_Vertex3f,
+    glcore_gl_Color3f, glcore_glu_Perspective, glcore_glu_Ortho2D
+};
+
+/* ***** Start/stop ***** */
+
+static inline void glcore_reset(void)
+{
+    // The state a new context starts with (before the OpenGL objects exist).
+    memset(&glcore, 0, sizeof(glcore));
+    glcore.matrix_mode = GL_MODELVIEW;
+    glcore.modelview = glcore.projection = mat4_identity();
+    glcore.color[0] = glcore.color[1] = glcore.color[2] = 1; // OpenGL's initial color is white
+    glcore.frame_dirty = glcore.object_dirty = 1;
+}
+
+static inline int glcore_init(const char *cache_path, int streaming)
+{
+    // Creates the program, buffers and VAO. Needs the (core profile) context to be current and
+    // the functions of common/gl_ext.h loaded. cache_path: the program binary (NULL = no cache).
+    // streaming: write the vertices and Object blocks into persistently mapped buffers if the
+    // driver can (else they are orphaned + glBufferSubData'ed).
+    // Returns 0 (after printing why) if this OpenGL can't do it.
+    const ShaderAttrib attribs[] = { { GLCORE_ATTRIB_POSITION, "position" }, { GLCORE_ATTRIB_COLOR, "color" } };
+    GLint alignment = 0;
+    uint64_t start;
+
+    if (!GLEXT_HAVE(glGenVertexArrays) || !GLEXT_HAVE(glBindBufferRange) || !GLEXT_HAVE(glUniformBlockBinding))
+    {
+        fprintf(stderr, "core profile: needs OpenGL 3.3\n");
+        return 0;
+    }
+    start = clock_now_ns();
+    glcore.program = shader_program_cached(glcore_vertex_shader, glcore_fragment_shader, attribs, 2,
+                                           cache_path, &glcore.program_from_cache);
+    if (!glcore.program) return 0;
+    glcore.program_ms = clock_ns_to_ms(clock_now_ns() - start);
+    glUniformBlockBinding(glcore.program, glGetUniformBlockIndex(glcore.program, "Frame"), GLCORE_FRAME_BINDING);
+    glUniformBlockBinding(glcore.program, glGetUniformBlockIndex(glcore.program, "Object"), GLCORE_OBJECT_BINDING);
+
+    // Object blocks must start at a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT (often 256).
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment < 1) alignment = 256;
+    glcore.object_stride = ((int)sizeof(GLCoreObjectBlock) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &glcore.frame_buffer);
+    if (!streaming || !stream_init(&glcore.object_stream, GL_UNIFORM_BUFFER, GLCORE_OBJECT_BUFFER))
+    {
+        glGenBuffers(1, &glcore.object_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, glcore.object_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, GLCORE_OBJECT_BUFFER, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glcore_upload_frame();
+    glBindBufferRange(GL_UNIFORM_BUFFER, GLCORE_FRAME_BINDING, glcore.frame_buffer, 0, sizeof(GLCoreFrameBlock));
+
+    glGenVertexArrays(1, &glcore.vao);
+    glBindVertexArray(glcore.vao);
+    if (!streaming || !stream_init(&glcore.vertex_stream, GL_ARRAY_BUFFER, GLCORE_VERTEX_BUFFER)) // (leaves it bound)
+    {
+        glGenBuffers(1, &glcore.vertex_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, glcore.vertex_buffer);
+        glBufferData(GL_ARRAY_BUFFER, GLCORE_VERTEX_BUFFER, NULL, GL_STREAM_DRAW);
+    }
+    glEnableVertexAttribArray(GLCORE_ATTRIB_POSITION);
+    glVertexAttribPointer(GLCORE_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(GLCoreVertex), (const void *)0);
+    glEnableVertexAttribArray(GLCORE_ATTRIB_COLOR);
+    glVertexAttribPointer(GLCORE_ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, sizeof(GLCoreVertex), (const void *)(sizeof(float) * 3));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    printf("core profile: program %s in %.2f ms, %s\n", glcore.program_from_cache ? "loaded from the cache" :
+           cache_path ? "compiled (and cached)" : "compiled", glcore.program_ms,
+           glcore.vertex_stream.memory ? "streaming through persistently mapped buffers" : "streaming with glBufferSubData");
+    return 1;
+}
+
+static inline void glcore_shutdown(void)
+{
+    if (!glcore.program) return;
+    glDeleteProgram(glcore.program);
+    glDeleteVertexArrays(1, &glcore.vao);
+    glDeleteBuffers(1, &glcore.vertex_buffer);
+    glDeleteBuffers(1, &glcore.frame_buffer);
+    glDeleteBuffers(1, &glcore.object_buffer);
+    stream_shutdown(&glcore.vertex_stream);
+    stream_shutdown(&glcore.object_stream);
+    free(glcore.vertices);
+    free(glcore.triangles);
+    glcore_reset();
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef COMMON_GOLDEN_H
+#define COMMON_GOLDEN_H
+
+/*
+- ***** A Note on Golden Images *****
+  Speeding something up is only half the job, the picture also has to stay the same. A "golden
+  image" is a frame we once looked at and decided was right. From then on every run draws that
+  frame again and compares it with the stored one, pixel by pixel:
+  - A pixel differs when one of its channels is off by more than --golden-tolerance (default 8
+    of 255): rounding changes that nobody can see are fine.
+  - The frame fails when more than --golden-pixels percent of its pixels differ (default 0.1%).
+  The frames compared are GOLDEN_FRAMES (counted from the first one drawn, warm-up included), as
+  binary PPM files (the simplest image format there is, any image viewer opens it) in the
+  --golden directory. --golden-update writes them instead, after a change that was MEANT to
+  change the picture (look at them before committing them!).
+
+  Frame times get the same treatment: --baseline FILE holds a median frame time, and a run whose
+  median is more than --max-regression percent slower (default 25%) fails. --baseline-update
+  writes the run's median into FILE. Times only compare on the machine they were taken on, so
+  take the baseline on the machine that runs the checks.
+
+  Both only mean something if every run draws the very same frames, so they're meant for the
+  headless mode (update() once per frame, no clock involved), and best on the software
+  rasterizer (common/swr.h): no GPU or driver whose rounding could change under us.
+  tools/regress.sh runs them for all three demos.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int golden_frames[] = { 1, 60, 180 };
+#define GOLDEN_FRAME_COUNT ((int)(sizeof(golden_frames) / sizeof(golden_frames[0])))
+
+typedef struct GoldenCheck
+{
+    const char *dir;          // --golden DIR, NULL = no images compared
+    int update;               // --golden-update: write the images instead
+    int tolerance;            // per channel
+    double max_pixels;        // percent of the pixels that may differ
+    const char *baseline;     // --baseline FILE, NULL = no frame time check
+    int baseline_update;
+    double max_regression;    // percent
+    long frame;               // frames drawn so far
+    int failures;
+    unsigned char *image;     // the frame as RGB, top row first
+} GoldenCheck;
+
+static GoldenCheck golden = { NULL, 0, 8, 0.1, NULL, 0, 25, 0, 0, NULL };
+
+static inline int golden_wanted(void)
+{
+    // Whether the frame about to be finished is one of GOLDEN_FRAMES (call once per frame).
+    int i;
+    golden.frame++;
+    if (!golden.dir) return 0;
+    for (i = 0; i < GOLDEN_FRAME_COUNT; i++)
+        if (golden_frames[i] == golden.frame) return 1;
+    return 0;
+}
+
+static inline unsigned char *golden_read_ppm(const char *path, int *width, int *height)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char *pixels;
+    int max;
+    if (!file) return NULL;
+    if (fscanf(file, "P6 %d %d %d", width, height, &max) != 3 || max != 255 || *width <= 0 || *height <= 0)
+    {
+        fclose(file);
+        return NULL;
+    }
+    fgetc(file); // (the one whitespace after the header)
+    pixels = (unsigned char *)malloc((size_t)*width * *height * 3);
+    if (fread(pixels, 3, (size_t)*width * *height, file) != (size_t)*width * *height)
+    {
+        free(pixels);
+        pixels = NULL;
+    }
+    fclose(file);
+    return pixels;
+}
+
+static inline void golden_check_frame(FILE *out, const unsigned char *rgba, int width, int height, int stride)
+{
+    // Compares the frame (RGBA, bottom row first, stride pixels per row) with its golden image,
+    // or writes it with --golden-update.
+    char path[1024];
+    unsigned char *expected;
+    int x, y, golden_width, golden_height, worst = 0;
+    long differ = 0;
+    snprintf(path, sizeof(path), "%s/frame_%03ld.ppm", golden.dir, golden.frame);
+    golden.image = (unsigned char *)realloc(golden.image, (size_t)width * height * 3);
+    for (y = 0; y < height; y++)
+    {
+        const unsigned char *from = rgba + (size_t)(height - 1 - y) * stride * 4;
+        unsigned char *to = golden.image + (size_t)y * width * 3;
+        for (x = 0; x < width; x++, from += 4, to += 3)
+        {
+            to[0] = from[0];
+            to[1] = from[1];
+            to[2] = from[2];
+        }
+    }
+
+    if (golden.update)
+    {
+        FILE *file = fopen(path, "wb");
+        if (!file)
+        {
+            fprintf(stderr, "golden: can't write %s\n", path);
+            golden.failures++;
+            return;
+        }
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        fwrite(golden.image, 3, (size_t)width * height, file);
+        fclose(file);
+        fprintf(out, "golden: frame %ld written to %s\n", golden.frame, path);
+        return;
+    }
+
+    expected = golden_read_ppm(path, &golden_width, &golden_height);
+    if (!expected || golden_width != width || golden_height != height)
+    {
+        fprintf(out, "golden: frame %ld FAILED, %s %s\n", golden.frame, path, expected ? "has another size" : "is missing");
+        free(expected);
+        golden.failures++;
+        return;
+    }
+    for (x = 0; x < width * height * 3; x += 3)
+    {
+        int c, off = 0;
+        for (c = 0; c < 3; c++)
+        {
+            int d = abs((int)golden.image[x + c] - (int)expected[x + c]);
+            if (d > off) off = d;
+        }
+        if (off > worst) worst = off;
+        if (off > golden.tolerance) differ++;
+    }
+    free(expected);
+    if (100.0 * differ / ((double)width * height) > golden.max_pixels)
+    {
+        fprintf(out, "golden: frame %ld FAILED, %ld of %d pixels differ by more than %d (most: %d)\n", golden.frame,
+                differ, width * height, golden.tolerance, worst);
+        golden.failures++;
+    }
+    else fprintf(out, "golden: frame %ld ok, %ld of %d pixels differ by more than %d (most: %d)\n", golden.frame,
+                 differ, width * height, golden.tolerance, worst);
+}
+
+static inline void golden_check_time(FILE *out, double median_ms)
+{
+    // Compares the run's median frame time with --baseline (or writes it with --baseline-update).
+    FILE *file;
+    double baseline_ms;
+    if (!golden.baseline) return;
+    if (golden.baseline_update)
+    {
+        file = fopen(golden.baseline, "w");
+        if (!file)
+        {
+            fprintf(stderr, "baseline: can't write %s\n", golden.baseline);
+            golden.failures++;
+            return;
+        }
+        fprintf(file, "median_ms %.3f\n", median_ms);
+        fclose(file);
+        fprintf(out, "baseline: median %.3f ms written to %s\n", median_ms, golden.baseline);
+        return;
+    }
+    file = fopen(golden.baseline, "r");
+    if (!file || fscanf(file, "median_ms %lf", &baseline_ms) != 1 || baseline_ms <= 0)
+    {
+        fprintf(out, "baseline: FAILED, can't read %s\n", golden.baseline);
+        if (file) fclose(file);
+        golden.failures++;
+        return;
+    }
+    fclose(file);
+    if (median_ms > baseline_ms * (1 + golden.max_regression / 100))
+    {
+        fprintf(out, "baseline: FAILED, median %.3f ms is %.0f%% slower than %.3f ms (allowed: %.0f%%)\n", median_ms,
+                100 * (median_ms / baseline_ms - 1), baseline_ms, golden.max_regression);
+        golden.failures++;
+    }
+    else fprintf(out, "baseline: ok, median %.3f ms against %.3f ms (%+.0f%%)\n", median_ms, baseline_ms,
+                 100 * (median_ms / baseline_ms - 1));
+}
+
+#endif
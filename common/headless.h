@@ -0,0 +1,130 @@
+#ifndef COMMON_HEADLESS_H
+#define COMMON_HEADLESS_H
+
+/*
+- ***** A Note on Rendering Without a Window *****
+  Normally GLUT asks the operating system for a window, and the window comes with the
+  OpenGL "context" (all of OpenGL's state + the buffers we draw into). On a machine with
+  no display (a CI server for example) there is no window to ask for, so glutCreateWindow() fails.
+
+  EGL is another way to get an OpenGL context. With Mesa's "surfaceless" platform we get a
+  context that isn't attached to any window or GPU at all, and with no GPU Mesa simply
+  renders on the CPU (the llvmpipe software rasterizer).
+  A context without a window has no buffers to draw into though, so we create our own:
+  a Framebuffer Object (FBO) with a color buffer and a depth buffer of the size we want.
+  Once it's bound, every glClear()/glBegin()/... draws into it just like it would into a window.
+
+  Note: This only exists on Linux/Mesa. On Windows headless_create() just fails.
+*/
+
+#include <stdio.h>
+#include "gl_ext.h"
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static EGLDisplay headless_display = EGL_NO_DISPLAY;
+static EGLContext headless_context = EGL_NO_CONTEXT;
+#endif
+
+static GLuint headless_fbo;
+static GLuint headless_color_rb;
+static GLuint headless_depth_rb;
+
+#ifndef _WIN32
+static inline void *headless_get_proc(const char *name)
+{
+    return (void *)eglGetProcAddress(name);
+}
+#endif
+
+static inline int headless_create(int width, int height, int core_profile)
+{
+    // Creates a windowless OpenGL context with a width x height offscreen framebuffer bound.
+    // core_profile = 1 asks for an OpenGL 3.3 core profile context (see common/glcore.h).
+    // Returns 1 on success and 0 on failure (after printing why).
+#ifdef _WIN32
+    (void)width; (void)height; (void)core_profile;
+    fprintf(stderr, "headless: not supported on Windows\n");
+    return 0;
+#else
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLint major, minor;
+    const EGLint core_attribs[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+
+    // 1. The "display" is the connection to the driver, the surfaceless one needs no X server.
+    if (get_platform_display)
+        headless_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (headless_display == EGL_NO_DISPLAY)
+        headless_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (headless_display == EGL_NO_DISPLAY || !eglInitialize(headless_display, &major, &minor))
+    {
+        fprintf(stderr, "headless: could not initialize EGL (0x%x)\n", eglGetError());
+        return 0;
+    }
+
+    // 2. EGL defaults to OpenGL ES, we want the desktop OpenGL with the old fixed-function calls
+    //    (or without them: the core profile).
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        fprintf(stderr, "headless: EGL has no desktop OpenGL (0x%x)\n", eglGetError());
+        return 0;
+    }
+
+    // 3. No config is needed since we never draw to an EGL surface (EGL_KHR_no_config_context).
+    headless_context = eglCreateContext(headless_display, (EGLConfig)0, EGL_NO_CONTEXT, core_profile ? core_attribs : NULL);
+    if (headless_context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless_context))
+    {
+        fprintf(stderr, "headless: could not create a surfaceless context (0x%x)\n", eglGetError());
+        return 0;
+    }
+
+    glext_load(headless_get_proc);
+    if (!GLEXT_HAVE(glGenFramebuffers) || !GLEXT_HAVE(glGenRenderbuffers))
+    {
+        fprintf(stderr, "headless: the driver has no framebuffer objects\n");
+        return 0;
+    }
+
+    // 4. Our own "window": a color buffer (what glutSwapBuffers would show) and a depth buffer
+    //    (what GLUT_DEPTH would give us) glued together in a framebuffer object.
+    glGenRenderbuffers(1, &headless_color_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_color_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &headless_depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &headless_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_color_rb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headless_depth_rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "headless: offscreen framebuffer is incomplete\n");
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+static inline void headless_destroy(void)
+{
+#ifndef _WIN32
+    if (headless_context == EGL_NO_CONTEXT) return;
+    glDeleteFramebuffers(1, &headless_fbo);
+    glDeleteRenderbuffers(1, &headless_color_rb);
+    glDeleteRenderbuffers(1, &headless_depth_rb);
+    eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(headless_display, headless_context);
+    eglTerminate(headless_display);
+    headless_context = EGL_NO_CONTEXT;
+#endif
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef COMMON_JOBS_H
+#define COMMON_JOBS_H
+
+/*
+- ***** A Note on Job Systems *****
+  A "job" is a small piece of work: run this function on entities first .. last. Instead of
+  starting a thread per piece (slow: a thread takes tens of microseconds to start), a fixed set of
+  worker threads is started once and takes jobs out of queues for as long as the program runs.
+
+  Every worker has its own queue (a "deque", open at both ends):
+  - jobs_parallel_for() cuts the work into chunks and deals them out to the queues like cards.
+  - A worker takes the jobs of its own queue from the back, without getting in anybody's way.
+  - When its queue is empty it "steals" from the FRONT of another worker's queue, the end the
+    owner isn't working at. So a worker that got cheap chunks (or started late, because the
+    operating system ran something else on its core) doesn't sit idle while another has a pile
+    left: the work spreads out by itself ("work stealing").
+  - A thread waiting for a batch (jobs_wait()) steals jobs too instead of just sleeping.
+  - With no jobs anywhere the workers sleep on a condition variable, using no CPU at all.
+
+  Every queue has its own lock, so workers only ever wait for each other when one steals from
+  the other at the same moment. The jobs are big (thousands of entities each), so that's rare.
+
+  The counters two threads touch without a lock (a batch's remaining jobs, the pool's queued
+  jobs, the per-queue statistics) only go through atomic operations (GCC's __atomic builtins).
+  The last job of a batch takes its count to 0 with a RELEASE, and jobs_wait() reads it with an
+  ACQUIRE: everything the jobs wrote is then visible to the thread that waited. A plain volatile
+  int gives no such guarantee (it only stops the compiler from caching the value), and the
+  "read-only snapshot" the 2D demo draws from while the workers compute the next step relies on it.
+  A queue's head and tail are only ever looked at with its lock held.
+
+  Note: Threads are POSIX threads, like the software rasterizer's (common/swr.h).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define JOBS_MAX_WORKERS 64
+#define JOBS_QUEUE_SIZE 1024 // jobs per queue (a power of 2)
+
+typedef struct JobBatch
+{
+    // A group of jobs to wait for (see jobs_wait()).
+    int remaining;            // (atomic, see the note above)
+} JobBatch;
+
+typedef struct Job
+{
+    void (*run)(void *arg, int first, int last);
+    void *arg;
+    int first, last;
+    JobBatch *batch;
+} Job;
+
+typedef struct JobQueue
+{
+    pthread_mutex_t lock;
+    Job jobs[JOBS_QUEUE_SIZE];
+    unsigned head, tail;     // thieves take jobs[head], the owner jobs[tail - 1]
+    long run, stolen;        // jobs this worker ran, and how many of them it stole (atomic)
+    char padding[64];        // (keeps two queues' counters out of one cache line)
+} JobQueue;
+
+typedef struct JobPool
+{
+    int worker_count;                    // 0 = no pool, jobs run right away on the calling thread
+    pthread_t threads[JOBS_MAX_WORKERS];
+    JobQueue *queues;                    // one per worker + one for the threads outside the pool
+    int next_queue;                      // where jobs_parallel_for() deals the next chunk
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int queued;                          // jobs in all queues together (atomic, a hint for sleeping)
+    int quit;
+} JobPool;
+
+typedef struct JobWorkerStart
+{
+    JobPool *pool;
+    int index;
+} JobWorkerStart;
+
+static inline int jobs_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static inline int jobs_take(JobPool *pool, int own, Job *job)
+{
+    // Takes a job: from the back of our own queue, or else from the front of someone else's.
+    // own = -1 for a thread that has no queue (it only steals). Returns 0 if there was none.
+    int queue_count = pool->worker_count + 1, k;
+    if (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0) return 0;
+    if (own >= 0)
+    {
+        JobQueue *q = &pool->queues[own];
+        pthread_mutex_lock(&q->lock);
+        if (q->tail != q->head)
+        {
+            *job = q->jobs[--q->tail % JOBS_QUEUE_SIZE];
+            pthread_mutex_unlock(&q->lock);
+            __atomic_fetch_add(&q->run, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            return 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    for (k = 1; k <= queue_count; k++)
+    {
+        // (starting with our neighbor, so the thieves don't all pick the same victim)
+        int victim = ((own < 0 ? 0 : own) + k) % queue_count;
+        JobQueue *q = &pool->queues[victim];
+        if (victim == own) continue;
+        pthread_mutex_lock(&q->lock); // (even just to look: the owner changes tail under it)
+        if (q->tail != q->head)
+        {
+            *job = q->jobs[q->head++ % JOBS_QUEUE_SIZE];
+            pthread_mutex_unlock(&q->lock);
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            if (own >= 0)
+            {
+                __atomic_fetch_add(&pool->queues[own].run, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&pool->queues[own].stolen, 1, __ATOMIC_RELAXED);
+            }
+            return 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return 0;
+}
+
+static inline void jobs_run(JobPool *pool, Job *job)
+{
+    job->run(job->arg, job->first, job->last);
+    if (__atomic_sub_fetch(&job->batch->remaining, 1, __ATOMIC_ACQ_REL) == 0) // (RELEASE: what the job wrote)
+    {
+        // The last job of the batch: wakes up whoever waits for it.
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static inline void *jobs_worker(void *arg)
+{
+    JobWorkerStart *start = (JobWorkerStart *)arg;
+    JobPool *pool = start->pool;
+    int own = start->index;
+    Job job;
+    free(start);
+    for (;;)
+    {
+        while (jobs_take(pool, own, &job)) jobs_run(pool, &job);
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 && !pool->quit) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static inline void jobs_init(JobPool *pool, int worker_count)
+{
+    // Starts worker_count worker threads (0 = none: every job runs on the thread that adds it).
+    int i;
+    memset(pool, 0, sizeof(*pool));
+    if (worker_count > JOBS_MAX_WORKERS) worker_count = JOBS_MAX_WORKERS;
+    if (worker_count <= 0) return;
+    pool->queues = (JobQueue *)calloc(worker_count + 1, sizeof(JobQueue));
+    for (i = 0; i <= worker_count; i++) pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->worker_count = worker_count;
+    for (i = 0; i < worker_count; i++)
+    {
+        JobWorkerStart *start = (JobWorkerStart *)malloc(sizeof(JobWorkerStart));
+        start->pool = pool;
+        start->index = i;
+        if (pthread_create(&pool->threads[i], NULL, jobs_worker, start) != 0)
+        {
+            fprintf(stderr, "job pool: could only start %d workers\n", i);
+            free(start);
+            pool->worker_count = i; // (the missing workers' queues just stay empty)
+            break;
+        }
+    }
+}
+
+static inline void jobs_parallel_for(JobPool *pool, JobBatch *batch, void (*run)(void *arg, int first, int last),
+                                     void *arg, int count, int chunk)
+{
+    // Runs run(arg, first, last) over 0 .. count - 1 in pieces of chunk, on the workers, and returns
+    // right away (jobs_wait(batch) waits for them). Without workers it runs them all before returning.
+    int first, queue_count = pool->worker_count + 1;
+    if (chunk < 1) chunk = 1;
+    __atomic_store_n(&batch->remaining, 0, __ATOMIC_RELAXED);
+    if (pool->worker_count == 0)
+    {
+        for (first = 0; first < count; first += chunk) run(arg, first, first + chunk < count ? first + chunk : count);
+        return;
+    }
+    __atomic_store_n(&batch->remaining, (count + chunk - 1) / chunk, __ATOMIC_RELEASE);
+    for (first = 0; first < count; first += chunk)
+    {
+        // Dealt out to the workers' queues one by one (not to ours: we might be busy drawing).
+        JobQueue *q;
+        Job job;
+        job.run = run;
+        job.arg = arg;
+        job.first = first;
+        job.last = first + chunk < count ? first + chunk : count;
+        job.batch = batch;
+        pool->next_queue = (pool->next_queue + 1) % (queue_count - 1);
+        q = &pool->queues[pool->next_queue];
+        pthread_mutex_lock(&q->lock);
+        while (q->tail - q->head == JOBS_QUEUE_SIZE)
+        {
+            // (full: runs one itself, there's obviously enough to do)
+            Job own = q->jobs[--q->tail % JOBS_QUEUE_SIZE];
+            pthread_mutex_unlock(&q->lock);
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            jobs_run(pool, &own);
+            pthread_mutex_lock(&q->lock);
+        }
+        q->jobs[q->tail++ % JOBS_QUEUE_SIZE] = job;
+        pthread_mutex_unlock(&q->lock);
+        __atomic_fetch_add(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline void jobs_wait(JobPool *pool, JobBatch *batch)
+{
+    // Helps with the jobs (of any batch) until every job of batch is done.
+    Job job;
+    while (__atomic_load_n(&batch->remaining, __ATOMIC_ACQUIRE) > 0)
+    {
+        if (jobs_take(pool, pool->worker_count, &job))
+        {
+            jobs_run(pool, &job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&batch->remaining, __ATOMIC_ACQUIRE) > 0 && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    // (the ACQUIRE that saw 0: everything the jobs wrote is visible from here on)
+}
+
+static inline void jobs_report(JobPool *pool, FILE *out)
+{
+    // Jobs per thread (and how many of them were stolen) since the last report.
+    int i;
+    long total = 0, stolen = 0, run[JOBS_MAX_WORKERS + 1];
+    if (pool->worker_count == 0) return;
+    for (i = 0; i <= pool->worker_count; i++)
+    {
+        run[i] = __atomic_exchange_n(&pool->queues[i].run, 0, __ATOMIC_RELAXED);
+        total += run[i];
+        stolen += __atomic_exchange_n(&pool->queues[i].stolen, 0, __ATOMIC_RELAXED);
+    }
+    fprintf(out, "jobs: %d workers | %ld jobs, %ld stolen (%.0f%%) |", pool->worker_count, total, stolen,
+            total ? 100.0 * stolen / total : 0.0);
+    for (i = 0; i <= pool->worker_count; i++) fprintf(out, " %s%ld", i == pool->worker_count ? "main " : "", run[i]);
+    fprintf(out, "\n");
+}
+
+static inline void jobs_shutdown(JobPool *pool)
+{
+    int i;
+    if (pool->worker_count == 0) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->worker_count; i++) pthread_join(pool->threads[i], NULL);
+    for (i = 0; i <= pool->worker_count; i++) pthread_mutex_destroy(&pool->queues[i].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->queues);
+    memset(pool, 0, sizeof(*pool));
+}
+
+#endif
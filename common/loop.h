@@ -0,0 +1,185 @@
+#ifndef COMMON_LOOP_H
+#define COMMON_LOOP_H
+
+/*
+- ***** A Note on Game Loops *****
+  The tutorials animate with glutTimerFunc(1000/60, timer, 0), which has a few problems:
+  - 1000/60 is integer division, so it's really every 16 ms (62.5 times a second, not 60).
+  - The timer only promises "at least 16 ms later". Every late call adds up (drift), and since
+    every call moves the shape by the same amount, the animation speed depends on how late
+    the callbacks happen to be (jitter).
+  - We can never draw faster than the timer fires, so we never see what the machine can really do.
+
+  The fixed-timestep loop fixes that by separating SIMULATION from RENDERING:
+  - A high resolution clock (common/clock.h) tells us how much real time passed.
+  - That time goes into an "accumulator". For every full tick (1/60th of a second by default)
+    in there, we run ONE update() step and take the tick out. So the animation always runs at
+    exactly 60 steps per (real) second, no matter how many frames we draw.
+  - After the ticks, part of a tick is usually left in the accumulator. alpha = leftover / tick
+    says how far we are between the previous step and the current one, and display() draws
+    the state in between (linear interpolation). Without that, a 144 Hz screen would show the
+    same position 2 or 3 frames in a row and then jump.
+  - How often we draw ("present policy"):
+      vsync     swap buffers waits for the monitor's refresh (no tearing, no wasted frames).
+      uncapped  draw as fast as possible (measures throughput).
+      cap       draw at most N frames per second. We sleep until shortly before the next frame
+                is due (sleep is cheap but not precise, the OS may wake us up a bit late),
+                then spin on the clock for the last bit (precise, but burns CPU).
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "clock.h"
+#include "bench.h"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+enum { PRESENT_VSYNC, PRESENT_UNCAPPED, PRESENT_CAP };
+
+// How long before the deadline we stop sleeping and start spinning (covers the OS's wake-up delay).
+#ifdef _WIN32
+#define LOOP_SPIN_NS 2000000ull
+#else
+#define LOOP_SPIN_NS 1000000ull
+#endif
+
+// More than this much time behind (eg the window was being dragged) is dropped instead of
+// being caught up with hundreds of update() calls at once.
+#define LOOP_MAX_CATCH_UP_MS 250.0
+
+typedef struct GameLoop
+{
+    double tick_ms;          // length of one simulation step
+    int present;             // PRESENT_*
+    double cap_fps;          // for PRESENT_CAP
+    uint64_t previous_ns;    // when loop_advance() last ran
+    double accumulator_ms;   // real time not simulated yet
+    uint64_t next_frame_ns;  // PRESENT_CAP: when the next frame may start
+    uint64_t last_frame_ns;  // when the last frame was done (for the frame intervals)
+    long ticks;              // update() steps so far
+    long frames;             // frames drawn so far
+    double dropped_ms;       // simulation time thrown away by LOOP_MAX_CATCH_UP_MS
+    FrameStats intervals;    // time between two finished frames, what the viewer actually sees
+} GameLoop;
+
+// How far between the previous and the current update() step display() should draw.
+// 1 means "the current state", which is what the timer mode and the headless benchmark use.
+static float loop_alpha = 1.0f;
+
+static inline float loop_lerp(float previous, float current)
+{
+    return previous + (current - previous) * loop_alpha;
+}
+
+static inline float loop_lerp_degrees(float previous, float current)
+{
+    // Like loop_lerp() for an angle that wraps around at 360: going from 359.6 to 0.4 is
+    // a step of +0.8 degrees, not -359.2.
+    float delta = current - previous;
+    if (delta > 180) delta -= 360;
+    else if (delta < -180) delta += 360;
+    return previous + delta * loop_alpha;
+}
+
+static inline void loop_init(GameLoop *loop, double tick_hz, int present, double cap_fps)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->tick_ms = 1000.0 / tick_hz;
+    loop->present = present;
+    loop->cap_fps = cap_fps;
+    loop->previous_ns = clock_now_ns();
+    loop->next_frame_ns = loop->previous_ns;
+    loop->last_frame_ns = loop->previous_ns;
+    frame_stats_init(&loop->intervals, 1024);
+}
+
+static inline int loop_advance(GameLoop *loop, void (*update)(void))
+{
+    // Runs as many fixed update() steps as real time asks for and sets loop_alpha.
+    // Returns the number of steps that were run.
+    uint64_t now = clock_now_ns();
+    int steps = 0;
+    loop->accumulator_ms += clock_ns_to_ms(now - loop->previous_ns);
+    loop->previous_ns = now;
+    if (loop->accumulator_ms > LOOP_MAX_CATCH_UP_MS)
+    {
+        loop->dropped_ms += loop->accumulator_ms - LOOP_MAX_CATCH_UP_MS;
+        loop->accumulator_ms = LOOP_MAX_CATCH_UP_MS;
+    }
+    while (loop->accumulator_ms >= loop->tick_ms)
+    {
+        update();
+        loop->accumulator_ms -= loop->tick_ms;
+        steps++;
+    }
+    loop->ticks += steps;
+    loop_alpha = (float)(loop->accumulator_ms / loop->tick_ms);
+    return steps;
+}
+
+static inline void loop_sleep_until(uint64_t deadline_ns)
+{
+    // Sleep for the bulk of the wait, then spin for the last LOOP_SPIN_NS.
+    uint64_t now = clock_now_ns();
+    if (deadline_ns > now + LOOP_SPIN_NS)
+    {
+        uint64_t sleep_ns = deadline_ns - now - LOOP_SPIN_NS;
+#ifdef _WIN32
+        Sleep((DWORD)(sleep_ns / 1000000ull));
+#else
+        struct timespec ts;
+        ts.tv_sec = (time_t)(sleep_ns / 1000000000ull);
+        ts.tv_nsec = (long)(sleep_ns % 1000000000ull);
+        nanosleep(&ts, NULL);
+#endif
+    }
+    while (clock_now_ns() < deadline_ns) { }
+}
+
+static inline void loop_pace(GameLoop *loop)
+{
+    // Call before a frame starts. Only PRESENT_CAP waits here (vsync waits in the swap itself).
+    uint64_t period_ns, now;
+    if (loop->present != PRESENT_CAP || loop->cap_fps <= 0) return;
+    period_ns = (uint64_t)(1e9 / loop->cap_fps);
+    loop_sleep_until(loop->next_frame_ns);
+    now = clock_now_ns();
+    // The next slot is one period after the previous SLOT (not after now), so small delays
+    // don't add up. If we're more than a whole frame late, we start over from now instead of
+    // rushing out several frames to catch up.
+    loop->next_frame_ns += period_ns;
+    if (loop->next_frame_ns + period_ns < now) loop->next_frame_ns = now + period_ns;
+}
+
+static inline void loop_frame_done(GameLoop *loop)
+{
+    // Call right after the frame was swapped/finished.
+    uint64_t now = clock_now_ns();
+    if (loop->frames > 0) frame_stats_add(&loop->intervals, clock_ns_to_ms(now - loop->last_frame_ns));
+    loop->last_frame_ns = now;
+    loop->frames++;
+}
+
+static inline void loop_report(GameLoop *loop, FILE *out, const char *label, double seconds)
+{
+    // Prints the frame intervals since the last report and starts a new period.
+    // "jitter" is how much the intervals vary (standard deviation): 0 = perfectly even pacing.
+    FrameSummary s = frame_stats_summarize(&loop->intervals);
+    fprintf(out, "%s: %.1f fps | interval median %.3f ms p99 %.3f ms | jitter %.3f ms | %.1f ticks/s",
+            label, s.fps, s.median_ms, s.p99_ms, s.stddev_ms, seconds > 0 ? loop->ticks / seconds : 0);
+    if (loop->dropped_ms > 0) fprintf(out, " | %.0f ms dropped", loop->dropped_ms);
+    fprintf(out, "\n");
+    loop->intervals.count = 0;
+    loop->intervals.total_ms = 0;
+    loop->ticks = 0;
+    loop->dropped_ms = 0;
+}
+
+static inline void loop_free(GameLoop *loop)
+{
+    frame_stats_free(&loop->intervals);
+}
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef COMMON_MESH_H
+#define COMMON_MESH_H
+
+/*
+- ***** A Note on Binary Mesh Files *****
+  Geometry written as text ("v -2 2 0") has to be parsed on every start: every number is read
+  character by character and converted to a float, which for a big scene takes far longer than
+  handing the result to OpenGL. A binary mesh file stores the vertex and index arrays exactly the
+  way OpenGL wants them in memory, so loading is no work at all:
+  1. The file is mapped into memory (mmap / MapViewOfFile): the operating system makes the file's
+     bytes appear at an address without reading anything yet.
+  2. glBufferData(GL_ARRAY_BUFFER, bytes, pointer into the mapping, ...) copies them straight
+     into the GPU buffer. The pages are read from disk as the driver touches them.
+  No parsing, no malloc, no copy of our own: the start-up time is the upload time.
+
+  Layout (little endian, every array starts at a multiple of 64 bytes):
+    MeshFileHeader        "GLTMESH", version, how many meshes, file size
+    MeshEntry[count]      name, vertex format, counts, where its arrays are, bounding box
+    arrays                vertices (interleaved: position, [normal], [color], all floats),
+                          indices (8, 16 or 32 bit, the smallest that fits)
+  Simpler levels of detail of a mesh (tools/mesh_convert.c --lod) are meshes of their own, called
+  NAME.lod1, NAME.lod2, ... right after it, with how far they are from it in lod_error.
+  The text format the converter (tools/mesh_convert.c) reads looks like immediate mode:
+    mesh cube              starts a mesh
+    color 0.8 0.2 0.6      like glColor3f: the color of the vertices that follow
+    normal 0 0 1           like glNormal3f
+    v -2 2 0               like glVertex3f: a vertex (numbered from 0 in every mesh)
+    tri 0 1 2              a triangle
+    quad 0 1 2 3           a quad, stored as the triangles 0 1 2 and 0 2 3
+    poly 0 1 2 3 4 5       a polygon, stored as a fan of triangles (like GL_POLYGON)
+    end
+  Lines starting with # are comments.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define MESH_MAGIC "GLTMESH"
+#define MESH_VERSION 1
+#define MESH_ALIGN 64
+#define MESH_NAME_SIZE 32
+
+enum { MESH_HAS_NORMAL = 1, MESH_HAS_COLOR = 2 }; // (the position is always there)
+
+typedef struct MeshFileHeader
+{
+    char magic[8];          // "GLTMESH\0"
+    uint32_t version;
+    uint32_t mesh_count;
+    uint64_t file_size;
+} MeshFileHeader;           // 24 bytes
+
+typedef struct MeshEntry
+{
+    char name[MESH_NAME_SIZE];
+    uint32_t format;        // MESH_HAS_* bits
+    uint32_t vertex_stride; // bytes per vertex
+    uint32_t vertex_count;
+    uint32_t index_size;    // bytes per index: 1, 2 or 4
+    uint32_t index_count;   // 3 per triangle
+    float lod_error;        // 0, or for a simpler level of another mesh: how far it is from it (common/mesh_lod.h)
+    uint64_t vertex_offset; // from the start of the file
+    uint64_t index_offset;
+    float bounds_min[3], bounds_max[3];
+} MeshEntry;                // 96 bytes
+
+typedef char mesh_entry_size_check[sizeof(MeshEntry) == 96 && sizeof(MeshFileHeader) == 24 ? 1 : -1];
+
+typedef struct MeshFile
+{
+    const unsigned char *data; // the whole file
+    size_t size;
+    const MeshFileHeader *header;
+    const MeshEntry *meshes;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+} MeshFile;
+
+static inline uint32_t mesh_vertex_stride(uint32_t format)
+{
+    return (uint32_t)sizeof(float) * (3 + (format & MESH_HAS_NORMAL ? 3 : 0) + (format & MESH_HAS_COLOR ? 3 : 0));
+}
+
+static inline uint32_t mesh_attrib_offset(uint32_t format, uint32_t attrib)
+{
+    // Where an attribute starts inside a vertex: 0 for the position, MESH_HAS_NORMAL or MESH_HAS_COLOR.
+    uint32_t offset = 0;
+    if (attrib == 0) return 0;
+    offset += 3 * sizeof(float);
+    if (attrib == MESH_HAS_NORMAL) return offset;
+    if (format & MESH_HAS_NORMAL) offset += 3 * sizeof(float);
+    return offset;
+}
+
+static inline uint64_t mesh_align(uint64_t offset)
+{
+    return (offset + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+}
+
+/* ***** Reading (mapping) ***** */
+
+static inline void mesh_file_close(MeshFile *file)
+{
+    if (file->data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->mapping);
+        CloseHandle(file->file);
+#else
+        munmap((void *)file->data, file->size);
+#endif
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+static inline int mesh_file_check(MeshFile *file, const char *path)
+{
+    // Makes sure every array the entries point to really lies inside the file. (The indices
+    // themselves aren't checked against the vertex count: that would mean reading the whole file.)
+    uint32_t i;
+    file->header = (const MeshFileHeader *)file->data;
+    file->meshes = (const MeshEntry *)(file->data + sizeof(MeshFileHeader));
+    if (file->size < sizeof(MeshFileHeader) || memcmp(file->header->magic, MESH_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a mesh file\n", path);
+        return 0;
+    }
+    if (file->header->version != MESH_VERSION || file->header->file_size != file->size ||
+        file->size < sizeof(MeshFileHeader) + (uint64_t)file->header->mesh_count * sizeof(MeshEntry))
+    {
+        fprintf(stderr, "%s: wrong version or truncated\n", path);
+        return 0;
+    }
+    for (i = 0; i < file->header->mesh_count; i++)
+    {
+        const MeshEntry *m = &file->meshes[i];
+        if ((m->index_size != 1 && m->index_size != 2 && m->index_size != 4) ||
+            m->vertex_stride != mesh_vertex_stride(m->format) ||
+            m->vertex_offset + (uint64_t)m->vertex_count * m->vertex_stride > file->size ||
+            m->index_offset + (uint64_t)m->index_count * m->index_size > file->size)
+        {
+            fprintf(stderr, "%s: mesh %u is broken\n", path, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline int mesh_file_open(MeshFile *file, const char *path)
+{
+    // Maps a mesh file into memory (nothing is read yet). Returns 0 if it can't be used.
+    memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+    {
+        LARGE_INTEGER size;
+        file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->file, &size) || size.QuadPart == 0)
+        {
+            fprintf(stderr, "can't open %s\n", path);
+            if (file->file != INVALID_HANDLE_VALUE) CloseHandle(file->file);
+            memset(file, 0, sizeof(*file));
+            return 0;
+        }
+        file->size = (size_t)size.QuadPart;
+        file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        file->data = file->mapping ? (const unsigned char *)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (!file->data)
+        {
+            fprintf(stderr, "can't map %s\n", path);
+            if (file->mapping) CloseHandle(file->mapping);
+            CloseHandle(file->file);
+            memset(file, 0, sizeof(*file));
+            return 0;
+        }
+    }
+#else
+    {
+        struct stat info;
+        void *data;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            fprintf(stderr, "can't open %s\n", path);
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // (the mapping stays valid without the file descriptor)
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "can't map %s\n", path);
+            return 0;
+        }
+        // We'll read it front to back once: the kernel can read ahead in big chunks.
+        madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+        file->data = (const unsigned char *)data;
+        file->size = (size_t)info.st_size;
+    }
+#endif
+    if (!mesh_file_check(file, path))
+    {
+        mesh_file_close(file);
+        return 0;
+    }
+    return 1;
+}
+
+static inline const MeshEntry *mesh_file_find(const MeshFile *file, const char *name)
+{
+    // The mesh called name, or NULL.
+    uint32_t i;
+    for (i = 0; i < file->header->mesh_count; i++)
+        if (strncmp(file->meshes[i].name, name, MESH_NAME_SIZE) == 0) return &file->meshes[i];
+    return NULL;
+}
+
+static inline const void *mesh_vertices(const MeshFile *file, const MeshEntry *mesh) { return file->data + mesh->vertex_offset; }
+static inline const void *mesh_indices(const MeshFile *file, const MeshEntry *mesh) { return file->data + mesh->index_offset; }
+static inline size_t mesh_vertex_bytes(const MeshEntry *mesh) { return (size_t)mesh->vertex_count * mesh->vertex_stride; }
+static inline size_t mesh_index_bytes(const MeshEntry *mesh) { return (size_t)mesh->index_count * mesh->index_size; }
+
+/* ***** Writing (tools/mesh_convert.c) ***** */
+
+typedef struct MeshData
+{
+    // A mesh in memory, on its way into a file.
+    char name[MESH_NAME_SIZE];
+    uint32_t format;
+    uint32_t vertex_count;
+    float *vertices;         // vertex_count * mesh_vertex_stride(format) bytes
+    uint32_t index_count;
+    uint32_t *indices;       // (stored with fewer bytes when they fit)
+    float lod_error;         // (see MeshEntry)
+} MeshData;
+
+static inline int mesh_write_padding(FILE *out, uint64_t *offset)
+{
+    static const char zeros[MESH_ALIGN] = { 0 };
+    uint64_t aligned = mesh_align(*offset);
+    if (aligned > *offset && fwrite(zeros, 1, (size_t)(aligned - *offset), out) != aligned - *offset) return 0;
+    *offset = aligned;
+    return 1;
+}
+
+static inline int mesh_file_write(const char *path, const MeshData *meshes, int count)
+{
+    // Writes meshes into a new mesh file. Returns 0 (with a message) if that failed.
+    FILE *out = fopen(path, "wb");
+    MeshFileHeader header;
+    MeshEntry *entries = (MeshEntry *)calloc(count > 0 ? count : 1, sizeof(MeshEntry));
+    uint64_t offset = mesh_align(sizeof(MeshFileHeader) + sizeof(MeshEntry) * (uint64_t)count);
+    int i, ok = out != NULL;
+    uint32_t j, k;
+
+    // Where everything goes, first (the table comes before the arrays).
+    for (i = 0; i < count; i++)
+    {
+        const MeshData *m = &meshes[i];
+        MeshEntry *e = &entries[i];
+        uint32_t stride = mesh_vertex_stride(m->format);
+        memcpy(e->name, m->name, MESH_NAME_SIZE);
+        e->name[MESH_NAME_SIZE - 1] = 0;
+        e->format = m->format;
+        e->vertex_stride = stride;
+        e->vertex_count = m->vertex_count;
+        e->index_size = m->vertex_count <= 256 ? 1 : m->vertex_count <= 65536 ? 2 : 4;
+        e->index_count = m->index_count;
+        e->lod_error = m->lod_error;
+        e->vertex_offset = offset;
+        offset = mesh_align(offset + (uint64_t)m->vertex_count * stride);
+        e->index_offset = offset;
+        offset = mesh_align(offset + (uint64_t)m->index_count * e->index_size);
+        for (k = 0; k < 3; k++)
+        {
+            e->bounds_min[k] = m->vertex_count ? 1e30f : 0;
+            e->bounds_max[k] = m->vertex_count ? -1e30f : 0;
+        }
+        for (j = 0; j < m->vertex_count; j++)
+            for (k = 0; k < 3; k++)
+            {
+                float v = m->vertices[(size_t)j * (stride / sizeof(float)) + k];
+                if (v < e->bounds_min[k]) e->bounds_min[k] = v;
+                if (v > e->bounds_max[k]) e->bounds_max[k] = v;
+            }
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_MAGIC, 8);
+    header.version = MESH_VERSION;
+    header.mesh_count = (uint32_t)count;
+    header.file_size = offset;
+
+    // Then the bytes, in that order.
+    offset = 0;
+    if (ok) ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (ok && count > 0) ok = fwrite(entries, sizeof(MeshEntry), count, out) == (size_t)count;
+    offset = sizeof(header) + sizeof(MeshEntry) * (uint64_t)count;
+    for (i = 0; ok && i < count; i++)
+    {
+        const MeshData *m = &meshes[i];
+        const MeshEntry *e = &entries[i];
+        size_t vertex_bytes = (size_t)m->vertex_count * e->vertex_stride;
+        ok = mesh_write_padding(out, &offset) && fwrite(m->vertices, 1, vertex_bytes, out) == vertex_bytes;
+        offset += vertex_bytes;
+        ok = ok && mesh_write_padding(out, &offset);
+        if (ok && e->index_size == 4) ok = fwrite(m->indices, 4, m->index_count, out) == m->index_count;
+        else if (ok)
+        {
+            // Narrowed in pieces, so a big mesh doesn't need a second copy of its indices.
+            unsigned char buffer[4096];
+            uint32_t per_buffer = sizeof(buffer) / e->index_size, done, n;
+            for (done = 0; ok && done < m->index_count; done += n)
+            {
+                n = m->index_count - done < per_buffer ? m->index_count - done : per_buffer;
+                for (j = 0; j < n; j++)
+                {
+                    if (e->index_size == 1) buffer[j] = (unsigned char)m->indices[done + j];
+                    else ((uint16_t *)buffer)[j] = (uint16_t)m->indices[done + j];
+                }
+                ok = fwrite(buffer, e->index_size, n, out) == n;
+            }
+        }
+        offset += (uint64_t)m->index_count * e->index_size;
+    }
+    ok = ok && mesh_write_padding(out, &offset);
+    if (out && fclose(out) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "can't write %s\n", path);
+    free(entries);
+    return ok;
+}
+
+#endif
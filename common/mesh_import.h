@@ -0,0 +1,879 @@
+#ifndef COMMON_MESH_IMPORT_H
+#define COMMON_MESH_IMPORT_H
+
+/*
+- ***** A Note on Importing Meshes *****
+  OBJ and PLY are the formats scanned and exported models usually come in. mesh_import() reads
+  either one into a MeshData (common/mesh.h): an indexed triangle mesh ready for a vertex and an
+  index buffer, or for mesh_file_write().
+
+  Streaming: the file is read in chunks of MESH_IMPORT_CHUNK bytes, only a few of them in memory
+  at a time, so a multi-gigabyte scan loads without ever holding its text. What stays is the
+  binary result (plus, for OBJ, the v/vn lists the faces point into).
+
+  Parallel parsing (OBJ): every chunk ends at a line break, so the chunks can be parsed on
+  different threads (the job pool of common/jobs.h) into their own little lists of positions,
+  normals and faces. The main thread meanwhile reads the next chunks, and adds the parsed ones to
+  the mesh in file order. (PLY is read on one thread: its binary form is mostly copying numbers.)
+
+  Welding: OBJ faces point at positions and normals separately ("f 1//4 2//4 3//4"), but a
+  vertex buffer needs ONE index per vertex, covering all of its attributes. And scanned meshes
+  (or STL-like exports) often repeat the very same vertex many times. So every corner goes
+  through a hash table keyed on its values (position, normal, color): the first time a vertex is
+  seen it gets a new index, every repeat gets the same index back. The index buffer then shares
+  vertices between triangles, which is what the GPU's vertex cache is there for.
+
+  Supported: OBJ v (with optional r g b), vn, f (any number of corners, v, v/vt, v//vn, v/vt/vn,
+  negative = relative); PLY ascii, binary_little_endian and binary_big_endian with x y z,
+  nx ny nz, red green blue (8 bit or float) and a face list. Polygons are cut into triangles by
+  mesh_triangulate() (common/mesh_opt.h).
+  Texture coordinates, materials, groups, lines and other PLY elements are skipped.
+
+  Note: Numbers are parsed by mesh_parse_float(), which is much faster than strtof(). It can be
+        1 unit in the last place off from strtof() on some long decimals.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "mesh.h"
+#include "mesh_opt.h"
+#include "jobs.h"
+#include "clock.h"
+
+#define MESH_IMPORT_CHUNK (4 << 20)   // bytes read at a time (and the longest line allowed)
+#define MESH_IMPORT_MAX_IN_FLIGHT 16  // chunks being parsed at once
+#define MESH_IMPORT_MAX_CORNERS 256   // per polygon
+#define MESH_IMPORT_BATCH 256         // vertices welded together
+
+typedef struct MeshImportStats
+{
+    uint64_t bytes;          // of the file
+    double seconds;
+    uint64_t corners;        // triangle corners read (3 per triangle)
+    uint32_t vertices;       // after welding
+    int threads;             // that parsed
+} MeshImportStats;
+
+/* ***** Numbers ***** */
+
+static inline const char *mesh_parse_float(const char *p, float *out)
+{
+    // Reads a number like -1.25e-3 (after spaces). Returns where it ended, or NULL if there was none.
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    uint64_t mantissa = 0;
+    int negative = 0, digits = 0, exponent = 0;
+    double value;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '-') { negative = 1; p++; }
+    else if (*p == '+') p++;
+    for (; *p >= '0' && *p <= '9'; p++, digits++)
+    {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else exponent++; // (digits past the 17th don't change a float)
+    }
+    if (*p == '.')
+        for (p++; *p >= '0' && *p <= '9'; p++, digits++)
+            if (mantissa < 100000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+    if (digits == 0) return NULL;
+    if (*p == 'e' || *p == 'E')
+    {
+        int e = 0, e_negative = 0;
+        const char *q = p + 1;
+        if (*q == '-') { e_negative = 1; q++; }
+        else if (*q == '+') q++;
+        if (*q >= '0' && *q <= '9')
+        {
+            for (; *q >= '0' && *q <= '9'; q++) if (e < 1000) e = e * 10 + (*q - '0');
+            exponent += e_negative ? -e : e;
+            p = q;
+        }
+    }
+    value = (double)mantissa;
+    while (exponent > 22) { value *= 1e22; exponent -= 22; }
+    while (exponent < -22) { value /= 1e22; exponent += 22; }
+    value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+    *out = (float)(negative ? -value : value);
+    return p;
+}
+
+static inline const char *mesh_parse_int(const char *p, long *out)
+{
+    // Reads a whole number (right here, no spaces skipped). NULL if there is none.
+    long value = 0;
+    int negative = 0;
+    const char *start;
+    if (*p == '-') { negative = 1; p++; }
+    start = p;
+    for (; *p >= '0' && *p <= '9'; p++) if (value < 100000000000L) value = value * 10 + (*p - '0');
+    if (p == start) return NULL;
+    *out = negative ? -value : value;
+    return p;
+}
+
+static inline void *mesh_import_grow(void *array, size_t *capacity, size_t needed, size_t item_size)
+{
+    if (needed <= *capacity) return array;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 4096;
+    array = realloc(array, item_size * *capacity);
+    if (!array)
+    {
+        fprintf(stderr, "mesh import: out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+/* ***** Welding ***** */
+
+#define MESH_WELD_FLOATS 9 // x y z, nx ny nz, r g b
+#define MESH_WELD_GROUP 16 // vertices looked up together (see mesh_weld_many())
+
+typedef struct MeshWelder
+{
+    float *vertices;       // MESH_WELD_FLOATS per vertex
+    size_t count, capacity;
+    uint64_t *table;       // hash << 32 | vertex index + 1 (0 = empty), open addressing
+    size_t table_size;     // a power of 2, kept at least twice the count
+} MeshWelder;
+
+static inline uint32_t mesh_weld_hash(const float *v)
+{
+    uint32_t h = 2166136261u, word;
+    int i;
+    for (i = 0; i < MESH_WELD_FLOATS; i++)
+    {
+        memcpy(&word, &v[i], 4);
+        h = (h ^ word) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static inline void mesh_weld_reserve(MeshWelder *w, size_t count)
+{
+    // Makes room for count vertices (if we know how many there will be, this saves growing the
+    // table step by step, and rehashing everything every time).
+    size_t table_size = 1 << 16, i;
+    while (table_size < count * 2) table_size *= 2;
+    w->vertices = (float *)mesh_import_grow(w->vertices, &w->capacity, count, sizeof(float) * MESH_WELD_FLOATS);
+    if (table_size <= w->table_size) return;
+    free(w->table);
+    w->table = (uint64_t *)calloc(table_size, sizeof(uint64_t));
+    w->table_size = table_size;
+    if (!w->table)
+    {
+        fprintf(stderr, "mesh import: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < w->count; i++)
+    {
+        uint32_t hash = mesh_weld_hash(w->vertices + i * MESH_WELD_FLOATS);
+        size_t slot = hash & (table_size - 1);
+        while (w->table[slot]) slot = (slot + 1) & (table_size - 1);
+        w->table[slot] = (uint64_t)hash << 32 | (uint32_t)(i + 1);
+    }
+}
+
+static inline uint32_t mesh_weld(MeshWelder *w, const float *v)
+{
+    // The index of the vertex with exactly these values, a new one if there is none yet. The
+    // table keeps the hashes too, so a different vertex in the way costs no trip to its values
+    // (with millions of vertices every one of those trips is a cache miss).
+    uint32_t hash = mesh_weld_hash(v);
+    size_t slot;
+    if ((w->count + 1) * 2 > w->table_size) mesh_weld_reserve(w, w->count * 2);
+    slot = hash & (w->table_size - 1);
+    while (w->table[slot])
+    {
+        uint32_t index = (uint32_t)w->table[slot] - 1;
+        if ((uint32_t)(w->table[slot] >> 32) == hash &&
+            memcmp(w->vertices + (size_t)index * MESH_WELD_FLOATS, v, sizeof(float) * MESH_WELD_FLOATS) == 0) return index;
+        slot = (slot + 1) & (w->table_size - 1);
+    }
+    if (w->count >= 0xffffffffu)
+    {
+        fprintf(stderr, "mesh import: more than 4 billion vertices\n");
+        exit(1);
+    }
+    w->vertices = (float *)mesh_import_grow(w->vertices, &w->capacity, w->count + 1, sizeof(float) * MESH_WELD_FLOATS);
+    memcpy(w->vertices + w->count * MESH_WELD_FLOATS, v, sizeof(float) * MESH_WELD_FLOATS);
+    w->table[slot] = (uint64_t)hash << 32 | (uint32_t)++w->count;
+    return (uint32_t)(w->count - 1);
+}
+
+static inline void mesh_weld_many(MeshWelder *w, const float *keys, size_t count, uint32_t *indices)
+{
+    // mesh_weld() for count vertices, MESH_WELD_GROUP at a time: first the hashes, and a prefetch
+    // of their table slots, so the cache misses of a group overlap instead of coming one by one.
+    size_t first, i;
+    for (first = 0; first < count; first += MESH_WELD_GROUP)
+    {
+        size_t n = count - first < MESH_WELD_GROUP ? count - first : MESH_WELD_GROUP;
+        if ((w->count + n) * 2 > w->table_size) mesh_weld_reserve(w, (w->count + n) * 2);
+        for (i = 0; i < n; i++)
+            __builtin_prefetch(&w->table[mesh_weld_hash(keys + (first + i) * MESH_WELD_FLOATS) & (w->table_size - 1)]);
+        for (i = 0; i < n; i++) indices[first + i] = mesh_weld(w, keys + (first + i) * MESH_WELD_FLOATS);
+    }
+}
+
+static inline void mesh_weld_finish(MeshWelder *w, uint32_t format, MeshData *out)
+{
+    // Packs the vertices down to the attributes the mesh has (in place) into out.
+    uint32_t floats = mesh_vertex_stride(format) / sizeof(float);
+    size_t i;
+    for (i = 0; i < w->count; i++)
+    {
+        const float *in = w->vertices + i * MESH_WELD_FLOATS;
+        float *packed = w->vertices + i * floats, v[MESH_WELD_FLOATS];
+        memcpy(v, in, sizeof(v)); // (in and packed overlap)
+        memcpy(packed, v, sizeof(float) * 3);
+        packed += 3;
+        if (format & MESH_HAS_NORMAL) { memcpy(packed, v + 3, sizeof(float) * 3); packed += 3; }
+        if (format & MESH_HAS_COLOR) memcpy(packed, v + 6, sizeof(float) * 3);
+    }
+    out->format = format;
+    out->vertex_count = (uint32_t)w->count;
+    out->vertices = w->count ? (float *)realloc(w->vertices, sizeof(float) * floats * w->count) : w->vertices;
+    free(w->table);
+    memset(w, 0, sizeof(*w));
+}
+
+/* ***** OBJ ***** */
+
+typedef struct ObjCorner
+{
+    int32_t v, vn;      // 0-based, or relative to the chunk's first v/vn (see relative)
+    int32_t relative;   // 1: v is, 2: vn is ("-1" = the last one so far, resolved when merging)
+} ObjCorner;
+
+typedef struct ObjChunk
+{
+    char *text;             // the chunk, whole lines, '\0' after the last '\n'
+    size_t length;
+    JobBatch batch;
+    // parsed:
+    float *positions;       // x y z r g b
+    size_t position_count, position_capacity;
+    float *normals;         // x y z
+    size_t normal_count, normal_capacity;
+    ObjCorner *corners;     // 3 per triangle
+    size_t corner_count, corner_capacity;
+    uint32_t *polygons;     // first corner, corner count of every face with more than 3
+    size_t polygon_count, polygon_capacity;
+    int has_color;
+    long lines;
+    long error_line;        // in the chunk, from 1 (0 = fine)
+    const char *error;
+} ObjChunk;
+
+static inline void obj_parse_chunk(void *arg, int unused_first, int unused_last)
+{
+    // One chunk into its own lists (runs on a worker thread).
+    ObjChunk *c = (ObjChunk *)arg;
+    const char *p = c->text, *end = c->text + c->length;
+    long line = 1;
+    (void)unused_first;
+    (void)unused_last;
+    c->position_count = c->normal_count = c->corner_count = c->polygon_count = 0;
+    c->has_color = 0;
+    c->error_line = 0;
+    for (; p < end; line++)
+    {
+        const char *next = (const char *)memchr(p, '\n', (size_t)(end - p)) + 1;
+        while (*p == ' ' || *p == '\t') p++;
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            float f[6] = { 0, 0, 0, 1, 1, 1 };
+            const char *q = p + 1;
+            int n = 0;
+            while (n < 3 && (q = mesh_parse_float(q, &f[n])) != NULL) n++;
+            if (n < 3) { c->error = "'v' needs x y z"; c->error_line = line; return; }
+            if ((q = mesh_parse_float(q, &f[3])) != NULL) // x y z w, or x y z r g b
+            {
+                if ((q = mesh_parse_float(q, &f[4])) != NULL && mesh_parse_float(q, &f[5]) != NULL) c->has_color = 1;
+                else f[3] = f[4] = f[5] = 1;
+            }
+            c->positions = (float *)mesh_import_grow(c->positions, &c->position_capacity, c->position_count + 1, sizeof(float) * 6);
+            memcpy(c->positions + c->position_count++ * 6, f, sizeof(f));
+        }
+        else if (p[0] == 'v' && p[1] == 'n')
+        {
+            float f[3];
+            const char *q = p + 2;
+            int n = 0;
+            while (n < 3 && (q = mesh_parse_float(q, &f[n])) != NULL) n++;
+            if (n < 3) { c->error = "'vn' needs x y z"; c->error_line = line; return; }
+            c->normals = (float *)mesh_import_grow(c->normals, &c->normal_capacity, c->normal_count + 1, sizeof(float) * 3);
+            memcpy(c->normals + c->normal_count++ * 3, f, sizeof(f));
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            ObjCorner polygon[MESH_IMPORT_MAX_CORNERS];
+            const char *q = p + 1;
+            int n = 0, k;
+            for (;;)
+            {
+                long v, vt, vn = 0;
+                ObjCorner *corner = &polygon[n];
+                while (*q == ' ' || *q == '\t' || *q == '\r') q++;
+                if (*q == '\n' || *q == '#') break;
+                if (n == MESH_IMPORT_MAX_CORNERS || (q = mesh_parse_int(q, &v)) == NULL || v == 0)
+                {
+                    c->error = "bad face (v, v/vt, v//vn or v/vt/vn, at most 256 corners)";
+                    c->error_line = line;
+                    return;
+                }
+                if (*q == '/')
+                {
+                    q++;
+                    if (*q != '/' && (q = mesh_parse_int(q, &vt)) == NULL) { c->error = "bad texture index"; c->error_line = line; return; }
+                    if (*q == '/' && (q = mesh_parse_int(q + 1, &vn)) == NULL) { c->error = "bad normal index"; c->error_line = line; return; }
+                }
+                // 1-based, or negative = counted back from the last one so far.
+                corner->relative = (v < 0 ? 1 : 0) | (vn < 0 ? 2 : 0);
+                corner->v = (int32_t)(v < 0 ? (long)c->position_count + v : v - 1);
+                corner->vn = (int32_t)(vn < 0 ? (long)c->normal_count + vn : vn == 0 ? -1 : vn - 1);
+                if (vn == 0) corner->relative |= 4; // (no normal)
+                n++;
+            }
+            if (n < 3) { c->error = "a face needs 3 corners"; c->error_line = line; return; }
+            if (n > 3)
+            {
+                // Stored as a fan for now: it's cut properly once its corners have positions (see obj_merge_chunk()).
+                c->polygons = (uint32_t *)mesh_import_grow(c->polygons, &c->polygon_capacity, c->polygon_count * 2 + 2, sizeof(uint32_t));
+                c->polygons[c->polygon_count * 2] = (uint32_t)c->corner_count;
+                c->polygons[c->polygon_count++ * 2 + 1] = (uint32_t)n;
+            }
+            c->corners = (ObjCorner *)mesh_import_grow(c->corners, &c->corner_capacity, c->corner_count + (size_t)(n - 2) * 3, sizeof(ObjCorner));
+            for (k = 1; k + 1 < n; k++)
+            {
+                c->corners[c->corner_count++] = polygon[0];
+                c->corners[c->corner_count++] = polygon[k];
+                c->corners[c->corner_count++] = polygon[k + 1];
+            }
+        }
+        p = next;
+    }
+    c->lines = line - 1;
+}
+
+typedef struct ObjMerge
+{
+    // Everything added to the mesh so far.
+    float *positions;
+    size_t position_count, position_capacity;
+    float *normals;
+    size_t normal_count, normal_capacity;
+    int has_color, has_normal;
+    uint32_t *last_vertex;   // per position: the vertex its last corner became,
+    int32_t *last_normal;    // and that corner's normal (-1 = none, -2 = no corner yet)
+    size_t last_capacity;
+    MeshWelder welder;
+    uint32_t *indices;
+    size_t index_count, index_capacity;
+    long lines;              // in the chunks added so far
+} ObjMerge;
+
+static inline int obj_merge_chunk(ObjMerge *m, ObjChunk *c, const char *path)
+{
+    // Adds a parsed chunk to the mesh (main thread, in file order).
+    // Most corners use a position together with the same normal as the last corner that used it
+    // (a smooth mesh: "f 7//7 ..." everywhere). Those get that corner's vertex straight away, only
+    // the others are looked up in the welder (which would find the same one, just slower).
+    float keys[MESH_IMPORT_BATCH * MESH_WELD_FLOATS];
+    uint32_t welded[MESH_IMPORT_BATCH], *indices;
+    size_t missed[MESH_IMPORT_BATCH];
+    size_t base_v = m->position_count, base_vn = m->normal_count, first, i, size = m->last_capacity;
+    if (c->error_line)
+    {
+        fprintf(stderr, "%s:%ld: %s\n", path, m->lines + c->error_line, c->error);
+        return 0;
+    }
+    m->positions = (float *)mesh_import_grow(m->positions, &m->position_capacity, m->position_count + c->position_count, sizeof(float) * 6);
+    if (c->position_count) memcpy(m->positions + m->position_count * 6, c->positions, sizeof(float) * 6 * c->position_count);
+    m->position_count += c->position_count;
+    m->last_vertex = (uint32_t *)mesh_import_grow(m->last_vertex, &size, m->position_count, sizeof(uint32_t));
+    m->last_normal = (int32_t *)mesh_import_grow(m->last_normal, &m->last_capacity, m->position_count, sizeof(int32_t));
+    for (i = base_v; i < m->position_count; i++) m->last_normal[i] = -2;
+    m->normals = (float *)mesh_import_grow(m->normals, &m->normal_capacity, m->normal_count + c->normal_count, sizeof(float) * 3);
+    if (c->normal_count) memcpy(m->normals + m->normal_count * 3, c->normals, sizeof(float) * 3 * c->normal_count); // (NULL when the chunk has none)
+    m->normal_count += c->normal_count;
+    m->has_color |= c->has_color;
+    m->indices = (uint32_t *)mesh_import_grow(m->indices, &m->index_capacity, m->index_count + c->corner_count, sizeof(uint32_t));
+    for (first = 0; first < c->corner_count; first += MESH_IMPORT_BATCH)
+    {
+        // A batch of corners: the ones the positions remember, then the rest (see mesh_weld_many()).
+        size_t n = c->corner_count - first < MESH_IMPORT_BATCH ? c->corner_count - first : MESH_IMPORT_BATCH, misses = 0;
+        indices = m->indices + m->index_count;
+        for (i = 0; i < n; i++)
+        {
+            const ObjCorner *corner = &c->corners[first + i];
+            long v = corner->relative & 1 ? (long)base_v + corner->v : corner->v;
+            long vn = corner->relative & 4 ? -1 : corner->relative & 2 ? (long)base_vn + corner->vn : corner->vn;
+            float *key = keys + misses * MESH_WELD_FLOATS;
+            if (v < 0 || v >= (long)m->position_count || (vn != -1 && (vn < 0 || vn >= (long)m->normal_count)))
+            {
+                fprintf(stderr, "%s:%ld..%ld: a face refers to a vertex or normal that isn't there (yet)\n", path,
+                        m->lines + 1, m->lines + c->lines);
+                return 0;
+            }
+            if (m->last_normal[v] == vn)
+            {
+                indices[i] = m->last_vertex[v];
+                continue;
+            }
+            memcpy(key, m->positions + v * 6, sizeof(float) * 3);
+            if (vn >= 0)
+            {
+                memcpy(key + 3, m->normals + vn * 3, sizeof(float) * 3);
+                m->has_normal = 1;
+            }
+            else key[3] = key[4] = key[5] = 0;
+            memcpy(key + 6, m->positions + v * 6 + 3, sizeof(float) * 3);
+            missed[misses++] = i;
+        }
+        mesh_weld_many(&m->welder, keys, misses, welded);
+        for (i = 0; i < misses; i++)
+        {
+            const ObjCorner *corner = &c->corners[first + missed[i]];
+            long v = corner->relative & 1 ? (long)base_v + corner->v : corner->v;
+            indices[missed[i]] = welded[i];
+            m->last_vertex[v] = welded[i];
+            m->last_normal[v] = corner->relative & 4 ? -1 : corner->relative & 2 ? (int32_t)(base_vn + corner->vn) : corner->vn;
+        }
+        m->index_count += n;
+    }
+    for (i = 0; i < c->polygon_count; i++)
+    {
+        // The fan 0 1 2, 0 2 3, ... back into the polygon 0 1 2 3 ..., then cut for real.
+        uint32_t *fan = m->indices + (m->index_count - c->corner_count) + c->polygons[i * 2], polygon[MESH_IMPORT_MAX_CORNERS];
+        uint32_t n = c->polygons[i * 2 + 1], k;
+        polygon[0] = fan[0];
+        for (k = 1; k < n; k++) polygon[k] = fan[k == 1 ? 1 : (k - 2) * 3 + 2];
+        mesh_triangulate(m->welder.vertices, MESH_WELD_FLOATS, polygon, (int)n, fan);
+    }
+    m->lines += c->lines;
+    return 1;
+}
+
+static inline int obj_import(FILE *file, const char *path, MeshData *out, JobPool *pool, MeshImportStats *stats)
+{
+    // Reads chunk i + 1 while chunk i is parsed, up to in_flight chunks ahead.
+    ObjChunk chunks[MESH_IMPORT_MAX_IN_FLIGHT];
+    ObjMerge merge;
+    JobPool no_pool;
+    char *carry = (char *)malloc(MESH_IMPORT_CHUNK);
+    size_t carry_length = 0;
+    int in_flight = pool && pool->worker_count ? 2 * (pool->worker_count + 1) : 1;
+    int ok = 1, at_end = 0, i, submitted = 0, merged = 0;
+    if (!pool)
+    {
+        memset(&no_pool, 0, sizeof(no_pool)); // (jobs run right away)
+        pool = &no_pool;
+    }
+    if (in_flight > MESH_IMPORT_MAX_IN_FLIGHT) in_flight = MESH_IMPORT_MAX_IN_FLIGHT;
+    memset(chunks, 0, sizeof(chunks));
+    memset(&merge, 0, sizeof(merge));
+    for (i = 0; i < in_flight; i++) chunks[i].text = (char *)malloc(MESH_IMPORT_CHUNK + 2);
+
+    while (ok && (!at_end || merged < submitted))
+    {
+        if (!at_end && submitted - merged < in_flight)
+        {
+            // The next chunk: the unfinished line of the last one + as much as fits.
+            ObjChunk *c = &chunks[submitted % in_flight];
+            size_t got, last;
+            memcpy(c->text, carry, carry_length);
+            got = carry_length + fread(c->text + carry_length, 1, MESH_IMPORT_CHUNK - carry_length, file);
+            stats->bytes += got - carry_length;
+            at_end = got < MESH_IMPORT_CHUNK;
+            for (last = got; last > 0 && c->text[last - 1] != '\n'; last--) { }
+            if (at_end && last < got) c->text[last = got++] = '\n'; // (no line break at the very end)
+            if (last == 0 && got > 0)
+            {
+                fprintf(stderr, "%s: a line longer than %d bytes (after byte %llu)\n", path, MESH_IMPORT_CHUNK,
+                        (unsigned long long)(stats->bytes - got));
+                ok = 0;
+                break;
+            }
+            carry_length = got - last;
+            memcpy(carry, c->text + last, carry_length);
+            c->text[last] = '\0';
+            c->length = last;
+            jobs_parallel_for(pool, &c->batch, obj_parse_chunk, c, 1, 1);
+            submitted++;
+            continue;
+        }
+        // Otherwise the oldest chunk is next in line to be added (helping with the parsing while we wait).
+        jobs_wait(pool, &chunks[merged % in_flight].batch);
+        ok = obj_merge_chunk(&merge, &chunks[merged % in_flight], path);
+        merged++;
+    }
+    while (merged < submitted) jobs_wait(pool, &chunks[merged++ % in_flight].batch); // (after an error)
+
+    for (i = 0; i < in_flight; i++)
+    {
+        free(chunks[i].text);
+        free(chunks[i].positions);
+        free(chunks[i].normals);
+        free(chunks[i].corners);
+        free(chunks[i].polygons);
+    }
+    free(carry);
+    free(merge.positions);
+    free(merge.normals);
+    free(merge.last_vertex);
+    free(merge.last_normal);
+    stats->threads = pool ? pool->worker_count + 1 : 1;
+    if (!ok)
+    {
+        free(merge.welder.vertices);
+        free(merge.welder.table);
+        free(merge.indices);
+        return 0;
+    }
+    if (merge.index_count > 0xffffffffu)
+    {
+        fprintf(stderr, "%s: more than 4 billion triangle corners\n", path);
+        return 0;
+    }
+    stats->corners = merge.index_count;
+    mesh_weld_finish(&merge.welder, (merge.has_normal ? MESH_HAS_NORMAL : 0) | (merge.has_color ? MESH_HAS_COLOR : 0), out);
+    out->indices = merge.indices;
+    out->index_count = (uint32_t)merge.index_count;
+    return 1;
+}
+
+/* ***** PLY ***** */
+
+typedef struct MeshStream
+{
+    // A file read through a buffer, a little at a time.
+    FILE *file;
+    unsigned char *buffer;
+    size_t start, end;
+    int at_end;
+    uint64_t bytes;
+} MeshStream;
+
+static inline int mesh_stream_need(MeshStream *s, size_t n)
+{
+    // Makes sure n bytes (at most MESH_IMPORT_CHUNK) are in the buffer. 0 if the file ends first.
+    if (s->end - s->start >= n) return 1;
+    memmove(s->buffer, s->buffer + s->start, s->end - s->start);
+    s->end -= s->start;
+    s->start = 0;
+    while (!s->at_end && s->end < n)
+    {
+        size_t got = fread(s->buffer + s->end, 1, MESH_IMPORT_CHUNK - s->end, s->file);
+        s->end += got;
+        s->bytes += got;
+        if (got == 0) s->at_end = 1;
+    }
+    return s->end - s->start >= n;
+}
+
+static inline char *mesh_stream_line(MeshStream *s)
+{
+    // The next text line ('\0' instead of its '\n'), NULL at the end of the file.
+    unsigned char *newline;
+    char *line;
+    size_t search = 0;
+    for (;;)
+    {
+        newline = (unsigned char *)memchr(s->buffer + s->start + search, '\n', s->end - s->start - search);
+        if (newline) break;
+        search = s->end - s->start;
+        if (s->at_end || search >= MESH_IMPORT_CHUNK) break;
+        mesh_stream_need(s, search + 4096 < MESH_IMPORT_CHUNK ? search + 4096 : MESH_IMPORT_CHUNK);
+        if (s->end - s->start == search) break; // (nothing more came)
+    }
+    if (!newline)
+    {
+        if (s->end == s->start || s->end - s->start >= MESH_IMPORT_CHUNK) return NULL;
+        newline = s->buffer + s->end; // (last line without a line break: there's room after it)
+        s->end++;
+    }
+    *newline = '\0';
+    line = (char *)s->buffer + s->start;
+    s->start = (size_t)(newline - s->buffer) + 1;
+    return line;
+}
+
+enum { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+enum { PLY_ASCII, PLY_LITTLE_ENDIAN, PLY_BIG_ENDIAN };
+
+typedef struct PlyProperty
+{
+    char name[32];
+    int type;            // PLY_* (the items' type for a list)
+    int count_type;      // -1 = not a list
+} PlyProperty;
+
+typedef struct PlyElement
+{
+    char name[32];
+    uint64_t count;
+    PlyProperty properties[32];
+    int property_count;
+} PlyElement;
+
+static inline int ply_type(const char *name)
+{
+    static const char *names[][2] = { { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+                                      { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" } };
+    int i;
+    for (i = 0; i < 8; i++)
+        if (strcmp(name, names[i][0]) == 0 || strcmp(name, names[i][1]) == 0) return i;
+    return -1;
+}
+
+static inline int ply_read(MeshStream *s, int format, int type, double *out)
+{
+    // One value of a property. 0 at the end of the file (or a broken number).
+    static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+    unsigned char bytes[8];
+    int size = sizes[type], i;
+    if (format == PLY_ASCII)
+    {
+        float f;
+        const char *p, *end;
+        for (;;)
+        {
+            if (!mesh_stream_need(s, 64) && s->end == s->start) return 0;
+            while (s->start < s->end && (s->buffer[s->start] == ' ' || s->buffer[s->start] == '\t' ||
+                                         s->buffer[s->start] == '\n' || s->buffer[s->start] == '\r')) s->start++;
+            if (s->start < s->end) break;
+        }
+        mesh_stream_need(s, 64); // (a whole number in the buffer)
+        s->buffer[s->end] = '\0'; // (the buffer has a byte more, for this)
+        p = (const char *)s->buffer + s->start;
+        if ((end = mesh_parse_float(p, &f)) == NULL) return 0;
+        if (type == PLY_FLOAT64)
+        {
+            *out = strtod(p, NULL); // (the rare double: exactly)
+        }
+        else *out = f;
+        s->start += (size_t)(end - p);
+        return 1;
+    }
+    if (!mesh_stream_need(s, (size_t)size)) return 0;
+    for (i = 0; i < size; i++) bytes[i] = s->buffer[s->start + (format == PLY_BIG_ENDIAN ? size - 1 - i : i)];
+    s->start += (size_t)size;
+    {
+        // bytes[] is little endian now.
+        uint64_t u = 0;
+        for (i = size - 1; i >= 0; i--) u = (u << 8) | bytes[i];
+        switch (type)
+        {
+            case PLY_INT8: *out = (int8_t)u; break;
+            case PLY_UINT8: *out = (uint8_t)u; break;
+            case PLY_INT16: *out = (int16_t)u; break;
+            case PLY_UINT16: *out = (uint16_t)u; break;
+            case PLY_INT32: *out = (int32_t)u; break;
+            case PLY_UINT32: *out = (uint32_t)u; break;
+            case PLY_FLOAT32: { uint32_t w = (uint32_t)u; float f; memcpy(&f, &w, 4); *out = f; break; }
+            default: { double d; memcpy(&d, &u, 8); *out = d; break; }
+        }
+    }
+    return 1;
+}
+
+static inline int ply_import(FILE *file, const char *path, MeshData *out, MeshImportStats *stats)
+{
+    MeshStream s;
+    PlyElement elements[16];
+    int element_count = 0, format = -1, e, ok = 1;
+    char *line;
+    uint32_t *remap = NULL;    // PLY vertex -> welded vertex
+    uint64_t ply_vertices = 0;
+    MeshWelder welder;
+    uint32_t *indices = NULL, mesh_format = 0;
+    size_t index_count = 0, index_capacity = 0;
+
+    memset(&s, 0, sizeof(s));
+    memset(&welder, 0, sizeof(welder));
+    s.file = file;
+    s.buffer = (unsigned char *)malloc(MESH_IMPORT_CHUNK + 1);
+
+    // The header: "ply", "format ...", "element NAME COUNT", "property TYPE NAME", "property list
+    // COUNT_TYPE TYPE NAME", ..., "end_header".
+    line = mesh_stream_line(&s);
+    if (!line || strncmp(line, "ply", 3) != 0) { fprintf(stderr, "%s: not a PLY file\n", path); ok = 0; }
+    while (ok && (line = mesh_stream_line(&s)) != NULL && strncmp(line, "end_header", 10) != 0)
+    {
+        char a[32], b[32], c[32];
+        unsigned long long count;
+        if (sscanf(line, "format %31s", a) == 1)
+            format = strcmp(a, "ascii") == 0 ? PLY_ASCII : strcmp(a, "binary_little_endian") == 0 ? PLY_LITTLE_ENDIAN :
+                     strcmp(a, "binary_big_endian") == 0 ? PLY_BIG_ENDIAN : -1;
+        else if (sscanf(line, "element %31s %llu", a, &count) == 2 && element_count < 16)
+        {
+            memset(&elements[element_count], 0, sizeof(PlyElement));
+            strcpy(elements[element_count].name, a);
+            elements[element_count++].count = count;
+        }
+        else if (sscanf(line, "property list %31s %31s %31s", a, b, c) == 3 && element_count > 0 &&
+                 elements[element_count - 1].property_count < 32)
+        {
+            PlyProperty *p = &elements[element_count - 1].properties[elements[element_count - 1].property_count++];
+            p->count_type = ply_type(a);
+            p->type = ply_type(b);
+            strcpy(p->name, c);
+            if (p->count_type < 0 || p->type < 0) ok = 0;
+        }
+        else if (sscanf(line, "property %31s %31s", a, b) == 2 && element_count > 0 &&
+                 elements[element_count - 1].property_count < 32)
+        {
+            PlyProperty *p = &elements[element_count - 1].properties[elements[element_count - 1].property_count++];
+            p->count_type = -1;
+            p->type = ply_type(a);
+            strcpy(p->name, b);
+            if (p->type < 0) ok = 0;
+        }
+        else if (strncmp(line, "comment", 7) == 0 || strncmp(line, "obj_info", 8) == 0) { }
+        else if (line[0] != '\0' && line[0] != '\r') ok = 0;
+        if (!ok) fprintf(stderr, "%s: can't read the PLY header line '%s'\n", path, line);
+    }
+    if (ok && (!line || format < 0))
+    {
+        fprintf(stderr, "%s: PLY header without a known format or end_header\n", path);
+        ok = 0;
+    }
+
+    for (e = 0; ok && e < element_count; e++)
+    {
+        PlyElement *el = &elements[e];
+        int is_vertex = strcmp(el->name, "vertex") == 0, is_face = strcmp(el->name, "face") == 0, k;
+        int slot[32];      // which of the 9 floats a property goes to (-1 = none)
+        float scale[32];   // (8 bit colors are 0..255)
+        int is_index[32];  // the face's list of vertices
+        float keys[MESH_IMPORT_BATCH * MESH_WELD_FLOATS];
+        size_t batched = 0;
+        uint64_t i;
+        for (k = 0; k < el->property_count; k++)
+        {
+            static const char *names[] = { "x", "y", "z", "nx", "ny", "nz", "red", "green", "blue" };
+            int n;
+            slot[k] = -1;
+            scale[k] = 1;
+            is_index[k] = is_face && el->properties[k].count_type >= 0 &&
+                          (strcmp(el->properties[k].name, "vertex_indices") == 0 || strcmp(el->properties[k].name, "vertex_index") == 0);
+            for (n = 0; is_vertex && n < 9; n++)
+                if (strcmp(el->properties[k].name, names[n]) == 0 && el->properties[k].count_type < 0) slot[k] = n;
+            if (slot[k] >= 3) mesh_format |= slot[k] < 6 ? MESH_HAS_NORMAL : MESH_HAS_COLOR;
+            if (slot[k] >= 6 && el->properties[k].type == PLY_UINT8) scale[k] = 1 / 255.0f;
+        }
+        if (is_vertex)
+        {
+            ply_vertices = el->count;
+            remap = (uint32_t *)malloc(sizeof(uint32_t) * (el->count ? el->count : 1));
+            if (!remap) { fprintf(stderr, "%s: out of memory\n", path); ok = 0; break; }
+            mesh_weld_reserve(&welder, (size_t)el->count); // (at most that many after welding)
+        }
+        for (i = 0; ok && i < el->count; i++)
+        {
+            static const float defaults[MESH_WELD_FLOATS] = { 0, 0, 0, 0, 0, 0, 1, 1, 1 };
+            float *key = keys + batched * MESH_WELD_FLOATS;
+            uint32_t polygon[MESH_IMPORT_MAX_CORNERS];
+            int corners = 0;
+            memcpy(key, defaults, sizeof(defaults));
+            for (k = 0; ok && k < el->property_count; k++)
+            {
+                const PlyProperty *p = &el->properties[k];
+                double value, count;
+                uint64_t n;
+                if (p->count_type < 0)
+                {
+                    ok = ply_read(&s, format, p->type, &value);
+                    if (slot[k] >= 0) key[slot[k]] = (float)value * scale[k];
+                    continue;
+                }
+                ok = ply_read(&s, format, p->count_type, &count);
+                for (n = 0; ok && n < (uint64_t)count; n++)
+                {
+                    ok = ply_read(&s, format, p->type, &value);
+                    if (!is_index[k]) continue;
+                    if (value < 0 || value >= (double)ply_vertices || !remap || corners == MESH_IMPORT_MAX_CORNERS)
+                    {
+                        fprintf(stderr, "%s: face %llu has a bad vertex index or too many corners\n", path, (unsigned long long)i);
+                        ok = 0;
+                        break;
+                    }
+                    polygon[corners++] = remap[(uint64_t)value];
+                }
+            }
+            if (!ok) break;
+            if (is_vertex && (++batched == MESH_IMPORT_BATCH || i + 1 == el->count))
+            {
+                mesh_weld_many(&welder, keys, batched, remap + i + 1 - batched);
+                batched = 0;
+            }
+            else if (is_face && corners >= 3)
+            {
+                indices = (uint32_t *)mesh_import_grow(indices, &index_capacity, index_count + (size_t)(corners - 2) * 3, sizeof(uint32_t));
+                index_count += (size_t)mesh_triangulate(welder.vertices, MESH_WELD_FLOATS, polygon, corners, indices + index_count) * 3;
+            }
+        }
+        if (!ok) fprintf(stderr, "%s: the %s data ends early or is broken\n", path, el->name);
+    }
+    stats->bytes = s.bytes;
+    stats->threads = 1;
+    free(s.buffer);
+    free(remap);
+    if (!ok || index_count > 0xffffffffu)
+    {
+        free(welder.vertices);
+        free(welder.table);
+        free(indices);
+        return 0;
+    }
+    stats->corners = index_count;
+    mesh_weld_finish(&welder, mesh_format, out);
+    out->indices = indices;
+    out->index_count = (uint32_t)index_count;
+    return 1;
+}
+
+/* ***** Either one ***** */
+
+static inline int mesh_import(const char *path, MeshData *out, JobPool *pool, MeshImportStats *stats)
+{
+    // Reads an .obj or .ply file into out (named after the file). pool = NULL or a pool with no
+    // workers parses on this thread only. Returns 0 (with a message) if it couldn't.
+    size_t length = strlen(path);
+    const char *name = path + length;
+    FILE *file;
+    uint64_t start = clock_now_ns();
+    int ok, is_ply = length > 4 && (strcmp(path + length - 4, ".ply") == 0 || strcmp(path + length - 4, ".PLY") == 0);
+    int is_obj = length > 4 && (strcmp(path + length - 4, ".obj") == 0 || strcmp(path + length - 4, ".OBJ") == 0);
+    memset(out, 0, sizeof(*out));
+    memset(stats, 0, sizeof(*stats));
+    if (!is_ply && !is_obj)
+    {
+        fprintf(stderr, "%s: expected an .obj or .ply file\n", path);
+        return 0;
+    }
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return 0;
+    }
+    while (name > path && name[-1] != '/' && name[-1] != '\\') name--;
+    snprintf(out->name, MESH_NAME_SIZE, "%.*s", (int)(path + length - 4 - name), name); // (without the extension)
+    ok = is_ply ? ply_import(file, path, out, stats) : obj_import(file, path, out, pool, stats);
+    fclose(file);
+    stats->seconds = (clock_now_ns() - start) / 1e9;
+    stats->vertices = out->vertex_count;
+    return ok;
+}
+
+#endif
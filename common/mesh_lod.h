@@ -0,0 +1,490 @@
+#ifndef COMMON_MESH_LOD_H
+#define COMMON_MESH_LOD_H
+
+/*
+- ***** A Note on Levels of Detail *****
+  A model far away from the camera covers a handful of pixels, but drawn as it is every one of its
+  triangles still goes through the vertex shader, the clipper and the rasterizer (most of them
+  smaller than a pixel by then, so they don't even produce one). A level of detail (LOD) is a
+  simpler version of the same model for when it's far: the further, the simpler. Done right
+  nobody can tell, since the difference is smaller than a pixel.
+
+  1. Simplifying: mesh_simplify() is Garland and Heckbert's "Surface Simplification Using Quadric
+     Error Metrics". It removes vertices one edge at a time: an edge collapse moves a vertex onto
+     its neighbor at the other end of the edge, and the 1 or 2 triangles on that edge vanish.
+     Which edge first? Every vertex keeps the planes of the triangles around it in a "quadric", a
+     4x4 matrix Q with which v^T Q v is the sum of the squared distances from v to all those
+     planes. Moving u onto v costs (Q_u + Q_v) evaluated at v: how far v is from where the
+     surface around u and v used to be. The cheapest collapses go first, and the quadrics add up,
+     so the error of a vertex remembers everything that was collapsed into it.
+     Collapses only move a vertex onto one of its neighbors (no new vertices), so every level
+     uses the vertex buffer of the full model: a level is just another index buffer.
+     Borders (edges with a triangle on one side only, like the outline of our flat square) get an
+     extra plane standing up on them, so they keep their shape, and a border vertex only slides
+     along its border.
+  2. A chain: mesh_lod_build() makes level 1 from the full model, level 2 from level 1, ... each
+     with MESH_LOD_RATIO of the last one's triangles, and keeps how far each level is (at most)
+     from the full model: its error, in the model's units.
+  3. Picking one: with gluPerspective(fovy, ...) the viewport's height shows 2 * tan(fovy / 2)
+     units at a distance of 1, so 1 unit at distance d is
+       pixels_per_unit / d    with pixels_per_unit = viewport height / (2 * tan(fovy / 2))
+     pixels tall. mesh_lod_select() picks the simplest level whose error, that size on screen,
+     is at most a pixel (or however many we allow). Twice as far away, the error may be twice
+     as big, and each level has a quarter of the triangles, so the triangles an object costs
+     drop with the square of its distance, while the number of objects in the frustum grows with
+     the square of the distance: the cost of each slice of depth stays about the same.
+
+  Note: Vertices at the same position but with another color or normal (the corners of our cube)
+        are moved together, and every corner of a triangle then picks the vertex with the closest
+        color and normal at its new position, so the cube's faces keep their colors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "mesh.h"
+#include "mesh_opt.h"
+
+#define MESH_LOD_MAX 8              // levels in a chain (the full model is level 0)
+#define MESH_LOD_RATIO 0.25f        // triangles each level keeps of the last one's
+#define MESH_LOD_MIN_TRIANGLES 16   // no levels simpler than this
+#define MESH_LOD_BORDER 10.0        // how much more a border's plane counts than a triangle's
+
+typedef struct MeshQuadric
+{
+    double a[10];   // the symmetric 4x4 matrix, upper half: xx xy xz xw yy yz yw zz zw ww
+    double weight;  // the area of the triangles it was made from (to get a distance back out)
+} MeshQuadric;
+
+typedef struct MeshLod
+{
+    uint32_t first, count;  // its indices (in the chain's index array)
+    float error;            // how far its surface is from the full model's, at most (model units)
+} MeshLod;
+
+typedef struct MeshLodChain
+{
+    int count;                  // levels, the full model included
+    MeshLod lods[MESH_LOD_MAX];
+    uint32_t *indices;          // every level's triangles, one level after the other
+    uint32_t index_count;
+} MeshLodChain;
+
+typedef struct MeshCollapse
+{
+    uint32_t from, to;      // moves vertex from onto vertex to
+    float cost;             // squared distance
+} MeshCollapse;
+
+/* ***** Quadrics ***** */
+
+static inline void mesh_quadric_add_plane(MeshQuadric *q, double a, double b, double c, double d, double weight)
+{
+    // The plane a x + b y + c z + d = 0 ((a, b, c) of length 1), weight times.
+    q->a[0] += weight * a * a; q->a[1] += weight * a * b; q->a[2] += weight * a * c; q->a[3] += weight * a * d;
+    q->a[4] += weight * b * b; q->a[5] += weight * b * c; q->a[6] += weight * b * d;
+    q->a[7] += weight * c * c; q->a[8] += weight * c * d;
+    q->a[9] += weight * d * d;
+    q->weight += weight;
+}
+
+static inline void mesh_quadric_add(MeshQuadric *q, const MeshQuadric *other)
+{
+    int k;
+    for (k = 0; k < 10; k++) q->a[k] += other->a[k];
+    q->weight += other->weight;
+}
+
+static inline double mesh_quadric_error(const MeshQuadric *q, const MeshQuadric *r, const float *p)
+{
+    // The squared distance from p to the planes of q and r together (averaged by their area).
+    double x = p[0], y = p[1], z = p[2], a[10], weight = q->weight + r->weight, e;
+    int k;
+    for (k = 0; k < 10; k++) a[k] = q->a[k] + r->a[k];
+    e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+      + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+      + a[7] * z * z + 2 * a[8] * z + a[9];
+    return weight > 0 && e > 0 ? e / weight : 0; // (e can come out a hair below 0 from rounding)
+}
+
+static inline void mesh_lod_normal(const float *a, const float *b, const float *c, double *n)
+{
+    // The (not normalized) normal of the triangle a b c, counter-clockwise = towards us.
+    double u[3], v[3];
+    int k;
+    for (k = 0; k < 3; k++)
+    {
+        u[k] = b[k] - a[k];
+        v[k] = c[k] - a[k];
+    }
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+/* ***** Edges (a hash set of "a -> b") ***** */
+
+static inline size_t mesh_lod_slot(uint64_t key, size_t mask)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 20) & mask;
+}
+
+static inline void mesh_edge_insert(uint64_t *table, size_t mask, uint32_t a, uint32_t b)
+{
+    uint64_t key = (uint64_t)a << 32 | b;
+    size_t slot = mesh_lod_slot(key, mask);
+    while (table[slot] != ~0ull && table[slot] != key) slot = (slot + 1) & mask;
+    table[slot] = key;
+}
+
+static inline int mesh_edge_find(const uint64_t *table, size_t mask, uint32_t a, uint32_t b)
+{
+    uint64_t key = (uint64_t)a << 32 | b;
+    size_t slot = mesh_lod_slot(key, mask);
+    while (table[slot] != ~0ull)
+    {
+        if (table[slot] == key) return 1;
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+static inline int mesh_collapse_compare(const void *a, const void *b)
+{
+    // Cheapest first (ties: by vertex, so every run does the same).
+    const MeshCollapse *x = (const MeshCollapse *)a, *y = (const MeshCollapse *)b;
+    if (x->cost != y->cost) return x->cost < y->cost ? -1 : 1;
+    if (x->from != y->from) return x->from < y->from ? -1 : 1;
+    return x->to < y->to ? -1 : x->to > y->to;
+}
+
+static inline uint32_t mesh_lod_closest(const float *vertices, size_t stride, const uint32_t *next, uint32_t at, uint32_t like)
+{
+    // The vertex at the position of vertex at whose other attributes (normal, color) are the
+    // closest to vertex like's.
+    uint32_t best = at, v;
+    float best_difference = 1e30f;
+    for (v = at; v != 0xffffffffu; v = next[v])
+    {
+        float difference = 0;
+        size_t k;
+        for (k = 3; k < stride; k++)
+        {
+            float d = vertices[(size_t)v * stride + k] - vertices[(size_t)like * stride + k];
+            difference += d * d;
+        }
+        if (difference < best_difference)
+        {
+            best_difference = difference;
+            best = v;
+        }
+    }
+    return best;
+}
+
+/* ***** 1. Simplifying ***** */
+
+static inline size_t mesh_simplify(const float *vertices, size_t stride, size_t vertex_count, const uint32_t *indices,
+                                   size_t index_count, size_t target_index_count, uint32_t *out, float *error)
+{
+    // Simplifies the triangles indices[] (stride floats per vertex) down to about
+    // target_index_count indices, written to out[] (room for index_count), and returns how many
+    // there are. *error = how far the result is from the input at most (model units).
+    // Works in passes: every pass sorts all possible collapses by cost, and does as many of the
+    // cheapest ones as it can that don't touch each other (so the costs it sorted by still hold).
+    size_t table_size = 64, edge_size = 64, n = 0, i, t;
+    uint32_t *group = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count ? vertex_count : 1));
+    uint32_t *next = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count ? vertex_count : 1));
+    uint32_t *collapse = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count ? vertex_count : 1));
+    uint32_t *first = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count + 1));
+    uint32_t *fill = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count ? vertex_count : 1));
+    uint32_t *around = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (index_count ? index_count : 1));
+    unsigned char *flags = (unsigned char *)mesh_opt_alloc(vertex_count ? vertex_count : 1); // 1: border, 2: locked
+    MeshQuadric *quadric = (MeshQuadric *)calloc(vertex_count ? vertex_count : 1, sizeof(MeshQuadric));
+    MeshCollapse *collapses = (MeshCollapse *)mesh_opt_alloc(sizeof(MeshCollapse) * (index_count ? index_count : 1));
+    uint32_t *table;
+    uint64_t *edges;
+    double worst = 0;
+    int pass;
+    if (!quadric)
+    {
+        fprintf(stderr, "mesh optimizer: out of memory\n");
+        exit(1);
+    }
+
+    // Vertices at the same position move together: group[v] = the first vertex at v's position,
+    // next[] links up the others (so they're v, next[v], next[next[v]], ...).
+    while (table_size < vertex_count * 2) table_size *= 2;
+    table = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * table_size);
+    memset(table, 0xff, sizeof(uint32_t) * table_size);
+    for (i = 0; i < vertex_count; i++)
+    {
+        const float *p = vertices + i * stride;
+        uint32_t bits[3];
+        size_t slot;
+        memcpy(bits, p, sizeof(bits));
+        slot = mesh_lod_slot((uint64_t)bits[0] * 73856093u ^ (uint64_t)bits[1] * 19349663u ^ (uint64_t)bits[2] * 83492791u ^
+                             (uint64_t)bits[2] << 32, table_size - 1);
+        while (table[slot] != 0xffffffffu && memcmp(vertices + (size_t)table[slot] * stride, p, sizeof(float) * 3) != 0)
+            slot = (slot + 1) & (table_size - 1);
+        next[i] = 0xffffffffu;
+        if (table[slot] == 0xffffffffu) group[i] = table[slot] = (uint32_t)i;
+        else
+        {
+            group[i] = table[slot];
+            next[i] = next[group[i]];
+            next[group[i]] = (uint32_t)i;
+        }
+    }
+    free(table);
+
+    // The triangles we work on (minus the ones that are already lines or points), and the
+    // planes they start out with.
+    for (t = 0; t + 2 < index_count; t += 3)
+    {
+        uint32_t a = group[indices[t]], b = group[indices[t + 1]], c = group[indices[t + 2]];
+        double normal[3], length;
+        if (a == b || b == c || c == a) continue;
+        memcpy(out + n, indices + t, sizeof(uint32_t) * 3);
+        n += 3;
+        mesh_lod_normal(vertices + (size_t)a * stride, vertices + (size_t)b * stride, vertices + (size_t)c * stride, normal);
+        length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 0)
+        {
+            const float *p = vertices + (size_t)a * stride;
+            double d = -(normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2]) / length;
+            mesh_quadric_add_plane(&quadric[a], normal[0] / length, normal[1] / length, normal[2] / length, d, length / 2);
+            mesh_quadric_add_plane(&quadric[b], normal[0] / length, normal[1] / length, normal[2] / length, d, length / 2);
+            mesh_quadric_add_plane(&quadric[c], normal[0] / length, normal[1] / length, normal[2] / length, d, length / 2);
+        }
+    }
+    while (edge_size < n * 2) edge_size *= 2;
+    edges = (uint64_t *)mesh_opt_alloc(sizeof(uint64_t) * edge_size);
+
+    for (pass = 0; n > target_index_count; pass++)
+    {
+        size_t collapse_count = 0, removed = 0, kept = 0;
+
+        // Which triangles are around each vertex (around[first[v] .. first[v + 1] - 1]), the edges,
+        // and which vertices are on a border (an edge a -> b without a b -> a).
+        memset(first, 0, sizeof(uint32_t) * (vertex_count + 1));
+        for (i = 0; i < n; i++) first[group[out[i]] + 1]++;
+        for (i = 0; i < vertex_count; i++) first[i + 1] += first[i];
+        memcpy(fill, first, sizeof(uint32_t) * vertex_count);
+        for (i = 0; i < n; i++) around[fill[group[out[i]]]++] = (uint32_t)(i / 3);
+        memset(edges, 0xff, sizeof(uint64_t) * edge_size);
+        for (t = 0; t < n; t += 3)
+        {
+            int k;
+            for (k = 0; k < 3; k++) mesh_edge_insert(edges, edge_size - 1, group[out[t + k]], group[out[t + (k + 1) % 3]]);
+        }
+        memset(flags, 0, vertex_count);
+        for (t = 0; t < n; t += 3)
+        {
+            int k;
+            for (k = 0; k < 3; k++)
+            {
+                uint32_t a = group[out[t + k]], b = group[out[t + (k + 1) % 3]], c = group[out[t + (k + 2) % 3]];
+                if (mesh_edge_find(edges, edge_size - 1, b, a)) continue;
+                flags[a] = flags[b] = 1;
+                if (pass == 0)
+                {
+                    // The plane through the border edge, standing up on the triangle.
+                    const float *pa = vertices + (size_t)a * stride, *pb = vertices + (size_t)b * stride;
+                    double normal[3], e[3], m[3], length;
+                    int j;
+                    mesh_lod_normal(pa, pb, vertices + (size_t)c * stride, normal);
+                    for (j = 0; j < 3; j++) e[j] = pb[j] - pa[j];
+                    m[0] = e[1] * normal[2] - e[2] * normal[1];
+                    m[1] = e[2] * normal[0] - e[0] * normal[2];
+                    m[2] = e[0] * normal[1] - e[1] * normal[0];
+                    length = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+                    if (length > 0)
+                    {
+                        double weight = (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]) * MESH_LOD_BORDER;
+                        double d = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]) / length;
+                        mesh_quadric_add_plane(&quadric[a], m[0] / length, m[1] / length, m[2] / length, d, weight);
+                        mesh_quadric_add_plane(&quadric[b], m[0] / length, m[1] / length, m[2] / length, d, weight);
+                    }
+                }
+            }
+        }
+
+        // Every collapse (both ways along every edge, each edge once), cheapest first. A border
+        // vertex may only move along a border edge.
+        for (t = 0; t < n; t += 3)
+        {
+            int k;
+            for (k = 0; k < 3; k++)
+            {
+                uint32_t a = group[out[t + k]], b = group[out[t + (k + 1) % 3]];
+                int border = !mesh_edge_find(edges, edge_size - 1, b, a);
+                if (a > b && !border) continue; // (b -> a is in another triangle, it's done there)
+                if (!(flags[a] & 1) || border)
+                {
+                    collapses[collapse_count].from = a;
+                    collapses[collapse_count].to = b;
+                    collapses[collapse_count++].cost = (float)mesh_quadric_error(&quadric[a], &quadric[b], vertices + (size_t)b * stride);
+                }
+                if (!(flags[b] & 1) || border)
+                {
+                    collapses[collapse_count].from = b;
+                    collapses[collapse_count].to = a;
+                    collapses[collapse_count++].cost = (float)mesh_quadric_error(&quadric[a], &quadric[b], vertices + (size_t)a * stride);
+                }
+            }
+        }
+        qsort(collapses, collapse_count, sizeof(MeshCollapse), mesh_collapse_compare);
+
+        for (i = 0; i < vertex_count; i++) collapse[i] = (uint32_t)i;
+        for (i = 0; i < collapse_count && n - removed > target_index_count; i++)
+        {
+            uint32_t u = collapses[i].from, v = collapses[i].to, j;
+            size_t gone = 0;
+            int flips = 0;
+            if ((flags[u] | flags[v]) & 2) continue;
+            // A triangle around u that stays must not turn over (or on its side) when u moves to v.
+            for (j = first[u]; j < first[u + 1] && !flips; j++)
+            {
+                const uint32_t *tri = out + (size_t)around[j] * 3;
+                const float *p[3], *q[3];
+                double before[3], after[3], dot, b2, a2;
+                int k, has_v = 0;
+                for (k = 0; k < 3; k++)
+                {
+                    uint32_t g = group[tri[k]];
+                    has_v |= g == v;
+                    p[k] = vertices + (size_t)g * stride;
+                    q[k] = g == u ? vertices + (size_t)v * stride : p[k];
+                }
+                if (has_v)
+                {
+                    gone += 3;
+                    continue;
+                }
+                mesh_lod_normal(p[0], p[1], p[2], before);
+                mesh_lod_normal(q[0], q[1], q[2], after);
+                dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+                b2 = before[0] * before[0] + before[1] * before[1] + before[2] * before[2];
+                a2 = after[0] * after[0] + after[1] * after[1] + after[2] * after[2];
+                flips = dot <= 0 || dot * dot < 0.0625 * a2 * b2; // (turned by more than ~75 degrees)
+            }
+            if (flips) continue;
+            collapse[u] = v;
+            mesh_quadric_add(&quadric[v], &quadric[u]);
+            if (collapses[i].cost > worst) worst = collapses[i].cost;
+            removed += gone;
+            // Nothing around u or v moves again in this pass.
+            for (j = first[u]; j < first[u + 1]; j++)
+            {
+                const uint32_t *tri = out + (size_t)around[j] * 3;
+                flags[group[tri[0]]] |= 2; flags[group[tri[1]]] |= 2; flags[group[tri[2]]] |= 2;
+            }
+            for (j = first[v]; j < first[v + 1]; j++)
+            {
+                const uint32_t *tri = out + (size_t)around[j] * 3;
+                flags[group[tri[0]]] |= 2; flags[group[tri[1]]] |= 2; flags[group[tri[2]]] |= 2;
+            }
+        }
+        if (removed == 0) break; // (nothing more we're allowed to collapse)
+
+        // The triangles, with the moved corners at their new places (minus the ones that vanished).
+        for (t = 0; t < n; t += 3)
+        {
+            uint32_t c[3];
+            int k;
+            for (k = 0; k < 3; k++)
+            {
+                uint32_t g = group[out[t + k]];
+                c[k] = collapse[g] == g ? out[t + k] : mesh_lod_closest(vertices, stride, next, collapse[g], out[t + k]);
+            }
+            if (group[c[0]] == group[c[1]] || group[c[1]] == group[c[2]] || group[c[2]] == group[c[0]]) continue;
+            memcpy(out + kept, c, sizeof(c));
+            kept += 3;
+        }
+        n = kept;
+    }
+
+    free(group);
+    free(next);
+    free(collapse);
+    free(first);
+    free(fill);
+    free(around);
+    free(flags);
+    free(quadric);
+    free(collapses);
+    free(edges);
+    if (error) *error = (float)sqrt(worst);
+    return n;
+}
+
+/* ***** 2. A chain of levels ***** */
+
+static inline void mesh_lod_build(const MeshData *mesh, int levels, float ratio, MeshLodChain *chain)
+{
+    // Level 0 is the mesh itself, every next one is simplified from the last one down to ratio
+    // of its triangles, up to levels levels (at most MESH_LOD_MAX). Stops early at
+    // MESH_LOD_MIN_TRIANGLES, or when a level would hardly be simpler than the last.
+    // Every level is ordered for the vertex cache (common/mesh_opt.h), the vertices stay as they are.
+    size_t stride = mesh_vertex_stride(mesh->format) / sizeof(float);
+    memset(chain, 0, sizeof(*chain));
+    if (levels > MESH_LOD_MAX) levels = MESH_LOD_MAX;
+    chain->indices = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (mesh->index_count ? mesh->index_count : 1));
+    memcpy(chain->indices, mesh->indices, sizeof(uint32_t) * mesh->index_count);
+    chain->index_count = mesh->index_count;
+    chain->lods[0].count = mesh->index_count;
+    chain->count = 1;
+    while (chain->count < levels)
+    {
+        MeshLod *last = &chain->lods[chain->count - 1], *level = &chain->lods[chain->count];
+        size_t target = (size_t)(last->count / 3 * ratio) * 3;
+        float error;
+        if (last->count / 3 <= MESH_LOD_MIN_TRIANGLES) break;
+        if (target < MESH_LOD_MIN_TRIANGLES * 3) target = MESH_LOD_MIN_TRIANGLES * 3;
+        chain->indices = (uint32_t *)realloc(chain->indices, sizeof(uint32_t) * ((size_t)chain->index_count + last->count));
+        if (!chain->indices)
+        {
+            fprintf(stderr, "mesh optimizer: out of memory\n");
+            exit(1);
+        }
+        level->first = chain->index_count;
+        level->count = (uint32_t)mesh_simplify(mesh->vertices, stride, mesh->vertex_count, chain->indices + last->first, last->count,
+                                               target, chain->indices + level->first, &error);
+        if (level->count == 0 || level->count > last->count * 0.9) break; // (stuck: borders or flips everywhere)
+        mesh_optimize_cache(chain->indices + level->first, level->count, mesh->vertex_count);
+        level->error = last->error + error; // (the distances add up, at most)
+        chain->index_count += level->count;
+        chain->count++;
+    }
+}
+
+static inline void mesh_lod_free(MeshLodChain *chain)
+{
+    free(chain->indices);
+    memset(chain, 0, sizeof(*chain));
+}
+
+/* ***** 3. Picking one ***** */
+
+static inline float mesh_lod_pixels_per_unit(float fovy_degrees, int viewport_height)
+{
+    // How many pixels tall 1 unit is at a distance of 1, with gluPerspective(fovy_degrees, ...)
+    // and a viewport viewport_height pixels tall.
+    return viewport_height / (2 * tanf(fovy_degrees * 3.14159265f / 360));
+}
+
+static inline int mesh_lod_select(const MeshLod *lods, int count, float distance, float pixels_per_unit, float max_pixels)
+{
+    // The simplest level whose error, at distance (along the view direction) and scaled to the
+    // screen, is at most max_pixels.
+    int level;
+    if (distance <= 0) return 0;
+    for (level = count - 1; level > 0; level--)
+        if (lods[level].error * pixels_per_unit <= max_pixels * distance) break;
+    return level;
+}
+
+#endif
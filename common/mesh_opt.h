@@ -0,0 +1,523 @@
+#ifndef COMMON_MESH_OPT_H
+#define COMMON_MESH_OPT_H
+
+/*
+- ***** A Note on Optimizing Meshes *****
+  The same triangles can be drawn a lot faster or slower depending on the ORDER they're in. This
+  file puts a triangle mesh (a MeshData of common/mesh.h) in a good order, once, when it's
+  converted (tools/mesh_convert.c --optimize) or loaded (OpenGL_Cube_Tutorial.c --optimize):
+
+  0. Triangulation: quads and polygons (GL_QUADS, GL_POLYGON) become indexed triangles. GPUs only
+     draw triangles, so with glBegin(GL_QUADS) the driver cuts every quad in 2 on every single
+     call. mesh_triangulate() does it once, by "ear clipping": it cuts off one corner triangle
+     (an "ear") after another. For a convex polygon that's the same fan GL_POLYGON would make;
+     unlike the fan it also gets concave ones right (an L shape, say).
+
+  1. Vertex cache: the GPU remembers the last few vertices its vertex shader transformed (the
+     "post-transform cache"). A triangle whose corners are still in there costs no vertex shader
+     work. The measure is the ACMR, the Average Cache Miss Ratio: vertices transformed per
+     triangle. 3 is the worst (no sharing at all), a big regular grid can get close to 0.5.
+     mesh_optimize_cache() is Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": every vertex
+     gets a score (high if it's in the cache, and higher the fewer triangles it has left, so
+     lonely triangles get finished instead of left behind), and it always draws next the triangle
+     with the best score among the ones next to the cache.
+
+  2. Overdraw: with the depth test, a pixel is shaded again whenever a NEARER triangle is drawn
+     over it later. Drawing front to back is best, but what's in front depends on the view.
+     mesh_optimize_overdraw() (after Sander, Nehab and Barczak, "Fast Triangle Reordering for
+     Vertex Locality and Reduced Overdraw") cuts the cache-friendly order into clusters (where a
+     cut costs little ACMR) and sorts the clusters so that the ones facing outward, away from the
+     middle of the mesh, are drawn first: from most directions those are the ones in front.
+
+  3. Vertex fetch: the vertex shader reads its vertices from the vertex buffer, through the
+     memory caches. mesh_optimize_fetch() renumbers the vertices in the order the triangles use
+     them, so those reads go through the buffer front to back (unused vertices are dropped).
+
+  mesh_analyze_cache() and mesh_analyze_overdraw() measure both, so the gains can be checked.
+
+  Note: Real GPUs don't all have a simple FIFO cache of 16 (newer ones work in batches of
+        vertices), but the ACMR of a 16 entry FIFO tracks how well any of them does.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "mesh.h"
+
+#define MESH_CACHE_FIFO 16          // the cache mesh_analyze_cache() simulates
+#define MESH_OPT_CACHE 32           // the cache mesh_optimize_cache() orders for (see its note)
+#define MESH_OPT_CLUSTER 1.05f      // a cluster may cost at most 5% more ACMR than the mesh
+#define MESH_OVERDRAW_SIZE 256      // pixels per side of mesh_analyze_overdraw()'s views
+
+typedef struct MeshOptStats
+{
+    double acmr, atvr;      // vertices transformed per triangle, and per vertex (1 is the best)
+    double overdraw;        // pixels shaded / pixels covered (1 = every pixel shaded once)
+} MeshOptStats;
+
+static inline void *mesh_opt_alloc(size_t bytes)
+{
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p)
+    {
+        fprintf(stderr, "mesh optimizer: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* ***** 0. Triangulation ***** */
+
+static inline int mesh_triangulate(const float *vertices, size_t stride, const uint32_t *polygon, int n, uint32_t *triangles)
+{
+    // Cuts the polygon polygon[0 .. n - 1] (vertex indices, stride floats per vertex) into n - 2
+    // triangles written to triangles[], by ear clipping in the polygon's own plane. Always tries
+    // the earliest corner first, so a convex polygon becomes the fan 0 1 2, 0 2 3, ...
+    // Returns the number of triangles (n - 2).
+    enum { MAX = 256 };
+    float normal[3] = { 0, 0, 0 }, u[MAX], v[MAX], orientation;
+    int left[MAX], count = n, out = 0, i, k, axis = 2;
+    if (n < 3) return 0;
+    if (n == 3 || n > MAX)
+    {
+        for (k = 1; k + 1 < n; k++, out++) // (a triangle, or too big for us: a fan)
+        {
+            triangles[out * 3] = polygon[0];
+            triangles[out * 3 + 1] = polygon[k];
+            triangles[out * 3 + 2] = polygon[k + 1];
+        }
+        return out;
+    }
+    // The polygon's normal (Newell's method, fine for any polygon), then the 2 coordinates of
+    // the plane it's most parallel to.
+    for (i = 0; i < n; i++)
+    {
+        const float *a = vertices + (size_t)polygon[i] * stride, *b = vertices + (size_t)polygon[(i + 1) % n] * stride;
+        normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+        normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+        normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+    }
+    if (fabsf(normal[0]) > fabsf(normal[axis])) axis = 0;
+    if (fabsf(normal[1]) > fabsf(normal[axis])) axis = 1;
+    orientation = normal[axis] >= 0 ? 1.0f : -1.0f;
+    for (i = 0; i < n; i++)
+    {
+        const float *p = vertices + (size_t)polygon[i] * stride;
+        u[i] = p[(axis + 1) % 3];
+        v[i] = p[(axis + 2) % 3];
+        left[i] = i;
+    }
+    while (count > 3)
+    {
+        int ear = -1;
+        for (i = 1; i < count + 1 && ear < 0; i++)
+        {
+            // Corner b (with its neighbors a and c) is an ear if it bends the polygon's way and
+            // no other corner is inside the triangle a b c.
+            int a = left[(i - 1) % count], b = left[i % count], c = left[(i + 1) % count], j;
+            float area = ((u[b] - u[a]) * (v[c] - v[a]) - (v[b] - v[a]) * (u[c] - u[a])) * orientation;
+            if (area <= 0) continue;
+            for (j = 0; j < count; j++)
+            {
+                int p = left[j];
+                float d0, d1, d2;
+                if (p == a || p == b || p == c) continue;
+                d0 = ((u[b] - u[a]) * (v[p] - v[a]) - (v[b] - v[a]) * (u[p] - u[a])) * orientation;
+                d1 = ((u[c] - u[b]) * (v[p] - v[b]) - (v[c] - v[b]) * (u[p] - u[b])) * orientation;
+                d2 = ((u[a] - u[c]) * (v[p] - v[c]) - (v[a] - v[c]) * (u[p] - u[c])) * orientation;
+                if (d0 >= 0 && d1 >= 0 && d2 >= 0) break;
+            }
+            if (j == count) ear = i % count;
+        }
+        if (ear < 0) ear = 1; // (no ear: a broken polygon, cut it anyway)
+        triangles[out * 3] = polygon[left[(ear + count - 1) % count]];
+        triangles[out * 3 + 1] = polygon[left[ear]];
+        triangles[out * 3 + 2] = polygon[left[(ear + 1) % count]];
+        out++;
+        memmove(&left[ear], &left[ear + 1], sizeof(int) * (size_t)(count - ear - 1));
+        count--;
+    }
+    triangles[out * 3] = polygon[left[0]];
+    triangles[out * 3 + 1] = polygon[left[1]];
+    triangles[out * 3 + 2] = polygon[left[2]];
+    return out + 1;
+}
+
+/* ***** Measuring ***** */
+
+static inline double mesh_analyze_cache(const uint32_t *indices, size_t index_count, size_t vertex_count, double *atvr)
+{
+    // The ACMR with a FIFO cache of MESH_CACHE_FIFO vertices (and the ATVR in *atvr, if not NULL).
+    uint32_t *stamp = (uint32_t *)calloc(vertex_count ? vertex_count : 1, sizeof(uint32_t));
+    size_t misses = 0, i;
+    if (!stamp)
+    {
+        fprintf(stderr, "mesh optimizer: out of memory\n");
+        exit(1);
+    }
+    // stamp[v] = the miss that put v into the FIFO. It's still in there as long as fewer than
+    // MESH_CACHE_FIFO misses came after it.
+    for (i = 0; i < index_count; i++)
+    {
+        uint32_t v = indices[i];
+        if (stamp[v] == 0 || misses - stamp[v] >= MESH_CACHE_FIFO) stamp[v] = (uint32_t)++misses;
+    }
+    free(stamp);
+    if (atvr) *atvr = vertex_count ? (double)misses / vertex_count : 0;
+    return index_count ? (double)misses / (index_count / 3) : 0;
+}
+
+static inline double mesh_analyze_overdraw(const float *vertices, size_t stride, const uint32_t *indices, size_t index_count,
+                                           size_t vertex_count)
+{
+    // Draws the mesh (depth test on, back faces culled, counter-clockwise = front like OpenGL)
+    // from the 6 sides of its bounding box, in its triangle order, and counts how often a pixel
+    // got shaded compared to how many pixels it covers. 1 = no overdraw at all.
+    float low[3] = { 1e30f, 1e30f, 1e30f }, high[3] = { -1e30f, -1e30f, -1e30f }, extent = 0;
+    float *depth = (float *)mesh_opt_alloc(sizeof(float) * MESH_OVERDRAW_SIZE * MESH_OVERDRAW_SIZE);
+    uint64_t shaded = 0, covered = 0;
+    size_t i;
+    int view, k;
+    for (i = 0; i < vertex_count; i++)
+        for (k = 0; k < 3; k++)
+        {
+            float p = vertices[i * stride + k];
+            if (p < low[k]) low[k] = p;
+            if (p > high[k]) high[k] = p;
+        }
+    for (k = 0; k < 3; k++) if (high[k] - low[k] > extent) extent = high[k] - low[k];
+    if (extent <= 0) extent = 1;
+    for (view = 0; view < 6; view++)
+    {
+        // Looking down axis view / 2 from its low side (view even) or high side (view odd), the
+        // other 2 axes in the order that keeps front faces counter-clockwise.
+        int axis = view / 2, flip = view & 1, ax = (axis + 1) % 3, ay = (axis + 2) % 3;
+        for (i = 0; i < MESH_OVERDRAW_SIZE * MESH_OVERDRAW_SIZE; i++) depth[i] = 1e30f;
+        for (i = 0; i + 2 < index_count; i += 3)
+        {
+            float x[3], y[3], z[3], area, min_x, max_x, min_y, max_y;
+            int px, py, x0, x1, y0, y1;
+            for (k = 0; k < 3; k++)
+            {
+                const float *p = vertices + (size_t)indices[i + k] * stride;
+                x[k] = (p[ax] - low[ax]) / extent * (MESH_OVERDRAW_SIZE - 1);
+                y[k] = (p[ay] - low[ay]) / extent * (MESH_OVERDRAW_SIZE - 1);
+                z[k] = flip ? high[axis] - p[axis] : p[axis] - low[axis]; // (nearer = smaller)
+                if (flip) x[k] = MESH_OVERDRAW_SIZE - 1 - x[k]; // (seen from the other side: mirrored)
+            }
+            // We look along +axis from the low side: a counter-clockwise front face, as seen
+            // from there, is clockwise in (ax, ay).
+            area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+            if (area >= 0) continue;
+            min_x = fminf(x[0], fminf(x[1], x[2])); max_x = fmaxf(x[0], fmaxf(x[1], x[2]));
+            min_y = fminf(y[0], fminf(y[1], y[2])); max_y = fmaxf(y[0], fmaxf(y[1], y[2]));
+            x0 = (int)ceilf(min_x); x1 = (int)floorf(max_x);
+            y0 = (int)ceilf(min_y); y1 = (int)floorf(max_y);
+            if (x0 < 0) x0 = 0;
+            if (y0 < 0) y0 = 0;
+            if (x1 > MESH_OVERDRAW_SIZE - 1) x1 = MESH_OVERDRAW_SIZE - 1;
+            if (y1 > MESH_OVERDRAW_SIZE - 1) y1 = MESH_OVERDRAW_SIZE - 1;
+            for (py = y0; py <= y1; py++)
+                for (px = x0; px <= x1; px++)
+                {
+                    // Barycentric weights of the pixel (all <= 0 inside, since area < 0).
+                    float w0 = (x[2] - x[1]) * (py - y[1]) - (y[2] - y[1]) * (px - x[1]);
+                    float w1 = (x[0] - x[2]) * (py - y[2]) - (y[0] - y[2]) * (px - x[2]);
+                    float w2 = (x[1] - x[0]) * (py - y[0]) - (y[1] - y[0]) * (px - x[0]);
+                    float d;
+                    float *cell = &depth[py * MESH_OVERDRAW_SIZE + px];
+                    if (w0 > 0 || w1 > 0 || w2 > 0) continue;
+                    d = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / area;
+                    if (d < *cell)
+                    {
+                        covered += *cell == 1e30f;
+                        *cell = d;
+                        shaded++;
+                    }
+                }
+        }
+    }
+    free(depth);
+    return covered ? (double)shaded / covered : 1;
+}
+
+static inline MeshOptStats mesh_analyze(const MeshData *mesh)
+{
+    MeshOptStats stats;
+    stats.acmr = mesh_analyze_cache(mesh->indices, mesh->index_count, mesh->vertex_count, &stats.atvr);
+    stats.overdraw = mesh_analyze_overdraw(mesh->vertices, mesh_vertex_stride(mesh->format) / sizeof(float),
+                                           mesh->indices, mesh->index_count, mesh->vertex_count);
+    return stats;
+}
+
+/* ***** 1. Vertex cache ***** */
+
+static inline void mesh_optimize_cache(uint32_t *indices, size_t index_count, size_t vertex_count)
+{
+    // Reorders the triangles for the post-transform cache (Forsyth, see the note at the top).
+    size_t triangle_count = index_count / 3, drawn = 0, cursor = 0, i;
+    uint32_t *offsets = (uint32_t *)calloc(vertex_count + 1, sizeof(uint32_t));   // where a vertex's triangles start in adjacent[]
+    uint32_t *remaining = (uint32_t *)calloc(vertex_count ? vertex_count : 1, sizeof(uint32_t)); // triangles it has left
+    uint32_t *adjacent = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * index_count);
+    int8_t *cache_slot = (int8_t *)mesh_opt_alloc(vertex_count ? vertex_count : 1);       // -1 = not in the cache
+    float *vertex_score = (float *)mesh_opt_alloc(sizeof(float) * (vertex_count ? vertex_count : 1));
+    float *triangle_score = (float *)mesh_opt_alloc(sizeof(float) * (triangle_count ? triangle_count : 1));
+    uint8_t *done = (uint8_t *)calloc(triangle_count ? triangle_count : 1, 1);
+    uint32_t *out = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * index_count);
+    uint32_t cache[MESH_OPT_CACHE + 3];
+    float cache_score[MESH_OPT_CACHE], valence_score[64];
+    int cache_count = 0, k;
+    long best = -1;
+    if (!offsets || !remaining || !done)
+    {
+        fprintf(stderr, "mesh optimizer: out of memory\n");
+        exit(1);
+    }
+
+    // The scores: the last triangle's 3 vertices all get 0.75 (which of them goes first doesn't
+    // matter for the next triangle), then falling off with the position in the cache. Plus a
+    // bonus for vertices with few triangles left.
+    for (k = 0; k < MESH_OPT_CACHE; k++)
+        cache_score[k] = k < 3 ? 0.75f : powf(1.0f - (float)(k - 3) / (MESH_OPT_CACHE - 3), 1.5f);
+    for (k = 1; k < 64; k++) valence_score[k] = 2.0f / sqrtf((float)k);
+    valence_score[0] = 0;
+#define MESH_VERTEX_SCORE(v) (remaining[v] == 0 ? -1.0f : (cache_slot[v] >= 0 ? cache_score[cache_slot[v]] : 0.0f) + \
+                              (remaining[v] < 64 ? valence_score[remaining[v]] : 2.0f / sqrtf((float)remaining[v])))
+
+    for (i = 0; i < index_count; i++) offsets[indices[i] + 1]++;
+    for (i = 0; i < vertex_count; i++)
+    {
+        remaining[i] = offsets[i + 1];
+        offsets[i + 1] += offsets[i];
+        cache_slot[i] = -1;
+    }
+    for (i = 0; i < triangle_count * 3; i++)
+    {
+        uint32_t v = indices[i];
+        adjacent[offsets[v] + (offsets[v + 1] - offsets[v]) - remaining[v]] = (uint32_t)(i / 3);
+        remaining[v]--;
+    }
+    for (i = 0; i < vertex_count; i++)
+    {
+        remaining[i] = offsets[i + 1] - offsets[i];
+        vertex_score[i] = MESH_VERTEX_SCORE(i);
+    }
+    for (i = 0; i < triangle_count; i++)
+        triangle_score[i] = vertex_score[indices[i * 3]] + vertex_score[indices[i * 3 + 1]] + vertex_score[indices[i * 3 + 2]];
+
+    while (drawn < triangle_count)
+    {
+        uint32_t new_cache[MESH_OPT_CACHE + 3];
+        int new_count = 0;
+        float best_score = -1;
+        if (best < 0)
+        {
+            // Nothing next to the cache (the start, or an island is finished): the next triangle
+            // in the old order that's left.
+            while (done[cursor]) cursor++;
+            best = (long)cursor;
+        }
+        done[best] = 1;
+        memcpy(out + drawn * 3, indices + best * 3, sizeof(uint32_t) * 3);
+        drawn++;
+
+        // Its vertices lose a triangle, and go to the front of the cache.
+        for (k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[best * 3 + k], *list = adjacent + offsets[v], n = remaining[v], j;
+            for (j = 0; j < n; j++)
+                if (list[j] == (uint32_t)best)
+                {
+                    list[j] = list[n - 1];
+                    break;
+                }
+            remaining[v]--;
+            new_cache[new_count++] = v;
+        }
+        for (k = 0; k < cache_count; k++)
+            if (cache[k] != new_cache[0] && cache[k] != new_cache[1] && cache[k] != new_cache[2]) new_cache[new_count++] = cache[k];
+
+        // New scores for everything that moved (and what fell out), and their triangles.
+        for (k = 0; k < new_count; k++)
+        {
+            uint32_t v = new_cache[k], j;
+            float old_score = vertex_score[v];
+            cache_slot[v] = (int8_t)(k < MESH_OPT_CACHE ? k : -1);
+            vertex_score[v] = MESH_VERTEX_SCORE(v);
+            for (j = 0; j < remaining[v]; j++) triangle_score[adjacent[offsets[v] + j]] += vertex_score[v] - old_score;
+        }
+        // The best triangle next to the cache goes next.
+        best = -1;
+        for (k = 0; k < new_count && k < MESH_OPT_CACHE; k++)
+        {
+            uint32_t v = new_cache[k], j;
+            for (j = 0; j < remaining[v]; j++)
+            {
+                uint32_t t = adjacent[offsets[v] + j];
+                if (triangle_score[t] > best_score)
+                {
+                    best_score = triangle_score[t];
+                    best = (long)t;
+                }
+            }
+        }
+        cache_count = new_count < MESH_OPT_CACHE ? new_count : MESH_OPT_CACHE;
+        memcpy(cache, new_cache, sizeof(uint32_t) * (size_t)cache_count);
+    }
+#undef MESH_VERTEX_SCORE
+    memcpy(indices, out, sizeof(uint32_t) * triangle_count * 3);
+    free(offsets);
+    free(remaining);
+    free(adjacent);
+    free(cache_slot);
+    free(vertex_score);
+    free(triangle_score);
+    free(done);
+    free(out);
+}
+
+/* ***** 2. Overdraw ***** */
+
+typedef struct MeshCluster
+{
+    size_t first, count;   // triangles
+    float sort_key;
+} MeshCluster;
+
+static inline int mesh_cluster_compare(const void *a, const void *b)
+{
+    // Biggest sort key first (ties: the old order, so the sort is stable).
+    const MeshCluster *x = (const MeshCluster *)a, *y = (const MeshCluster *)b;
+    if (x->sort_key != y->sort_key) return x->sort_key > y->sort_key ? -1 : 1;
+    return x->first < y->first ? -1 : 1;
+}
+
+static inline void mesh_optimize_overdraw(uint32_t *indices, size_t index_count, const float *vertices, size_t stride,
+                                          size_t vertex_count)
+{
+    // Reorders clusters of the (cache-optimized) triangle order so outward-facing ones come
+    // first. Every cluster starts with an empty cache, and is made just long enough that its own
+    // ACMR stays within MESH_OPT_CLUSTER of the whole mesh's.
+    size_t triangle_count = index_count / 3, cluster_count = 0, t, i;
+    double acmr = mesh_analyze_cache(indices, index_count, vertex_count, NULL);
+    MeshCluster *clusters = (MeshCluster *)mesh_opt_alloc(sizeof(MeshCluster) * (triangle_count ? triangle_count : 1));
+    uint32_t *stamp = (uint32_t *)calloc(vertex_count ? vertex_count : 1, sizeof(uint32_t)), *out;
+    float center[3] = { 0, 0, 0 };
+    uint32_t misses = 0;
+    int k;
+    if (!stamp)
+    {
+        fprintf(stderr, "mesh optimizer: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < vertex_count; i++)
+        for (k = 0; k < 3; k++) center[k] += vertices[i * stride + k] / vertex_count;
+
+    for (t = 0; t < triangle_count;)
+    {
+        // One cluster: as many triangles as it takes to get its ACMR (cold cache) down.
+        MeshCluster *c = &clusters[cluster_count++];
+        size_t cluster_misses = 0;
+        uint32_t start = misses;
+        c->first = t;
+        do
+        {
+            for (k = 0; k < 3; k++)
+            {
+                uint32_t v = indices[t * 3 + k];
+                if (stamp[v] <= start || misses - stamp[v] >= MESH_CACHE_FIFO)
+                {
+                    stamp[v] = ++misses;
+                    cluster_misses++;
+                }
+            }
+            t++;
+        } while (t < triangle_count && (double)cluster_misses / (t - c->first) > acmr * MESH_OPT_CLUSTER);
+        c->count = t - c->first;
+        if (misses > 0xf0000000u) // (the stamps would overflow: start over)
+        {
+            memset(stamp, 0, sizeof(uint32_t) * vertex_count);
+            misses = 0;
+        }
+    }
+    free(stamp);
+
+    for (i = 0; i < cluster_count; i++)
+    {
+        // How far out the cluster is, along the way it faces: dot(centroid - center, normal),
+        // with the centroid and normal weighted by the triangles' areas.
+        MeshCluster *c = &clusters[i];
+        float centroid[3] = { 0, 0, 0 }, normal[3] = { 0, 0, 0 }, area_sum = 0, length;
+        for (t = c->first; t < c->first + c->count; t++)
+        {
+            const float *a = vertices + (size_t)indices[t * 3] * stride;
+            const float *b = vertices + (size_t)indices[t * 3 + 1] * stride;
+            const float *d = vertices + (size_t)indices[t * 3 + 2] * stride;
+            float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (k = 0; k < 3; k++)
+            {
+                centroid[k] += (a[k] + b[k] + d[k]) / 3 * area;
+                normal[k] += n[k];
+            }
+            area_sum += area;
+        }
+        length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        c->sort_key = 0;
+        if (area_sum > 0 && length > 0)
+            for (k = 0; k < 3; k++) c->sort_key += (centroid[k] / area_sum - center[k]) * normal[k] / length;
+    }
+    qsort(clusters, cluster_count, sizeof(MeshCluster), mesh_cluster_compare);
+
+    out = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * index_count);
+    for (i = 0, t = 0; i < cluster_count; i++)
+    {
+        memcpy(out + t * 3, indices + clusters[i].first * 3, sizeof(uint32_t) * 3 * clusters[i].count);
+        t += clusters[i].count;
+    }
+    memcpy(indices, out, sizeof(uint32_t) * triangle_count * 3);
+    free(out);
+    free(clusters);
+}
+
+/* ***** 3. Vertex fetch ***** */
+
+static inline size_t mesh_optimize_fetch(float *vertices, size_t stride, size_t vertex_count, uint32_t *indices, size_t index_count)
+{
+    // Renumbers the vertices in the order the indices first use them (and moves them there).
+    // Returns the new vertex count (vertices no triangle uses are gone).
+    uint32_t *remap = (uint32_t *)mesh_opt_alloc(sizeof(uint32_t) * (vertex_count ? vertex_count : 1));
+    float *moved;
+    uint32_t next = 0;
+    size_t i;
+    memset(remap, 0xff, sizeof(uint32_t) * vertex_count);
+    for (i = 0; i < index_count; i++)
+    {
+        uint32_t v = indices[i];
+        if (remap[v] == 0xffffffffu) remap[v] = next++;
+        indices[i] = remap[v];
+    }
+    moved = (float *)mesh_opt_alloc(sizeof(float) * stride * (next ? next : 1));
+    for (i = 0; i < vertex_count; i++)
+        if (remap[i] != 0xffffffffu) memcpy(moved + (size_t)remap[i] * stride, vertices + i * stride, sizeof(float) * stride);
+    memcpy(vertices, moved, sizeof(float) * stride * next);
+    free(moved);
+    free(remap);
+    return next;
+}
+
+/* ***** All of it ***** */
+
+static inline void mesh_optimize(MeshData *mesh)
+{
+    // 1, 2 and 3 on a triangulated mesh, in that order (each one keeps what the last one did).
+    size_t stride = mesh_vertex_stride(mesh->format) / sizeof(float);
+    mesh_optimize_cache(mesh->indices, mesh->index_count, mesh->vertex_count);
+    mesh_optimize_overdraw(mesh->indices, mesh->index_count, mesh->vertices, stride, mesh->vertex_count);
+    mesh->vertex_count = (uint32_t)mesh_optimize_fetch(mesh->vertices, stride, mesh->vertex_count, mesh->indices, mesh->index_count);
+}
+
+#endif
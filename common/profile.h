@@ -0,0 +1,300 @@
+#ifndef COMMON_PROFILE_H
+#define COMMON_PROFILE_H
+
+/*
+- ***** A Note on Profiling *****
+  The frame time tells us how long a whole frame took, but not WHERE the time went. So we
+  time "sections": every callback (init, reshape, update, display) and any piece of drawing
+  a demo marks with profile_gpu_begin/end.
+
+  CPU time is easy: the clock before and after (common/clock.h).
+  GPU time isn't: the CPU only QUEUES the drawing, the GPU does it later. Timing the glBegin ..
+  glEnd calls on the CPU measures how long it took to queue them, not to draw them.
+  A timer query (GL_TIME_ELAPSED) asks the GPU itself to measure: glBeginQuery starts its
+  stopwatch when the GPU gets to that point of the queue, glEndQuery stops it. The result is
+  only there once the GPU is done, so asking for it right away would make the CPU wait for the
+  GPU, exactly what we don't want. Instead every query goes into a small ring and we only pick
+  up results that are already available (GL_QUERY_RESULT_AVAILABLE), usually 1-3 frames later.
+  Note: OpenGL runs one GL_TIME_ELAPSED query at a time, so GPU sections can't be nested.
+
+  Every sample goes into a histogram (powers of two of microseconds: <2us, <4us, <8us, ...)
+  and is kept for the percentiles. On exit everything is written as JSON or CSV:
+    --profile out.json   or   --profile out.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "gl_ext.h"
+#include "clock.h"
+#include "bench.h"
+
+#define PROFILE_MAX_SECTIONS 32
+#define PROFILE_MAX_DEPTH 16    // nested CPU sections
+#define PROFILE_BUCKETS 24      // histogram bucket k: < 2^(k+1) us, the last one is everything above
+#define PROFILE_GPU_QUERIES 16  // timer queries in flight per GPU section
+
+enum { PROFILE_CPU, PROFILE_GPU };
+
+typedef struct ProfileSection
+{
+    const char *name;
+    int kind;                          // PROFILE_CPU / PROFILE_GPU
+    FrameStats samples;                // every sample in ms (for the percentiles)
+    long histogram[PROFILE_BUCKETS];
+    // GPU only: a ring of timer queries, results are collected oldest first
+    GLuint queries[PROFILE_GPU_QUERIES];
+    int query_head, query_count;
+    long dropped;                      // the ring was full of unfinished queries: sample skipped
+} ProfileSection;
+
+typedef struct Profile
+{
+    int enabled;
+    int gpu;                           // timer queries available (and an OpenGL context to use them in)
+    const char *path;
+    ProfileSection sections[PROFILE_MAX_SECTIONS];
+    int section_count;
+    int stack[PROFILE_MAX_DEPTH];      // open CPU sections
+    uint64_t stack_start[PROFILE_MAX_DEPTH];
+    int depth;
+    int gpu_open;                      // GPU section being measured, -1 = none
+    int gpu_skipped_depth;             // nested GPU begins that were ignored
+    long frames;
+} Profile;
+
+static Profile profile = { 0 };
+
+static inline void profile_open(const char *path)
+{
+    // Turns profiling on (nothing is measured otherwise). The timer queries are created lazily,
+    // once there is an OpenGL context.
+    memset(&profile, 0, sizeof(profile));
+    profile.enabled = 1;
+    profile.path = path;
+    profile.gpu_open = -1;
+}
+
+static inline void profile_use_gpu(int on)
+{
+    // Call with 1 once an OpenGL context exists (the software rasterizer has no GPU to ask).
+    profile.gpu = on && GLEXT_HAVE(glGenQueries) && GLEXT_HAVE(glGetQueryObjectui64v);
+}
+
+static inline int profile_section(const char *name, int kind)
+{
+    // Finds (or adds) the section called name. Names are usually string literals, so comparing
+    // the pointers first finds them without a strcmp.
+    int i;
+    ProfileSection *s;
+    for (i = 0; i < profile.section_count; i++)
+        if (profile.sections[i].kind == kind && profile.sections[i].name == name) return i;
+    for (i = 0; i < profile.section_count; i++)
+        if (profile.sections[i].kind == kind && strcmp(profile.sections[i].name, name) == 0) return i;
+    if (profile.section_count == PROFILE_MAX_SECTIONS) return -1;
+    s = &profile.sections[profile.section_count];
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->kind = kind;
+    frame_stats_init(&s->samples, 1024);
+    if (kind == PROFILE_GPU) glGenQueries(PROFILE_GPU_QUERIES, s->queries);
+    return profile.section_count++;
+}
+
+static inline void profile_add_sample(ProfileSection *s, double ms)
+{
+    double us = ms * 1000;
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && us >= (double)(2u << bucket)) bucket++;
+    s->histogram[bucket]++;
+    frame_stats_add(&s->samples, ms);
+}
+
+static inline void profile_cpu_begin(const char *name)
+{
+    if (!profile.enabled) return;
+    if (profile.depth < PROFILE_MAX_DEPTH)
+    {
+        profile.stack[profile.depth] = profile_section(name, PROFILE_CPU);
+        profile.stack_start[profile.depth] = clock_now_ns();
+    }
+    profile.depth++;
+}
+
+static inline void profile_cpu_end(void)
+{
+    // Ends the innermost open CPU section.
+    uint64_t now;
+    if (!profile.enabled || profile.depth == 0) return;
+    now = clock_now_ns();
+    profile.depth--;
+    if (profile.depth < PROFILE_MAX_DEPTH && profile.stack[profile.depth] >= 0)
+        profile_add_sample(&profile.sections[profile.stack[profile.depth]], clock_ns_to_ms(now - profile.stack_start[profile.depth]));
+}
+
+static inline void profile_gpu_collect(ProfileSection *s)
+{
+    // Picks up the finished queries, oldest first, without ever waiting for the GPU.
+    while (s->query_count > 0)
+    {
+        GLuint query = s->queries[s->query_head];
+        GLint available = 0;
+        GLuint64 ns;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break; // (the later ones can't be done either)
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        profile_add_sample(s, clock_ns_to_ms(ns));
+        s->query_head = (s->query_head + 1) % PROFILE_GPU_QUERIES;
+        s->query_count--;
+    }
+}
+
+static inline void profile_gpu_begin(const char *name)
+{
+    ProfileSection *s;
+    int index;
+    if (!profile.enabled || !profile.gpu) return;
+    if (profile.gpu_open >= 0)
+    {
+        profile.gpu_skipped_depth++; // (nested: only the outer one is measured)
+        return;
+    }
+    index = profile_section(name, PROFILE_GPU);
+    if (index < 0) return;
+    s = &profile.sections[index];
+    profile_gpu_collect(s);
+    if (s->query_count == PROFILE_GPU_QUERIES)
+    {
+        s->dropped++;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, s->queries[(s->query_head + s->query_count) % PROFILE_GPU_QUERIES]);
+    profile.gpu_open = index;
+}
+
+static inline void profile_gpu_end(void)
+{
+    if (!profile.enabled || !profile.gpu) return;
+    if (profile.gpu_skipped_depth > 0)
+    {
+        profile.gpu_skipped_depth--;
+        return;
+    }
+    if (profile.gpu_open < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    profile.sections[profile.gpu_open].query_count++;
+    profile.gpu_open = -1;
+}
+
+static inline void profile_frame_done(void)
+{
+    // Once per frame: collects the GPU results that came in meanwhile.
+    int i;
+    if (!profile.enabled) return;
+    profile.frames++;
+    if (!profile.gpu) return;
+    for (i = 0; i < profile.section_count; i++)
+        if (profile.sections[i].kind == PROFILE_GPU) profile_gpu_collect(&profile.sections[i]);
+}
+
+static inline void profile_bucket_name(char *out, size_t size, int bucket)
+{
+    // "<2us", "<4us", ... ">=8388608us" for the last one
+    if (bucket == PROFILE_BUCKETS - 1) snprintf(out, size, ">=%uus", 2u << (bucket - 1));
+    else snprintf(out, size, "<%uus", 2u << bucket);
+}
+
+static inline void profile_write_json(FILE *f)
+{
+    int i, k;
+    // histogram_buckets_us: the upper bound of every bucket (null: the last one has none)
+    fprintf(f, "{\n  \"frames\": %ld,\n  \"histogram_buckets_us\": [", profile.frames);
+    for (k = 0; k < PROFILE_BUCKETS - 1; k++) fprintf(f, "%u, ", 2u << k);
+    fprintf(f, "null");
+    fprintf(f, "],\n  \"sections\": [\n");
+    for (i = 0; i < profile.section_count; i++)
+    {
+        ProfileSection *s = &profile.sections[i];
+        FrameSummary sum = frame_stats_summarize(&s->samples);
+        fprintf(f, "    { \"name\": \"%s\", \"kind\": \"%s\", \"samples\": %d, \"dropped\": %ld, \"total_ms\": %.6f,"
+                   " \"min_ms\": %.6f, \"median_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f, \"mean_ms\": %.6f,\n      \"histogram\": [",
+                s->name, s->kind == PROFILE_GPU ? "gpu" : "cpu", s->samples.count, s->dropped, s->samples.total_ms,
+                sum.min_ms, sum.median_ms, sum.p99_ms, sum.max_ms, sum.mean_ms);
+        for (k = 0; k < PROFILE_BUCKETS; k++) fprintf(f, "%s%ld", k ? ", " : "", s->histogram[k]);
+        fprintf(f, "] }%s\n", i + 1 < profile.section_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static inline void profile_write_csv(FILE *f)
+{
+    int i, k;
+    char bucket[32];
+    fprintf(f, "section,kind,samples,dropped,total_ms,min_ms,median_ms,p99_ms,max_ms,mean_ms");
+    for (k = 0; k < PROFILE_BUCKETS; k++)
+    {
+        profile_bucket_name(bucket, sizeof(bucket), k);
+        fprintf(f, ",%s", bucket);
+    }
+    fprintf(f, "\n");
+    for (i = 0; i < profile.section_count; i++)
+    {
+        ProfileSection *s = &profile.sections[i];
+        FrameSummary sum = frame_stats_summarize(&s->samples);
+        fprintf(f, "%s,%s,%d,%ld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f", s->name, s->kind == PROFILE_GPU ? "gpu" : "cpu",
+                s->samples.count, s->dropped, s->samples.total_ms, sum.min_ms, sum.median_ms, sum.p99_ms, sum.max_ms, sum.mean_ms);
+        for (k = 0; k < PROFILE_BUCKETS; k++) fprintf(f, ",%ld", s->histogram[k]);
+        fprintf(f, "\n");
+    }
+}
+
+static inline void profile_report(FILE *out)
+{
+    // One line per section, the full data goes to the --profile file.
+    int i;
+    for (i = 0; i < profile.section_count; i++)
+    {
+        ProfileSection *s = &profile.sections[i];
+        FrameSummary sum = frame_stats_summarize(&s->samples);
+        fprintf(out, "profile %s %-12s %6d samples | median %.3f ms | p99 %.3f ms | max %.3f ms",
+                s->kind == PROFILE_GPU ? "gpu" : "cpu", s->name, s->samples.count, sum.median_ms, sum.p99_ms, sum.max_ms);
+        if (s->dropped) fprintf(out, " | %ld dropped", s->dropped);
+        fprintf(out, "\n");
+    }
+}
+
+static inline void profile_close(FILE *out, int have_context)
+{
+    // Writes the --profile file and frees everything. With have_context the GPU results still
+    // in flight are waited for first (they would be lost otherwise).
+    int i;
+    size_t length;
+    FILE *f;
+    if (!profile.enabled) return;
+    if (have_context && profile.gpu)
+    {
+        glFinish();
+        profile_frame_done();
+        profile.frames--; // (that wasn't a frame)
+    }
+    profile_report(out);
+    length = strlen(profile.path);
+    f = fopen(profile.path, "w");
+    if (!f) fprintf(stderr, "profile: can't write %s\n", profile.path);
+    else
+    {
+        if (length > 4 && strcmp(profile.path + length - 4, ".csv") == 0) profile_write_csv(f);
+        else profile_write_json(f);
+        fclose(f);
+        fprintf(out, "profile: %d sections written to %s\n", profile.section_count, profile.path);
+    }
+    for (i = 0; i < profile.section_count; i++)
+    {
+        if (have_context && profile.sections[i].kind == PROFILE_GPU) glDeleteQueries(PROFILE_GPU_QUERIES, profile.sections[i].queries);
+        frame_stats_free(&profile.sections[i].samples);
+    }
+    profile.enabled = 0;
+}
+
+#endif
@@ -0,0 +1,387 @@
+#ifndef COMMON_RAYCAST_H
+#define COMMON_RAYCAST_H
+
+/*
+- ***** A Note on Raycasting *****
+  Wolfenstein 3D's trick: the world is a grid of square cells, each one empty or a wall, the
+  walls are all equally tall and we never look up or down. So everything in one screen COLUMN
+  is the same wall (or none), and the whole picture takes ONE ray per column instead of one per
+  pixel: 3840 rays for a 4K screen.
+  - The camera has a position, a direction and a "camera plane" at right angles to it (the
+    screen, seen from above). Column c's ray goes from the position through the point of the
+    plane at camera_x = 2c/width - 1 (-1 = the left edge, 1 = the right edge):
+      ray = direction + plane * camera_x
+  - How far the ray went when the wall was hit gives the wall's height on screen: height / distance.
+    The distance taken is the one along the view direction, not along the ray, otherwise walls
+    bulge in the middle of the screen ("fisheye").
+
+- ***** A Note on DDA *****
+  To find the first wall we walk the ray from cell to cell (a "digital differential analyzer"):
+  - delta_x is how far along the ray we get when x grows by 1 (1/|ray_x|), delta_y the same for y.
+  - side_x/side_y is how far along the ray the next vertical/horizontal grid line is.
+  - Every step takes the NEARER of the two lines: that's the next cell the ray enters. The
+    line is pushed one delta further, and we go on until the cell is a wall.
+  There's no precision to lose and no cell is skipped, however flat the ray: only additions and
+  one compare per cell.
+
+- ***** A Note on Casting 8 Columns at Once *****
+  Neighboring rays take almost the same path through the grid, so AVX2 walks 8 of them at once,
+  one per lane: every step compares the 8 side_x with the 8 side_y, moves each lane along its
+  own nearer line (with masks, like common/entity.h), and reads the 8 cells with one gather.
+  A lane that hit its wall keeps its result, the loop ends when all 8 have. The lanes that are
+  done go on stepping with the others (their cell index clamped to the map) rather than being
+  masked off: that way the next step never waits for this step's gather, only the loop's end does.
+  Without AVX2 it's the plain loop, one ray at a time: SSE2 has no gather, and 4 lanes reading
+  their cells one by one were slower than that loop (tools/bench_raycast.c). Both do the very same
+  float operations in the same order, so they give exactly the same distances (the benchmark
+  checks that too).
+
+- ***** A Note on Writing the Picture *****
+  The picture is written column by column: floor, wall slice, ceiling. Column c starts c * stride
+  pixels into the buffer ("column-major"), so drawing a column writes memory front to back. The
+  stride is the height rounded up to a whole cache line (16 pixels), so the worker threads
+  (common/jobs.h) each get their own columns and never share a cache line.
+  At 4K that's 33 MB every frame, far more than the caches hold, and simply writing it takes
+  longer than casting the rays: a normal store first READS the cache line it goes to (it can't
+  know we'll overwrite all of it). So each column is drawn into a small buffer on the stack and
+  copied out with "non-temporal" stores (_mm_stream_si128), which write whole lines straight to
+  memory without reading them first and without pushing everything else out of the cache. For
+  the demo's mapped pixel buffer that's doubly right: such memory is often "write-combined",
+  which only whole-line writes are fast to.
+  The demo hands the buffer to OpenGL as a texture lying on its side and turns it back when
+  drawing it (see OpenGL_Raycaster_Tutorial.c).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#define RAYCAST_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define RAYCAST_SSE2 1 // (only for the non-temporal stores)
+#include <emmintrin.h>
+#endif
+
+#if defined(RAYCAST_AVX2)
+#define RAYCAST_LANES 8
+#define RAYCAST_SIMD_NAME "AVX2"
+#else
+#define RAYCAST_LANES 1
+#define RAYCAST_SIMD_NAME "scalar"
+#endif
+
+#define RAYCAST_TEXTURE_SIZE 64 // texels per side of a wall texture
+#define RAYCAST_TEXTURES 4      // wall types 1 .. 4
+#define RAYCAST_FAR 1e30f       // delta of a ray that never crosses a line (ray_x or ray_y 0)
+#define RAYCAST_LINE 16         // pixels per cache line: a column's stride is a multiple of it
+#define RAYCAST_SCRATCH 4352    // the tallest column drawn on the stack first (taller ones are written directly)
+
+typedef struct RaycastMap
+{
+    int width, height;
+    int shift;                // a row is 1 << shift cells long (so a cell's index is a shift, not a multiply)
+    int32_t *cells;           // 0 = empty, 1 .. RAYCAST_TEXTURES = a wall and its texture
+} RaycastMap;
+
+typedef struct RaycastCamera
+{
+    float x, y;               // position, in cells
+    float dir_x, dir_y;       // where we look (length 1)
+    float plane_x, plane_y;   // the screen, at right angles to dir (its length sets the field of view)
+} RaycastCamera;
+
+typedef struct RaycastFrame
+{
+    int width, height;
+    int columns;              // width rounded up to RAYCAST_LANES (the rays past the edge are thrown away)
+    int stride;               // pixels from one column to the next: height rounded up to RAYCAST_LINE
+    uint32_t *pixels;         // RGBA, column-major, each column bottom to top (see the notes above)
+    float *ray_x, *ray_y;     // each column's ray (raycast_setup_rays())
+    float *distance;          // along the view direction, to the wall each column hit
+    int32_t *cell;            // what it hit
+    int32_t *side;            // 0: a vertical grid line (x side), 1: a horizontal one (y side)
+    int32_t *steps;           // cells walked through (for the report)
+    uint32_t ceiling, floor;
+    uint32_t *textures;       // RAYCAST_TEXTURES textures, column-major like the picture
+} RaycastFrame;
+
+static inline int raycast_map_load(RaycastMap *map, const char *const *rows, int height)
+{
+    // A map from text: '.' or ' ' is empty, '1' .. '4' a wall. The border is made a wall in any
+    // case, so every ray ends somewhere. Returns 0 if the rows aren't all equally long.
+    int x, y, width;
+    if (height < 1) return 0;
+    width = (int)strlen(rows[0]);
+    for (y = 1; y < height; y++)
+        if ((int)strlen(rows[y]) != width) return 0;
+    map->width = width;
+    map->height = height;
+    for (map->shift = 0; (1 << map->shift) < width; map->shift++) { }
+    map->cells = (int32_t *)calloc((size_t)height << map->shift, sizeof(int32_t));
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+        {
+            char c = rows[height - 1 - y][x]; // (the first row is the top of the map, ie the largest y)
+            int wall = c >= '1' && c <= '0' + RAYCAST_TEXTURES ? c - '0' : 0;
+            if (x == 0 || y == 0 || x == width - 1 || y == height - 1) wall = wall ? wall : 1;
+            map->cells[(y << map->shift) + x] = wall;
+        }
+    return 1;
+}
+
+static inline int raycast_map_empty(const RaycastMap *map, float x, float y)
+{
+    int cx = (int)x, cy = (int)y;
+    if (x < 0 || y < 0 || cx >= map->width || cy >= map->height) return 0;
+    return map->cells[(cy << map->shift) + cx] == 0;
+}
+
+static inline uint32_t raycast_rgb(int r, int g, int b)
+{
+    return (uint32_t)r | (uint32_t)g << 8 | (uint32_t)b << 16 | 0xff000000u; // (the byte order of GL_RGBA)
+}
+
+static inline void raycast_make_textures(RaycastFrame *frame)
+{
+    // Four made-up textures: red bricks, gray stone blocks, wooden planks and blue tiles.
+    const int n = RAYCAST_TEXTURE_SIZE;
+    int t, u, v;
+    frame->textures = (uint32_t *)malloc(sizeof(uint32_t) * RAYCAST_TEXTURES * n * n);
+    for (t = 0; t < RAYCAST_TEXTURES; t++)
+        for (u = 0; u < n; u++)
+            for (v = 0; v < n; v++)
+            {
+                int noise = (u * 7 + v * 13 + (u * v) % 11) % 16; // (a little grain)
+                uint32_t color;
+                if (t == 0) // bricks: 8 rows, every other row shifted by half a brick
+                {
+                    int mortar = v % 8 == 0 || (u + (v / 8 % 2) * 8) % 16 == 0;
+                    color = mortar ? raycast_rgb(150, 150, 140) : raycast_rgb(150 + noise * 3, 40 + noise, 30);
+                }
+                else if (t == 1) // stone blocks
+                {
+                    int edge = u % 32 == 0 || v % 32 == 0;
+                    color = edge ? raycast_rgb(60, 60, 60) : raycast_rgb(110 + noise * 2, 110 + noise * 2, 115 + noise * 2);
+                }
+                else if (t == 2) // planks
+                {
+                    int gap = u % 16 == 0;
+                    color = gap ? raycast_rgb(60, 35, 15) : raycast_rgb(140 + noise * 2, 90 + noise, 40);
+                }
+                else // tiles
+                {
+                    int dark = (u / 16 + v / 16) % 2;
+                    color = dark ? raycast_rgb(30, 60, 140 + noise) : raycast_rgb(70, 110, 200 + noise);
+                }
+                frame->textures[(t * n + u) * n + v] = color;
+            }
+}
+
+static inline void raycast_frame_resize(RaycastFrame *frame, int width, int height)
+{
+    // (Re)allocates everything for a width x height picture. The pixels (width * stride of them,
+    // best at a multiple of 64 bytes) are up to the caller, they're often mapped buffer memory.
+    frame->width = width;
+    frame->height = height;
+    frame->stride = (height + RAYCAST_LINE - 1) / RAYCAST_LINE * RAYCAST_LINE;
+    frame->columns = (width + RAYCAST_LANES - 1) / RAYCAST_LANES * RAYCAST_LANES;
+    frame->ray_x = (float *)realloc(frame->ray_x, sizeof(float) * frame->columns);
+    frame->ray_y = (float *)realloc(frame->ray_y, sizeof(float) * frame->columns);
+    frame->distance = (float *)realloc(frame->distance, sizeof(float) * frame->columns);
+    frame->cell = (int32_t *)realloc(frame->cell, sizeof(int32_t) * frame->columns);
+    frame->side = (int32_t *)realloc(frame->side, sizeof(int32_t) * frame->columns);
+    frame->steps = (int32_t *)realloc(frame->steps, sizeof(int32_t) * frame->columns);
+}
+
+static inline void raycast_setup_rays(RaycastFrame *frame, const RaycastCamera *camera)
+{
+    // Every column's ray (see the note above). The columns past the right edge get the edge's ray.
+    int c;
+    for (c = 0; c < frame->columns; c++)
+    {
+        float camera_x = 2.0f * (c < frame->width ? c : frame->width - 1) / frame->width - 1;
+        frame->ray_x[c] = camera->dir_x + camera->plane_x * camera_x;
+        frame->ray_y[c] = camera->dir_y + camera->plane_y * camera_x;
+    }
+}
+
+static inline void raycast_cast_scalar(RaycastFrame *frame, const RaycastMap *map, const RaycastCamera *camera,
+                                       int first, int last)
+{
+    // DDA for the columns first .. last - 1, one at a time (the reference for the SIMD versions).
+    int c;
+    for (c = first; c < last; c++)
+    {
+        float ray_x = frame->ray_x[c], ray_y = frame->ray_y[c];
+        int map_x = (int)camera->x, map_y = (int)camera->y, steps = 0, side = 0, cell = 0;
+        float delta_x = ray_x == 0 ? RAYCAST_FAR : fabsf(1.0f / ray_x);
+        float delta_y = ray_y == 0 ? RAYCAST_FAR : fabsf(1.0f / ray_y);
+        int step_x = ray_x < 0 ? -1 : 1, step_y = ray_y < 0 ? -1 : 1;
+        float side_x = ray_x < 0 ? (camera->x - (float)map_x) * delta_x : ((float)map_x + 1.0f - camera->x) * delta_x;
+        float side_y = ray_y < 0 ? (camera->y - (float)map_y) * delta_y : ((float)map_y + 1.0f - camera->y) * delta_y;
+        while (cell == 0)
+        {
+            if (side_x < side_y)
+            {
+                side_x += delta_x;
+                map_x += step_x;
+                side = 0;
+            }
+            else
+            {
+                side_y += delta_y;
+                map_y += step_y;
+                side = 1;
+            }
+            cell = map->cells[(map_y << map->shift) + map_x];
+            steps++;
+        }
+        // The line we stopped at is one delta back.
+        frame->distance[c] = side == 0 ? side_x - delta_x : side_y - delta_y;
+        frame->cell[c] = cell;
+        frame->side[c] = side;
+        frame->steps[c] = steps;
+    }
+}
+
+#if defined(RAYCAST_AVX2)
+static inline void raycast_cast_simd(RaycastFrame *frame, const RaycastMap *map, const RaycastCamera *camera,
+                                     int first, int last)
+{
+    // 8 columns per loop (first and last are multiples of 8).
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), far = _mm256_set1_ps(RAYCAST_FAR);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 pos_x = _mm256_set1_ps(camera->x), pos_y = _mm256_set1_ps(camera->y);
+    const __m256i cell_x = _mm256_set1_epi32((int)camera->x), cell_y = _mm256_set1_epi32((int)camera->y);
+    const __m128i shift = _mm_cvtsi32_si128(map->shift);
+    const __m256i last_cell = _mm256_set1_epi32((map->height << map->shift) - 1);
+    int c;
+    for (c = first; c < last; c += 8)
+    {
+        __m256 ray_x = _mm256_loadu_ps(frame->ray_x + c), ray_y = _mm256_loadu_ps(frame->ray_y + c);
+        __m256 negative_x = _mm256_cmp_ps(ray_x, zero, _CMP_LT_OQ), negative_y = _mm256_cmp_ps(ray_y, zero, _CMP_LT_OQ);
+        __m256 delta_x = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, ray_x), abs_mask), far, _mm256_cmp_ps(ray_x, zero, _CMP_EQ_OQ));
+        __m256 delta_y = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, ray_y), abs_mask), far, _mm256_cmp_ps(ray_y, zero, _CMP_EQ_OQ));
+        __m256i map_x = cell_x, map_y = cell_y;
+        __m256 map_xf = _mm256_cvtepi32_ps(map_x), map_yf = _mm256_cvtepi32_ps(map_y);
+        __m256i step_x = _mm256_or_si256(_mm256_castps_si256(negative_x), _mm256_set1_epi32(1)); // -1 or 1
+        __m256i step_y = _mm256_or_si256(_mm256_castps_si256(negative_y), _mm256_set1_epi32(1));
+        __m256 side_x = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(map_xf, one), pos_x), _mm256_sub_ps(pos_x, map_xf), negative_x), delta_x);
+        __m256 side_y = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(map_yf, one), pos_y), _mm256_sub_ps(pos_y, map_yf), negative_y), delta_y);
+        __m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1)), distance = zero, y_side = zero;
+        __m256i cell = _mm256_setzero_si256(), steps = _mm256_setzero_si256();
+        while (_mm256_movemask_ps(active))
+        {
+            __m256 take_x = _mm256_cmp_ps(side_x, side_y, _CMP_LT_OQ);
+            __m256 take_y = _mm256_andnot_ps(take_x, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+            __m256i hit_cells, index;
+            __m256 hit;
+            side_x = _mm256_blendv_ps(side_x, _mm256_add_ps(side_x, delta_x), take_x);
+            side_y = _mm256_blendv_ps(side_y, _mm256_add_ps(side_y, delta_y), take_y);
+            map_x = _mm256_add_epi32(map_x, _mm256_and_si256(step_x, _mm256_castps_si256(take_x)));
+            map_y = _mm256_add_epi32(map_y, _mm256_and_si256(step_y, _mm256_castps_si256(take_y)));
+            steps = _mm256_sub_epi32(steps, _mm256_castps_si256(active)); // (active is -1)
+            index = _mm256_add_epi32(_mm256_sll_epi32(map_y, shift), map_x);
+            index = _mm256_min_epi32(_mm256_max_epi32(index, _mm256_setzero_si256()), last_cell);
+            hit_cells = _mm256_i32gather_epi32((const int *)map->cells, index, 4);
+            hit = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hit_cells, _mm256_setzero_si256())), active);
+            // The lanes that hit something now: their distance, side and cell, then they're done.
+            distance = _mm256_blendv_ps(distance, _mm256_blendv_ps(_mm256_sub_ps(side_x, delta_x), _mm256_sub_ps(side_y, delta_y), take_y), hit);
+            y_side = _mm256_blendv_ps(y_side, take_y, hit);
+            cell = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(cell), _mm256_castsi256_ps(hit_cells), hit));
+            active = _mm256_andnot_ps(hit, active);
+        }
+        _mm256_storeu_ps(frame->distance + c, distance);
+        _mm256_storeu_si256((__m256i *)(frame->cell + c), cell);
+        _mm256_storeu_si256((__m256i *)(frame->side + c), _mm256_srli_epi32(_mm256_castps_si256(y_side), 31));
+        _mm256_storeu_si256((__m256i *)(frame->steps + c), steps);
+    }
+}
+#else
+static inline void raycast_cast_simd(RaycastFrame *frame, const RaycastMap *map, const RaycastCamera *camera,
+                                     int first, int last)
+{
+    raycast_cast_scalar(frame, map, camera, first, last);
+}
+#endif
+
+static inline void raycast_copy_column(uint32_t *to, const uint32_t *from, int count)
+{
+    // count pixels (a multiple of 4) past the caches (see the note above), plain memcpy without SSE2.
+#if defined(RAYCAST_SSE2)
+    int i;
+    if (((uintptr_t)to & 15) == 0)
+    {
+        for (i = 0; i < count; i += 4) _mm_stream_si128((__m128i *)(to + i), _mm_loadu_si128((const __m128i *)(from + i)));
+        return;
+    }
+#endif
+    memcpy(to, from, sizeof(uint32_t) * count);
+}
+
+static inline void raycast_draw_columns(RaycastFrame *frame, const RaycastCamera *camera, int first, int last)
+{
+    // Floor, wall and ceiling of the columns first .. last - 1 (after casting them).
+    const int n = RAYCAST_TEXTURE_SIZE, height = frame->height;
+    uint32_t scratch[RAYCAST_SCRATCH];
+    int c, y;
+    if (last > frame->width) last = frame->width;
+    for (c = first; c < last; c++)
+    {
+        uint32_t *pixels = frame->pixels + (size_t)c * frame->stride;
+        uint32_t *column = height <= RAYCAST_SCRATCH ? scratch : pixels;
+        int filled = column == scratch ? (height + 3) & ~3 : height; // (the copy goes 4 pixels at a time)
+        float distance = frame->distance[c] > 1e-4f ? frame->distance[c] : 1e-4f;
+        float wall_height = height / distance, wall_top = (height + wall_height) * 0.5f, wall_x;
+        int bottom = (int)((height - wall_height) * 0.5f), top = (int)wall_top, u;
+        const uint32_t *texture;
+        uint32_t v, v_step;
+        if (bottom < 0) bottom = 0;
+        if (top > height) top = height;
+
+        // Where along the wall (0 .. 1) the ray hit: that's the texture's column u.
+        wall_x = frame->side[c] == 0 ? camera->y + distance * frame->ray_y[c] : camera->x + distance * frame->ray_x[c];
+        wall_x -= floorf(wall_x);
+        u = (int)(wall_x * n);
+        if ((frame->side[c] == 0 && frame->ray_x[c] > 0) || (frame->side[c] == 1 && frame->ray_y[c] < 0)) u = n - 1 - u;
+        texture = frame->textures + ((frame->cell[c] - 1) * n + (u & (n - 1))) * n;
+
+        // v goes from the wall's top (0) down, in 16.16 fixed point.
+        v_step = (uint32_t)(n * 65536.0f / wall_height);
+        v = (uint32_t)((wall_top - (top - 1 + 0.5f)) * n * 65536.0f / wall_height);
+
+        for (y = 0; y < bottom; y++) column[y] = frame->floor;
+        if (frame->side[c] == 0)
+        {
+            for (y = top - 1; y >= bottom; y--, v += v_step) column[y] = texture[(v >> 16) & (n - 1)];
+        }
+        else
+        {
+            // The y sides are a little darker: walls facing two ways don't melt into each other.
+            for (y = top - 1; y >= bottom; y--, v += v_step) column[y] = (texture[(v >> 16) & (n - 1)] >> 1 & 0x7f7f7f) | 0xff000000u;
+        }
+        for (y = top; y < filled; y++) column[y] = frame->ceiling; // (up to 3 more into the stride's padding)
+        if (column == scratch) raycast_copy_column(pixels, scratch, filled);
+    }
+#if defined(RAYCAST_SSE2)
+    _mm_sfence(); // (the non-temporal stores are done before anybody else reads the picture)
+#endif
+}
+
+static inline void raycast_frame_free(RaycastFrame *frame)
+{
+    free(frame->ray_x);
+    free(frame->ray_y);
+    free(frame->distance);
+    free(frame->cell);
+    free(frame->side);
+    free(frame->steps);
+    free(frame->textures);
+    memset(frame, 0, sizeof(*frame));
+}
+
+#endif
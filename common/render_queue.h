@@ -0,0 +1,204 @@
+#ifndef COMMON_RENDER_QUEUE_H
+#define COMMON_RENDER_QUEUE_H
+
+/*
+- ***** A Note on Render Queues *****
+  Drawing objects in the order we happen to find them means switching meshes, colors, shaders...
+  back and forth all the time, and OpenGL checks (and sometimes recompiles) state on the next draw
+  after every switch. A render queue splits drawing in two:
+  1. Recording: instead of drawing, display() puts a small command into a queue: WHAT to draw
+     (an index into our own arrays, eg the object) and a 64-bit sort key saying WHEN to draw it.
+  2. Submitting: the commands are sorted by their keys and then drawn in that order, each state
+     change only made when the next command actually needs something else.
+
+  The key is made of fields, the most important one in the highest bits (see render_key()):
+  - pass:     2 bits, eg opaque before transparent. Always first.
+  - depth:    24 bits, 0 = the near plane, 1 = the far plane (times 2^24 - 1).
+  - shader:   8 bits, eg the mesh or level of detail (anything that's expensive to switch).
+  - material: 16 bits, eg the color.
+  RENDER_ORDER_STATE puts shader and material before depth: as few switches as possible.
+  RENDER_ORDER_DEPTH puts depth first: front to back, so the depth test throws away the pixels
+  of what's behind before they're shaded. Which one wins depends on what costs more, switching
+  state or shading pixels (the counters tell the first, a profile the second).
+
+  Sorting is a radix sort: 8 passes over the keys, 8 bits at a time, each a counting sort that's
+  stable (so equal keys keep the order they were recorded in). That's O(n), and passes where all
+  keys have the same byte (eg the unused low bits) are skipped.
+
+  Recording can run on several threads at once (see common/jobs.h): every job gets its own queue
+  (render_frame_queue()), so nobody waits for anybody, and render_frame_sort() merges them in job
+  order. Since the sort is stable, the result doesn't depend on which thread ran which job.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "clock.h"
+
+#define RENDER_KEY_DEPTH_MAX 0xffffff
+
+enum { RENDER_ORDER_STATE, RENDER_ORDER_DEPTH };
+
+typedef struct RenderCommand
+{
+    uint64_t key;
+    uint32_t item;            // what to draw (an index into the caller's arrays)
+    uint32_t data;            // anything else the caller needs to draw it (eg a level of detail)
+} RenderCommand;
+
+typedef struct RenderQueue
+{
+    RenderCommand *commands;
+    int count, capacity;
+} RenderQueue;
+
+typedef struct RenderFrame
+{
+    RenderQueue *queues;      // one per recording job
+    int queue_count, queue_capacity;
+    RenderCommand *sorted, *scratch; // all the commands of the frame, merged and sorted
+    int count, capacity;
+    int histogram[8][256];    // (the radix sort's counts)
+
+    long frames;              // counters, summed over frames (for the report)
+    long commands;
+    long sort_passes;         // radix passes run (of 8 per frame)
+    uint64_t record_ns, sort_ns;
+} RenderFrame;
+
+static inline uint64_t render_key(int order, unsigned pass, float depth, unsigned shader, unsigned material)
+{
+    // Packs the fields into a key (see the note above). depth is 0 .. 1, clamped.
+    uint64_t d = depth <= 0 ? 0 : depth >= 1 ? RENDER_KEY_DEPTH_MAX : (uint64_t)(depth * RENDER_KEY_DEPTH_MAX);
+    uint64_t key = (uint64_t)(pass & 3) << 62;
+    if (order == RENDER_ORDER_DEPTH) return key | d << 38 | (uint64_t)(shader & 0xff) << 30 | (uint64_t)(material & 0xffff) << 14;
+    return key | (uint64_t)(shader & 0xff) << 54 | (uint64_t)(material & 0xffff) << 38 | d << 14;
+}
+
+static inline unsigned render_material_rgb(float r, float g, float b)
+{
+    // A color as a 16-bit material (5 bits red, 6 green, 5 blue): close colors sort together.
+    unsigned ri = (unsigned)(r <= 0 ? 0 : r >= 1 ? 31 : r * 31 + 0.5f);
+    unsigned gi = (unsigned)(g <= 0 ? 0 : g >= 1 ? 63 : g * 63 + 0.5f);
+    unsigned bi = (unsigned)(b <= 0 ? 0 : b >= 1 ? 31 : b * 31 + 0.5f);
+    return ri << 11 | gi << 5 | bi;
+}
+
+static inline void render_frame_begin(RenderFrame *frame, int queue_count)
+{
+    // Starts recording a frame with queue_count queues (eg one per job of a jobs_parallel_for()).
+    int i;
+    if (queue_count < 1) queue_count = 1;
+    if (queue_count > frame->queue_capacity)
+    {
+        frame->queues = (RenderQueue *)realloc(frame->queues, queue_count * sizeof(RenderQueue));
+        memset(frame->queues + frame->queue_capacity, 0, (queue_count - frame->queue_capacity) * sizeof(RenderQueue));
+        frame->queue_capacity = queue_count;
+    }
+    for (i = 0; i < queue_count; i++) frame->queues[i].count = 0;
+    frame->queue_count = queue_count;
+    frame->count = 0;
+}
+
+static inline RenderQueue *render_frame_queue(RenderFrame *frame, int index)
+{
+    // The queue of job index. Only that job writes to it, so no locks.
+    return &frame->queues[index];
+}
+
+static inline void render_queue_push(RenderQueue *queue, uint64_t key, uint32_t item, uint32_t data)
+{
+    RenderCommand *command;
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 256;
+        queue->commands = (RenderCommand *)realloc(queue->commands, queue->capacity * sizeof(RenderCommand));
+    }
+    command = &queue->commands[queue->count++];
+    command->key = key;
+    command->item = item;
+    command->data = data;
+}
+
+static inline const RenderCommand *render_frame_sort(RenderFrame *frame, int *count)
+{
+    // Merges the queues (in order) and sorts the commands by key. Returns them, *count of them.
+    // Stays valid until the next render_frame_begin().
+    uint64_t start = clock_now_ns();
+    int total = 0, i, pass;
+    RenderCommand *from, *to, *swap;
+    int (*histogram)[256] = frame->histogram;
+
+    for (i = 0; i < frame->queue_count; i++) total += frame->queues[i].count;
+    if (total > frame->capacity)
+    {
+        frame->capacity = total + total / 2;
+        frame->sorted = (RenderCommand *)realloc(frame->sorted, frame->capacity * sizeof(RenderCommand));
+        frame->scratch = (RenderCommand *)realloc(frame->scratch, frame->capacity * sizeof(RenderCommand));
+    }
+    for (i = 0, total = 0; i < frame->queue_count; i++)
+    {
+        memcpy(frame->sorted + total, frame->queues[i].commands, frame->queues[i].count * sizeof(RenderCommand));
+        total += frame->queues[i].count;
+    }
+
+    // All 8 histograms in one go, then a counting sort per byte, lowest byte first.
+    memset(frame->histogram, 0, sizeof(frame->histogram));
+    for (i = 0; i < total; i++)
+        for (pass = 0; pass < 8; pass++) histogram[pass][(frame->sorted[i].key >> (pass * 8)) & 0xff]++;
+    from = frame->sorted;
+    to = frame->scratch;
+    for (pass = 0; pass < 8; pass++)
+    {
+        int *counts = histogram[pass], offset = 0, byte;
+        if (total == 0 || counts[(from[0].key >> (pass * 8)) & 0xff] == total) continue; // (all the same)
+        for (byte = 0; byte < 256; byte++)
+        {
+            int n = counts[byte];
+            counts[byte] = offset;
+            offset += n;
+        }
+        for (i = 0; i < total; i++) to[counts[(from[i].key >> (pass * 8)) & 0xff]++] = from[i];
+        swap = from;
+        from = to;
+        to = swap;
+        frame->sort_passes++;
+    }
+    frame->sorted = from;
+    frame->scratch = to;
+
+    frame->count = total;
+    frame->commands += total;
+    frame->frames++;
+    frame->sort_ns += clock_now_ns() - start;
+    *count = total;
+    return frame->sorted;
+}
+
+static inline void render_frame_report(RenderFrame *frame, FILE *out, long shader_changes, long material_changes)
+{
+    // Per frame since the last report. The changes are what the caller counted while drawing.
+    if (frame->frames == 0) return;
+    fprintf(out, "render queue: %.1f commands per frame | %.1f shader, %.1f material changes | record %.3f ms, sort %.3f ms (%.1f radix passes)\n",
+            (double)frame->commands / frame->frames, (double)shader_changes / frame->frames,
+            (double)material_changes / frame->frames, frame->record_ns / 1e6 / frame->frames,
+            frame->sort_ns / 1e6 / frame->frames, (double)frame->sort_passes / frame->frames);
+    frame->frames = 0;
+    frame->commands = 0;
+    frame->sort_passes = 0;
+    frame->record_ns = 0;
+    frame->sort_ns = 0;
+}
+
+static inline void render_frame_free(RenderFrame *frame)
+{
+    int i;
+    for (i = 0; i < frame->queue_capacity; i++) free(frame->queues[i].commands);
+    free(frame->queues);
+    free(frame->sorted);
+    free(frame->scratch);
+    memset(frame, 0, sizeof(*frame));
+}
+
+#endif
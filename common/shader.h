@@ -0,0 +1,213 @@
+#ifndef COMMON_SHADER_H
+#define COMMON_SHADER_H
+
+/*
+- ***** A Note on Shaders *****
+  Everything we did with glColor3f/glRotatef/... is the "fixed-function pipeline": OpenGL has a
+  built-in program that transforms each vertex by the ModelView and Projection matrices and
+  paints the pixels with the current color. Shaders let us replace that built-in program with
+  our own small programs (written in GLSL, a C-like language) that run on the GPU:
+  - The vertex shader runs once per vertex and outputs its position on screen (gl_Position).
+  - The fragment shader runs once per pixel covered by a triangle and outputs its color.
+  The driver compiles the source text at runtime (glCompileShader), then both shaders are
+  "linked" into one program (glLinkProgram) which we turn on with glUseProgram().
+
+  Compiling isn't free (a few milliseconds per program here, much more for big shaders on some
+  drivers), and it happens at every start. shader_program_cached() asks the driver for the linked
+  program as a blob of bytes (glGetProgramBinary), keeps it in a file and next time hands it
+  straight back (glProgramBinary), no compiler involved. A binary only fits the driver that made
+  it, so the file starts with a fingerprint of the sources, GL_RENDERER and GL_VERSION: after a
+  driver update (or a change to the shaders) the fingerprint doesn't match and we compile again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "gl_ext.h"
+
+typedef struct ShaderAttrib
+{
+    GLuint location; // the number the vertex data is hooked up to with glVertexAttribPointer
+    const char *name;  // the "in" variable of the vertex shader
+} ShaderAttrib;
+
+static inline GLuint shader_compile(GLenum type, const char *source)
+{
+    // Compiles one shader, prints the driver's error messages and returns 0 if it fails.
+    GLuint shader = glCreateShader(type);
+    GLint ok = 0;
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        char log[2048];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "%s shader failed to compile:\n%s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static inline GLuint shader_program_link(const char *vertex_source, const char *fragment_source,
+                                         const ShaderAttrib *attribs, int attrib_count, int retrievable)
+{
+    // shader_program_create(), retrievable = 1 asks the driver to keep the program's binary for
+    // glGetProgramBinary (it has to be said before linking).
+    GLuint program, vs, fs;
+    GLint ok = 0;
+    int i;
+
+    vs = shader_compile(GL_VERTEX_SHADER, vertex_source);
+    fs = shader_compile(GL_FRAGMENT_SHADER, fragment_source);
+    if (!vs || !fs)
+    {
+        if (vs) glDeleteShader(vs);
+        if (fs) glDeleteShader(fs);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    for (i = 0; i < attrib_count; i++) glBindAttribLocation(program, attribs[i].location, attribs[i].name);
+    if (retrievable) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    // The program keeps what it needs, the shader objects can go.
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        char log[2048];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "shader program failed to link:\n%s\n", log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static inline GLuint shader_program_create(const char *vertex_source, const char *fragment_source,
+                                    const ShaderAttrib *attribs, int attrib_count)
+{
+    // Compiles and links a vertex + fragment shader into a program. attribs fixes the location
+    // of each vertex shader input before linking (so it matches our glVertexAttribPointer calls).
+    // Returns 0 on failure.
+    return shader_program_link(vertex_source, fragment_source, attribs, attrib_count, 0);
+}
+
+typedef struct ShaderCacheHeader
+{
+    char magic[8];          // "SHDRBIN1"
+    uint64_t fingerprint;   // of the sources + driver, see shader_fingerprint()
+    uint32_t format;        // the driver's binary format (glProgramBinary needs it back)
+    uint32_t length;        // bytes of binary that follow
+} ShaderCacheHeader;
+
+static inline uint64_t shader_hash(uint64_t hash, const char *text)
+{
+    // FNV-1a, 64 bits. (text may be NULL: a driver that doesn't say its name)
+    if (!text) return hash;
+    while (*text) hash = (hash ^ (unsigned char)*text++) * 1099511628211ull;
+    return (hash ^ 0xff) * 1099511628211ull; // (so "ab" + "c" and "a" + "bc" differ)
+}
+
+static inline uint64_t shader_fingerprint(const char *vertex_source, const char *fragment_source,
+                                          const ShaderAttrib *attribs, int attrib_count)
+{
+    uint64_t hash = 14695981039346656037ull;
+    int i;
+    hash = shader_hash(hash, vertex_source);
+    hash = shader_hash(hash, fragment_source);
+    for (i = 0; i < attrib_count; i++)
+    {
+        hash = shader_hash(hash, attribs[i].name);
+        hash = (hash ^ attribs[i].location) * 1099511628211ull;
+    }
+    hash = shader_hash(hash, (const char *)glGetString(GL_RENDERER));
+    return shader_hash(hash, (const char *)glGetString(GL_VERSION));
+}
+
+static inline GLuint shader_program_load_binary(const char *path, uint64_t fingerprint)
+{
+    // The program from the cache file, or 0 if there is none that fits.
+    ShaderCacheHeader header;
+    GLuint program = 0;
+    GLint ok = 0;
+    void *binary;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    if (fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "SHDRBIN1", 8) == 0 &&
+        header.fingerprint == fingerprint && header.length > 0 && (binary = malloc(header.length)) != NULL)
+    {
+        if (fread(binary, 1, header.length, f) == header.length)
+        {
+            program = glCreateProgram();
+            glProgramBinary(program, header.format, binary, (GLsizei)header.length);
+            glGetProgramiv(program, GL_LINK_STATUS, &ok);
+            if (!ok) // (the driver may still say no, eg it was rebuilt with the same version string)
+            {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        free(binary);
+    }
+    fclose(f);
+    return program;
+}
+
+static inline void shader_program_save_binary(GLuint program, const char *path, uint64_t fingerprint)
+{
+    ShaderCacheHeader header;
+    GLint length = 0;
+    GLenum format;
+    void *binary;
+    FILE *f;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || (binary = malloc(length)) == NULL) return;
+    glGetProgramBinary(program, length, &length, &format, binary);
+    memcpy(header.magic, "SHDRBIN1", 8);
+    header.fingerprint = fingerprint;
+    header.format = format;
+    header.length = (uint32_t)length;
+    f = fopen(path, "wb");
+    if (!f || fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(binary, 1, length, f) != (size_t)length)
+        fprintf(stderr, "could not write the shader cache %s\n", path);
+    if (f) fclose(f);
+    free(binary);
+}
+
+static inline GLuint shader_program_cached(const char *vertex_source, const char *fragment_source,
+                                           const ShaderAttrib *attribs, int attrib_count,
+                                           const char *cache_path, int *from_cache)
+{
+    // shader_program_create(), but kept in the file cache_path (NULL = no cache) between runs.
+    // *from_cache says whether the compiler was skipped. Returns 0 on failure.
+    int have_binaries = GLEXT_HAVE(glProgramBinary) && GLEXT_HAVE(glGetProgramBinary) && GLEXT_HAVE(glProgramParameteri);
+    GLint formats = 0;
+    uint64_t fingerprint = 0;
+    GLuint program;
+
+    *from_cache = 0;
+    if (have_binaries) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats); // (0: the driver can't)
+    if (!cache_path || formats <= 0) return shader_program_create(vertex_source, fragment_source, attribs, attrib_count);
+
+    fingerprint = shader_fingerprint(vertex_source, fragment_source, attribs, attrib_count);
+    program = shader_program_load_binary(cache_path, fingerprint);
+    if (program)
+    {
+        *from_cache = 1;
+        return program;
+    }
+    program = shader_program_link(vertex_source, fragment_source, attribs, attrib_count, 1);
+    if (program) shader_program_save_binary(program, cache_path, fingerprint);
+    return program;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef COMMON_SPRITE_BATCH_H
+#define COMMON_SPRITE_BATCH_H
+
+/*
+- ***** A Note on Batching *****
+  Drawing a rectangle with glBegin/4x glVertex/glEnd costs 6 calls into the driver, and every
+  glBegin/glEnd pair is a separate little draw for the driver to set up. For one rectangle
+  that is nothing, for 100000 of them the driver overhead is the whole frame.
+  A batcher collects the rectangles ("sprites") in our own array first:
+    4 vertices per sprite, each one x, y and a color (12 bytes)
+  and hands the whole array to OpenGL in one go: a vertex buffer filled once per frame and ONE
+  glDrawElements for every sprite. The index buffer (which 4 vertices make the 2 triangles of
+  each sprite) never changes, so it is built once at the start.
+  The "array" is this frame's region of a persistently mapped buffer (common/stream.h), so the
+  vertices are written where the GPU reads them. With --stream orphan (or without OpenGL 4.4)
+  it's our own memory, handed over with glBufferData(NULL) ("orphaning") + glBufferSubData.
+
+  Note: Everything in a batch is drawn with the same state. Sprites that need a different state
+        (another texture, blending, ...) go into another batch: one draw call per "bucket".
+        The batch also draws by itself when it is full (SPRITE_BATCH_MAX_QUADS).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "gl_ext.h"
+#include "stream.h"
+
+#define SPRITE_BATCH_MAX_QUADS (1 << 20) // per draw call
+
+typedef struct SpriteVertex
+{
+    GLfloat x, y;
+    GLubyte color[4];
+} SpriteVertex;
+
+typedef struct SpriteBatch
+{
+    GLuint vbo, ibo;
+    StreamBuffer stream;      // used instead of vbo if it could be created
+    GLintptr offset;          // where vertices are in stream's buffer
+    SpriteVertex *vertices;   // 4 per quad (in the mapped stream buffer since the first quad of the batch)
+    int capacity;             // quads
+    int count;                // quads waiting to be drawn
+    long quads_drawn;
+    long draw_calls;
+} SpriteBatch;
+
+static inline int sprite_batch_init(SpriteBatch *batch, int capacity, int streaming)
+{
+    // Room for capacity quads per draw call (more are drawn in several calls). Needs an OpenGL
+    // context with buffer objects. Returns 0 if there is none.
+    // streaming: write the vertices into a persistently mapped buffer if the context can.
+    GLuint *indices;
+    int i;
+    memset(batch, 0, sizeof(*batch));
+    if (!GLEXT_HAVE(glGenBuffers)) return 0;
+    if (capacity < 1) capacity = 1;
+    if (capacity > SPRITE_BATCH_MAX_QUADS) capacity = SPRITE_BATCH_MAX_QUADS;
+    batch->capacity = capacity;
+
+    // 0 1 2, 0 2 3 for the first quad, 4 5 6, 4 6 7 for the second, ...
+    indices = (GLuint *)malloc(sizeof(GLuint) * 6 * capacity);
+    for (i = 0; i < capacity; i++)
+    {
+        GLuint v = (GLuint)i * 4, *q = indices + i * 6;
+        q[0] = v; q[1] = v + 1; q[2] = v + 2;
+        q[3] = v; q[4] = v + 2; q[5] = v + 3;
+    }
+    glGenBuffers(1, &batch->ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 6 * capacity, indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(indices);
+
+    // A region holds one full batch (+ one vertex, for lining it up on a whole vertex).
+    if (!streaming || !stream_init(&batch->stream, GL_ARRAY_BUFFER, sizeof(SpriteVertex) * (4 * capacity + 1)))
+    {
+        batch->vertices = (SpriteVertex *)malloc(sizeof(SpriteVertex) * 4 * capacity);
+        glGenBuffers(1, &batch->vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(SpriteVertex) * 4 * capacity, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return 1;
+}
+
+static inline void sprite_batch_flush(SpriteBatch *batch)
+{
+    // Draws the quads collected so far with one glDrawElements.
+    GLsizeiptr bytes = (GLsizeiptr)sizeof(SpriteVertex) * 4 * batch->count;
+    GLintptr offset = 0;
+    if (batch->count == 0) return;
+    if (batch->stream.memory)
+    {
+        // Already in the buffer: only the room the batch didn't fill goes back.
+        stream_unused(&batch->stream, (int)(sizeof(SpriteVertex) * 4 * (batch->capacity - batch->count)));
+        glBindBuffer(GL_ARRAY_BUFFER, batch->stream.buffer);
+        offset = batch->offset;
+        batch->vertices = NULL;
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(SpriteVertex) * 4 * batch->capacity, NULL, GL_STREAM_DRAW); // (orphan)
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, batch->vertices);
+    }
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(SpriteVertex), (const void *)(offset + offsetof(SpriteVertex, x)));
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(SpriteVertex), (const void *)(offset + offsetof(SpriteVertex, color)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+    glDrawElements(GL_TRIANGLES, 6 * batch->count, GL_UNSIGNED_INT, (const void *)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    batch->quads_drawn += batch->count;
+    batch->draw_calls++;
+    batch->count = 0;
+}
+
+static inline void sprite_batch_add(SpriteBatch *batch, float x, float y, float width, float height, const GLubyte color[4])
+{
+    // Queues an axis aligned rectangle, (x, y) is its bottom left corner.
+    SpriteVertex *v;
+    int k;
+    if (batch->count == batch->capacity) sprite_batch_flush(batch);
+    if (batch->count == 0 && batch->stream.memory) // (room for a whole batch, what isn't used goes back in sprite_batch_flush())
+        batch->vertices = (SpriteVertex *)stream_alloc(&batch->stream, (int)sizeof(SpriteVertex) * 4 * batch->capacity, sizeof(SpriteVertex), &batch->offset);
+    v = batch->vertices + batch->count * 4;
+    v[0].x = x;         v[0].y = y + height; // (the same corner order as the glBegin(GL_POLYGON) rectangle)
+    v[1].x = x;         v[1].y = y;
+    v[2].x = x + width; v[2].y = y;
+    v[3].x = x + width; v[3].y = y + height;
+    for (k = 0; k < 4; k++) memcpy(v[k].color, color, 4);
+    batch->count++;
+}
+
+static inline void sprite_batch_end_frame(SpriteBatch *batch)
+{
+    // After the frame's last sprite_batch_flush(): the next frame writes into the next region.
+    stream_end_frame(&batch->stream);
+}
+
+static inline void sprite_batch_free(SpriteBatch *batch)
+{
+    if (batch->vbo) glDeleteBuffers(1, &batch->vbo);
+    if (batch->ibo) glDeleteBuffers(1, &batch->ibo);
+    if (!batch->stream.memory) free(batch->vertices); // (else they're in the mapping)
+    stream_shutdown(&batch->stream);
+    memset(batch, 0, sizeof(*batch));
+}
+
+#endif
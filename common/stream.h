@@ -0,0 +1,160 @@
+#ifndef COMMON_STREAM_H
+#define COMMON_STREAM_H
+
+/*
+- ***** A Note on Streaming Buffers *****
+  Data that changes every frame (the vertices of the moving square, the matrices of every
+  object, ...) has to get into a buffer every frame. The classic way is glBufferData(NULL)
+  ("orphaning": the driver hands us fresh memory and keeps the old one until the GPU is done
+  with it) followed by glBufferSubData, which copies our array into the driver and from there
+  into the buffer. Whether that allocates, copies twice or waits for the GPU is up to the driver.
+
+  OpenGL 4.4 (glBufferStorage) lets us do it ourselves:
+  1. ONE buffer, big enough for 3 frames, is created with GL_MAP_PERSISTENT_BIT and
+     GL_MAP_COHERENT_BIT and mapped once, for good. The pointer stays valid while the GPU draws
+     from the buffer, and what we write there is seen by the GPU without any flush call.
+  2. The buffer is cut into 3 regions, frame N writes only into region N % 3. stream_alloc()
+     hands out pieces of it front to back: a pointer to write the data to, and its offset in
+     the buffer for glDrawArrays, glVertexAttribPointer, glBindBufferRange, ...
+  3. At the end of the frame a fence (glFenceSync) goes in after its draws. Before frame N + 3
+     writes into the same region again, we wait for that fence: the GPU must be done reading
+     it, else we'd change the vertices under its feet. So the GPU can fall two frames behind
+     before we ever wait, and the counters tell how often we did.
+
+  Note: A frame that needs more than one region simply moves on to the next region early (with
+        a fence for the one it filled). Make the regions big enough that this stays rare, since
+        it eats into the GPU's head start.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "gl_ext.h"
+#include "clock.h"
+
+#define STREAM_REGIONS 3
+
+typedef struct StreamBuffer
+{
+    GLuint buffer;
+    GLenum target;            // what it was created as (GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, ...)
+    unsigned char *memory;    // the persistent mapping of the whole buffer
+    int region_size;          // bytes
+    int region;               // the one being written to
+    int used;                 // bytes handed out in it
+    GLsync fences[STREAM_REGIONS]; // signaled when the GPU is done with the region (0 = never used)
+
+    long frames;
+    long bytes;               // handed out in total
+    long early;               // regions left early because they were full
+    long fence_waits;         // times a region was still in use when we got to it
+    double wait_ms;           // time spent waiting for those
+} StreamBuffer;
+
+static inline int stream_init(StreamBuffer *stream, GLenum target, int region_size)
+{
+    // Creates and maps a buffer of STREAM_REGIONS * region_size bytes. Leaves it bound to target.
+    // Returns 0 if this OpenGL can't (no OpenGL 4.4 / ARB_buffer_storage): use glBufferData then.
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    memset(stream, 0, sizeof(*stream));
+    if (!GLEXT_HAVE(glBufferStorage) || !GLEXT_HAVE(glMapBufferRange) || !GLEXT_HAVE(glFenceSync)) return 0;
+    stream->target = target;
+    stream->region_size = region_size;
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(target, stream->buffer);
+    glBufferStorage(target, (GLsizeiptr)region_size * STREAM_REGIONS, NULL, flags);
+    stream->memory = (unsigned char *)glMapBufferRange(target, 0, (GLsizeiptr)region_size * STREAM_REGIONS, flags);
+    if (!stream->memory)
+    {
+        glDeleteBuffers(1, &stream->buffer);
+        memset(stream, 0, sizeof(*stream));
+        return 0;
+    }
+    return 1;
+}
+
+static inline void stream_wait(StreamBuffer *stream, int region)
+{
+    // Waits until the GPU is done with region (if it's still busy, which is counted).
+    GLsync fence = stream->fences[region];
+    if (!fence) return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        uint64_t start = clock_now_ns();
+        stream->fence_waits++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) { }
+        stream->wait_ms += clock_ns_to_ms(clock_now_ns() - start);
+    }
+    glDeleteSync(fence);
+    stream->fences[region] = 0;
+}
+
+static inline void stream_next_region(StreamBuffer *stream)
+{
+    // Puts the fence behind everything drawn from the current region, then moves on.
+    if (stream->used > 0) stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream->region = (stream->region + 1) % STREAM_REGIONS;
+    stream->used = 0;
+    stream_wait(stream, stream->region);
+}
+
+static inline void *stream_alloc(StreamBuffer *stream, int bytes, int align, GLintptr *offset)
+{
+    // bytes to write this frame, starting at a multiple of align (counted from the start of the
+    // buffer, so any align works, eg sizeof(vertex)). Returns where to write them, *offset is
+    // where they are in the buffer. NULL if bytes doesn't fit in a region at all.
+    long start = (long)stream->region * stream->region_size, at;
+    *offset = 0;
+    if (bytes > stream->region_size - align) return NULL;
+    at = (start + stream->used + align - 1) / align * align;
+    if (at + bytes > start + stream->region_size)
+    {
+        stream->early++;
+        stream_next_region(stream);
+        start = (long)stream->region * stream->region_size;
+        at = (start + align - 1) / align * align;
+    }
+    stream->used = (int)(at + bytes - start);
+    stream->bytes += bytes;
+    *offset = (GLintptr)at;
+    return stream->memory + at;
+}
+
+static inline void stream_unused(StreamBuffer *stream, int bytes)
+{
+    // Gives back the last bytes of the last stream_alloc(), when fewer were written than it asked
+    // for (the next stream_alloc() starts there instead).
+    stream->used -= bytes;
+    stream->bytes -= bytes;
+}
+
+static inline void stream_end_frame(StreamBuffer *stream)
+{
+    // After the frame's last draw: the next frame writes into the next region.
+    if (!stream->memory) return;
+    stream_next_region(stream);
+    stream->frames++;
+}
+
+static inline void stream_report(const StreamBuffer *stream, FILE *out, const char *name)
+{
+    if (!stream->memory || stream->frames == 0) return;
+    fprintf(out, "%s: %.1f KB per frame in %d regions of %d KB | %ld fence waits (%.3f ms) | %ld regions filled up early\n",
+            name, stream->bytes / 1024.0 / stream->frames, STREAM_REGIONS, stream->region_size / 1024,
+            stream->fence_waits, stream->wait_ms, stream->early);
+}
+
+static inline void stream_shutdown(StreamBuffer *stream)
+{
+    int i;
+    if (!stream->memory) return;
+    for (i = 0; i < STREAM_REGIONS; i++)
+        if (stream->fences[i]) glDeleteSync(stream->fences[i]);
+    glBindBuffer(stream->target, stream->buffer);
+    glUnmapBuffer(stream->target);
+    glBindBuffer(stream->target, 0);
+    glDeleteBuffers(1, &stream->buffer);
+    memset(stream, 0, sizeof(*stream));
+}
+
+#endif
@@ -0,0 +1,829 @@
+#ifndef COMMON_SWR_H
+#define COMMON_SWR_H
+
+/*
+- ***** A Note on the Software Rasterizer *****
+  This is a small OpenGL of our own, running on the CPU: it understands the fixed-function calls
+  the tutorials make (common/gl_dispatch.h) and draws into a framebuffer in plain memory.
+  Selected with --backend sw (see common/app.h). How it works:
+  1. glVertex: every vertex is multiplied by Projection * ModelView right away ("clip space")
+     and stored with the current color.
+  2. glEnd: the vertices become triangles (a quad is 2 triangles, a polygon a "fan" of them).
+     Triangles that stick out in front of zNear or behind zFar are cut off ("clipped"), then
+     divided by w and mapped to pixels by the viewport.
+  3. Binning: the screen is cut into tiles of 64x64 pixels. Each triangle is not drawn yet,
+     it is only added to the list ("bin") of every tile its bounding box touches. glClear adds
+     a clear command to every bin the same way, so the order of everything stays the same.
+  4. When the frame is done (swr_finish(), called by app_swap_buffers()) all threads grab
+     tiles one by one and draw the bin of their tile. Two tiles never share a pixel, so the
+     threads never have to wait for each other, and a 64x64 tile of color + depth (32 KB)
+     stays in the CPU's cache while all its triangles are drawn.
+  5. Drawing a triangle in a tile uses "edge functions": for each of the 3 edges,
+     E(x, y) = A*x + B*y + C is > 0 on the inside and < 0 on the outside of the edge, so a pixel
+     is in the triangle when all 3 are > 0. The three values also give the pixel's position
+     inside the triangle (barycentric coordinates) to interpolate depth and color. E is the
+     same formula for every pixel of a row, so we test 4 (SSE) or 8 (AVX2) pixels at once with
+     SIMD, and only over the part of the row where E = 0 says the triangle can be.
+  6. Depth test like glEnable(GL_DEPTH_TEST) with OpenGL's defaults: a pixel is only drawn if
+     its depth is LESS than what's in the depth buffer (glDepthFunc(GL_LESS)), the depth
+     buffer is cleared to 1 (glClearDepth(1)) and only written while the test is on.
+  Pixels that lie exactly on an edge shared by two triangles go to exactly one of them (a "tie
+  rule"), so there are no gaps and no pixel is drawn twice.
+
+  Note: Only triangles, quads and polygons are supported (no points or lines), and colors
+        are interpolated the way glShadeModel(GL_SMOOTH) does (with perspective correction).
+  Note: Threads are POSIX threads (pthreads). Linux and macOS have them, on Windows MinGW
+        comes with them (winpthreads).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include "gl_dispatch.h"
+#include "vmath.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define SWR_TILE_SIZE 64
+#define SWR_MAX_THREADS 64
+#define SWR_STACK_DEPTH 32 // glPushMatrix levels per matrix (what Mesa allows)
+#define SWR_CLEAR_BIT 0x80000000u // a bin entry with this bit is a clear command, otherwise a triangle
+
+/* ***** SIMD helpers ***** */
+
+// The pixel loop is written once with these, for SWR_LANES pixels at a time. swr_f holds floats,
+// swr_i 32-bit integers (packed RGBA colors) and swr_m a mask (which lanes are "true").
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SWR_LANES 8
+#define SWR_SIMD_NAME "AVX2"
+typedef __m256 swr_f;
+typedef __m256i swr_i;
+typedef __m256 swr_m;
+#define swr_set1(a) _mm256_set1_ps(a)
+#define swr_add(a, b) _mm256_add_ps(a, b)
+#define swr_sub(a, b) _mm256_sub_ps(a, b)
+#define swr_mul(a, b) _mm256_mul_ps(a, b)
+#define swr_div(a, b) _mm256_div_ps(a, b)
+#define swr_min(a, b) _mm256_min_ps(a, b)
+#define swr_max(a, b) _mm256_max_ps(a, b)
+#define swr_gt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define swr_ge(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define swr_lt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define swr_le(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define swr_and(a, b) _mm256_and_ps(a, b)
+#define swr_any(m) _mm256_movemask_ps(m)
+#define swr_lane_index() _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)
+#define swr_loadf(p) _mm256_loadu_ps(p)
+#define swr_storef(p, a) _mm256_storeu_ps(p, a)
+#define swr_blendf(old, new, m) _mm256_blendv_ps(old, new, m)
+#define swr_to_int(a) _mm256_cvttps_epi32(a)
+#define swr_rgba(r, g, b) _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), \
+                                          _mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_set1_epi32((int)0xff000000u)))
+#define swr_seti(a) _mm256_set1_epi32((int)(a))
+#define swr_loadi(p) _mm256_loadu_si256((const __m256i *)(p))
+#define swr_storei(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+#define swr_blendi(old, new, m) _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(old), _mm256_castsi256_ps(new), m))
+#elif defined(VMATH_SSE)
+#define SWR_LANES 4
+#define SWR_SIMD_NAME "SSE2"
+typedef __m128 swr_f;
+typedef __m128i swr_i;
+typedef __m128 swr_m;
+#define swr_set1(a) _mm_set1_ps(a)
+#define swr_add(a, b) _mm_add_ps(a, b)
+#define swr_sub(a, b) _mm_sub_ps(a, b)
+#define swr_mul(a, b) _mm_mul_ps(a, b)
+#define swr_div(a, b) _mm_div_ps(a, b)
+#define swr_min(a, b) _mm_min_ps(a, b)
+#define swr_max(a, b) _mm_max_ps(a, b)
+#define swr_gt(a, b) _mm_cmpgt_ps(a, b)
+#define swr_ge(a, b) _mm_cmpge_ps(a, b)
+#define swr_lt(a, b) _mm_cmplt_ps(a, b)
+#define swr_le(a, b) _mm_cmple_ps(a, b)
+#define swr_and(a, b) _mm_and_ps(a, b)
+#define swr_any(m) _mm_movemask_ps(m)
+#define swr_lane_index() _mm_setr_ps(0, 1, 2, 3)
+#define swr_loadf(p) _mm_loadu_ps(p)
+#define swr_storef(p, a) _mm_storeu_ps(p, a)
+#define swr_blendf(old, new, m) _mm_or_ps(_mm_and_ps(m, new), _mm_andnot_ps(m, old)) // (SSE2 has no blend)
+#define swr_to_int(a) _mm_cvttps_epi32(a)
+#define swr_rgba(r, g, b) _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), \
+                                       _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32((int)0xff000000u)))
+#define swr_seti(a) _mm_set1_epi32((int)(a))
+#define swr_loadi(p) _mm_loadu_si128((const __m128i *)(p))
+#define swr_storei(p, a) _mm_storeu_si128((__m128i *)(p), a)
+#define swr_blendi(old, new, m) _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), new), _mm_andnot_si128(_mm_castps_si128(m), old))
+#else
+// No SIMD (eg ARM): one pixel at a time, a mask is just 0 or 1.
+#define SWR_LANES 1
+#define SWR_SIMD_NAME "scalar"
+typedef float swr_f;
+typedef uint32_t swr_i;
+typedef int swr_m;
+#define swr_set1(a) ((float)(a))
+#define swr_add(a, b) ((a) + (b))
+#define swr_sub(a, b) ((a) - (b))
+#define swr_mul(a, b) ((a) * (b))
+#define swr_div(a, b) ((a) / (b))
+#define swr_min(a, b) ((a) < (b) ? (a) : (b))
+#define swr_max(a, b) ((a) > (b) ? (a) : (b))
+#define swr_gt(a, b) ((a) > (b))
+#define swr_ge(a, b) ((a) >= (b))
+#define swr_lt(a, b) ((a) < (b))
+#define swr_le(a, b) ((a) <= (b))
+#define swr_and(a, b) ((a) & (b))
+#define swr_any(m) (m)
+#define swr_lane_index() 0.0f
+#define swr_loadf(p) (*(p))
+#define swr_storef(p, a) (*(p) = (a))
+#define swr_blendf(old, new, m) ((m) ? (new) : (old))
+#define swr_to_int(a) ((uint32_t)(int)(a))
+#define swr_rgba(r, g, b) ((r) | ((g) << 8) | ((b) << 16) | 0xff000000u)
+#define swr_seti(a) ((uint32_t)(a))
+#define swr_loadi(p) (*(p))
+#define swr_storei(p, a) (*(p) = (a))
+#define swr_blendi(old, new, m) ((m) ? (new) : (old))
+#endif
+
+/* ***** State ***** */
+
+typedef struct SwrVertex
+{
+    vec4 clip;      // position after Projection * ModelView
+    float color[3];
+} SwrVertex;
+
+typedef struct SwrTriangle
+{
+    // Edge k goes between the two vertices that aren't vertex k, and E_k / (E_0 + E_1 + E_2) is
+    // how much of vertex k a pixel gets. E_k(x, y) = A*(x - anchor_x) + B*(y - anchor_y).
+    float a[3], b[3], anchor_x[3], anchor_y[3];
+    int inclusive[3];            // tie rule: pixels with E_k exactly 0 belong to this triangle
+    float inv_area;              // 1 / (E_0 + E_1 + E_2), the same for every pixel
+    float z[3];                  // depth of vertex 0, then the differences vertex 1 - 0 and 2 - 0
+    float inv_w[3];              // 1/w the same way (for perspective correct colors)
+    float color_w[3][3];         // color/w the same way, [channel][...]
+    uint32_t flat_color;         // all 3 vertices have this color (then nothing needs interpolating)
+    int flat;
+    int depth_test;
+    int min_x, min_y, max_x, max_y; // pixels, inclusive, inside the viewport
+} SwrTriangle;
+
+typedef struct SwrClear
+{
+    GLbitfield mask;
+    uint32_t color;
+} SwrClear;
+
+typedef struct SwrBin
+{
+    uint32_t *entries;           // triangle indices or SWR_CLEAR_BIT | clear index, in call order
+    int count, capacity;
+} SwrBin;
+
+typedef struct SwrContext
+{
+    // framebuffer: rows go bottom to top like in OpenGL, every row is "stride" pixels long
+    // (the width rounded up to whole tiles, so the SIMD loop never has to stop in the middle of one)
+    int width, height, stride;
+    uint32_t *color;             // RGBA, 8 bits each (the byte order glReadPixels(GL_RGBA) gives)
+    float *depth;
+    int tiles_x, tiles_y;
+    SwrBin *bins;
+
+    // OpenGL state
+    int viewport[4];
+    mat4 modelview, projection, mvp;
+    mat4 stacks[2][SWR_STACK_DEPTH]; // what glPushMatrix saved: [0] modelview, [1] projection
+    int stack_depth[2];
+    GLenum matrix_mode;
+    int mvp_dirty;
+    float clear_color[4];
+    float current_color[3];
+    int depth_test;
+
+    // glBegin/glEnd
+    GLenum primitive;
+    SwrVertex *vertices;
+    int vertex_count, vertex_capacity;
+
+    // what's waiting to be drawn
+    SwrTriangle *triangles;
+    int triangle_count, triangle_capacity;
+    SwrClear *clears;
+    int clear_count, clear_capacity;
+
+    // threads
+    int thread_count;            // including the main thread
+    pthread_t threads[SWR_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int generation;              // +1 for every swr_finish(), wakes the workers up
+    int workers_done;
+    int quit;
+    volatile int next_tile;      // the next tile nobody took yet
+
+    // statistics
+    long triangles_drawn;
+    long bin_entries;
+} SwrContext;
+
+static SwrContext swr;
+
+static inline int swr_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static inline void *swr_grow(void *array, int *capacity, int needed, size_t item_size)
+{
+    // Makes room for "needed" items (doubling, so appending is cheap on average).
+    if (needed <= *capacity) return array;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+    {
+        fprintf(stderr, "software rasterizer: out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+/* ***** Drawing a tile (runs on every thread) ***** */
+
+static inline swr_m swr_edge_test(swr_f e, int inclusive)
+{
+    return inclusive ? swr_ge(e, swr_set1(0)) : swr_gt(e, swr_set1(0));
+}
+
+static inline void swr_draw_triangle_in_tile(const SwrTriangle *t, int tile_x0, int tile_y0, int tile_x1, int tile_y1)
+{
+    // Draws the part of triangle t that lies in the tile [tile_x0, tile_x1) x [tile_y0, tile_y1).
+    int min_x = t->min_x > tile_x0 ? t->min_x : tile_x0;
+    int max_x = t->max_x < tile_x1 - 1 ? t->max_x : tile_x1 - 1;
+    int min_y = t->min_y > tile_y0 ? t->min_y : tile_y0;
+    int max_y = t->max_y < tile_y1 - 1 ? t->max_y : tile_y1 - 1;
+    swr_f lanes = swr_lane_index(), first = swr_set1(min_x + 0.5f), last = swr_set1(max_x + 0.5f);
+    swr_f inv_area = swr_set1(t->inv_area);
+    swr_f a[3], anchor_x[3];
+    int k, x, y;
+    if (min_x > max_x || min_y > max_y) return;
+    for (k = 0; k < 3; k++)
+    {
+        a[k] = swr_set1(t->a[k]);
+        anchor_x[k] = swr_set1(t->anchor_x[k]);
+    }
+
+    for (y = min_y; y <= max_y; y++)
+    {
+        uint32_t *color_row = swr.color + (size_t)y * swr.stride;
+        float *depth_row = swr.depth + (size_t)y * swr.stride;
+        float row[3], lo = (float)min_x, hi = (float)max_x;
+        swr_f row_e[3], px;
+        int start_x;
+        for (k = 0; k < 3; k++)
+        {
+            // E_k = A*(x - anchor_x) + row_k on this row. E_k is 0 at x = anchor_x - row_k / A, which
+            // bounds the row's span from the left (A > 0) or the right (A < 0). The span gets one
+            // pixel extra on both sides, the edge test below decides the exact pixels.
+            row[k] = t->b[k] * (y + 0.5f - t->anchor_y[k]);
+            row_e[k] = swr_set1(row[k]);
+            if (t->a[k] > 0) lo = fmaxf(lo, t->anchor_x[k] - row[k] / t->a[k] - 1.5f);
+            else if (t->a[k] < 0) hi = fminf(hi, t->anchor_x[k] - row[k] / t->a[k] + 0.5f);
+            else if (row[k] < 0) lo = hi + 1; // a horizontal edge with the row on its outside
+        }
+        if (lo > hi) continue;
+        start_x = (int)ceilf(lo);
+        start_x -= (start_x - tile_x0) % SWR_LANES; // tiles start at a multiple of SWR_LANES
+        px = swr_add(swr_set1(start_x + 0.5f), lanes);
+        for (x = start_x; x <= (int)hi; x += SWR_LANES, px = swr_add(px, swr_set1(SWR_LANES)))
+        {
+            // Every E is computed the same way from the anchor (not by adding A pixel after pixel),
+            // so the two triangles of a shared edge get exactly opposite values.
+            swr_f e[3];
+            swr_m inside;
+            for (k = 0; k < 3; k++) e[k] = swr_add(swr_mul(a[k], swr_sub(px, anchor_x[k])), row_e[k]);
+            inside = swr_and(swr_and(swr_edge_test(e[0], t->inclusive[0]), swr_edge_test(e[1], t->inclusive[1])),
+                                   swr_edge_test(e[2], t->inclusive[2]));
+            inside = swr_and(inside, swr_and(swr_ge(px, first), swr_le(px, last))); // (lanes outside the bounding box)
+            if (swr_any(inside))
+            {
+                swr_f l1 = swr_mul(e[1], inv_area), l2 = swr_mul(e[2], inv_area);
+                swr_i old_color = swr_loadi(color_row + x), new_color;
+                if (t->depth_test)
+                {
+                    swr_f z = swr_add(swr_set1(t->z[0]), swr_add(swr_mul(l1, swr_set1(t->z[1])), swr_mul(l2, swr_set1(t->z[2]))));
+                    swr_f old_depth = swr_loadf(depth_row + x);
+                    inside = swr_and(inside, swr_lt(z, old_depth));
+                    swr_storef(depth_row + x, swr_blendf(old_depth, z, inside));
+                }
+                if (t->flat) new_color = swr_seti(t->flat_color);
+                else
+                {
+                    // color/w and 1/w change linearly over the screen, color itself doesn't (perspective)
+                    swr_f w = swr_div(swr_set1(1), swr_add(swr_set1(t->inv_w[0]),
+                                      swr_add(swr_mul(l1, swr_set1(t->inv_w[1])), swr_mul(l2, swr_set1(t->inv_w[2])))));
+                    swr_i channel[3];
+                    int c;
+                    for (c = 0; c < 3; c++)
+                    {
+                        swr_f v = swr_add(swr_set1(t->color_w[c][0]), swr_add(swr_mul(l1, swr_set1(t->color_w[c][1])),
+                                                                             swr_mul(l2, swr_set1(t->color_w[c][2]))));
+                        v = swr_min(swr_max(swr_mul(v, w), swr_set1(0)), swr_set1(1));
+                        channel[c] = swr_to_int(swr_add(swr_mul(v, swr_set1(255)), swr_set1(0.5f)));
+                    }
+                    new_color = swr_rgba(channel[0], channel[1], channel[2]);
+                }
+                swr_storei(color_row + x, swr_blendi(old_color, new_color, inside));
+            }
+        }
+    }
+}
+
+static inline void swr_clear_tile(const SwrClear *clear, int x0, int y0, int x1, int y1)
+{
+    int x, y;
+    for (y = y0; y < y1; y++)
+    {
+        if (clear->mask & GL_COLOR_BUFFER_BIT)
+        {
+            uint32_t *row = swr.color + (size_t)y * swr.stride;
+            for (x = x0; x < x1; x++) row[x] = clear->color;
+        }
+        if (clear->mask & GL_DEPTH_BUFFER_BIT)
+        {
+            float *row = swr.depth + (size_t)y * swr.stride;
+            for (x = x0; x < x1; x++) row[x] = 1.0f;
+        }
+    }
+}
+
+static inline void swr_draw_tile(int tile)
+{
+    const SwrBin *bin = &swr.bins[tile];
+    int x0 = (tile % swr.tiles_x) * SWR_TILE_SIZE, y0 = (tile / swr.tiles_x) * SWR_TILE_SIZE;
+    int x1 = x0 + SWR_TILE_SIZE, y1 = y0 + SWR_TILE_SIZE, i;
+    if (y1 > swr.height) y1 = swr.height;
+    // (x1 may go past the width: those pixels are the row padding, nobody sees them)
+    for (i = 0; i < bin->count; i++)
+    {
+        uint32_t entry = bin->entries[i];
+        if (entry & SWR_CLEAR_BIT) swr_clear_tile(&swr.clears[entry & ~SWR_CLEAR_BIT], x0, y0, x1, y1);
+        else swr_draw_triangle_in_tile(&swr.triangles[entry], x0, y0, x1, y1);
+    }
+}
+
+static inline void swr_draw_tiles(void)
+{
+    // Takes tiles until there are none left. Every thread runs this at the same time.
+    int tile_count = swr.tiles_x * swr.tiles_y, tile;
+    while ((tile = __sync_fetch_and_add(&swr.next_tile, 1)) < tile_count)
+        if (swr.bins[tile].count > 0) swr_draw_tile(tile);
+}
+
+static inline void *swr_worker(void *unused)
+{
+    // A worker thread sleeps until swr_finish() starts a new generation, helps with the tiles,
+    // reports back and goes to sleep again.
+    int seen = 0;
+    (void)unused;
+    for (;;)
+    {
+        pthread_mutex_lock(&swr.lock);
+        while (swr.generation == seen && !swr.quit) pthread_cond_wait(&swr.wake, &swr.lock);
+        seen = swr.generation;
+        if (swr.quit)
+        {
+            pthread_mutex_unlock(&swr.lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&swr.lock);
+
+        swr_draw_tiles();
+
+        pthread_mutex_lock(&swr.lock);
+        if (++swr.workers_done == swr.thread_count - 1) pthread_cond_signal(&swr.done);
+        pthread_mutex_unlock(&swr.lock);
+    }
+}
+
+static inline void swr_finish(void)
+{
+    // Draws everything that was binned since the last call, on all threads (like glFinish()).
+    int tile_count = swr.tiles_x * swr.tiles_y, tile;
+    if (swr.triangle_count == 0 && swr.clear_count == 0) return;
+    swr.next_tile = 0;
+    if (swr.thread_count > 1)
+    {
+        pthread_mutex_lock(&swr.lock);
+        swr.workers_done = 0;
+        swr.generation++;
+        pthread_cond_broadcast(&swr.wake);
+        pthread_mutex_unlock(&swr.lock);
+    }
+    swr_draw_tiles(); // the main thread helps too
+    if (swr.thread_count > 1)
+    {
+        pthread_mutex_lock(&swr.lock);
+        while (swr.workers_done < swr.thread_count - 1) pthread_cond_wait(&swr.done, &swr.lock);
+        pthread_mutex_unlock(&swr.lock);
+    }
+    for (tile = 0; tile < tile_count; tile++) swr.bins[tile].count = 0;
+    swr.triangle_count = 0;
+    swr.clear_count = 0;
+}
+
+/* ***** Setup and binning (main thread) ***** */
+
+static inline void swr_resize(int width, int height)
+{
+    // (Re)allocates the framebuffer. Whatever was drawn so far is finished first.
+    int tile_count = swr.tiles_x * swr.tiles_y, i;
+    swr_finish();
+    for (i = 0; i < tile_count; i++) free(swr.bins[i].entries);
+    free(swr.color);
+    free(swr.depth);
+    swr.width = width;
+    swr.height = height;
+    swr.tiles_x = (width + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+    swr.tiles_y = (height + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+    swr.stride = swr.tiles_x * SWR_TILE_SIZE;
+    swr.color = (uint32_t *)calloc((size_t)swr.stride * height, sizeof(uint32_t));
+    swr.depth = (float *)calloc((size_t)swr.stride * height, sizeof(float));
+    tile_count = swr.tiles_x * swr.tiles_y;
+    swr.bins = (SwrBin *)realloc(swr.bins, sizeof(SwrBin) * (tile_count > 0 ? tile_count : 1));
+    memset(swr.bins, 0, sizeof(SwrBin) * tile_count);
+}
+
+static inline void swr_bin(int tile_x0, int tile_y0, int tile_x1, int tile_y1, uint32_t entry)
+{
+    int tx, ty;
+    for (ty = tile_y0; ty <= tile_y1; ty++)
+        for (tx = tile_x0; tx <= tile_x1; tx++)
+        {
+            SwrBin *bin = &swr.bins[ty * swr.tiles_x + tx];
+            bin->entries = (uint32_t *)swr_grow(bin->entries, &bin->capacity, bin->count + 1, sizeof(uint32_t));
+            bin->entries[bin->count++] = entry;
+            swr.bin_entries++;
+        }
+}
+
+static inline uint32_t swr_pack_color(const float *rgb, float alpha)
+{
+    uint32_t c[4];
+    float v[4];
+    int i;
+    v[0] = rgb[0]; v[1] = rgb[1]; v[2] = rgb[2]; v[3] = alpha;
+    for (i = 0; i < 4; i++) c[i] = (uint32_t)((v[i] < 0 ? 0 : v[i] > 1 ? 1 : v[i]) * 255 + 0.5f);
+    return c[0] | (c[1] << 8) | (c[2] << 16) | (c[3] << 24);
+}
+
+static inline void swr_setup_triangle(const SwrVertex *v0, const SwrVertex *v1, const SwrVertex *v2)
+{
+    // Turns a clipped triangle into screen space edge functions and bins it.
+    const SwrVertex *v[3];
+    float sx[3], sy[3], sz[3], inv_w[3], area, min_x, max_x, min_y, max_y;
+    float vx = (float)swr.viewport[0], vy = (float)swr.viewport[1];
+    float vw = (float)swr.viewport[2], vh = (float)swr.viewport[3];
+    SwrTriangle *t;
+    int k, c;
+
+    v[0] = v0; v[1] = v1; v[2] = v2;
+    for (k = 0; k < 3; k++)
+    {
+        // perspective divide, then the viewport transform (and depth from [-1, 1] to [0, 1])
+        inv_w[k] = 1.0f / v[k]->clip.w;
+        sx[k] = vx + (v[k]->clip.x * inv_w[k] + 1) * 0.5f * vw;
+        sy[k] = vy + (v[k]->clip.y * inv_w[k] + 1) * 0.5f * vh;
+        sz[k] = v[k]->clip.z * inv_w[k] * 0.5f + 0.5f;
+    }
+    area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]); // twice the area, > 0 if counterclockwise
+    if (!(area != 0) || !isfinite(area)) return; // (degenerate, a line or a point: nothing to draw)
+    if (area < 0)
+    {
+        // Clockwise: swap two vertices so the inside is where all E_k > 0. (Without glCullFace
+        // both sides of a triangle get drawn.)
+        const SwrVertex *tv = v[1]; float tf;
+        v[1] = v[2]; v[2] = tv;
+        tf = sx[1]; sx[1] = sx[2]; sx[2] = tf;
+        tf = sy[1]; sy[1] = sy[2]; sy[2] = tf;
+        tf = sz[1]; sz[1] = sz[2]; sz[2] = tf;
+        tf = inv_w[1]; inv_w[1] = inv_w[2]; inv_w[2] = tf;
+        area = -area;
+    }
+
+    min_x = fminf(sx[0], fminf(sx[1], sx[2])); max_x = fmaxf(sx[0], fmaxf(sx[1], sx[2]));
+    min_y = fminf(sy[0], fminf(sy[1], sy[2])); max_y = fmaxf(sy[0], fmaxf(sy[1], sy[2]));
+    // only the pixels inside the viewport (and the framebuffer)
+    min_x = fmaxf(min_x, vx); max_x = fminf(max_x, fminf(vx + vw, (float)swr.width) - 0.5f);
+    min_y = fmaxf(min_y, vy); max_y = fminf(max_y, fminf(vy + vh, (float)swr.height) - 0.5f);
+    if (min_x > max_x || min_y > max_y) return;
+
+    swr.triangles = (SwrTriangle *)swr_grow(swr.triangles, &swr.triangle_capacity, swr.triangle_count + 1, sizeof(SwrTriangle));
+    t = &swr.triangles[swr.triangle_count];
+    t->min_x = (int)floorf(min_x); t->max_x = (int)floorf(max_x);
+    t->min_y = (int)floorf(min_y); t->max_y = (int)floorf(max_y);
+
+    for (k = 0; k < 3; k++)
+    {
+        // edge k goes from vertex (k+1)%3 to vertex (k+2)%3
+        int from = (k + 1) % 3, to = (k + 2) % 3, anchor;
+        float dx = sx[to] - sx[from], dy = sy[to] - sy[from];
+        t->a[k] = -dy;
+        t->b[k] = dx;
+        // Both triangles sharing an edge use the same end of it as anchor, so their E values are
+        // exactly the negative of each other and the tie rule below can't give a pixel to both or neither.
+        anchor = (sy[from] < sy[to] || (sy[from] == sy[to] && sx[from] < sx[to])) ? from : to;
+        t->anchor_x[k] = sx[anchor];
+        t->anchor_y[k] = sy[anchor];
+        t->inclusive[k] = dy > 0 || (dy == 0 && dx < 0);
+    }
+    t->inv_area = 1.0f / area;
+    t->z[0] = sz[0]; t->z[1] = sz[1] - sz[0]; t->z[2] = sz[2] - sz[0];
+    t->inv_w[0] = inv_w[0]; t->inv_w[1] = inv_w[1] - inv_w[0]; t->inv_w[2] = inv_w[2] - inv_w[0];
+    for (c = 0; c < 3; c++)
+    {
+        float c0 = v[0]->color[c] * inv_w[0], c1 = v[1]->color[c] * inv_w[1], c2 = v[2]->color[c] * inv_w[2];
+        t->color_w[c][0] = c0; t->color_w[c][1] = c1 - c0; t->color_w[c][2] = c2 - c0;
+    }
+    t->flat = memcmp(v[0]->color, v[1]->color, sizeof(v[0]->color)) == 0 && memcmp(v[0]->color, v[2]->color, sizeof(v[0]->color)) == 0;
+    t->flat_color = swr_pack_color(v[0]->color, 1);
+    t->depth_test = swr.depth_test;
+
+    swr_bin(t->min_x / SWR_TILE_SIZE, t->min_y / SWR_TILE_SIZE, t->max_x / SWR_TILE_SIZE, t->max_y / SWR_TILE_SIZE,
+            (uint32_t)swr.triangle_count);
+    swr.triangle_count++;
+    swr.triangles_drawn++;
+}
+
+static inline int swr_clip_plane(const SwrVertex *in, int count, SwrVertex *out, float sign)
+{
+    // Sutherland-Hodgman: keeps the part of the polygon where w + sign * z >= 0
+    // (sign 1: in front of zNear is cut, sign -1: behind zFar is cut).
+    int i, out_count = 0;
+    for (i = 0; i < count; i++)
+    {
+        const SwrVertex *a = &in[i], *b = &in[(i + 1) % count];
+        float da = a->clip.w + sign * a->clip.z, db = b->clip.w + sign * b->clip.z;
+        if (da >= 0) out[out_count++] = *a;
+        if ((da >= 0) != (db >= 0))
+        {
+            // the edge crosses the plane: add the point where it does
+            float t = da / (da - db);
+            SwrVertex *p = &out[out_count++];
+            p->clip.x = a->clip.x + (b->clip.x - a->clip.x) * t;
+            p->clip.y = a->clip.y + (b->clip.y - a->clip.y) * t;
+            p->clip.z = a->clip.z + (b->clip.z - a->clip.z) * t;
+            p->clip.w = a->clip.w + (b->clip.w - a->clip.w) * t;
+            p->color[0] = a->color[0] + (b->color[0] - a->color[0]) * t;
+            p->color[1] = a->color[1] + (b->color[1] - a->color[1]) * t;
+            p->color[2] = a->color[2] + (b->color[2] - a->color[2]) * t;
+        }
+    }
+    return out_count;
+}
+
+static inline void swr_triangle(const SwrVertex *v0, const SwrVertex *v1, const SwrVertex *v2)
+{
+    // Clips against zNear and zFar if needed, then sets up the (1 to 3) resulting triangles.
+    // Left, right, top and bottom don't need clipping, the bounding box takes care of those.
+    SwrVertex polygon[5], clipped[5];
+    int count = 3, i;
+    int outside_near = (v0->clip.z < -v0->clip.w) + (v1->clip.z < -v1->clip.w) + (v2->clip.z < -v2->clip.w);
+    int outside_far = (v0->clip.z > v0->clip.w) + (v1->clip.z > v1->clip.w) + (v2->clip.z > v2->clip.w);
+    if (outside_near == 0 && outside_far == 0)
+    {
+        swr_setup_triangle(v0, v1, v2);
+        return;
+    }
+    if (outside_near == 3 || outside_far == 3) return;
+    polygon[0] = *v0; polygon[1] = *v1; polygon[2] = *v2;
+    if (outside_near)
+    {
+        count = swr_clip_plane(polygon, count, clipped, 1);
+        memcpy(polygon, clipped, sizeof(SwrVertex) * count);
+    }
+    if (outside_far)
+    {
+        count = swr_clip_plane(polygon, count, clipped, -1);
+        memcpy(polygon, clipped, sizeof(SwrVertex) * count);
+    }
+    for (i = 2; i < count; i++) swr_setup_triangle(&polygon[0], &polygon[i - 1], &polygon[i]);
+}
+
+/* ***** The OpenGL functions (what gl_dispatch points to with --backend sw) ***** */
+
+static void APIENTRY swr_gl_Clear(GLbitfield mask)
+{
+    SwrClear *clear;
+    mask &= GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+    if (!mask || swr.tiles_x * swr.tiles_y == 0) return;
+    swr.clears = (SwrClear *)swr_grow(swr.clears, &swr.clear_capacity, swr.clear_count + 1, sizeof(SwrClear));
+    clear = &swr.clears[swr.clear_count];
+    clear->mask = mask;
+    clear->color = swr_pack_color(swr.clear_color, swr.clear_color[3]);
+    swr_bin(0, 0, swr.tiles_x - 1, swr.tiles_y - 1, SWR_CLEAR_BIT | (uint32_t)swr.clear_count++);
+}
+
+static void APIENTRY swr_gl_ClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    swr.clear_color[0] = red; swr.clear_color[1] = green; swr.clear_color[2] = blue; swr.clear_color[3] = alpha;
+}
+
+static void APIENTRY swr_gl_Enable(GLenum cap)
+{
+    if (cap == GL_DEPTH_TEST) swr.depth_test = 1;
+}
+
+static void APIENTRY swr_gl_Disable(GLenum cap)
+{
+    if (cap == GL_DEPTH_TEST) swr.depth_test = 0;
+}
+
+static void APIENTRY swr_gl_Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    // The framebuffer follows the viewport (the tutorials always set it to the whole window).
+    swr.viewport[0] = x; swr.viewport[1] = y; swr.viewport[2] = width; swr.viewport[3] = height;
+    if (x + width != swr.width || y + height != swr.height) swr_resize(x + width, y + height);
+}
+
+static inline mat4 *swr_current_matrix(void)
+{
+    swr.mvp_dirty = 1;
+    return swr.matrix_mode == GL_PROJECTION ? &swr.projection : &swr.modelview;
+}
+
+static inline void swr_multiply(mat4 m)
+{
+    mat4 *current = swr_current_matrix();
+    *current = mat4_mul(current, &m);
+}
+
+static void APIENTRY swr_gl_MatrixMode(GLenum mode) { swr.matrix_mode = mode; }
+static void APIENTRY swr_gl_LoadIdentity(void) { *swr_current_matrix() = mat4_identity(); }
+static void APIENTRY swr_gl_LoadMatrixf(const GLfloat *m) { memcpy(swr_current_matrix()->m, m, sizeof(float) * 16); }
+static void APIENTRY swr_gl_Translatef(GLfloat x, GLfloat y, GLfloat z) { swr_multiply(mat4_translate(x, y, z)); }
+static void APIENTRY swr_gl_Rotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z) { swr_multiply(mat4_rotate(angle, x, y, z)); }
+static void APIENTRY swr_gl_Scalef(GLfloat x, GLfloat y, GLfloat z) { swr_multiply(mat4_scale(x, y, z)); }
+
+static void APIENTRY swr_gl_PushMatrix(void)
+{
+    // (a full stack ignores the call, like OpenGL does with GL_STACK_OVERFLOW)
+    int which = swr.matrix_mode == GL_PROJECTION;
+    if (swr.stack_depth[which] < SWR_STACK_DEPTH) swr.stacks[which][swr.stack_depth[which]++] = *swr_current_matrix();
+}
+
+static void APIENTRY swr_gl_PopMatrix(void)
+{
+    int which = swr.matrix_mode == GL_PROJECTION;
+    if (swr.stack_depth[which] > 0) *swr_current_matrix() = swr.stacks[which][--swr.stack_depth[which]];
+}
+
+static void APIENTRY swr_glu_Perspective(GLdouble fovy, GLdouble aspect, GLdouble z_near, GLdouble z_far)
+{
+    swr_multiply(mat4_perspective((float)fovy, (float)aspect, (float)z_near, (float)z_far));
+}
+
+static void APIENTRY swr_glu_Ortho2D(GLdouble left, GLdouble right, GLdouble bottom, GLdouble top)
+{
+    swr_multiply(mat4_ortho2d((float)left, (float)right, (float)bottom, (float)top));
+}
+
+static void APIENTRY swr_gl_Color3f(GLfloat red, GLfloat green, GLfloat blue)
+{
+    swr.current_color[0] = red; swr.current_color[1] = green; swr.current_color[2] = blue;
+}
+
+static void APIENTRY swr_gl_Begin(GLenum mode)
+{
+    swr.primitive = mode;
+    swr.vertex_count = 0;
+    if (swr.mvp_dirty)
+    {
+        swr.mvp = mat4_mul(&swr.projection, &swr.modelview);
+        swr.mvp_dirty = 0;
+    }
+}
+
+static void APIENTRY swr_gl_Vertex3f(GLfloat x, GLfloat y, GLfloat z)
+{
+    SwrVertex *v;
+    vec4 position;
+    swr.vertices = (SwrVertex *)swr_grow(swr.vertices, &swr.vertex_capacity, swr.vertex_count + 1, sizeof(SwrVertex));
+    v = &swr.vertices[swr.vertex_count++];
+    position.x = x; position.y = y; position.z = z; position.w = 1;
+    v->clip = mat4_mul_vec4(&swr.mvp, position);
+    memcpy(v->color, swr.current_color, sizeof(v->color));
+}
+
+static void APIENTRY swr_gl_Vertex2f(GLfloat x, GLfloat y) { swr_gl_Vertex3f(x, y, 0); }
+
+static void APIENTRY swr_gl_End(void)
+{
+    // Cuts what came since glBegin into triangles.
+    const SwrVertex *v = swr.vertices;
+    int n = swr.vertex_count, i;
+    static int warned;
+    switch (swr.primitive)
+    {
+        case GL_TRIANGLES:
+            for (i = 2; i < n; i += 3) swr_triangle(&v[i - 2], &v[i - 1], &v[i]);
+            break;
+        case GL_TRIANGLE_STRIP:
+            for (i = 2; i < n; i++) swr_triangle(&v[i - 2], &v[i - 1], &v[i]);
+            break;
+        case GL_TRIANGLE_FAN:
+        case GL_POLYGON:
+            for (i = 2; i < n; i++) swr_triangle(&v[0], &v[i - 1], &v[i]);
+            break;
+        case GL_QUADS:
+            for (i = 3; i < n; i += 4)
+            {
+                swr_triangle(&v[i - 3], &v[i - 2], &v[i - 1]);
+                swr_triangle(&v[i - 3], &v[i - 1], &v[i]);
+            }
+            break;
+        case GL_QUAD_STRIP:
+            for (i = 3; i < n; i += 2)
+            {
+                swr_triangle(&v[i - 3], &v[i - 2], &v[i]);
+                swr_triangle(&v[i - 3], &v[i], &v[i - 1]);
+            }
+            break;
+        default:
+            if (!warned) fprintf(stderr, "software rasterizer: only triangles, quads and polygons are drawn\n");
+            warned = 1;
+            break;
+    }
+    swr.vertex_count = 0;
+}
+
+static const GLDispatch swr_dispatch =
+{
+    swr_gl_Clear, swr_gl_ClearColor, swr_gl_Enable, swr_gl_Disable, swr_gl_Viewport, swr_gl_MatrixMode,
+    swr_gl_LoadIdentity, swr_gl_LoadMatrixf, swr_gl_Translatef, swr_gl_Rotatef, swr_gl_Scalef, swr_gl_PushMatrix,
+    swr_gl_PopMatrix, swr_gl_Begin, swr_gl_End, swr_gl_Vertex2f, swr_gl_Vertex3f, swr_gl_Color3f, swr_glu_Perspective,
+    swr_glu_Ortho2D
+};
+
+/* ***** Start/stop ***** */
+
+static inline void swr_init(int thread_count)
+{
+    // Starts the rasterizer with thread_count threads in total (0 = one per CPU core).
+    int i;
+    memset(&swr, 0, sizeof(swr));
+    swr.modelview = swr.projection = swr.mvp = mat4_identity();
+    swr.matrix_mode = GL_MODELVIEW;
+    swr.current_color[0] = swr.current_color[1] = swr.current_color[2] = 1; // OpenGL's initial color is white
+    swr.thread_count = thread_count > 0 ? thread_count : swr_cpu_count();
+    if (swr.thread_count > SWR_MAX_THREADS) swr.thread_count = SWR_MAX_THREADS;
+    pthread_mutex_init(&swr.lock, NULL);
+    pthread_cond_init(&swr.wake, NULL);
+    pthread_cond_init(&swr.done, NULL);
+    for (i = 1; i < swr.thread_count; i++)
+        if (pthread_create(&swr.threads[i], NULL, swr_worker, NULL) != 0)
+        {
+            fprintf(stderr, "software rasterizer: could only start %d threads\n", i);
+            swr.thread_count = i;
+            break;
+        }
+}
+
+static inline void swr_shutdown(void)
+{
+    int i, tile_count = swr.tiles_x * swr.tiles_y;
+    swr_finish();
+    pthread_mutex_lock(&swr.lock);
+    swr.quit = 1;
+    pthread_cond_broadcast(&swr.wake);
+    pthread_mutex_unlock(&swr.lock);
+    for (i = 1; i < swr.thread_count; i++) pthread_join(swr.threads[i], NULL);
+    for (i = 0; i < tile_count; i++) free(swr.bins[i].entries);
+    free(swr.bins);
+    free(swr.color);
+    free(swr.depth);
+    free(swr.vertices);
+    free(swr.triangles);
+    free(swr.clears);
+    pthread_mutex_destroy(&swr.lock);
+    pthread_cond_destroy(&swr.wake);
+    pthread_cond_destroy(&swr.done);
+}
+
+#endif
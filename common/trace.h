@@ -0,0 +1,477 @@
+#ifndef COMMON_TRACE_H
+#define COMMON_TRACE_H
+
+/*
+- ***** A Note on Call Traces *****
+  Two runs of a demo never draw quite the same frames: timer() moves things when GLUT gets
+  around to calling it, the loop (common/loop.h) moves them by however much real time passed,
+  and a slower machine or build sees other positions than a faster one. Comparing their frame
+  times compares different work.
+
+  A trace fixes the work instead. With --trace-record FILE this layer sits in the dispatch table
+  (common/gl_dispatch.h), in front of everything else (the state cache included), and writes
+  every call the demo makes into FILE, with its arguments, before passing it on. The animation is
+  in there too: every frame's calls carry the positions, angles and colors that frame's update()
+  produced. tools/trace_replay.c then sends the calls of the file to OpenGL again, frame after
+  frame, without running any of the demo's code: the same frames, on any machine, with any build.
+
+  The file:
+    header   "GLTRACE1", width and height (int32), the demo's name (32 chars)
+    calls    one byte saying which call (TRACE_*), then its arguments as they were passed:
+             GLenum/GLbitfield/GLint as 4 bytes, GLfloat as 4, GLdouble (GLU) as 8
+    ...      TRACE_FRAME ends a frame, with the time it ended at (ms since recording started)
+  Everything is in the byte order of the machine that recorded it (little endian everywhere we
+  run). A glVertex3f is 13 bytes, a square with its color 65.
+
+  Calls are collected in memory and written out (and flushed) at the end of every frame, so a
+  recording that gets killed still has all its finished frames.
+
+  Note: Only the calls in the dispatch table are recorded, the same ones --backend sw and core
+        understand. The demos refuse to record the paths that draw from buffer objects.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "gl_dispatch.h"
+#include "clock.h"
+
+#define TRACE_MAGIC "GLTRACE1"
+
+enum
+{
+    TRACE_CLEAR = 1, TRACE_CLEAR_COLOR, TRACE_ENABLE, TRACE_DISABLE, TRACE_VIEWPORT, TRACE_MATRIX_MODE,
+    TRACE_LOAD_IDENTITY, TRACE_LOAD_MATRIX, TRACE_TRANSLATE, TRACE_ROTATE, TRACE_BEGIN, TRACE_END,
+    TRACE_VERTEX2, TRACE_VERTEX3, TRACE_COLOR3, TRACE_PERSPECTIVE, TRACE_ORTHO2D,
+    TRACE_FRAME, TRACE_SCALE, TRACE_PUSH_MATRIX, TRACE_POP_MATRIX, TRACE_OPS // (new calls go last: older files stay readable)
+};
+
+// Bytes of arguments after each call's byte.
+static const int trace_arg_bytes[TRACE_OPS] =
+{
+    -1, 4, 16, 4, 4, 16, 4,
+    0, 64, 12, 16, 4, 0,
+    8, 12, 12, 32, 32,
+    8, 12, 0, 0
+};
+
+typedef struct TraceHeader
+{
+    char magic[8];
+    int32_t width, height;
+    char name[32];
+} TraceHeader;
+
+typedef struct TraceRecorder
+{
+    FILE *file;               // NULL = not recording
+    const char *path;
+    const GLDispatch *next;   // where the calls go after being written down
+    int width, height;
+    int header_written;       // (written with the first frame, when the demo's name is known)
+    unsigned char *buffer;    // this frame's calls
+    size_t used, capacity;
+    uint64_t start_ns;
+    long frames, calls;
+    double bytes;             // written to the file
+} TraceRecorder;
+
+static TraceRecorder trace;
+static GLDispatch trace_dispatch;
+
+static inline unsigned char *trace_put(int op, int arg_bytes)
+{
+    // Room for a call and its arguments at the end of the frame's buffer; returns where the
+    // arguments go.
+    if (trace.used + 1 + arg_bytes > trace.capacity)
+    {
+        trace.capacity = trace.capacity ? trace.capacity * 2 : 65536;
+        trace.buffer = (unsigned char *)realloc(trace.buffer, trace.capacity);
+    }
+    trace.buffer[trace.used] = (unsigned char)op;
+    trace.used += 1 + arg_bytes;
+    trace.calls++;
+    return trace.buffer + trace.used - arg_bytes;
+}
+
+static inline void trace_put_floats(int op, const GLfloat *values, int count)
+{
+    memcpy(trace_put(op, count * 4), values, count * 4);
+}
+
+static inline void trace_put_ints(int op, const GLint *values, int count)
+{
+    memcpy(trace_put(op, count * 4), values, count * 4);
+}
+
+static inline void trace_put_doubles(int op, const GLdouble *values, int count)
+{
+    memcpy(trace_put(op, count * 8), values, count * 8);
+}
+
+// The recording functions: write the call down, then pass it on.
+
+static void APIENTRY trace_Clear(GLbitfield mask)
+{
+    GLint v = (GLint)mask;
+    trace_put_ints(TRACE_CLEAR, &v, 1);
+    trace.next->Clear(mask);
+}
+
+static void APIENTRY trace_ClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    GLfloat v[4];
+    v[0] = red; v[1] = green; v[2] = blue; v[3] = alpha;
+    trace_put_floats(TRACE_CLEAR_COLOR, v, 4);
+    trace.next->ClearColor(red, green, blue, alpha);
+}
+
+static void APIENTRY trace_Enable(GLenum cap)
+{
+    GLint v = (GLint)cap;
+    trace_put_ints(TRACE_ENABLE, &v, 1);
+    trace.next->Enable(cap);
+}
+
+static void APIENTRY trace_Disable(GLenum cap)
+{
+    GLint v = (GLint)cap;
+    trace_put_ints(TRACE_DISABLE, &v, 1);
+    trace.next->Disable(cap);
+}
+
+static void APIENTRY trace_Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint v[4];
+    v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+    trace_put_ints(TRACE_VIEWPORT, v, 4);
+    trace.next->Viewport(x, y, width, height);
+}
+
+static void APIENTRY trace_MatrixMode(GLenum mode)
+{
+    GLint v = (GLint)mode;
+    trace_put_ints(TRACE_MATRIX_MODE, &v, 1);
+    trace.next->MatrixMode(mode);
+}
+
+static void APIENTRY trace_LoadIdentity(void)
+{
+    trace_put(TRACE_LOAD_IDENTITY, 0);
+    trace.next->LoadIdentity();
+}
+
+static void APIENTRY trace_LoadMatrixf(const GLfloat *m)
+{
+    trace_put_floats(TRACE_LOAD_MATRIX, m, 16);
+    trace.next->LoadMatrixf(m);
+}
+
+static void APIENTRY trace_Translatef(GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat v[3];
+    v[0] = x; v[1] = y; v[2] = z;
+    trace_put_floats(TRACE_TRANSLATE, v, 3);
+    trace.next->Translatef(x, y, z);
+}
+
+static void APIENTRY trace_Rotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat v[4];
+    v[0] = angle; v[1] = x; v[2] = y; v[3] = z;
+    trace_put_floats(TRACE_ROTATE, v, 4);
+    trace.next->Rotatef(angle, x, y, z);
+}
+
+static void APIENTRY trace_Scalef(GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat v[3];
+    v[0] = x; v[1] = y; v[2] = z;
+    trace_put_floats(TRACE_SCALE, v, 3);
+    trace.next->Scalef(x, y, z);
+}
+
+static void APIENTRY trace_PushMatrix(void)
+{
+    trace_put(TRACE_PUSH_MATRIX, 0);
+    trace.next->PushMatrix();
+}
+
+static void APIENTRY trace_PopMatrix(void)
+{
+    trace_put(TRACE_POP_MATRIX, 0);
+    trace.next->PopMatrix();
+}
+
+static void APIENTRY trace_Begin(GLenum mode)
+{
+    GLint v = (GLint)mode;
+    trace_put_ints(TRACE_BEGIN, &v, 1);
+    trace.next->Begin(mode);
+}
+
+static void APIENTRY trace_End(void)
+{
+    trace_put(TRACE_END, 0);
+    trace.next->End();
+}
+
+static void APIENTRY trace_Vertex2f(GLfloat x, GLfloat y)
+{
+    GLfloat v[2];
+    v[0] = x; v[1] = y;
+    trace_put_floats(TRACE_VERTEX2, v, 2);
+    trace.next->Vertex2f(x, y);
+}
+
+static void APIENTRY trace_Vertex3f(GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat v[3];
+    v[0] = x; v[1] = y; v[2] = z;
+    trace_put_floats(TRACE_VERTEX3, v, 3);
+    trace.next->Vertex3f(x, y, z);
+}
+
+static void APIENTRY trace_Color3f(GLfloat red, GLfloat green, GLfloat blue)
+{
+    GLfloat v[3];
+    v[0] = red; v[1] = green; v[2] = blue;
+    trace_put_floats(TRACE_COLOR3, v, 3);
+    trace.next->Color3f(red, green, blue);
+}
+
+static void APIENTRY trace_Perspective(GLdouble fovy, GLdouble aspect, GLdouble z_near, GLdouble z_far)
+{
+    GLdouble v[4];
+    v[0] = fovy; v[1] = aspect; v[2] = z_near; v[3] = z_far;
+    trace_put_doubles(TRACE_PERSPECTIVE, v, 4);
+    trace.next->Perspective(fovy, aspect, z_near, z_far);
+}
+
+static void APIENTRY trace_Ortho2D(GLdouble left, GLdouble right, GLdouble bottom, GLdouble top)
+{
+    GLdouble v[4];
+    v[0] = left; v[1] = right; v[2] = bottom; v[3] = top;
+    trace_put_doubles(TRACE_ORTHO2D, v, 4);
+    trace.next->Ortho2D(left, right, bottom, top);
+}
+
+static inline int trace_open(const char *path, int width, int height)
+{
+    // Starts recording into path. Returns 0 if it can't be created.
+    memset(&trace, 0, sizeof(trace));
+    trace.file = fopen(path, "wb");
+    if (!trace.file)
+    {
+        fprintf(stderr, "can't create the trace '%s'\n", path);
+        return 0;
+    }
+    trace.path = path;
+    trace.width = width;
+    trace.height = height;
+    trace.start_ns = clock_now_ns();
+    return 1;
+}
+
+static inline const GLDispatch *trace_install(const GLDispatch *next)
+{
+    // Returns the table to use instead of next: every call is written down first.
+    trace.next = next;
+    trace_dispatch.Clear = trace_Clear;
+    trace_dispatch.ClearColor = trace_ClearColor;
+    trace_dispatch.Enable = trace_Enable;
+    trace_dispatch.Disable = trace_Disable;
+    trace_dispatch.Viewport = trace_Viewport;
+    trace_dispatch.MatrixMode = trace_MatrixMode;
+    trace_dispatch.LoadIdentity = trace_LoadIdentity;
+    trace_dispatch.LoadMatrixf = trace_LoadMatrixf;
+    trace_dispatch.Translatef = trace_Translatef;
+    trace_dispatch.Rotatef = trace_Rotatef;
+    trace_dispatch.Scalef = trace_Scalef;
+    trace_dispatch.PushMatrix = trace_PushMatrix;
+    trace_dispatch.PopMatrix = trace_PopMatrix;
+    trace_dispatch.Begin = trace_Begin;
+    trace_dispatch.End = trace_End;
+    trace_dispatch.Vertex2f = trace_Vertex2f;
+    trace_dispatch.Vertex3f = trace_Vertex3f;
+    trace_dispatch.Color3f = trace_Color3f;
+    trace_dispatch.Perspective = trace_Perspective;
+    trace_dispatch.Ortho2D = trace_Ortho2D;
+    return &trace_dispatch;
+}
+
+static inline void trace_frame_done(const char *name)
+{
+    // Ends the frame (name: the demo's, for the header) and writes its calls to the file.
+    double ms;
+    if (!trace.file) return;
+    if (!trace.header_written)
+    {
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, 8);
+        header.width = trace.width;
+        header.height = trace.height;
+        if (name) strncpy(header.name, name, sizeof(header.name) - 1);
+        fwrite(&header, sizeof(header), 1, trace.file);
+        trace.bytes += sizeof(header);
+        trace.header_written = 1;
+    }
+    ms = clock_ns_to_ms(clock_now_ns() - trace.start_ns);
+    memcpy(trace_put(TRACE_FRAME, 8), &ms, 8);
+    trace.calls--; // (the marker isn't a call)
+    fwrite(trace.buffer, 1, trace.used, trace.file);
+    fflush(trace.file); // (out of stdio's buffer too, so a killed recording keeps the frame)
+    trace.bytes += trace.used;
+    trace.used = 0;
+    trace.frames++;
+}
+
+static inline void trace_close(FILE *out)
+{
+    // Stops recording. The calls after the last finished frame are dropped.
+    if (!trace.file) return;
+    fclose(trace.file);
+    trace.file = NULL;
+    if (out && trace.frames > 0)
+        fprintf(out, "trace: %ld frames, %.1f calls and %.1f KB per frame, %.1f MB written to %s\n", trace.frames,
+                (double)trace.calls / trace.frames, trace.bytes / 1024.0 / trace.frames, trace.bytes / (1024.0 * 1024.0), trace.path);
+    free(trace.buffer);
+    trace.buffer = NULL;
+}
+
+// Playing a trace back.
+
+typedef struct Trace
+{
+    TraceHeader header;
+    unsigned char *data;      // the whole file
+    long frame_count;
+    size_t *frame_starts;     // where each frame's calls start in data (frame_count + 1 of them)
+    double *frame_ends;       // when each frame ended while recording (ms)
+    long calls;
+} Trace;
+
+static inline void trace_free(Trace *t)
+{
+    free(t->data);
+    free(t->frame_starts);
+    free(t->frame_ends);
+    memset(t, 0, sizeof(*t));
+}
+
+static inline int trace_load(Trace *t, const char *path)
+{
+    // Reads path and finds its frames. Returns 0 (and says why) if it isn't a complete trace.
+    FILE *file = fopen(path, "rb");
+    long size;
+    size_t at, frame_capacity = 1024;
+    memset(t, 0, sizeof(*t));
+    if (!file)
+    {
+        fprintf(stderr, "can't open the trace '%s'\n", path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < (long)sizeof(TraceHeader) || fread(&t->header, sizeof(TraceHeader), 1, file) != 1 ||
+        memcmp(t->header.magic, TRACE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "'%s' isn't a trace\n", path);
+        fclose(file);
+        return 0;
+    }
+    size -= sizeof(TraceHeader);
+    t->data = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (fread(t->data, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "can't read the trace '%s'\n", path);
+        fclose(file);
+        free(t->data);
+        return 0;
+    }
+    fclose(file);
+    t->header.name[sizeof(t->header.name) - 1] = 0;
+
+    t->frame_starts = (size_t *)malloc(frame_capacity * sizeof(size_t));
+    t->frame_ends = (double *)malloc(frame_capacity * sizeof(double));
+    t->frame_starts[0] = 0;
+    for (at = 0; at < (size_t)size; )
+    {
+        int op = t->data[at];
+        if (op <= 0 || op >= TRACE_OPS || at + 1 + trace_arg_bytes[op] > (size_t)size)
+        {
+            fprintf(stderr, "the trace '%s' is broken after %ld frames\n", path, t->frame_count);
+            break; // (the frames before are fine)
+        }
+        at += 1 + trace_arg_bytes[op];
+        if (op != TRACE_FRAME)
+        {
+            t->calls++;
+            continue;
+        }
+        if ((size_t)t->frame_count + 2 > frame_capacity)
+        {
+            frame_capacity *= 2;
+            t->frame_starts = (size_t *)realloc(t->frame_starts, frame_capacity * sizeof(size_t));
+            t->frame_ends = (double *)realloc(t->frame_ends, frame_capacity * sizeof(double));
+        }
+        memcpy(&t->frame_ends[t->frame_count], t->data + at - 8, 8);
+        t->frame_starts[++t->frame_count] = at;
+    }
+    if (t->frame_count == 0)
+    {
+        fprintf(stderr, "the trace '%s' has no frames\n", path);
+        trace_free(t);
+        return 0;
+    }
+    return 1;
+}
+
+static inline double trace_frame_ms(const Trace *t, long frame)
+{
+    // How long frame took while recording (from the end of the one before).
+    return t->frame_ends[frame] - (frame > 0 ? t->frame_ends[frame - 1] : 0);
+}
+
+static inline void trace_play_frame(const Trace *t, long frame)
+{
+    // Sends frame's calls to gl_dispatch, ie to whichever backend is active.
+    const unsigned char *at = t->data + t->frame_starts[frame], *end = t->data + t->frame_starts[frame + 1];
+    GLfloat f[16];
+    GLint i[4];
+    GLdouble d[4];
+    while (at < end)
+    {
+        int op = *at++, bytes = trace_arg_bytes[op];
+        switch (op)
+        {
+        case TRACE_CLEAR: memcpy(i, at, bytes); glClear((GLbitfield)i[0]); break;
+        case TRACE_CLEAR_COLOR: memcpy(f, at, bytes); glClearColor(f[0], f[1], f[2], f[3]); break;
+        case TRACE_ENABLE: memcpy(i, at, bytes); glEnable((GLenum)i[0]); break;
+        case TRACE_DISABLE: memcpy(i, at, bytes); glDisable((GLenum)i[0]); break;
+        case TRACE_VIEWPORT: memcpy(i, at, bytes); glViewport(i[0], i[1], i[2], i[3]); break;
+        case TRACE_MATRIX_MODE: memcpy(i, at, bytes); glMatrixMode((GLenum)i[0]); break;
+        case TRACE_LOAD_IDENTITY: glLoadIdentity(); break;
+        case TRACE_LOAD_MATRIX: memcpy(f, at, bytes); glLoadMatrixf(f); break;
+        case TRACE_TRANSLATE: memcpy(f, at, bytes); glTranslatef(f[0], f[1], f[2]); break;
+        case TRACE_ROTATE: memcpy(f, at, bytes); glRotatef(f[0], f[1], f[2], f[3]); break;
+        case TRACE_SCALE: memcpy(f, at, bytes); glScalef(f[0], f[1], f[2]); break;
+        case TRACE_PUSH_MATRIX: glPushMatrix(); break;
+        case TRACE_POP_MATRIX: glPopMatrix(); break;
+        case TRACE_BEGIN: memcpy(i, at, bytes); glBegin((GLenum)i[0]); break;
+        case TRACE_END: glEnd(); break;
+        case TRACE_VERTEX2: memcpy(f, at, bytes); glVertex2f(f[0], f[1]); break;
+        case TRACE_VERTEX3: memcpy(f, at, bytes); glVertex3f(f[0], f[1], f[2]); break;
+        case TRACE_COLOR3: memcpy(f, at, bytes); glColor3f(f[0], f[1], f[2]); break;
+        case TRACE_PERSPECTIVE: memcpy(d, at, bytes); gluPerspective(d[0], d[1], d[2], d[3]); break;
+        case TRACE_ORTHO2D: memcpy(d, at, bytes); gluOrtho2D(d[0], d[1], d[2], d[3]); break;
+        default: break; // (TRACE_FRAME)
+        }
+        at += bytes;
+    }
+}
+
+#endif
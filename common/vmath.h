@@ -0,0 +1,405 @@
+#ifndef COMMON_VMATH_H
+#define COMMON_VMATH_H
+
+/*
+- ***** A Note on Doing the Matrix Math Ourselves *****
+  Every glRotatef/glTranslatef call builds a 4x4 matrix inside the driver and multiplies the
+  current matrix with it (64 multiplies + 48 adds each time). Our cube does that 8 times per
+  frame, and the instanced field needs one matrix per cube. So we do the math on our side:
+  - Rotations are combined as quaternions (4 numbers instead of 16, and combining two costs
+    16 multiplies instead of 64), then turned into a matrix once at the end.
+  - The final matrix goes to OpenGL with a single glLoadMatrixf()/glUniformMatrix4fv().
+
+  Matrices are stored the way OpenGL wants them: column-major, ie m[0..3] is the first COLUMN.
+  So in the notation of the tutorials' ModelView matrix comment, the translation sits in m[12..14].
+
+- ***** A Note on SIMD *****
+  SIMD (Single Instruction Multiple Data) instructions do the same operation on several
+  numbers at once: one SSE instruction adds/multiplies 4 floats, one AVX instruction 8 floats.
+  A matrix column is exactly 4 floats, so a matrix multiply becomes 4 "column times number"
+  steps instead of 64 separate multiplies. For batches (one matrix per cube) we go further and
+  handle 4 cubes at a time, each SSE register holding the same matrix entry of 4 different cubes.
+  The compiler only lets us use the instructions the target CPU has: SSE is always there on
+  x86-64, AVX/FMA only when compiling with -mavx/-mfma (or -march=native). Without them the
+  plain C versions below are used.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define VMATH_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define VMATH_AVX 1
+#include <immintrin.h>
+#endif
+
+#define VMATH_PI 3.14159265358979323846f
+#define VMATH_DEG_TO_RAD (VMATH_PI / 180.0f)
+
+typedef struct vec4 { float x, y, z, w; } vec4;
+typedef struct quat { float x, y, z, w; } quat; // (axis * sin(angle/2), cos(angle/2))
+typedef struct mat4 { float m[16]; } mat4;       // column-major
+
+/* ***** Fast sin/cos ***** */
+
+// sinf()/cosf() from the C library are exact to the last bit and handle any input, which makes
+// them slow-ish. Ours: bring x into [-pi/4, pi/4] by removing multiples of pi/2 (in 3 steps,
+// so no precision is lost for large x), then a short polynomial (the same ones the Cephes math
+// library uses). Max error ~1e-7 for |x| < 10000, plenty for spinning cubes.
+#define VMATH_PIO2_1 1.5703125f
+#define VMATH_PIO2_2 4.837512969970703125e-4f
+#define VMATH_PIO2_3 7.54978995489188216e-8f
+#define VMATH_2_OVER_PI 0.636619772367581343f
+
+static inline void fast_sincosf(float x, float *sin_out, float *cos_out)
+{
+    float j = floorf(x * VMATH_2_OVER_PI + 0.5f); // nearest multiple of pi/2
+    int quadrant = (int)j;
+    float r = ((x - j * VMATH_PIO2_1) - j * VMATH_PIO2_2) - j * VMATH_PIO2_3;
+    float r2 = r * r;
+    float s = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    float c = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+    // sin(r + quadrant * 90 degrees) is one of sin(r), cos(r), -sin(r), -cos(r):
+    switch (quadrant & 3)
+    {
+        case 0: *sin_out = s;  *cos_out = c;  break;
+        case 1: *sin_out = c;  *cos_out = -s; break;
+        case 2: *sin_out = -s; *cos_out = -c; break;
+        default: *sin_out = -c; *cos_out = s; break;
+    }
+}
+
+#ifdef VMATH_SSE
+static inline void fast_sincos_ps(__m128 x, __m128 *sin_out, __m128 *cos_out)
+{
+    // Same as fast_sincosf() for 4 values at once. The quadrant switch becomes bit tricks:
+    // odd quadrants swap sin and cos, and bit 1 of the quadrant flips the sign.
+    __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(VMATH_2_OVER_PI))); // rounds to nearest
+    __m128 j = _mm_cvtepi32_ps(quadrant);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(VMATH_PIO2_1)));
+    __m128 r2, s, c, swap, sin_sign, cos_sign;
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(VMATH_PIO2_2)));
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(VMATH_PIO2_3)));
+    r2 = _mm_mul_ps(r, r);
+
+    s = _mm_add_ps(_mm_set1_ps(8.3321608736e-3f), _mm_mul_ps(r2, _mm_set1_ps(-1.9515295891e-4f)));
+    s = _mm_add_ps(_mm_set1_ps(-1.6666654611e-1f), _mm_mul_ps(r2, s));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), s));
+
+    c = _mm_add_ps(_mm_set1_ps(-1.388731625493765e-3f), _mm_mul_ps(r2, _mm_set1_ps(2.443315711809948e-5f)));
+    c = _mm_add_ps(_mm_set1_ps(4.166664568298827e-2f), _mm_mul_ps(r2, c));
+    c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), c));
+
+    swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    *sin_out = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sin_sign);
+    *cos_out = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cos_sign);
+}
+#endif
+
+/* ***** mat4 ***** */
+
+static inline mat4 mat4_identity(void)
+{
+    mat4 r;
+    memset(&r, 0, sizeof(r));
+    r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1;
+    return r;
+}
+
+static inline mat4 mat4_mul_scalar(const mat4 *a, const mat4 *b)
+{
+    // a * b, the plain way: every entry is a row of a dotted with a column of b.
+    mat4 r;
+    int row, column, k;
+    for (column = 0; column < 4; column++)
+        for (row = 0; row < 4; row++)
+        {
+            float sum = 0;
+            for (k = 0; k < 4; k++) sum += a->m[k * 4 + row] * b->m[column * 4 + k];
+            r.m[column * 4 + row] = sum;
+        }
+    return r;
+}
+
+static inline mat4 mat4_mul(const mat4 *a, const mat4 *b)
+{
+    // a * b. Column j of the result = a's columns weighted by the 4 numbers of b's column j.
+#ifdef VMATH_SSE
+    mat4 r;
+    __m128 a0 = _mm_loadu_ps(&a->m[0]), a1 = _mm_loadu_ps(&a->m[4]);
+    __m128 a2 = _mm_loadu_ps(&a->m[8]), a3 = _mm_loadu_ps(&a->m[12]);
+    int column;
+    for (column = 0; column < 4; column++)
+    {
+        const float *b_column = &b->m[column * 4];
+        __m128 sum = _mm_mul_ps(a0, _mm_set1_ps(b_column[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(b_column[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(b_column[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(b_column[3])));
+        _mm_storeu_ps(&r.m[column * 4], sum);
+    }
+    return r;
+#else
+    return mat4_mul_scalar(a, b);
+#endif
+}
+
+static inline void mat4_mul_batch(const mat4 *a, const mat4 *b, mat4 *out, int count)
+{
+    // out[i] = a * b[i] for a whole array (eg view-projection * every model matrix).
+    // With AVX two columns of b[i] are done at once (8 floats = 2 columns).
+    int i = 0;
+#ifdef VMATH_AVX
+    __m256 a0 = _mm256_broadcast_ps((const __m128 *)&a->m[0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128 *)&a->m[4]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128 *)&a->m[8]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128 *)&a->m[12]);
+    for (; i < count; i++)
+    {
+        int half;
+        for (half = 0; half < 2; half++)
+        {
+            __m256 columns = _mm256_loadu_ps(&b[i].m[half * 8]);
+            // shuffle 0x00 copies entry 0 of each column over its whole column, 0x55 entry 1, ...
+            __m256 sum = _mm256_mul_ps(a0, _mm256_shuffle_ps(columns, columns, 0x00));
+#ifdef __FMA__
+            sum = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(columns, columns, 0x55), sum);
+            sum = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(columns, columns, 0xAA), sum);
+            sum = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(columns, columns, 0xFF), sum);
+#else
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(a1, _mm256_shuffle_ps(columns, columns, 0x55)));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_shuffle_ps(columns, columns, 0xAA)));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(a3, _mm256_shuffle_ps(columns, columns, 0xFF)));
+#endif
+            _mm256_storeu_ps(&out[i].m[half * 8], sum);
+        }
+    }
+#endif
+    for (; i < count; i++) out[i] = mat4_mul(a, &b[i]);
+}
+
+static inline vec4 mat4_mul_vec4(const mat4 *a, vec4 v)
+{
+    vec4 r;
+    r.x = a->m[0] * v.x + a->m[4] * v.y + a->m[8] * v.z + a->m[12] * v.w;
+    r.y = a->m[1] * v.x + a->m[5] * v.y + a->m[9] * v.z + a->m[13] * v.w;
+    r.z = a->m[2] * v.x + a->m[6] * v.y + a->m[10] * v.z + a->m[14] * v.w;
+    r.w = a->m[3] * v.x + a->m[7] * v.y + a->m[11] * v.z + a->m[15] * v.w;
+    return r;
+}
+
+static inline mat4 mat4_translate(float x, float y, float z)
+{
+    // What glTranslatef(x, y, z) multiplies with.
+    mat4 r = mat4_identity();
+    r.m[12] = x;
+    r.m[13] = y;
+    r.m[14] = z;
+    return r;
+}
+
+static inline mat4 mat4_scale(float x, float y, float z)
+{
+    mat4 r = mat4_identity();
+    r.m[0] = x;
+    r.m[5] = y;
+    r.m[10] = z;
+    return r;
+}
+
+static inline mat4 mat4_rotate(float angle_degrees, float x, float y, float z)
+{
+    // What glRotatef(angle, x, y, z) multiplies with (the axis doesn't need to be normalized).
+    float length = sqrtf(x * x + y * y + z * z);
+    float radians = angle_degrees * VMATH_DEG_TO_RAD;
+    float c = cosf(radians), s = sinf(radians), t = 1 - c;
+    mat4 r = mat4_identity();
+    if (length == 0) return r;
+    x /= length; y /= length; z /= length;
+    r.m[0] = t*x*x + c;   r.m[4] = t*x*y - s*z; r.m[8] = t*x*z + s*y;
+    r.m[1] = t*x*y + s*z; r.m[5] = t*y*y + c;   r.m[9] = t*y*z - s*x;
+    r.m[2] = t*x*z - s*y; r.m[6] = t*y*z + s*x; r.m[10] = t*z*z + c;
+    return r;
+}
+
+static inline mat4 mat4_perspective(float fovy_degrees, float aspect, float z_near, float z_far)
+{
+    // The matrix gluPerspective(fovy, aspect, zNear, zFar) builds (see reshape() in the tutorials
+    // for what the parameters mean).
+    float f = 1.0f / tanf(fovy_degrees * VMATH_DEG_TO_RAD / 2);
+    mat4 r;
+    memset(&r, 0, sizeof(r));
+    r.m[0] = f / aspect;
+    r.m[5] = f;
+    r.m[10] = (z_far + z_near) / (z_near - z_far);
+    r.m[11] = -1;
+    r.m[14] = 2 * z_far * z_near / (z_near - z_far);
+    return r;
+}
+
+static inline mat4 mat4_ortho(float left, float right, float bottom, float top, float z_near, float z_far)
+{
+    // The matrix glOrtho() builds.
+    mat4 r = mat4_identity();
+    r.m[0] = 2 / (right - left);
+    r.m[5] = 2 / (top - bottom);
+    r.m[10] = -2 / (z_far - z_near);
+    r.m[12] = -(right + left) / (right - left);
+    r.m[13] = -(top + bottom) / (top - bottom);
+    r.m[14] = -(z_far + z_near) / (z_far - z_near);
+    return r;
+}
+
+static inline mat4 mat4_ortho2d(float left, float right, float bottom, float top)
+{
+    // gluOrtho2D(left, right, bottom, top) is glOrtho with zNear = -1 and zFar = 1.
+    return mat4_ortho(left, right, bottom, top, -1, 1);
+}
+
+/* ***** quat ***** */
+
+static inline quat quat_from_axis_angle(float angle_degrees, float x, float y, float z)
+{
+    // The rotation glRotatef(angle, x, y, z) does, as a quaternion.
+    float length = sqrtf(x * x + y * y + z * z), s, c;
+    quat q = { 0, 0, 0, 1 };
+    if (length == 0) return q;
+    fast_sincosf(angle_degrees * VMATH_DEG_TO_RAD * 0.5f, &s, &c);
+    s /= length;
+    q.x = x * s;
+    q.y = y * s;
+    q.z = z * s;
+    q.w = c;
+    return q;
+}
+
+static inline quat quat_mul(quat a, quat b)
+{
+    // "First rotate by b, then by a" (just like the matrix product a * b).
+    quat r;
+    r.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+    r.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+    r.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+    r.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+    return r;
+}
+
+static inline mat4 quat_to_mat4(quat q)
+{
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    mat4 r = mat4_identity();
+    r.m[0] = 1 - 2 * (yy + zz); r.m[4] = 2 * (xy - wz);     r.m[8] = 2 * (xz + wy);
+    r.m[1] = 2 * (xy + wz);     r.m[5] = 1 - 2 * (xx + zz); r.m[9] = 2 * (yz - wx);
+    r.m[2] = 2 * (xz - wy);     r.m[6] = 2 * (yz + wx);     r.m[10] = 1 - 2 * (xx + yy);
+    return r;
+}
+
+/* ***** Many model matrices at once ***** */
+
+// model = translate(position) * rotate(angle, axis) * scale(s) * translate(pivot)
+// positions and axes are x,y,z triplets (axes normalized), angles in degrees.
+// The pivot is the point of the mesh that should sit at "position" (and be spun around).
+
+static inline void mat4_compose_scalar(mat4 *out, const float *position, const float *axis, float angle_degrees,
+                                float scale, const float *pivot)
+{
+    // One matrix, the straightforward way (C library sin/cos, a full rotation matrix).
+    mat4 r = mat4_rotate(angle_degrees, axis[0], axis[1], axis[2]);
+    int column, row;
+    for (column = 0; column < 3; column++)
+        for (row = 0; row < 3; row++) r.m[column * 4 + row] *= scale;
+    for (row = 0; row < 3; row++)
+        r.m[12 + row] = position[row] + r.m[row] * pivot[0] + r.m[4 + row] * pivot[1] + r.m[8 + row] * pivot[2];
+    *out = r;
+}
+
+#ifdef VMATH_SSE
+static inline void vmath_load_xyz4(const float *p, __m128 *x, __m128 *y, __m128 *z)
+{
+    // 4 points stored x0 y0 z0 x1 y1 z1 x2 y2 z2 x3 y3 z3 -> (x0 x1 x2 x3), (y0 ..), (z0 ..)
+    __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+    __m128 t0 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)); // b2 b2 c1 c1
+    __m128 t1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)); // a1 a1 b0 b0
+    __m128 t2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)); // b3 b3 c2 c2
+    __m128 t3 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)); // a2 a2 b1 b1
+    __m128 t4 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)); // c0 c0 c3 c3
+    *x = _mm_shuffle_ps(a, t0, _MM_SHUFFLE(2, 0, 3, 0));
+    *y = _mm_shuffle_ps(t1, t2, _MM_SHUFFLE(2, 0, 2, 0));
+    *z = _mm_shuffle_ps(t3, t4, _MM_SHUFFLE(2, 0, 2, 0));
+}
+#endif
+
+static inline void mat4_compose_batch(mat4 *out, const float *positions, const float *axes, const float *angles_degrees,
+                               const float *scales, const float *pivot, int count)
+{
+    // The same as calling mat4_compose_scalar() count times, 4 matrices at a time:
+    // each SSE register holds one entry for 4 different matrices ("structure of arrays").
+    // The rotation goes through a quaternion (half the sin/cos work of a rotation matrix).
+    int i = 0;
+#ifdef VMATH_SSE
+    const __m128 half_deg_to_rad = _mm_set1_ps(VMATH_DEG_TO_RAD * 0.5f);
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 px = _mm_set1_ps(pivot[0]), py = _mm_set1_ps(pivot[1]), pz = _mm_set1_ps(pivot[2]);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 tx, ty, tz, ax, ay, az, s, c, qx, qy, qz, qw, sc;
+        __m128 m0, m1, m2, m3, m4, m5, m6, m8, m9, m10, m12, m13, m14, zero = _mm_setzero_ps();
+        vmath_load_xyz4(&positions[i * 3], &tx, &ty, &tz);
+        vmath_load_xyz4(&axes[i * 3], &ax, &ay, &az);
+        fast_sincos_ps(_mm_mul_ps(_mm_loadu_ps(&angles_degrees[i]), half_deg_to_rad), &s, &c);
+        qx = _mm_mul_ps(ax, s); qy = _mm_mul_ps(ay, s); qz = _mm_mul_ps(az, s); qw = c;
+
+        // quat_to_mat4() with the scale folded in: 2 * scale and 1 * scale.
+        sc = _mm_loadu_ps(&scales[i]);
+        {
+            __m128 s2 = _mm_mul_ps(two, sc);
+            __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+            __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+            __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+            m0 = _mm_mul_ps(sc, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+            m1 = _mm_mul_ps(s2, _mm_add_ps(xy, wz));
+            m2 = _mm_mul_ps(s2, _mm_sub_ps(xz, wy));
+            m4 = _mm_mul_ps(s2, _mm_sub_ps(xy, wz));
+            m5 = _mm_mul_ps(sc, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+            m6 = _mm_mul_ps(s2, _mm_add_ps(yz, wx));
+            m8 = _mm_mul_ps(s2, _mm_add_ps(xz, wy));
+            m9 = _mm_mul_ps(s2, _mm_sub_ps(yz, wx));
+            m10 = _mm_mul_ps(sc, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+        }
+        m12 = _mm_add_ps(tx, _mm_add_ps(_mm_mul_ps(m0, px), _mm_add_ps(_mm_mul_ps(m4, py), _mm_mul_ps(m8, pz))));
+        m13 = _mm_add_ps(ty, _mm_add_ps(_mm_mul_ps(m1, px), _mm_add_ps(_mm_mul_ps(m5, py), _mm_mul_ps(m9, pz))));
+        m14 = _mm_add_ps(tz, _mm_add_ps(_mm_mul_ps(m2, px), _mm_add_ps(_mm_mul_ps(m6, py), _mm_mul_ps(m10, pz))));
+
+        // Back from "entry k of 4 matrices" to "4 entries of matrix k": a 4x4 transpose per column.
+        m3 = zero;
+        _MM_TRANSPOSE4_PS(m0, m1, m2, m3);
+        _mm_storeu_ps(&out[i + 0].m[0], m0); _mm_storeu_ps(&out[i + 1].m[0], m1);
+        _mm_storeu_ps(&out[i + 2].m[0], m2); _mm_storeu_ps(&out[i + 3].m[0], m3);
+        m3 = zero;
+        _MM_TRANSPOSE4_PS(m4, m5, m6, m3);
+        _mm_storeu_ps(&out[i + 0].m[4], m4); _mm_storeu_ps(&out[i + 1].m[4], m5);
+        _mm_storeu_ps(&out[i + 2].m[4], m6); _mm_storeu_ps(&out[i + 3].m[4], m3);
+        m3 = zero;
+        _MM_TRANSPOSE4_PS(m8, m9, m10, m3);
+        _mm_storeu_ps(&out[i + 0].m[8], m8); _mm_storeu_ps(&out[i + 1].m[8], m9);
+        _mm_storeu_ps(&out[i + 2].m[8], m10); _mm_storeu_ps(&out[i + 3].m[8], m3);
+        m3 = one;
+        _MM_TRANSPOSE4_PS(m12, m13, m14, m3);
+        _mm_storeu_ps(&out[i + 0].m[12], m12); _mm_storeu_ps(&out[i + 1].m[12], m13);
+        _mm_storeu_ps(&out[i + 2].m[12], m14); _mm_storeu_ps(&out[i + 3].m[12], m3);
+    }
+#endif
+    // The leftovers (or everything without SSE).
+    for (; i < count; i++)
+        mat4_compose_scalar(&out[i], &positions[i * 3], &axes[i * 3], angles_degrees[i], scales[i], pivot);
+}
+
+#endif
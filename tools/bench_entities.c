@@ -0,0 +1,249 @@
+/*
+- ***** Entity Update Benchmark *****
+  Checks that the structure of arrays update of common/entity.h moves everything exactly like the
+  if/else code of the tutorials (an array of structs, one entity at a time), for the 2D bounce
+  (-10 .. 7, stop and turn) and the 3D bounce (z -95 .. -6, turn and go on, with a spin like
+  the cube's), then times one update of all of them. Last, the same update cut into chunks on
+  the job pool of common/jobs.h, with 1 worker thread up to one per core.
+
+  Build (add -march=native to get the AVX2 version instead of SSE2):
+    gcc -O2 tools/bench_entities.c -o bench_entities -lm -pthread
+  Run:
+    ./bench_entities [count] [workers]    (count = entities, default 1000000,
+                                           workers = the most worker threads, default one per core)
+
+  Note: The tutorials step with doubles (x_position += 0.30 adds a double), the stores keep floats.
+        The reference below does the same steps in float, so "exactly" means bit for bit.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/entity.h"
+#include "../common/jobs.h"
+#include "../common/clock.h"
+
+typedef struct RefEntity
+{
+    // How the tutorials keep it (one struct per entity).
+    float x, prev_x, y;
+    float speed;
+    int state;          // 1: towards high, -1: towards low
+    int color_counter;
+    float angle, spin;
+} RefEntity;
+
+typedef struct Config
+{
+    const char *name;
+    int bounce;
+    float low, high;
+    int with_spin;
+} Config;
+
+static unsigned int random_state = 12345;
+static float random_float(float low, float high)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return low + (high - low) * (random_state / 4294967296.0f);
+}
+
+static void ref_update(RefEntity *e, int count, const Config *config)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        RefEntity *s = &e[i];
+        s->prev_x = s->x;
+        s->color_counter++;
+        if (s->color_counter > 30) s->color_counter = 0;
+        if (config->bounce == ENTITY_BOUNCE_HOLD)
+        {
+            // OpenGL_2D_Tutorial.c
+            if (s->state == 1)
+            {
+                if (s->x < config->high) s->x += s->speed;
+                else s->state = -1;
+            }
+            else
+            {
+                if (s->x > config->low) s->x -= s->speed;
+                else s->state = 1;
+            }
+        }
+        else
+        {
+            // OpenGL_3D_Tutorial.c
+            if (s->x < config->low) s->state = 1;
+            else if (s->x > config->high) s->state = -1;
+            if (s->state == 1) s->x += s->speed;
+            else s->x -= s->speed;
+        }
+        if (config->with_spin)
+        {
+            // OpenGL_Cube_Tutorial.c
+            if (s->angle > 360) s->angle -= 360;
+            s->angle += s->spin;
+        }
+    }
+}
+
+static void setup(RefEntity *ref, EntityStore *store, int count, const Config *config)
+{
+    // The same random entities in both (some start outside the limits, to check that too).
+    int i;
+    float margin = (config->high - config->low) * 0.05f;
+    random_state = 12345;
+    entity_store_init(store, count, config->bounce, config->low, config->high, config->with_spin);
+    for (i = 0; i < count; i++)
+    {
+        RefEntity *s = &ref[i];
+        s->x = s->prev_x = random_float(config->low - margin, config->high + margin);
+        s->y = random_float(-10, 10);
+        s->speed = random_float(0.05f, 0.75f);
+        s->state = random_float(0, 1) < 0.5f ? 1 : -1;
+        s->color_counter = (int)random_float(0, 31);
+        s->angle = random_float(0, 360);
+        s->spin = random_float(0.1f, 2.0f);
+        entity_set(store, i, s->x, s->y, s->speed, s->state == 1, s->color_counter);
+        if (config->with_spin)
+        {
+            store->angle[store->current][i] = s->angle;
+            store->spin[i] = s->spin;
+        }
+    }
+}
+
+static int compare(const RefEntity *ref, const EntityStore *store, int count)
+{
+    // Number of entities that don't match bit for bit.
+    int i, wrong = 0;
+    for (i = 0; i < count; i++)
+    {
+        const RefEntity *s = &ref[i];
+        int same = s->x == entity_position(store, i) && s->prev_x == entity_prev_position(store, i) &&
+                   (s->state == 1) == entity_towards_high(store, i) && s->color_counter == entity_color_step(store, i);
+        if (store->spin) same = same && s->angle == store->angle[store->current][i];
+        if (!same) wrong++;
+    }
+    return wrong;
+}
+
+static double ms_per_update(void (*update)(void *, const Config *), void *what, const Config *config, int updates)
+{
+    uint64_t start;
+    int i;
+    update(what, config); // (warms up the caches)
+    start = clock_now_ns();
+    for (i = 0; i < updates; i++) update(what, config);
+    return (clock_now_ns() - start) / 1e6 / updates;
+}
+
+static int bench_count;
+static void run_ref(void *what, const Config *config) { ref_update((RefEntity *)what, bench_count, config); }
+static void run_scalar(void *what, const Config *config)
+{
+    EntityStore *store = (EntityStore *)what;
+    (void)config;
+    entity_update_scalar(store, 0, store->capacity);
+    entity_swap(store);
+}
+static void run_simd(void *what, const Config *config) { (void)config; entity_update((EntityStore *)what); }
+
+static JobPool bench_pool;
+static void run_chunk(void *what, int first, int last) { entity_update_range((EntityStore *)what, first, last); }
+static void run_jobs(void *what, const Config *config)
+{
+    // (the main thread only waits and steals, like the 2D demo's GLUT thread once it's done drawing)
+    EntityStore *store = (EntityStore *)what;
+    JobBatch batch;
+    (void)config;
+    jobs_parallel_for(&bench_pool, &batch, run_chunk, store, store->capacity, ENTITY_CHUNK);
+    jobs_wait(&bench_pool, &batch);
+    entity_swap(store);
+}
+
+int main(int argc, char **argv)
+{
+    static const Config configs[] = {
+        { "2D (x -10 .. 7, stop and turn)", ENTITY_BOUNCE_HOLD, -10, 7, 0 },
+        { "3D (z -95 .. -6, turn and go)", ENTITY_BOUNCE_TURN, -95, -6, 0 },
+        { "3D (z -95 .. -6, turn and go, + spin)", ENTITY_BOUNCE_TURN, -95, -6, 1 },
+    };
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int max_workers = argc > 2 ? atoi(argv[2]) : jobs_cpu_count();
+    int c, step, updates, workers;
+    double one_ms = 0;
+    RefEntity *ref;
+    EntityStore store;
+
+    if (count < 1 || max_workers < 1)
+    {
+        fprintf(stderr, "usage: %s [count] [workers]\n", argv[0]);
+        return 1;
+    }
+    ref = (RefEntity *)malloc(sizeof(RefEntity) * count);
+    bench_count = count;
+    updates = count >= 1000000 ? 100 : 1000;
+    printf("entities: %d, update kernel %s\n", count, ENTITY_SIMD_NAME);
+
+    printf("exactness (200 updates, entities that differ from the if/else version):\n");
+    for (c = 0; c < (int)(sizeof(configs) / sizeof(configs[0])); c++)
+    {
+        int wrong_simd, wrong_scalar;
+        setup(ref, &store, count, &configs[c]);
+        for (step = 0; step < 200; step++)
+        {
+            ref_update(ref, count, &configs[c]);
+            entity_update(&store);
+        }
+        wrong_simd = compare(ref, &store, count);
+        entity_store_free(&store);
+
+        setup(ref, &store, count, &configs[c]);
+        for (step = 0; step < 200; step++)
+        {
+            ref_update(ref, count, &configs[c]);
+            run_scalar(&store, &configs[c]);
+        }
+        wrong_scalar = compare(ref, &store, count);
+        entity_store_free(&store);
+        printf("  %-40s %s %d, scalar %d\n", configs[c].name, ENTITY_SIMD_NAME, wrong_simd, wrong_scalar);
+        if (wrong_simd || wrong_scalar) return 1;
+    }
+
+    printf("one update of all of them (ms, %d updates each):\n", updates);
+    for (c = 0; c < (int)(sizeof(configs) / sizeof(configs[0])); c++)
+    {
+        double ref_ms, scalar_ms, simd_ms;
+        setup(ref, &store, count, &configs[c]);
+        ref_ms = ms_per_update(run_ref, ref, &configs[c], updates);
+        scalar_ms = ms_per_update(run_scalar, &store, &configs[c], updates);
+        simd_ms = ms_per_update(run_simd, &store, &configs[c], updates);
+        printf("  %-40s structs %.3f | arrays %.3f | arrays %s %.3f (x%.1f, %.0f M/s)\n", configs[c].name,
+               ref_ms, scalar_ms, ENTITY_SIMD_NAME, simd_ms, ref_ms / simd_ms, count / simd_ms / 1e3);
+        entity_store_free(&store);
+    }
+
+    printf("on the job pool, %s (ms, chunks of %d, %d cores):\n", configs[0].name, ENTITY_CHUNK, jobs_cpu_count());
+    for (workers = 1; workers <= max_workers; workers++)
+    {
+        double ms;
+        int wrong;
+        setup(ref, &store, count, &configs[0]);
+        jobs_init(&bench_pool, workers);
+        ms = ms_per_update(run_jobs, &store, &configs[0], updates);
+        if (workers == 1) one_ms = ms;
+        jobs_report(&bench_pool, stdout); // (resets the counts)
+        for (step = 0; step < updates + 1; step++) ref_update(ref, count, &configs[0]);
+        wrong = compare(ref, &store, count);
+        jobs_shutdown(&bench_pool);
+        entity_store_free(&store);
+        printf("  %2d workers %.3f (x%.2f)%s\n", workers, ms, one_ms > 0 ? one_ms / ms : 1.0, wrong ? " WRONG" : "");
+        if (wrong) return 1;
+    }
+    free(ref);
+    return 0;
+}
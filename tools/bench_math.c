@@ -0,0 +1,249 @@
+/*
+- ***** Math Micro-Benchmarks *****
+  Checks that the fast paths of common/vmath.h give the same answers as the plain ones,
+  then times how many matrices per second each of them makes.
+
+  Build (add -march=native to get the AVX/FMA versions too):
+    gcc -O2 tools/bench_math.c -o bench_math -lGLU -lGL -lEGL -lm
+  Run:
+    ./bench_math [count]     (count = matrices per timed batch, default 100000)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <GL/glu.h>
+#include "../common/vmath.h"
+#include "../common/clock.h"
+#include "../common/headless.h"
+
+static float random_float(float low, float high)
+{
+    return low + (high - low) * (float)rand() / (float)RAND_MAX;
+}
+
+static float max_difference(const float *a, const float *b, int count)
+{
+    float worst = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        if (fabsf(a[i] - b[i]) > worst) worst = fabsf(a[i] - b[i]);
+    return worst;
+}
+
+static void report(const char *name, int matrices, uint64_t ns, double baseline_per_second)
+{
+    double per_second = matrices / (ns / 1e9);
+    printf("  %-42s %8.1f M/s", name, per_second / 1e6);
+    if (baseline_per_second > 0) printf("  (x%.2f)", per_second / baseline_per_second);
+    printf("\n");
+}
+
+static mat4 rotate_chain_matrices(float angle)
+{
+    // The cube's display(): glTranslatef + 7 glRotatef, done as 8 full matrix multiplies.
+    static const float axes[7][3] = { {0,1,1}, {1,1,0}, {0,1,0}, {1,0,1}, {1,1,1}, {1,0,0}, {0,0,1} };
+    mat4 m = mat4_translate(0, 0, -9);
+    int i;
+    for (i = 0; i < 7; i++)
+    {
+        mat4 r = mat4_rotate(angle, axes[i][0], axes[i][1], axes[i][2]);
+        m = mat4_mul_scalar(&m, &r);
+    }
+    return m;
+}
+
+static mat4 rotate_chain_quaternions(float angle)
+{
+    // The same with quaternions: 7 quaternion multiplies and one conversion to a matrix.
+    static const float axes[7][3] = { {0,1,1}, {1,1,0}, {0,1,0}, {1,0,1}, {1,1,1}, {1,0,0}, {0,0,1} };
+    quat q = { 0, 0, 0, 1 };
+    mat4 m;
+    int i;
+    for (i = 0; i < 7; i++) q = quat_mul(q, quat_from_axis_angle(angle, axes[i][0], axes[i][1], axes[i][2]));
+    m = quat_to_mat4(q);
+    m.m[14] = -9;
+    return m;
+}
+
+static void check_against_glu(void)
+{
+    // gluPerspective/gluOrtho2D work on the current GL matrix, so they need a context.
+    mat4 ours;
+    float theirs[16];
+    if (!headless_create(16, 16, 0))
+    {
+        printf("  (no OpenGL context, skipping the GLU comparison)\n");
+        return;
+    }
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(60.0, 1.0, 2.0, 50.0);
+    glGetFloatv(GL_PROJECTION_MATRIX, theirs);
+    ours = mat4_perspective(60, 1, 2, 50);
+    printf("  mat4_perspective vs gluPerspective          max diff %.2e\n", max_difference(ours.m, theirs, 16));
+
+    glLoadIdentity();
+    gluOrtho2D(-10, 10, -10, 10);
+    glGetFloatv(GL_PROJECTION_MATRIX, theirs);
+    ours = mat4_ortho2d(-10, 10, -10, 10);
+    printf("  mat4_ortho2d vs gluOrtho2D                  max diff %.2e\n", max_difference(ours.m, theirs, 16));
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glTranslatef(0, 0, -9);
+    glRotatef(37, 0, 1, 1); glRotatef(37, 1, 1, 0); glRotatef(37, 0, 1, 0); glRotatef(37, 1, 0, 1);
+    glRotatef(37, 1, 1, 1); glRotatef(37, 1, 0, 0); glRotatef(37, 0, 0, 1);
+    glGetFloatv(GL_MODELVIEW_MATRIX, theirs);
+    ours = rotate_chain_quaternions(37);
+    printf("  quaternion chain vs glRotatef chain         max diff %.2e\n", max_difference(ours.m, theirs, 16));
+    headless_destroy();
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000, i, repeat;
+    const int repeats = 20;
+    float *positions, *axes, *angles, *scales, pivot[3] = { 0, 0, 2 };
+    mat4 *a, *b, *out, *reference, chain;
+    float worst_sin = 0, worst_cos = 0, checksum = 0;
+    uint64_t start, ns;
+    double baseline;
+
+    if (count < repeats) count = repeats; // (a[repeat] is used as the left matrix)
+    positions = (float *)malloc(sizeof(float) * 3 * count);
+    axes = (float *)malloc(sizeof(float) * 3 * count);
+    angles = (float *)malloc(sizeof(float) * count);
+    scales = (float *)malloc(sizeof(float) * count);
+    a = (mat4 *)malloc(sizeof(mat4) * count);
+    b = (mat4 *)malloc(sizeof(mat4) * count);
+    out = (mat4 *)malloc(sizeof(mat4) * count);
+    reference = (mat4 *)malloc(sizeof(mat4) * count);
+    for (i = 0; i < count; i++)
+    {
+        float x = random_float(-1, 1), y = random_float(-1, 1), z = random_float(-1, 1) + 0.01f;
+        float length = sqrtf(x * x + y * y + z * z);
+        int k;
+        positions[i * 3 + 0] = random_float(-6, 6);
+        positions[i * 3 + 1] = random_float(-6, 6);
+        positions[i * 3 + 2] = random_float(-40, -10);
+        axes[i * 3 + 0] = x / length; axes[i * 3 + 1] = y / length; axes[i * 3 + 2] = z / length;
+        angles[i] = random_float(-1080, 1080);
+        scales[i] = random_float(0.05f, 0.5f);
+        for (k = 0; k < 16; k++) { a[i].m[k] = random_float(-2, 2); b[i].m[k] = random_float(-2, 2); }
+    }
+
+    printf("vmath: SSE %s, AVX %s, FMA %s\n",
+#ifdef VMATH_SSE
+           "on",
+#else
+           "off",
+#endif
+#ifdef VMATH_AVX
+           "on",
+#else
+           "off",
+#endif
+#ifdef __FMA__
+           "on"
+#else
+           "off"
+#endif
+           );
+
+    printf("accuracy:\n");
+    for (i = 0; i < 2000000; i++)
+    {
+        float x = -1000.0f + 2000.0f * i / 2000000.0f, s, c;
+        fast_sincosf(x, &s, &c);
+        if (fabs(s - sin((double)x)) > worst_sin) worst_sin = (float)fabs(s - sin((double)x));
+        if (fabs(c - cos((double)x)) > worst_cos) worst_cos = (float)fabs(c - cos((double)x));
+    }
+    printf("  fast_sincosf on [-1000, 1000]               max error sin %.2e cos %.2e\n", worst_sin, worst_cos);
+#ifdef VMATH_SSE
+    worst_sin = worst_cos = 0;
+    for (i = 0; i < 2000000; i += 4)
+    {
+        float x[4], s[4], c[4];
+        __m128 vs, vc;
+        int k;
+        for (k = 0; k < 4; k++) x[k] = -1000.0f + 2000.0f * (i + k) / 2000000.0f;
+        fast_sincos_ps(_mm_loadu_ps(x), &vs, &vc);
+        _mm_storeu_ps(s, vs);
+        _mm_storeu_ps(c, vc);
+        for (k = 0; k < 4; k++)
+        {
+            if (fabs(s[k] - sin((double)x[k])) > worst_sin) worst_sin = (float)fabs(s[k] - sin((double)x[k]));
+            if (fabs(c[k] - cos((double)x[k])) > worst_cos) worst_cos = (float)fabs(c[k] - cos((double)x[k]));
+        }
+    }
+    printf("  fast_sincos_ps on [-1000, 1000]             max error sin %.2e cos %.2e\n", worst_sin, worst_cos);
+#endif
+    for (i = 0; i < count; i++) reference[i] = mat4_mul_scalar(&a[0], &b[i]);
+    mat4_mul_batch(&a[0], b, out, count);
+    printf("  mat4_mul_batch vs mat4_mul_scalar           max diff %.2e\n", max_difference(out[0].m, reference[0].m, 16 * count));
+    for (i = 0; i < count; i++) mat4_compose_scalar(&reference[i], &positions[i * 3], &axes[i * 3], angles[i], scales[i], pivot);
+    mat4_compose_batch(out, positions, axes, angles, scales, pivot, count);
+    printf("  mat4_compose_batch vs mat4_compose_scalar   max diff %.2e\n", max_difference(out[0].m, reference[0].m, 16 * count));
+    chain = rotate_chain_matrices(37);
+    reference[0] = rotate_chain_quaternions(37);
+    printf("  quaternion chain vs matrix chain            max diff %.2e\n", max_difference(chain.m, reference[0].m, 16));
+    check_against_glu();
+
+    printf("throughput (%d matrices x %d, million matrices per second):\n", count, repeats);
+
+    start = clock_now_ns();
+    for (repeat = 0; repeat < repeats; repeat++)
+        for (i = 0; i < count; i++) out[i] = mat4_mul_scalar(&a[repeat], &b[i]);
+    ns = clock_now_ns() - start;
+    checksum += out[count - 1].m[5];
+    baseline = count * repeats / (ns / 1e9);
+    report("mat4_mul_scalar", count * repeats, ns, 0);
+
+    start = clock_now_ns();
+    for (repeat = 0; repeat < repeats; repeat++)
+        for (i = 0; i < count; i++) out[i] = mat4_mul(&a[repeat], &b[i]);
+    ns = clock_now_ns() - start;
+    checksum += out[count - 1].m[5];
+    report("mat4_mul (SSE)", count * repeats, ns, baseline);
+
+    start = clock_now_ns();
+    for (repeat = 0; repeat < repeats; repeat++) mat4_mul_batch(&a[repeat], b, out, count);
+    ns = clock_now_ns() - start;
+    checksum += out[count - 1].m[5];
+    report("mat4_mul_batch (AVX when available)", count * repeats, ns, baseline);
+
+    start = clock_now_ns();
+    for (repeat = 0; repeat < repeats; repeat++)
+        for (i = 0; i < count; i++)
+            mat4_compose_scalar(&out[i], &positions[i * 3], &axes[i * 3], angles[i] + repeat, scales[i], pivot);
+    ns = clock_now_ns() - start;
+    checksum += out[count - 1].m[5];
+    baseline = count * repeats / (ns / 1e9);
+    report("model matrix, scalar (sinf/cosf + mat4)", count * repeats, ns, 0);
+
+    start = clock_now_ns();
+    for (repeat = 0; repeat < repeats; repeat++)
+        mat4_compose_batch(out, positions, axes, angles, scales, pivot, count);
+    ns = clock_now_ns() - start;
+    checksum += out[count - 1].m[5];
+    report("model matrix, mat4_compose_batch (SSE)", count * repeats, ns, baseline);
+
+    start = clock_now_ns();
+    for (i = 0; i < count; i++) chain = rotate_chain_matrices(angles[i]);
+    ns = clock_now_ns() - start;
+    checksum += chain.m[5];
+    baseline = count / (ns / 1e9);
+    report("cube modelview, 8 matrix multiplies", count, ns, 0);
+
+    start = clock_now_ns();
+    for (i = 0; i < count; i++) chain = rotate_chain_quaternions(angles[i]);
+    ns = clock_now_ns() - start;
+    checksum += chain.m[5];
+    report("cube modelview, 7 quaternion multiplies", count, ns, baseline);
+
+    printf("(checksum %g)\n", checksum); // keeps the compiler from optimizing the loops away
+    free(positions); free(axes); free(angles); free(scales);
+    free(a); free(b); free(out); free(reference);
+    return 0;
+}
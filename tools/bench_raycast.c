@@ -0,0 +1,214 @@
+/*
+- ***** Raycaster Benchmark *****
+  Checks that the SIMD DDA of common/raycast.h finds exactly the same walls at exactly the same
+  distances as the one-ray-at-a-time version, for many cameras on a random map (walls everywhere,
+  rays along the grid lines included), then times a frame: casting alone, scalar against SIMD,
+  then casting + drawing, and last both cut into chunks of columns on the job pool of
+  common/jobs.h, with 1 worker thread up to one per core.
+
+  Build (add -march=native to get the AVX2 version, without AVX2 "SIMD" is the scalar loop again):
+    gcc -O2 tools/bench_raycast.c -o bench_raycast -lm -pthread
+  Run:
+    ./bench_raycast [WxH] [workers]    (WxH = the picture, default 3840x2160,
+                                        workers = the most worker threads, default one per core)
+
+  Note: Only the CPU's part of the demo is timed here, OpenGL still has to upload and show the
+        picture (see the "upload" time OpenGL_Raycaster_Tutorial.c reports).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/raycast.h"
+#include "../common/jobs.h"
+#include "../common/clock.h"
+
+#define MAP_SIZE 64
+#define COLUMN_CHUNK 64
+
+static unsigned int random_state = 12345;
+static float random_float(float low, float high)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return low + (high - low) * (random_state / 4294967296.0f);
+}
+
+static void make_map(RaycastMap *map, float walls)
+{
+    // MAP_SIZE x MAP_SIZE cells, walls of them walls (0 .. 1), with random textures.
+    char **rows = (char **)malloc(sizeof(char *) * MAP_SIZE);
+    int x, y;
+    for (y = 0; y < MAP_SIZE; y++)
+    {
+        rows[y] = (char *)malloc(MAP_SIZE + 1);
+        for (x = 0; x < MAP_SIZE; x++)
+            rows[y][x] = random_float(0, 1) < walls ? (char)('1' + (int)random_float(0, RAYCAST_TEXTURES)) : '.';
+        rows[y][MAP_SIZE] = 0;
+    }
+    raycast_map_load(map, (const char *const *)rows, MAP_SIZE);
+    for (y = 0; y < MAP_SIZE; y++) free(rows[y]);
+    free(rows);
+}
+
+static void random_camera(const RaycastMap *map, RaycastCamera *camera, const RaycastFrame *frame, int along_grid)
+{
+    // Somewhere empty, looking anywhere (or straight along x or y: some rays are then exactly 0 in x or y).
+    float look = along_grid ? 1.5707963f * (int)random_float(0, 4) : random_float(0, 6.2831853f), plane;
+    do
+    {
+        camera->x = random_float(1, MAP_SIZE - 1);
+        camera->y = random_float(1, MAP_SIZE - 1);
+    } while (!raycast_map_empty(map, camera->x, camera->y));
+    camera->dir_x = along_grid ? (float)(int)roundf(cosf(look)) : cosf(look);
+    camera->dir_y = along_grid ? (float)(int)roundf(sinf(look)) : sinf(look);
+    plane = 0.5f * frame->width / frame->height;
+    camera->plane_x = camera->dir_y * plane;
+    camera->plane_y = -camera->dir_x * plane;
+}
+
+static int compare(const RaycastFrame *frame, const float *distance, const int32_t *cell, const int32_t *side, const int32_t *steps)
+{
+    // Number of columns that don't match bit for bit.
+    int c, wrong = 0;
+    for (c = 0; c < frame->width; c++)
+        if (frame->distance[c] != distance[c] || frame->cell[c] != cell[c] || frame->side[c] != side[c] || frame->steps[c] != steps[c])
+            wrong++;
+    return wrong;
+}
+
+static RaycastFrame frame;
+static RaycastMap map;
+static RaycastCamera cameras[64];
+static JobPool bench_pool;
+
+static void run_scalar(int i) { raycast_cast_scalar(&frame, &map, &cameras[i], 0, frame.columns); }
+static void run_simd(int i) { raycast_cast_simd(&frame, &map, &cameras[i], 0, frame.columns); }
+static void run_draw(int i)
+{
+    raycast_cast_simd(&frame, &map, &cameras[i], 0, frame.columns);
+    raycast_draw_columns(&frame, &cameras[i], 0, frame.columns);
+}
+static void run_chunk(void *camera, int first, int last)
+{
+    raycast_cast_simd(&frame, &map, (const RaycastCamera *)camera, first, last);
+    raycast_draw_columns(&frame, (const RaycastCamera *)camera, first, last);
+}
+static void run_jobs(int i)
+{
+    // (the main thread only waits and steals, like the demo's GLUT thread)
+    JobBatch batch;
+    jobs_parallel_for(&bench_pool, &batch, run_chunk, &cameras[i], frame.columns, COLUMN_CHUNK);
+    jobs_wait(&bench_pool, &batch);
+}
+
+static double ms_per_frame(void (*run)(int), int frames)
+{
+    // Every frame from another camera (its rays set up outside the timed part, like in the demo
+    // where that's a few microseconds of the GLUT thread).
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < frames; i++)
+    {
+        uint64_t start;
+        raycast_setup_rays(&frame, &cameras[i % 64]);
+        start = clock_now_ns();
+        run(i % 64);
+        total += clock_now_ns() - start;
+    }
+    return total / 1e6 / frames;
+}
+
+int main(int argc, char **argv)
+{
+    int width = 3840, height = 2160, max_workers = argc > 2 ? atoi(argv[2]) : jobs_cpu_count();
+    int i, workers, frames = 30, wrong = 0;
+    float *distance;
+    int32_t *cell, *side, *steps;
+    long cells = 0;
+    double scalar_ms, simd_ms, draw_ms, one_ms = 0;
+
+    if ((argc > 1 && sscanf(argv[1], "%dx%d", &width, &height) != 2) || width < 1 || height < 1 || max_workers < 1)
+    {
+        fprintf(stderr, "usage: %s [WxH] [workers]\n", argv[0]);
+        return 1;
+    }
+    raycast_frame_resize(&frame, width, height);
+    raycast_make_textures(&frame);
+    frame.ceiling = raycast_rgb(60, 60, 70);
+    frame.floor = raycast_rgb(100, 90, 80);
+    frame.pixels = (uint32_t *)malloc(sizeof(uint32_t) * width * frame.stride);
+    distance = (float *)malloc(sizeof(float) * frame.columns);
+    cell = (int32_t *)malloc(sizeof(int32_t) * frame.columns);
+    side = (int32_t *)malloc(sizeof(int32_t) * frame.columns);
+    steps = (int32_t *)malloc(sizeof(int32_t) * frame.columns);
+    printf("picture: %dx%d, DDA kernel %s (%d lanes)\n", width, height, RAYCAST_SIMD_NAME, RAYCAST_LANES);
+
+    printf("exactness (columns that differ from the scalar version):\n");
+    for (i = 0; i < 3; i++)
+    {
+        static const float walls[] = { 0.02f, 0.1f, 0.3f };
+        int camera, differ = 0;
+        make_map(&map, walls[i]);
+        for (camera = 0; camera < 200; camera++)
+        {
+            RaycastCamera test;
+            random_camera(&map, &test, &frame, camera % 4 == 0);
+            raycast_setup_rays(&frame, &test);
+            raycast_cast_scalar(&frame, &map, &test, 0, frame.columns);
+            memcpy(distance, frame.distance, sizeof(float) * frame.columns);
+            memcpy(cell, frame.cell, sizeof(int32_t) * frame.columns);
+            memcpy(side, frame.side, sizeof(int32_t) * frame.columns);
+            memcpy(steps, frame.steps, sizeof(int32_t) * frame.columns);
+            raycast_cast_simd(&frame, &map, &test, 0, frame.columns);
+            differ += compare(&frame, distance, cell, side, steps);
+        }
+        printf("  map %2.0f%% walls, 200 cameras: %s %d\n", walls[i] * 100, RAYCAST_SIMD_NAME, differ);
+        wrong += differ;
+        free(map.cells);
+    }
+    if (wrong) return 1;
+
+    // The timed map: few walls, so the rays are long (the demo's hall averages ~13 cells per ray).
+    random_state = 777;
+    make_map(&map, 0.04f);
+    for (i = 0; i < 64; i++) random_camera(&map, &cameras[i], &frame, 0);
+    for (i = 0; i < 64; i++)
+    {
+        int c;
+        raycast_setup_rays(&frame, &cameras[i]);
+        raycast_cast_scalar(&frame, &map, &cameras[i], 0, frame.columns);
+        for (c = 0; c < width; c++) cells += frame.steps[c];
+    }
+    printf("one frame (ms, %d frames each, %.1f cells per ray):\n", frames, (double)cells / (64.0 * width));
+    scalar_ms = ms_per_frame(run_scalar, frames);
+    simd_ms = ms_per_frame(run_simd, frames);
+    draw_ms = ms_per_frame(run_draw, frames);
+    printf("  casting       scalar %.3f | %s %.3f (x%.1f, %.0f M rays/s)\n", scalar_ms, RAYCAST_SIMD_NAME, simd_ms,
+           scalar_ms / simd_ms, width / simd_ms / 1e3);
+    printf("  cast + draw   %s %.3f (%.0f fps, %.2f G pixels/s)\n", RAYCAST_SIMD_NAME, draw_ms, 1000 / draw_ms,
+           (double)width * height / draw_ms / 1e6);
+
+    printf("on the job pool, cast + draw (ms, chunks of %d columns, %d cores):\n", COLUMN_CHUNK, jobs_cpu_count());
+    for (workers = 1; workers <= max_workers; workers++)
+    {
+        double ms;
+        jobs_init(&bench_pool, workers);
+        ms = ms_per_frame(run_jobs, frames);
+        if (workers == 1) one_ms = ms;
+        jobs_report(&bench_pool, stdout); // (resets the counts)
+        jobs_shutdown(&bench_pool);
+        printf("  %2d workers %.3f (x%.2f, %.0f fps)\n", workers, ms, one_ms / ms, 1000 / ms);
+    }
+
+    free(map.cells);
+    free(frame.pixels);
+    raycast_frame_free(&frame);
+    free(distance);
+    free(cell);
+    free(side);
+    free(steps);
+    return 0;
+}
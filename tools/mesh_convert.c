@@ -0,0 +1,487 @@
+/*
+- ***** Mesh Converter *****
+  Turns the text mesh format of common/mesh.h, or an OBJ or PLY model (common/mesh_import.h),
+  into a binary mesh file the demos can map (OpenGL_Cube_Tutorial.c --scene), or makes a big test
+  grid to time loading with. With --optimize first, the meshes are put in a GPU-friendly order on
+  the way (common/mesh_opt.h), and it says how much that gained. With --lod N every mesh also gets
+  N - 1 simpler levels of detail (common/mesh_lod.h), stored as meshes of their own.
+
+  Build:
+    gcc -O2 tools/mesh_convert.c -o mesh_convert -pthread -lm
+  Run:
+    ./mesh_convert assets/cube.scene cube.mesh     text -> binary
+    ./mesh_convert model.obj model.mesh [workers]  OBJ or PLY -> binary (workers: parsing threads
+                                                   besides this one, default one per core)
+    ./mesh_convert --optimize in out.mesh          any of the above (or a mesh file) -> optimized
+    ./mesh_convert --lod 6 in out.mesh             any of the above + 5 simpler levels of each mesh
+                                                   (--optimize --lod 6 in out.mesh: both)
+    ./mesh_convert --grid 4096 grid.mesh           a 4096 x 4096 vertex grid called "grid" (~800 MB)
+    ./mesh_convert --info cube.mesh                what's inside
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/mesh.h"
+#include "../common/mesh_import.h"
+#include "../common/mesh_opt.h"
+#include "../common/mesh_lod.h"
+#include "../common/clock.h"
+
+#define MAX_MESHES 256
+
+static int optimize = 0; // --optimize
+static int lod_levels = 0; // --lod N
+
+typedef struct Builder
+{
+    // The mesh being read. The vertices are kept with every attribute until the end, when we know
+    // which ones the mesh actually uses.
+    MeshData mesh;
+    float *full;                // x y z nx ny nz r g b per vertex
+    uint32_t vertex_capacity, index_capacity;
+    float normal[3], color[3];
+    int line;
+} Builder;
+
+static void *grow(void *array, uint32_t *capacity, uint64_t needed, size_t item_size)
+{
+    if (needed <= *capacity) return array;
+    if (needed > 0xffffffffu)
+    {
+        fprintf(stderr, "mesh too big\n");
+        exit(1);
+    }
+    while (*capacity < needed) *capacity = *capacity ? (*capacity > 0x7fffffffu ? 0xffffffffu : *capacity * 2) : 1024;
+    array = realloc(array, item_size * *capacity);
+    if (!array)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static void add_triangle(Builder *b, const char *path, uint32_t a, uint32_t c, uint32_t d)
+{
+    if (a >= b->mesh.vertex_count || c >= b->mesh.vertex_count || d >= b->mesh.vertex_count)
+    {
+        fprintf(stderr, "%s:%d: vertex index out of range (the mesh has %u so far)\n", path, b->line, b->mesh.vertex_count);
+        exit(1);
+    }
+    b->mesh.indices = (uint32_t *)grow(b->mesh.indices, &b->index_capacity, (uint64_t)b->mesh.index_count + 3, sizeof(uint32_t));
+    b->mesh.indices[b->mesh.index_count++] = a;
+    b->mesh.indices[b->mesh.index_count++] = c;
+    b->mesh.indices[b->mesh.index_count++] = d;
+}
+
+static void finish_mesh(Builder *b)
+{
+    // Packs the vertices with only the attributes the mesh used.
+    uint32_t floats = mesh_vertex_stride(b->mesh.format) / sizeof(float), i;
+    float *packed = (float *)malloc(sizeof(float) * floats * (b->mesh.vertex_count ? b->mesh.vertex_count : 1));
+    for (i = 0; i < b->mesh.vertex_count; i++)
+    {
+        const float *in = b->full + (size_t)i * 9;
+        float *out = packed + (size_t)i * floats;
+        memcpy(out, in, sizeof(float) * 3);
+        out += 3;
+        if (b->mesh.format & MESH_HAS_NORMAL) { memcpy(out, in + 3, sizeof(float) * 3); out += 3; }
+        if (b->mesh.format & MESH_HAS_COLOR) memcpy(out, in + 6, sizeof(float) * 3);
+    }
+    free(b->full);
+    b->full = NULL;
+    b->mesh.vertices = packed;
+}
+
+static void optimize_meshes(MeshData *meshes, int count)
+{
+    // Reorders every mesh (common/mesh_opt.h) and shows the vertex cache misses per triangle
+    // (ACMR, FIFO of 16) and per vertex (ATVR), and the overdraw, before and after.
+    int i;
+    if (!optimize) return;
+    for (i = 0; i < count; i++)
+    {
+        MeshOptStats before = mesh_analyze(&meshes[i]), after;
+        uint32_t vertex_count = meshes[i].vertex_count;
+        uint64_t start = clock_now_ns();
+        double ms;
+        mesh_optimize(&meshes[i]);
+        ms = (clock_now_ns() - start) / 1e6;
+        after = mesh_analyze(&meshes[i]);
+        printf("  %-16s optimized in %.1f ms: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f", meshes[i].name,
+               ms, before.acmr, after.acmr, before.atvr, after.atvr, before.overdraw, after.overdraw);
+        if (meshes[i].vertex_count != vertex_count) printf(" (%u unused vertices dropped)", vertex_count - meshes[i].vertex_count);
+        printf("\n");
+    }
+}
+
+static int write_meshes(const char *out_path, MeshData *meshes, int count)
+{
+    // Writes the meshes, each one followed by its levels of detail with --lod N (NAME.lod1, ...,
+    // every level with only the vertices it uses).
+    MeshData *all;
+    char *is_level;
+    int total = 0, i, level, ok;
+    if (lod_levels < 2) return mesh_file_write(out_path, meshes, count);
+    all = (MeshData *)calloc(count * MESH_LOD_MAX + 1, sizeof(MeshData));
+    is_level = (char *)calloc(count * MESH_LOD_MAX + 1, 1);
+    if (!all || !is_level)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 0;
+    }
+    for (i = 0; i < count; i++)
+    {
+        size_t stride = mesh_vertex_stride(meshes[i].format) / sizeof(float);
+        uint64_t start = clock_now_ns();
+        MeshLodChain chain;
+        all[total++] = meshes[i];
+        mesh_lod_build(&meshes[i], lod_levels, MESH_LOD_RATIO, &chain);
+        printf("  %-16s %d levels of detail in %.1f ms, triangles (error):", meshes[i].name, chain.count,
+               (clock_now_ns() - start) / 1e6);
+        for (level = 1; level < chain.count; level++)
+        {
+            const MeshLod *lod = &chain.lods[level];
+            MeshData *m = &all[total];
+            is_level[total++] = 1;
+            memset(m, 0, sizeof(*m));
+            snprintf(m->name, MESH_NAME_SIZE, "%.*s.lod%d", MESH_NAME_SIZE - 6, meshes[i].name, level);
+            m->format = meshes[i].format;
+            m->vertices = (float *)malloc(sizeof(float) * stride * (meshes[i].vertex_count ? meshes[i].vertex_count : 1));
+            m->indices = (uint32_t *)malloc(sizeof(uint32_t) * (lod->count ? lod->count : 1));
+            if (!m->vertices || !m->indices)
+            {
+                fprintf(stderr, "out of memory\n");
+                return 0;
+            }
+            memcpy(m->vertices, meshes[i].vertices, sizeof(float) * stride * meshes[i].vertex_count);
+            memcpy(m->indices, chain.indices + lod->first, sizeof(uint32_t) * lod->count);
+            m->index_count = lod->count;
+            m->vertex_count = (uint32_t)mesh_optimize_fetch(m->vertices, stride, meshes[i].vertex_count, m->indices, m->index_count);
+            m->lod_error = lod->error;
+            printf(" %u (%.3g)", m->index_count / 3, m->lod_error);
+        }
+        printf("\n");
+        mesh_lod_free(&chain);
+    }
+    ok = mesh_file_write(out_path, all, total);
+    for (i = 0; i < total; i++)
+        if (is_level[i])
+        {
+            free(all[i].vertices);
+            free(all[i].indices);
+        }
+    free(all);
+    free(is_level);
+    return ok;
+}
+
+static int load(const char *in_path, MeshData *meshes, int *count)
+{
+    // The meshes of a mesh file, copied out (to be optimized), with 32 bit indices.
+    MeshFile file;
+    uint32_t m, i;
+    if (!mesh_file_open(&file, in_path)) return 0;
+    for (m = 0; m < file.header->mesh_count && m < MAX_MESHES; m++)
+    {
+        const MeshEntry *e = &file.meshes[m];
+        const uint8_t *indices = (const uint8_t *)mesh_indices(&file, e);
+        MeshData *mesh = &meshes[m];
+        memset(mesh, 0, sizeof(*mesh));
+        memcpy(mesh->name, e->name, MESH_NAME_SIZE);
+        mesh->format = e->format;
+        mesh->vertex_count = e->vertex_count;
+        mesh->index_count = e->index_count;
+        mesh->vertices = (float *)malloc(mesh_vertex_bytes(e) ? mesh_vertex_bytes(e) : 1);
+        mesh->indices = (uint32_t *)malloc(sizeof(uint32_t) * (e->index_count ? e->index_count : 1));
+        if (!mesh->vertices || !mesh->indices)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 0;
+        }
+        memcpy(mesh->vertices, mesh_vertices(&file, e), mesh_vertex_bytes(e));
+        for (i = 0; i < e->index_count; i++)
+        {
+            if (e->index_size == 1) mesh->indices[i] = indices[i];
+            else if (e->index_size == 2) mesh->indices[i] = ((const uint16_t *)indices)[i];
+            else mesh->indices[i] = ((const uint32_t *)indices)[i];
+        }
+    }
+    *count = (int)m;
+    printf("%s: %d meshes\n", in_path, *count);
+    mesh_file_close(&file);
+    return 1;
+}
+
+static int reorder(const char *in_path, const char *out_path)
+{
+    MeshData meshes[MAX_MESHES];
+    int count, i, ok;
+    if (!load(in_path, meshes, &count)) return 0;
+    optimize_meshes(meshes, count);
+    ok = write_meshes(out_path, meshes, count);
+    for (i = 0; i < count; i++)
+    {
+        free(meshes[i].vertices);
+        free(meshes[i].indices);
+    }
+    return ok;
+}
+
+static int convert(const char *in_path, const char *out_path)
+{
+    FILE *in = fopen(in_path, "r");
+    MeshData meshes[MAX_MESHES];
+    Builder b;
+    int count = 0, in_mesh = 0, i;
+    char line[1024];
+    long bytes = 0;
+    uint64_t start = clock_now_ns();
+    if (!in)
+    {
+        fprintf(stderr, "can't open %s\n", in_path);
+        return 0;
+    }
+    memset(&b, 0, sizeof(b));
+    while (fgets(line, sizeof(line), in))
+    {
+        char word[16], name[MESH_NAME_SIZE];
+        float x, y, z;
+        unsigned v[64];
+        int n = 0, used = 0;
+        const char *p;
+        bytes += (long)strlen(line);
+        b.line++;
+        if (sscanf(line, "%15s%n", word, &used) != 1 || word[0] == '#') continue;
+        p = line + used;
+        if (strcmp(word, "mesh") == 0)
+        {
+            if (in_mesh || count == MAX_MESHES || sscanf(p, "%31s", name) != 1)
+            {
+                fprintf(stderr, "%s:%d: 'mesh NAME' (at most %d, each closed with 'end')\n", in_path, b.line, MAX_MESHES);
+                return 0;
+            }
+            n = b.line;
+            memset(&b, 0, sizeof(b)); // (the last mesh's arrays are in meshes[] now)
+            b.line = n;
+            strcpy(b.mesh.name, name); // (names longer than 31 characters are cut off)
+            b.color[0] = b.color[1] = b.color[2] = 1; // (OpenGL's default current color is white)
+            b.normal[2] = 1;                          // (and the default normal 0 0 1)
+            in_mesh = 1;
+            continue;
+        }
+        if (!in_mesh)
+        {
+            fprintf(stderr, "%s:%d: '%s' outside of a mesh\n", in_path, b.line, word);
+            return 0;
+        }
+        if (strcmp(word, "end") == 0)
+        {
+            finish_mesh(&b);
+            meshes[count++] = b.mesh;
+            in_mesh = 0;
+        }
+        else if (strcmp(word, "v") == 0 || strcmp(word, "color") == 0 || strcmp(word, "normal") == 0)
+        {
+            if (sscanf(p, "%f %f %f", &x, &y, &z) != 3)
+            {
+                fprintf(stderr, "%s:%d: '%s' needs 3 numbers\n", in_path, b.line, word);
+                return 0;
+            }
+            if (word[0] == 'c')
+            {
+                b.color[0] = x; b.color[1] = y; b.color[2] = z;
+                b.mesh.format |= MESH_HAS_COLOR;
+            }
+            else if (word[0] == 'n')
+            {
+                b.normal[0] = x; b.normal[1] = y; b.normal[2] = z;
+                b.mesh.format |= MESH_HAS_NORMAL;
+            }
+            else
+            {
+                float *f;
+                b.full = (float *)grow(b.full, &b.vertex_capacity, (uint64_t)b.mesh.vertex_count + 1, sizeof(float) * 9);
+                f = b.full + (size_t)b.mesh.vertex_count++ * 9;
+                f[0] = x; f[1] = y; f[2] = z;
+                memcpy(f + 3, b.normal, sizeof(b.normal));
+                memcpy(f + 6, b.color, sizeof(b.color));
+            }
+        }
+        else if (strcmp(word, "tri") == 0 || strcmp(word, "quad") == 0 || strcmp(word, "poly") == 0)
+        {
+            int want = word[0] == 't' ? 3 : word[0] == 'q' ? 4 : 0, k;
+            uint32_t polygon[64], triangles[62 * 3];
+            while (n < 64 && sscanf(p, "%u%n", &v[n], &used) == 1)
+            {
+                p += used;
+                n++;
+            }
+            if ((want && n != want) || n < 3)
+            {
+                fprintf(stderr, "%s:%d: '%s' needs %s vertex numbers\n", in_path, b.line, word, want == 3 ? "3" : want == 4 ? "4" : "3 to 64");
+                return 0;
+            }
+            for (k = 0; k < n; k++)
+            {
+                polygon[k] = v[k];
+                if (v[k] >= b.mesh.vertex_count) add_triangle(&b, in_path, v[k], v[k], v[k]); // (out of range: the error)
+            }
+            n = mesh_triangulate(b.full, 9, polygon, n, triangles); // (convex: a fan 0 1 2, 0 2 3, ...)
+            for (k = 0; k < n; k++) add_triangle(&b, in_path, triangles[k * 3], triangles[k * 3 + 1], triangles[k * 3 + 2]);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown '%s'\n", in_path, b.line, word);
+            return 0;
+        }
+    }
+    fclose(in);
+    if (in_mesh)
+    {
+        fprintf(stderr, "%s: mesh '%s' has no 'end'\n", in_path, b.mesh.name);
+        return 0;
+    }
+    printf("%s: %d meshes, parsed %.2f MB in %.1f ms\n", in_path, count, bytes / 1e6, (clock_now_ns() - start) / 1e6);
+    for (i = 0; i < count; i++)
+        printf("  %-16s %u vertices, %u triangles%s%s\n", meshes[i].name, meshes[i].vertex_count, meshes[i].index_count / 3,
+               meshes[i].format & MESH_HAS_NORMAL ? ", normals" : "", meshes[i].format & MESH_HAS_COLOR ? ", colors" : "");
+    optimize_meshes(meshes, count);
+    if (!write_meshes(out_path, meshes, count)) return 0;
+    for (i = 0; i < count; i++)
+    {
+        free(meshes[i].vertices);
+        free(meshes[i].indices);
+    }
+    return 1;
+}
+
+static int import(const char *in_path, const char *out_path, int workers)
+{
+    MeshData mesh;
+    MeshImportStats stats;
+    JobPool pool;
+    int ok;
+    jobs_init(&pool, workers);
+    ok = mesh_import(in_path, &mesh, &pool, &stats);
+    jobs_shutdown(&pool);
+    if (!ok) return 0;
+    printf("%s: %.2f MB in %.1f ms (%.0f MB/s, %d threads)\n", in_path, stats.bytes / 1e6, stats.seconds * 1e3,
+           stats.bytes / 1e6 / stats.seconds, stats.threads);
+    printf("  %-16s %llu corners welded into %u vertices (%.1f%%), %u triangles%s%s\n", mesh.name,
+           (unsigned long long)stats.corners, mesh.vertex_count, stats.corners ? 100.0 * mesh.vertex_count / stats.corners : 0.0,
+           mesh.index_count / 3, mesh.format & MESH_HAS_NORMAL ? ", normals" : "", mesh.format & MESH_HAS_COLOR ? ", colors" : "");
+    optimize_meshes(&mesh, 1);
+    ok = write_meshes(out_path, &mesh, 1);
+    free(mesh.vertices);
+    free(mesh.indices);
+    return ok;
+}
+
+static int grid(int n, const char *out_path)
+{
+    // n x n vertices in the z = 0 plane between -2 and 2 (the size of our cube), with a color
+    // gradient, and 2 triangles per cell.
+    MeshData mesh;
+    uint32_t x, y, i = 0;
+    float *v;
+    memset(&mesh, 0, sizeof(mesh));
+    strcpy(mesh.name, "grid");
+    mesh.format = MESH_HAS_COLOR;
+    mesh.vertex_count = (uint32_t)n * n;
+    mesh.index_count = (uint32_t)(n - 1) * (n - 1) * 6;
+    mesh.vertices = v = (float *)malloc(sizeof(float) * 6 * mesh.vertex_count);
+    mesh.indices = (uint32_t *)malloc(sizeof(uint32_t) * mesh.index_count);
+    if (!mesh.vertices || !mesh.indices)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 0;
+    }
+    for (y = 0; y < (uint32_t)n; y++)
+        for (x = 0; x < (uint32_t)n; x++, v += 6)
+        {
+            v[0] = -2 + 4.0f * x / (n - 1);
+            v[1] = -2 + 4.0f * y / (n - 1);
+            v[2] = 0;
+            v[3] = (float)x / (n - 1);
+            v[4] = (float)y / (n - 1);
+            v[5] = 0.5f;
+        }
+    for (y = 0; y + 1 < (uint32_t)n; y++)
+        for (x = 0; x + 1 < (uint32_t)n; x++)
+        {
+            uint32_t a = y * n + x, b = a + 1, c = a + n + 1, d = a + n;
+            mesh.indices[i++] = a; mesh.indices[i++] = b; mesh.indices[i++] = c;
+            mesh.indices[i++] = a; mesh.indices[i++] = c; mesh.indices[i++] = d;
+        }
+    printf("grid: %u vertices, %u triangles\n", mesh.vertex_count, mesh.index_count / 3);
+    optimize_meshes(&mesh, 1);
+    i = (uint32_t)write_meshes(out_path, &mesh, 1);
+    free(mesh.vertices);
+    free(mesh.indices);
+    return (int)i;
+}
+
+static int info(const char *path)
+{
+    MeshFile file;
+    uint32_t i;
+    if (!mesh_file_open(&file, path)) return 0;
+    printf("%s: %u meshes, %.2f MB\n", path, file.header->mesh_count, file.size / 1e6);
+    for (i = 0; i < file.header->mesh_count; i++)
+    {
+        const MeshEntry *m = &file.meshes[i];
+        printf("  %-16s %u vertices (%u bytes each), %u triangles (%u byte indices), bounds %g %g %g .. %g %g %g\n",
+               m->name, m->vertex_count, m->vertex_stride, m->index_count / 3, m->index_size,
+               m->bounds_min[0], m->bounds_min[1], m->bounds_min[2], m->bounds_max[0], m->bounds_max[1], m->bounds_max[2]);
+        if (m->lod_error > 0) printf("  %-16s (a level of detail, error %g)\n", "", m->lod_error);
+    }
+    mesh_file_close(&file);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    while (argc > 1 && (strcmp(argv[1], "--optimize") == 0 || strcmp(argv[1], "--lod") == 0))
+    {
+        int used = 1;
+        if (strcmp(argv[1], "--optimize") == 0) optimize = 1;
+        else
+        {
+            lod_levels = argc > 2 ? atoi(argv[2]) : 0;
+            if (lod_levels < 2 || lod_levels > MESH_LOD_MAX)
+            {
+                fprintf(stderr, "--lod N: N from 2 to %d levels (the full mesh included)\n", MESH_LOD_MAX);
+                return 1;
+            }
+            used = 2;
+        }
+        argv[used] = argv[0];
+        argv += used;
+        argc -= used;
+    }
+    if (argc == 3 && strcmp(argv[1], "--info") == 0) return info(argv[2]) ? 0 : 1;
+    if (argc == 4 && strcmp(argv[1], "--grid") == 0)
+    {
+        int n = atoi(argv[2]);
+        if (n < 2 || (uint64_t)(n - 1) * (n - 1) * 6 > 0xffffffffu)
+        {
+            fprintf(stderr, "--grid N: N from 2 to 26755\n");
+            return 1;
+        }
+        return grid(n, argv[3]) ? 0 : 1;
+    }
+    if ((argc == 3 || argc == 4) && argv[1][0] != '-')
+    {
+        size_t length = strlen(argv[1]);
+        const char *extension = length > 4 ? argv[1] + length - 4 : "";
+        if (strcmp(extension, ".obj") == 0 || strcmp(extension, ".ply") == 0 || strcmp(extension, ".OBJ") == 0 || strcmp(extension, ".PLY") == 0)
+            return import(argv[1], argv[2], argc == 4 ? atoi(argv[3]) : jobs_cpu_count() - 1) ? 0 : 1;
+        if (argc == 3 && length > 5 && strcmp(argv[1] + length - 5, ".mesh") == 0) return reorder(argv[1], argv[2]) ? 0 : 1;
+        if (argc == 3) return convert(argv[1], argv[2]) ? 0 : 1;
+    }
+    fprintf(stderr, "usage: %s [--optimize] [--lod N] in.scene/in.mesh out.mesh | [--optimize] [--lod N] in.obj/in.ply out.mesh [workers] |\n"
+                    "       [--optimize] [--lod N] --grid N out.mesh | --info file.mesh\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Golden-image and frame time checks of the demos on the software rasterizer (common/golden.h), and of
+# the raycaster through OpenGL (its picture is drawn on the CPU anyway, OpenGL only shows it).
+# Needs no GPU and no display, only what the demos need to build.
+#
+#   tools/regress.sh                     builds the demos, then for each one:
+#                                        - draws 200 frames at 128x128 and compares frames 1, 60 and 180
+#                                          with golden/<demo>/frame_*.ppm
+#                                        - draws 300 frames at 500x500 and compares the median frame time
+#                                          with golden/<demo>/baseline.txt
+#                                        - draws 2D, 3D and the cube with --backend gl and --backend core,
+#                                          the two must not differ in a single pixel
+#   tools/regress.sh --update            writes new golden images (look at them!)
+#   tools/regress.sh --update-baseline   writes new frame times (do this once on the machine that runs the checks)
+#   MAX_REGRESSION=40 tools/regress.sh   allows 40% slower instead of 25%
+#
+# Exits with 1 if anything failed. CFLAGS (default -O2) is passed to gcc, eg CFLAGS="-O2 -march=native".
+
+cd "$(dirname "$0")/.." || exit 1
+CFLAGS=${CFLAGS:--O2}
+MAX_REGRESSION=${MAX_REGRESSION:-25}
+golden_update=
+baseline_update=
+case "$1" in
+    --update) golden_update=--golden-update ;;
+    --update-baseline) baseline_update=--baseline-update ;;
+    "") ;;
+    *) echo "usage: $0 [--update | --update-baseline]"; exit 1 ;;
+esac
+
+mkdir -p _regress
+for demo in 2D 3D Cube Raycaster; do
+    gcc $CFLAGS OpenGL_${demo}_Tutorial.c -o _regress/$demo -lglut -lGLU -lGL -lEGL -lm -pthread || exit 1
+done
+
+failed=
+run() {
+    # run NAME COMMAND...: shows the check's lines (everything if the demo failed), counts NAME as failed
+    # if the demo exits with 1.
+    name=$1; shift
+    if "$@" > _regress/out.txt 2>&1; then grep "^golden\|^baseline" _regress/out.txt
+    else
+        grep -v "^frame" _regress/out.txt
+        failed="$failed $name"
+    fi
+}
+check() {
+    # check NAME DEMO OPTIONS...: the golden images, then the frame time.
+    name=$1; demo=$2; shift 2
+    mkdir -p golden/$name
+    echo "== $name: $demo $*"
+    run $name ./_regress/$demo --headless --backend sw --threads 1 --size 128x128 --warmup 0 --frames 200 "$@" \
+        --golden golden/$name $golden_update
+    run $name ./_regress/$demo --headless --backend sw --threads 1 --frames 300 "$@" \
+        --baseline golden/$name/baseline.txt --max-regression $MAX_REGRESSION $baseline_update
+}
+check 2d 2D --sprites 5000 --sprite-mode immediate
+check 3d 3D --objects 20000
+check cube Cube
+check raycaster Raycaster --backend gl
+
+same() {
+    # same NAME DEMO OPTIONS...: draws the frames through OpenGL's fixed-function pipeline, then through
+    # our core profile path (common/glcore.h), which must come out pixel for pixel the same.
+    name=$1; demo=$2; shift 2
+    mkdir -p _regress/$name
+    echo "== $name: $demo${*:+ $*}, --backend gl against --backend core"
+    run $name ./_regress/$demo --headless --backend gl --size 128x128 --warmup 0 --frames 200 "$@" \
+        --golden _regress/$name --golden-update
+    run $name ./_regress/$demo --headless --backend core --shader-cache off --size 128x128 --warmup 0 --frames 200 "$@" \
+        --golden _regress/$name --golden-tolerance 0 --golden-pixels 0
+}
+same 2d-core 2D --sprites 5000 --sprite-mode immediate
+same 3d-core 3D --objects 20000
+same cube-core Cube
+
+if [ -n "$failed" ]; then
+    echo "FAILED:$failed"
+    exit 1
+fi
+echo "all checks passed"
@@ -0,0 +1,140 @@
+/*
+- ***** Trace Replay *****
+  Plays back a trace recorded by a demo with --trace-record (common/trace.h): every frame's calls
+  go to OpenGL again exactly as the demo made them, with no timer() and no update() in between.
+  So two builds, two drivers or two machines get the very same frames to draw, and their frame
+  times can be compared.
+
+  This is a headless app like the demos' --headless mode (common/app.h), so their options work
+  here too: --frames, --warmup, --backend gl|sw|core, --state-cache, --profile, --capture, ...
+  The trace is played in a loop when more frames are asked for than it has.
+
+  Build:
+    gcc -O2 tools/trace_replay.c -o trace_replay -lglut -lGLU -lGL -lEGL -lm -pthread
+  Run:
+    ./3D --headless --objects 10000 --trace-record 3d.trace
+    ./trace_replay --trace 3d.trace [--locked] [--frame-times out.csv] [--frames N] [--backend sw] ...
+      --locked           plays the frames at the rate they were recorded at, instead of as fast as possible
+      --frame-times F    writes every measured frame's time to F (csv), next to the time it took when recorded
+
+  Note: The trace is drawn at the size it was recorded at (the demo's glViewport calls are in it).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/app.h"
+
+static const char *trace_path = NULL;
+static const char *frame_times_path = NULL;
+static int locked = 0;
+static Trace replay;
+static char replay_name[64];
+static long replayed = 0;        // frames played so far (the warm-up ones too)
+static double *frame_ms;         // time of each measured frame
+static long measured = 0;
+
+static void init(void) { }
+static void reshape(int width, int height) { (void)width; (void)height; } // (the trace has the demo's own)
+static void update(void) { }                                            // (and its animation)
+
+static void display(void)
+{
+    // The next frame of the trace, timed the same way app_run_headless() times it.
+    long frame = replayed % replay.frame_count;
+    uint64_t start = clock_now_ns();
+    trace_play_frame(&replay, frame);
+    app_swap_buffers();
+    if (replayed >= app.warmup && measured < app.frames) frame_ms[measured++] = clock_ns_to_ms(clock_now_ns() - start);
+    replayed++;
+}
+
+static void report(FILE *out)
+{
+    double recorded_seconds = replay.frame_ends[replay.frame_count - 1] / 1000;
+    long i;
+    fprintf(out, "trace: %s, %ld frames recorded at %.1f fps, %.1f calls per frame | %ld frames replayed%s\n", trace_path,
+            replay.frame_count, recorded_seconds > 0 ? replay.frame_count / recorded_seconds : 0.0,
+            (double)replay.calls / replay.frame_count, replayed, locked ? " (locked)" : "");
+    if (frame_times_path)
+    {
+        FILE *file = fopen(frame_times_path, "w");
+        if (!file)
+        {
+            fprintf(stderr, "can't create '%s'\n", frame_times_path);
+            return;
+        }
+        fprintf(file, "frame,trace_frame,recorded_ms,replay_ms\n");
+        for (i = 0; i < measured; i++)
+        {
+            long frame = (app.warmup + i) % replay.frame_count;
+            fprintf(file, "%ld,%ld,%.3f,%.3f\n", i, frame, trace_frame_ms(&replay, frame), frame_ms[i]);
+        }
+        fclose(file);
+        fprintf(out, "trace: frame times written to %s\n", frame_times_path);
+    }
+}
+
+static int parse_replay_args(int argc, char **argv, int i)
+{
+    // --trace FILE is read right away: its size has to be known before --capture opens its file.
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+    {
+        trace_path = argv[i + 1];
+        if (!trace_load(&replay, trace_path)) exit(1);
+        app.width = replay.header.width;
+        app.height = replay.header.height;
+        return 2;
+    }
+    if (strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc)
+    {
+        frame_times_path = argv[i + 1];
+        return 2;
+    }
+    if (strcmp(argv[i], "--locked") == 0)
+    {
+        locked = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    AppCallbacks callbacks = { replay_name, init, reshape, update, display, report };
+    int result;
+
+    app.headless = 1;
+    if (!app_parse_args(&argc, argv, parse_replay_args)) return 1;
+    if (!trace_path)
+    {
+        fprintf(stderr, "usage: %s --trace FILE [--locked] [--frame-times out.csv] [headless options]\n", argv[0]);
+        return 1;
+    }
+    if (app.width != replay.header.width || app.height != replay.header.height)
+    {
+        fprintf(stderr, "the trace was recorded at %dx%d, it can't be replayed at another --size\n",
+                replay.header.width, replay.header.height);
+        return 1;
+    }
+    if (app.dynamic_res_ms > 0)
+    {
+        fprintf(stderr, "--dynamic-res can't be used with a trace (its viewports are in it)\n");
+        return 1;
+    }
+    if (locked)
+    {
+        // The loop's cap paces the frames (outside the measured time), at the recorded rate.
+        double seconds = replay.frame_ends[replay.frame_count - 1] / 1000;
+        app.loop = 1;
+        app.present = PRESENT_CAP;
+        app.fps_cap = seconds > 0 ? replay.frame_count / seconds : 60;
+    }
+    snprintf(replay_name, sizeof(replay_name), "%s replay", replay.header.name[0] ? replay.header.name : "trace");
+    frame_ms = (double *)malloc(sizeof(double) * app.frames);
+
+    result = app_run_headless(&callbacks);
+    trace_free(&replay);
+    free(frame_ms);
+    return result;
+}